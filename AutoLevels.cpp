@@ -0,0 +1,223 @@
+#include <math.h>
+#include <string.h>
+#include "AutoLevels.h"
+
+// Share of the pixels allowed to clip at either end
+static const double g_dClip = 0.005;
+
+// The narrowest black-to-white span that is stretched, so that a flat
+// picture is not blown up into noise
+static const double g_dMinSpan = 64.0;
+
+// Smoothed levels must move by this much before a new curve is published
+static const double g_dDeadBand = 0.5;
+
+CAutoLevels::CAutoLevels()
+	: m_bRunning(false),
+	  m_bExit(false),
+	  m_bPending(false),
+	  m_bReset(false),
+	  m_Gamma(127),
+	  m_nSmoothing(15),
+	  m_dBlack(16),
+	  m_dWhite(235),
+	  m_bPrimed(false),
+	  m_dPublishedBlack(-1),
+	  m_dPublishedWhite(-1),
+	  m_PublishedGamma(0)
+{
+	memset(m_Pending, 0, sizeof(m_Pending));
+}
+
+CAutoLevels::~CAutoLevels()
+{
+	Stop();
+}
+
+bool CAutoLevels::Start()
+{
+	if (m_bRunning)
+		return true;
+	m_bExit = false;
+	m_bRunning = m_Thread.Start(ThreadProc, this);
+	return m_bRunning;
+}
+
+void CAutoLevels::Stop()
+{
+	if (!m_bRunning)
+		return;
+	{
+		CFrameAutoLock lock(&m_Lock);
+		m_bExit = true;
+		m_Wake.Signal();
+	}
+	m_Thread.Join();
+	m_bRunning = false;
+}
+
+void CAutoLevels::Reset()
+{
+	CFrameAutoLock lock(&m_Lock);
+	m_bPending = false;
+	m_bReset = true;
+}
+
+void CAutoLevels::SetGamma(unsigned char Gamma)
+{
+	CFrameAutoLock lock(&m_Lock);
+	m_Gamma = Gamma;
+}
+
+void CAutoLevels::SetSmoothing(int nFrames)
+{
+	CFrameAutoLock lock(&m_Lock);
+	m_nSmoothing = nFrames < 1 ? 1 : nFrames;
+}
+
+void CAutoLevels::Feed(const FrameStats &stats)
+{
+	// The analyser only holds the lock while it copies the histogram out
+	CFrameAutoLock lock(&m_Lock);
+	memcpy(m_Pending, stats.LumaIn, sizeof(m_Pending));
+	m_bPending = true;
+	m_Wake.Signal();
+}
+
+double CAutoLevels::Black()
+{
+	CFrameAutoLock lock(&m_Lock);
+	return m_dBlack;
+}
+
+double CAutoLevels::White()
+{
+	CFrameAutoLock lock(&m_Lock);
+	return m_dWhite;
+}
+
+void CAutoLevels::ThreadProc(void *pv)
+{
+	((CAutoLevels *)pv)->Run();
+}
+
+void CAutoLevels::Run()
+{
+	unsigned int hist[256];
+	for (;;)
+	{
+		{
+			CFrameAutoLock lock(&m_Lock);
+			while (!m_bExit && !m_bPending)
+				m_Wake.Wait(&m_Lock);
+			if (m_bExit)
+				return;
+			memcpy(hist, m_Pending, sizeof(hist));
+			m_bPending = false;
+		}
+		Analyse(hist);
+	}
+}
+
+void CAutoLevels::Analyse(const unsigned int *pHist)
+{
+	unsigned char Gamma;
+	int nSmoothing;
+	{
+		CFrameAutoLock lock(&m_Lock);
+		Gamma = m_Gamma;
+		nSmoothing = m_nSmoothing;
+		if (m_bReset)
+		{
+			m_bPrimed = false;
+			m_bReset = false;
+		}
+	}
+
+	unsigned long long n = 0;
+	for (int i = 0; i < 256; i++)
+		n += pHist[i];
+	if (n == 0)
+		return;
+
+	// Black and white points with g_dClip of the pixels beyond each
+	unsigned long long nLow = (unsigned long long)(n * g_dClip);
+	unsigned long long nHigh = n - nLow;
+	unsigned long long sum = 0;
+	int nBlack = -1, nWhite = 255;
+	for (int i = 0; i < 256; i++)
+	{
+		sum += pHist[i];
+		if (nBlack < 0 && sum > nLow)
+			nBlack = i;
+		if (sum >= nHigh)
+		{
+			nWhite = i;
+			break;
+		}
+	}
+	double dBlack = nBlack < 0 ? 0 : nBlack;
+	double dWhite = nWhite;
+
+	if (dWhite - dBlack < g_dMinSpan)
+	{
+		double dMid = (dBlack + dWhite) / 2;
+		dBlack = dMid - g_dMinSpan / 2;
+		dWhite = dMid + g_dMinSpan / 2;
+		if (dBlack < 0) { dWhite -= dBlack; dBlack = 0; }
+		if (dWhite > 255) { dBlack -= dWhite - 255; dWhite = 255; }
+	}
+
+	// Exponential smoothing over about nSmoothing frames
+	double dSmoothBlack, dSmoothWhite;
+	{
+		CFrameAutoLock lock(&m_Lock);
+		if (!m_bPrimed)
+		{
+			m_dBlack = dBlack;
+			m_dWhite = dWhite;
+			m_bPrimed = true;
+		}
+		else
+		{
+			double a = 1.0 / nSmoothing;
+			m_dBlack += (dBlack - m_dBlack) * a;
+			m_dWhite += (dWhite - m_dWhite) * a;
+		}
+		dSmoothBlack = m_dBlack;
+		dSmoothWhite = m_dWhite;
+	}
+
+	if (fabs(dSmoothBlack - m_dPublishedBlack) < g_dDeadBand &&
+		fabs(dSmoothWhite - m_dPublishedWhite) < g_dDeadBand &&
+		Gamma == m_PublishedGamma)
+		return;
+
+	m_dPublishedBlack = dSmoothBlack;
+	m_dPublishedWhite = dSmoothWhite;
+	m_PublishedGamma = Gamma;
+
+	unsigned char table[256];
+	BuildCurve(table);
+	m_Curve.Publish(table);
+}
+
+//
+// Stretch [black, white] to the nominal 16..235 range, then apply gamma the
+// same way CColorEngine::UpdateLuma() does.
+//
+void CAutoLevels::BuildCurve(unsigned char *pTable) const
+{
+	double dScale = 219.0 / (m_dPublishedWhite - m_dPublishedBlack);
+	double G = (double)m_PublishedGamma;
+	if ( G < 0.0001) G = 0.01;
+	G = 128.0/G;
+	for (int i = 0; i < 256; i++)
+	{
+		double L = (i - m_dPublishedBlack) * dScale + 16;
+		if (L < 0) L = 0;
+		L = 255.0 * pow((L/255.0),G);
+		if (L > 255) L = 255;
+		pTable[i] = (unsigned char)L;
+	}
+}
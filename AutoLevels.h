@@ -0,0 +1,75 @@
+#pragma once
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+
+//
+// CAutoLevels
+//
+// Automatic levels. The streaming thread hands over the luma histogram of
+// every frame it has processed; a background thread finds the black and
+// white points, smooths them over time so that the picture does not pump,
+// and publishes a new luma curve through a CLumaCurve. The next frame picks
+// the curve up. Feed() only copies the histogram, so frames never wait for
+// the analysis; a histogram that arrives while the previous one is still
+// being analysed simply replaces the pending one.
+//
+class CAutoLevels
+{
+public:
+	CAutoLevels();
+	~CAutoLevels();
+
+	bool Start();
+	void Stop();
+
+	// Forget the smoothed levels, e.g. when the stream restarts
+	void Reset();
+
+	// Gamma is still applied on top of the stretched levels
+	void SetGamma(unsigned char Gamma);
+
+	// Roughly how many frames the levels take to follow a change
+	void SetSmoothing(int nFrames);
+	int GetSmoothing() const { return m_nSmoothing; }
+
+	// Streaming thread: the statistics of the frame just processed
+	void Feed(const FrameStats &stats);
+
+	// Analyse one histogram and publish the curve on the calling thread.
+	// The background thread does the same for every fed frame.
+	void Analyse(const unsigned int *pHist);
+
+	CLumaCurve *Curve() { return &m_Curve; }
+
+	// Smoothed levels, for display
+	double Black();
+	double White();
+
+private:
+	static void ThreadProc(void *pv);
+	void Run();
+	void BuildCurve(unsigned char *pTable) const;
+
+	CFrameThread m_Thread;
+	CFrameCritSec m_Lock;
+	CFrameCondition m_Wake;
+	bool m_bRunning;
+	bool m_bExit;
+
+	// Guarded by m_Lock
+	unsigned int m_Pending[256];
+	bool m_bPending;
+	bool m_bReset;
+	unsigned char m_Gamma;
+	int m_nSmoothing;
+	double m_dBlack;           // Smoothed levels
+	double m_dWhite;
+	bool m_bPrimed;
+
+	// Analyser state
+	double m_dPublishedBlack;
+	double m_dPublishedWhite;
+	unsigned char m_PublishedGamma;
+
+	CLumaCurve m_Curve;
+};
@@ -0,0 +1,201 @@
+#include <math.h>
+#include "ChainTables.h"
+
+#define PI 3.1415926
+
+CChainTables::CChainTables()
+{
+	// Luma precomputed data
+	for ( int i = 0; i < 256; i++ )
+	{
+		for ( int j = 0; j < 256; j++)
+		{
+			double C = (double)j / 127.0;
+			double Lu = (double)i;
+
+			Lu = ((Lu-16) * C);
+			if ( Lu < 0)
+			{
+				Lu = 0;	
+			}	
+			m_Lumas1[i][j] = (short)Lu;
+		}
+	}
+
+	for ( int i = 0; i < 512; i++ )
+	{
+		for ( int j = 0; j < 256; j++)
+		{
+			int B =  (int)j;	
+			int Lu = (int)i;
+
+			Lu = Lu + (B-127) + 16;
+			if ( Lu < 0 ) Lu = 0;
+			if (Lu > 255) Lu = 255;
+			m_Lumas2[i][j] = (unsigned char)Lu;
+		}
+	}
+
+	// Gamma correction
+	for ( int i = 0; i < 256; i++ )
+	{
+		for ( int j = 0; j < 256; j++)
+		{
+			double G = (double)j;
+			if ( G < 0.0001) G = 0.01;
+			G = 128.0/G;
+			double Lu = (double)i;
+			Lu = 255.0 * pow((Lu/255.0),G);
+			if (Lu < 0) Lu = 0;
+			if (Lu > 255) Lu = 255;
+			m_Lumas3[i][j] = (unsigned char)Lu;
+		}
+	}
+
+	// Chroma precomputed data
+	//__asm {emms};
+	/*for (int i=-180,ii=0;i<=180;ii++,i++)
+	{
+		double Hue=(i * 3.1415926) / 180.0;
+		hueSin[ii]=int(sin(Hue) * 128);
+		hueCos[ii]=int(cos(Hue) * 128);
+	}*/
+
+	// U-128(V-128)*Cos
+	for ( int i = 0; i < 256; i++)
+	{
+		for ( int j = 0; j < 256; j++)
+		{
+			double H = (double)j - 128.0;
+			H *= 180.0/128.0;
+			int Cr = (int)((i - 128) * cos(H*PI/180.0) + 180);
+			// -180 -> 0 -> 180
+			if (Cr < 0) Cr = 0;
+			if (Cr > 360) Cr = 360;
+			m_Chromas1[i][j] = (short)Cr;
+		}
+	}
+
+	// U-128(V-128)*Sin
+	for ( int i = 0; i < 256; i++)
+	{
+		for ( int j = 0; j < 256; j++)
+		{
+			double H = (double)j - 128.0;
+			H *= 180.0/128.0;
+			int Cr = (int)((i - 128) * sin(H*PI/180.0) + 180);
+			// -180 -> 0 -> 180
+			if (Cr < 0) Cr = 0;
+			if (Cr > 360) Cr = 360;
+			m_Chromas2[i][j] = (short)Cr;
+		}
+	}
+
+	//(U-128) x Cos(H) + (V-128) x Sin(H)
+	for ( int i = 0; i <= 360; i++)
+	{
+		for ( int j = 0; j <= 360; j++)
+		{
+			int Cr1 = i - 180;
+			int Cr2 = j - 180;
+			int Cr = (Cr1 + Cr2) + 180;
+			if (Cr < 0) Cr = 0;
+			if (Cr > 360) Cr = 360;
+			m_Chromas3[i][j] = (short)Cr;
+		}
+	}
+
+	//(U-128) x Cos(H) - (V-128) x Sin(H)
+	for ( int i = 0; i <= 360; i++)
+	{
+		for ( int j = 0; j <= 360; j++)
+		{
+			int Cr1 = i - 180;
+			int Cr2 = j - 180;
+			int Cr = (Cr1 - Cr2) + 180;
+			if (Cr < 0) Cr = 0;
+			if (Cr > 360) Cr = 360;
+			m_Chromas4[i][j] = (short)Cr;
+		}
+	}
+
+	// Saturation
+	for ( int i = 0; i <= 360; i++)
+	{
+		for ( int j = 0; j < 256; j++)
+		{
+			int Cr = i - 180;
+			int S = j/4;
+			int res =  (Cr * S)/32 + 128;
+			if (res < 0) res = 0;
+			if (res > 255) res = 255;
+			m_Chromas5[i][j] = (unsigned char )res;
+
+		}
+	}
+
+}
+
+unsigned char CChainTables::ProcessLuma(unsigned char src,
+	unsigned char Brightness, unsigned char Contrast, unsigned char Gamma) const
+{
+	short C = m_Lumas1[src][Contrast];
+	unsigned char L =  m_Lumas2[C][Brightness];	
+	return m_Lumas3[L][Gamma];
+}
+
+void CChainTables::ProcessChroma(unsigned char srcU, unsigned char srcV,
+	unsigned char Hue, unsigned char Saturation,
+	unsigned char *dstU, unsigned char *dstV) const
+{
+	short p1 = m_Chromas1[srcU][Hue]; // Cos
+	short p2 = m_Chromas2[srcV][Hue]; // Sin
+	short p3 = m_Chromas3[p1][p2];
+
+	/*double H = (double)Hue - 128.0;
+	H *= 180.0/128.0;
+	int sat = Saturation/4.0;
+	double u = (double)srcU - 128;
+	double v = (double)srcV - 128;
+	double u2 = u * cos(H*PI/180.0) + v * sin(H*PI/180.0);
+	u = ((int)(u2 * Saturation/4.0) >> 6) + 128;*/
+
+	*dstU = m_Chromas5[p3][Saturation];
+
+	// The old +-8 tolerance check against the formula above is now done
+	// for every table by tools/fpaccuracy.
+
+	short p4 = m_Chromas1[srcV][Hue]; // Cos
+	short p5 = m_Chromas2[srcU][Hue]; // Sin
+	short p6 = m_Chromas3[p4][p5];
+	*dstV = m_Chromas5[p6][Saturation];
+
+	// Old
+	/*double h = (double)Hue;
+	h -= 128;
+	h *= 180.0/128.0;
+
+	int sat = Saturation/4.0;
+
+	int Cos = hueCos[(int)h+180];
+	int Sin = hueSin[(int)h+180];
+
+	int u = srcU - 128;
+    int v = srcV - 128;
+
+	
+	int u2 = ((u * Cos)>>7) + ((v * Sin)>>7);
+    int v2 = ((v * Cos)>>7) - ((u * Sin)>>7);
+
+    u = ((u2 * sat) >> 6) + 128;
+    v = ((v2 * sat) >> 6) + 128;
+
+    if (u < 0) u = 0;
+    if (u > 255) u = 255;
+    if (v < 0) v = 0;
+    if (v > 255) v = 255;
+
+    *dstU = u;
+    *dstV = v;*/
+
+}
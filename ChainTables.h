@@ -0,0 +1,39 @@
+#pragma once
+
+//
+// CChainTables
+//
+// The first table design of the filter: every adjustment is a separate
+// precomputed table and a pixel walks through a chain of lookups. It is no
+// longer used for processing; it is kept so that the accuracy harness can
+// compare it with CColorEngine and the double-precision reference.
+//
+// Known approximations, kept as they were:
+//  - contrast, brightness and gamma are each truncated to an integer
+//  - the hue rotation terms are truncated to integers before the sum
+//  - saturation is quantized to Saturation/4
+//  - V is rotated with the same sign as U (m_Chromas4 is never used)
+//
+class CChainTables
+{
+public:
+	CChainTables();
+
+	unsigned char ProcessLuma(unsigned char src,
+		unsigned char Brightness, unsigned char Contrast, unsigned char Gamma) const;
+	void ProcessChroma(unsigned char srcU, unsigned char srcV,
+		unsigned char Hue, unsigned char Saturation,
+		unsigned char *dstU, unsigned char *dstV) const;
+
+private:
+	short m_Lumas1[256][256];
+	unsigned char m_Lumas2[512][256];
+	unsigned char m_Lumas3[256][256];
+
+	// The intermediate chroma values are clamped to [0, 360] inclusive
+	short m_Chromas1[256][256];
+	short m_Chromas2[256][256];
+	short m_Chromas3[361][361];
+	short m_Chromas4[361][361];
+	unsigned char m_Chromas5[361][256];
+};
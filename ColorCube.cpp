@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ColorCube.h"
+
+CColorCube::CColorCube()
+	: m_nSize(0)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		m_Min[c] = 0;
+		m_Max[c] = 1;
+	}
+	m_szTitle[0] = 0;
+	m_szError[0] = 0;
+}
+
+bool CColorCube::Fail(const char *pszFormat, int nLine)
+{
+	sprintf(m_szError, pszFormat, nLine);
+	m_nSize = 0;
+	m_Nodes.clear();
+	return false;
+}
+
+bool CColorCube::Load(const char *pszPath)
+{
+	FILE *fp = fopen(pszPath, "r");
+	if (fp == NULL)
+	{
+		sprintf(m_szError, "cannot open the file");
+		return false;
+	}
+	bool bOk = Load(fp);
+	fclose(fp);
+	return bOk;
+}
+
+bool CColorCube::Load(FILE *fp)
+{
+	m_nSize = 0;
+	m_Nodes.clear();
+	m_szTitle[0] = 0;
+	m_szError[0] = 0;
+	for (int c = 0; c < 3; c++)
+	{
+		m_Min[c] = 0;
+		m_Max[c] = 1;
+	}
+
+	char line[512];
+	int nLine = 0;
+	size_t nExpected = 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		nLine++;
+		char *p = line;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\r' || *p == '\n' || *p == 0)
+			continue;
+
+		// Data lines start with a number, keywords with a letter
+		if ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.')
+		{
+			if (m_nSize == 0)
+				return Fail("line %d: data before LUT_3D_SIZE", nLine);
+			float rgb[3];
+			if (sscanf(p, "%f %f %f", &rgb[0], &rgb[1], &rgb[2]) != 3)
+				return Fail("line %d: expected three numbers", nLine);
+			if (m_Nodes.size() >= nExpected * 3)
+				return Fail("line %d: more entries than LUT_3D_SIZE allows", nLine);
+			m_Nodes.insert(m_Nodes.end(), rgb, rgb + 3);
+		}
+		else if (strncmp(p, "TITLE", 5) == 0)
+		{
+			char *q = strchr(p, '"');
+			char *e = q ? strrchr(q + 1, '"') : NULL;
+			if (q && e)
+			{
+				size_t cch = e - q - 1;
+				if (cch >= sizeof(m_szTitle))
+					cch = sizeof(m_szTitle) - 1;
+				memcpy(m_szTitle, q + 1, cch);
+				m_szTitle[cch] = 0;
+			}
+		}
+		else if (strncmp(p, "LUT_3D_SIZE", 11) == 0)
+		{
+			int n = atoi(p + 11);
+			if (n < 2 || n > 256)
+				return Fail("line %d: LUT_3D_SIZE out of range", nLine);
+			m_nSize = n;
+			nExpected = (size_t)n * n * n;
+			m_Nodes.reserve(nExpected * 3);
+		}
+		else if (strncmp(p, "LUT_1D_SIZE", 11) == 0)
+		{
+			return Fail("line %d: 1D tables are not supported", nLine);
+		}
+		else if (strncmp(p, "DOMAIN_MIN", 10) == 0)
+		{
+			if (sscanf(p + 10, "%lf %lf %lf", &m_Min[0], &m_Min[1], &m_Min[2]) != 3)
+				return Fail("line %d: bad DOMAIN_MIN", nLine);
+		}
+		else if (strncmp(p, "DOMAIN_MAX", 10) == 0)
+		{
+			if (sscanf(p + 10, "%lf %lf %lf", &m_Max[0], &m_Max[1], &m_Max[2]) != 3)
+				return Fail("line %d: bad DOMAIN_MAX", nLine);
+		}
+		else if (strncmp(p, "LUT_3D_INPUT_RANGE", 18) == 0)
+		{
+			double lo, hi;
+			if (sscanf(p + 18, "%lf %lf", &lo, &hi) != 2)
+				return Fail("line %d: bad LUT_3D_INPUT_RANGE", nLine);
+			for (int c = 0; c < 3; c++)
+			{
+				m_Min[c] = lo;
+				m_Max[c] = hi;
+			}
+		}
+		// Other keywords are ignored
+	}
+
+	if (m_nSize == 0)
+		return Fail("no LUT_3D_SIZE after %d lines", nLine);
+	if (m_Nodes.size() != nExpected * 3)
+		return Fail("%d lines: fewer entries than LUT_3D_SIZE needs", nLine);
+	for (int c = 0; c < 3; c++)
+	{
+		if (!(m_Max[c] > m_Min[c]))
+			return Fail("%d lines: empty domain", nLine);
+	}
+	return true;
+}
+
+void CColorCube::Identity(int nSize)
+{
+	m_nSize = nSize;
+	m_Nodes.resize((size_t)nSize * nSize * nSize * 3);
+	size_t k = 0;
+	for (int b = 0; b < nSize; b++)
+	{
+		for (int g = 0; g < nSize; g++)
+		{
+			for (int r = 0; r < nSize; r++)
+			{
+				m_Nodes[k++] = (float)r / (nSize - 1);
+				m_Nodes[k++] = (float)g / (nSize - 1);
+				m_Nodes[k++] = (float)b / (nSize - 1);
+			}
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		m_Min[c] = 0;
+		m_Max[c] = 1;
+	}
+	strcpy(m_szTitle, "identity");
+	m_szError[0] = 0;
+}
+
+void CColorCube::Sample(double r, double g, double b, double *pr, double *pg, double *pb) const
+{
+	const int n = m_nSize;
+	double in[3] = { r, g, b };
+	int i[3];
+	double f[3];
+	for (int c = 0; c < 3; c++)
+	{
+		double x = (in[c] - m_Min[c]) / (m_Max[c] - m_Min[c]) * (n - 1);
+		if (x < 0) x = 0;
+		if (x > n - 1) x = n - 1;
+		i[c] = (int)x;
+		if (i[c] > n - 2) i[c] = n - 2;
+		f[c] = x - i[c];
+	}
+
+	// Red is the fastest axis
+	const size_t stride[3] = { 3, (size_t)n * 3, (size_t)n * n * 3 };
+	const float *p0 = &m_Nodes[i[0] * stride[0] + i[1] * stride[1] + i[2] * stride[2]];
+
+	// Visit the axes from the largest fraction to the smallest
+	int a0 = 0, a1 = 1, a2 = 2, t;
+	if (f[a0] < f[a1]) { t = a0; a0 = a1; a1 = t; }
+	if (f[a1] < f[a2]) { t = a1; a1 = a2; a2 = t; }
+	if (f[a0] < f[a1]) { t = a0; a0 = a1; a1 = t; }
+	const float *p1 = p0 + stride[a0];
+	const float *p2 = p1 + stride[a1];
+	const float *p3 = p2 + stride[a2];
+
+	double out[3];
+	for (int c = 0; c < 3; c++)
+	{
+		out[c] = p0[c] + (p1[c] - p0[c]) * f[a0] + (p2[c] - p1[c]) * f[a1] + (p3[c] - p2[c]) * f[a2];
+	}
+	*pr = out[0];
+	*pg = out[1];
+	*pb = out[2];
+}
+
+// Bit 0: fy >= fu, bit 1: fu >= fv, bit 2: fy >= fv
+const unsigned char g_LatticeOrder[8][3] =
+{
+	{ 2, 1, 0 },   // v > u > y
+	{ 2, 0, 1 },   // v > y >= u
+	{ 1, 2, 0 },   // u >= v > y
+	{ 0, 1, 2 },   // impossible: y >= u >= v > y
+	{ 1, 0, 2 },   // impossible: v > u > y >= v
+	{ 0, 2, 1 },   // y >= v > u
+	{ 1, 0, 2 },   // u > y >= v
+	{ 0, 1, 2 },   // y >= u >= v
+};
+
+CColorLattice::CColorLattice()
+	: m_nSize(0), m_nShift(0), m_StrideY(0), m_StrideU(0)
+{
+}
+
+static int Clamp16(double x)
+{
+	// 1/16 steps of the 0..255 code range
+	int n = (int)(x * 16 + 0.5);
+	if (n < 0) n = 0;
+	if (n > 255 * 16) n = 255 * 16;
+	return n;
+}
+
+void CColorLattice::Build(const CColorCube &cube, int nShift, bool bControls,
+	const ColorSpace &in, const ColorSpace &out)
+{
+	m_nShift = nShift;
+	m_nSize = (256 >> nShift) + 1;
+	m_StrideU = m_nSize;
+	m_StrideY = m_nSize * m_nSize;
+	m_Nodes.resize((size_t)m_nSize * m_nSize * m_nSize);
+
+	// The conversion is affine in the codes, so it is measured once. The
+	// control tables hand on chroma in the output space; the nodes go back
+	// to the input chroma through the inverse of its 2x2 part to find the
+	// output luma.
+	double y0, u0, v0, yy, uy, vy, yu, uu, vu, yv, uv, vv;
+	ColorSpaceConvert(in, out, 128, 128, 128, &y0, &u0, &v0);
+	ColorSpaceConvert(in, out, 129, 128, 128, &yy, &uy, &vy);
+	ColorSpaceConvert(in, out, 128, 129, 128, &yu, &uu, &vu);
+	ColorSpaceConvert(in, out, 128, 128, 129, &yv, &uv, &vv);
+	const double m00 = uu - u0, m01 = uv - u0, m10 = vu - v0, m11 = vv - v0;
+	const double det = m00 * m11 - m01 * m10;
+
+	const int nStep = 1 << nShift;
+	for (int iy = 0; iy < m_nSize; iy++)
+	{
+		for (int iu = 0; iu < m_nSize; iu++)
+		{
+			for (int iv = 0; iv < m_nSize; iv++)
+			{
+				// The last node sits at code 256; evaluate it at 255
+				int y = iy * nStep, u = iu * nStep, v = iv * nStep;
+				if (y > 255) y = 255;
+				if (u > 255) u = 255;
+				if (v > 255) v = 255;
+
+				double r, g, b;
+				if (bControls)
+				{
+					double Du = (m11 * (u - u0) - m01 * (v - v0)) / det;
+					double Dv = (m00 * (v - v0) - m10 * (u - u0)) / det;
+					double Y = y0 + (yy - y0) * (y - 128) + (yu - y0) * Du + (yv - y0) * Dv;
+					Y = Y < 0 ? 0 : (Y > 255 ? 255 : Y);
+					ColorSpaceToRGB(out, Y, u, v, &r, &g, &b);
+				}
+				else
+				{
+					ColorSpaceToRGB(in, y, u, v, &r, &g, &b);
+				}
+				r = r < 0 ? 0 : (r > 1 ? 1 : r);
+				g = g < 0 ? 0 : (g > 1 ? 1 : g);
+				b = b < 0 ? 0 : (b > 1 ? 1 : b);
+
+				cube.Sample(r, g, b, &r, &g, &b);
+
+				double Yo, Uo, Vo;
+				ColorSpaceFromRGB(out, r, g, b, &Yo, &Uo, &Vo);
+				Node &node = m_Nodes[iy * m_StrideY + iu * m_StrideU + iv];
+				node.y = (short)Clamp16(Yo);
+				node.u = (short)Clamp16(Uo);
+				node.v = (short)Clamp16(Vo);
+				node.pad = 0;
+			}
+		}
+	}
+}
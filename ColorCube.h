@@ -0,0 +1,161 @@
+#pragma once
+#include <stdio.h>
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorSpace.h"
+
+//
+// CColorCube
+//
+// A 3D colour lookup table in the .cube format used by grading tools:
+// LUT_3D_SIZE N followed by N*N*N lines of "R G B" with red changing
+// fastest. Input and output are RGB in [DOMAIN_MIN, DOMAIN_MAX], normally
+// 0..1. 1D tables in the same format are not supported.
+//
+class CColorCube
+{
+public:
+	CColorCube();
+
+	// Return false and leave a message in Error() when the file is bad
+	bool Load(const char *pszPath);
+	bool Load(FILE *fp);
+
+	// An N*N*N table that returns its input
+	void Identity(int nSize);
+
+	int Size() const { return m_nSize; }
+	const char *Title() const { return m_szTitle; }
+	const char *Error() const { return m_szError; }
+
+	// Tetrahedral interpolation at RGB in 0..1; the result is RGB in 0..1
+	void Sample(double r, double g, double b, double *pr, double *pg, double *pb) const;
+
+private:
+	bool Fail(const char *pszFormat, int nLine);
+
+	int m_nSize;
+	double m_Min[3];
+	double m_Max[3];
+	std::vector<float> m_Nodes;   // RGB triplets, red fastest
+	char m_szTitle[128];
+	char m_szError[128];
+};
+
+//
+// CColorLattice
+//
+// A .cube converted to the engine's YUV domain: a (2^k+1)^3 grid over the
+// 8-bit Y, U and V codes, so that the node and the fraction of a sample
+// fall out of a shift and a mask. Every node holds the final Y'U'V' in
+// 1/16 steps, with the cube and the colour space conversion applied, and
+// a pixel costs one tetrahedral interpolation.
+//
+class CColorLattice
+{
+public:
+	CColorLattice();
+
+	// nShift 3 gives a 33^3 grid (step 8), 2 a 65^3 one. The cube sees RGB
+	// decoded with the output space and its result is encoded with it.
+	// Without bControls the nodes sit at input codes, decoded with the
+	// input space. With it they sit at the codes the engine's control
+	// tables hand on, luma in the input range and chroma already in the
+	// output space, and the nodes convert the luma; the tables themselves
+	// stay in front of the lookup at full resolution, since a curve such
+	// as the gamma bends faster than the nodes can follow.
+	void Build(const CColorCube &cube, int nShift, bool bControls,
+		const ColorSpace &in, const ColorSpace &out);
+
+	bool Empty() const { return m_Nodes.empty(); }
+	int Size() const { return m_nSize; }
+
+	// Y'U'V' in 1/16 steps
+	inline void Lookup(int y, int u, int v, int *py, int *pu, int *pv) const;
+
+	// Y' only, in 1/16 steps
+	inline int LookupY(int y, int u, int v) const;
+
+#ifdef FRAME_SSE2
+	// Y'U'V' in 1/16 steps in the low three 32-bit lanes; the three
+	// channels are interpolated together with two multiply-adds
+	inline __m128i LookupSSE2(int y, int u, int v) const;
+#endif
+
+private:
+	struct Node
+	{
+		short y;
+		short u;
+		short v;
+		short pad;
+	};
+
+	int m_nSize;
+	int m_nShift;
+	int m_StrideY;
+	int m_StrideU;
+	std::vector<Node> m_Nodes;
+};
+
+// Axes (0 = Y, 1 = U, 2 = V) by falling fraction, indexed by the three
+// pairwise comparisons; the two impossible combinations are filled in.
+extern const unsigned char g_LatticeOrder[8][3];
+
+//
+// Tetrahedral interpolation: the unit cell is split into six tetrahedra
+// along its main diagonal, chosen by the order of the three fractions
+// through a table rather than branches, which random pixels would defeat.
+// c0 + (c1 - c0) * f1 + (c2 - c1) * f2 + (c3 - c2) * f3, where f1 >= f2 >= f3
+// and c1..c3 step along the axes in that order.
+//
+#define LATTICE_SETUP() \
+	const int nMask = (1 << m_nShift) - 1; \
+	const int nFracShift = 8 - m_nShift; \
+	const int f[3] = { (y & nMask) << nFracShift, (u & nMask) << nFracShift, (v & nMask) << nFracShift }; \
+	const int st[3] = { m_StrideY, m_StrideU, 1 }; \
+	const Node *p0 = &m_Nodes[(y >> m_nShift) * m_StrideY + (u >> m_nShift) * m_StrideU + (v >> m_nShift)]; \
+	const unsigned char *order = g_LatticeOrder[(f[0] >= f[1]) | ((f[1] >= f[2]) << 1) | ((f[0] >= f[2]) << 2)]; \
+	const int f1 = f[order[0]], f2 = f[order[1]], f3 = f[order[2]]; \
+	const Node *p1 = p0 + st[order[0]]; \
+	const Node *p2 = p1 + st[order[1]]; \
+	const Node *p3 = p0 + m_StrideY + m_StrideU + 1;
+
+#define LATTICE_CHANNEL(c) \
+	((p0->c << 8) + (p1->c - p0->c) * f1 + (p2->c - p1->c) * f2 + (p3->c - p2->c) * f3 + 128) >> 8
+
+inline void CColorLattice::Lookup(int y, int u, int v, int *py, int *pu, int *pv) const
+{
+	LATTICE_SETUP()
+	*py = LATTICE_CHANNEL(y);
+	*pu = LATTICE_CHANNEL(u);
+	*pv = LATTICE_CHANNEL(v);
+}
+
+inline int CColorLattice::LookupY(int y, int u, int v) const
+{
+	LATTICE_SETUP()
+	return LATTICE_CHANNEL(y);
+}
+
+#ifdef FRAME_SSE2
+inline __m128i CColorLattice::LookupSSE2(int y, int u, int v) const
+{
+	LATTICE_SETUP()
+	__m128i n0 = _mm_loadl_epi64((const __m128i *)p0);
+	__m128i n1 = _mm_loadl_epi64((const __m128i *)p1);
+	__m128i n2 = _mm_loadl_epi64((const __m128i *)p2);
+	__m128i n3 = _mm_loadl_epi64((const __m128i *)p3);
+
+	// (c1 - c0) * f1 + (c2 - c1) * f2 and (c3 - c2) * f3 + c0 * 256, per channel
+	__m128i d12 = _mm_unpacklo_epi16(_mm_sub_epi16(n1, n0), _mm_sub_epi16(n2, n1));
+	__m128i d30 = _mm_unpacklo_epi16(_mm_sub_epi16(n3, n2), n0);
+	__m128i sum = _mm_add_epi32(
+		_mm_madd_epi16(d12, _mm_set1_epi32(f1 | (f2 << 16))),
+		_mm_madd_epi16(d30, _mm_set1_epi32(f3 | (256 << 16))));
+	return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8);
+}
+#endif
+
+#undef LATTICE_SETUP
+#undef LATTICE_CHANNEL
@@ -0,0 +1,1536 @@
+#include <math.h>
+#include <string.h>
+#include "ColorEngine.h"
+#include "FrameScaler.h"
+#include "FrameReuse.h"
+#include "FrameMotion.h"
+#include "FrameOverlay.h"
+#include "FrameKey.h"
+#include "FramePreview.h"
+#include "FrameFingerprint.h"
+#include "FrameTrace.h"
+
+#define PI 3.1415926
+
+CColorEngine::CColorEngine()
+	: m_nStatsStep(1), m_bCube(false), m_bCubeControls(false), m_pCurve(NULL), m_Hue(128), m_Saturation(128),
+	  m_pPartials(NULL), m_nPartials(0),
+	  m_Isa(FrameIsaBest()), m_bLumaOps(false), m_bChromaOps(false), m_Blend(),
+	  m_bBypassLuma(false), m_bBypassChroma(false), m_nSliceRows(0), m_pSliceSink(NULL),
+	  m_StreamMode(STREAM_AUTO), m_nPrefetchRows(0), m_bMovesOnly(true), m_bStream(false),
+	  m_pReuse(NULL), m_nGeneration(0), m_pMotion(NULL),
+	  m_pOverlay(NULL), m_nOverlayGeneration(0), m_bOverlay(false),
+	  m_pKey(NULL), m_nKeyGeneration(0), m_bKey(false), m_pPreview(NULL), m_bPreview(false),
+	  m_pFingerprint(NULL), m_bFingerprint(false), m_pTrace(NULL)
+{
+	for (int i = 0; i < 256; i++)
+	{
+		m_Luma[i] = (unsigned char)i;
+		for (int j = 0; j < 256; j++)
+		{
+			m_ChromaU[i][j] = (unsigned char)i;
+			m_ChromaV[i][j] = (unsigned char)j;
+		}
+	}
+	m_pLumaSrc = m_pLuma = m_Luma;
+	ColorSpace sd = MakeColorSpace(COLOR_MATRIX_BT601, false);
+	SetColorSpaces(sd, sd);
+}
+
+CColorEngine::~CColorEngine()
+{
+	delete [] m_pPartials;
+}
+
+void CColorEngine::SetCube(const CColorCube &cube, bool bBakeControls)
+{
+	// The grid follows the cube: 17^3 and smaller, 33^3, or 65^3
+	int nShift = cube.Size() <= 17 ? 4 : (cube.Size() <= 33 ? 3 : 2);
+	if (m_pTrace != NULL)
+		m_pTrace->Record(TRACE_LUT_START, TRACE_TABLE_CUBE);
+	m_Lattice.Build(cube, nShift, bBakeControls, m_In, m_Out);
+	m_bCube = true;
+	m_bCubeControls = bBakeControls;
+	SelectKernels();
+	if (m_pTrace != NULL)
+		m_pTrace->Record(TRACE_LUT_END, TRACE_TABLE_CUBE);
+}
+
+void CColorEngine::ClearCube()
+{
+	m_bCube = false;
+	SelectKernels();
+}
+
+void CColorEngine::SetBlend(const FrameDesc *pBlend)
+{
+	FrameDesc none = FrameDesc();
+	const FrameDesc &blend = pBlend != NULL ? *pBlend : none;
+	if (blend.pbTop != m_Blend.pbTop || blend.lStride != m_Blend.lStride ||
+		blend.nWidth != m_Blend.nWidth || blend.nHeight != m_Blend.nHeight ||
+		blend.format != m_Blend.format || blend.pbU != m_Blend.pbU ||
+		blend.pbV != m_Blend.pbV || blend.lStrideUV != m_Blend.lStrideUV)
+		m_nGeneration++;
+	m_Blend = blend;
+}
+
+void CColorEngine::SetIsa(FrameIsa isa)
+{
+	m_Isa = isa < FrameIsaBest() ? isa : FrameIsaBest();
+	SelectKernels();
+}
+
+void CColorEngine::SetBypass(bool bLuma, bool bChroma)
+{
+	if (bLuma == m_bBypassLuma && bChroma == m_bBypassChroma)
+		return;
+	m_bBypassLuma = bLuma;
+	m_bBypassChroma = bChroma;
+	SelectLuma(m_pLumaSrc);
+}
+
+void CColorEngine::SetStreaming(StreamMode mode, int nPrefetchRows)
+{
+	m_StreamMode = mode;
+	m_nPrefetchRows = nPrefetchRows > 0 ? nPrefetchRows : 0;
+}
+
+bool CColorEngine::Streaming(const FrameDesc &dst) const
+{
+	if (m_Isa < FRAME_ISA_SSE2 || m_StreamMode == STREAM_OFF)
+		return false;
+	return m_StreamMode == STREAM_ON ||
+		(m_bMovesOnly && FrameBytes(dst.format, dst.nWidth, dst.nHeight) >= g_FrameStreamBytes);
+}
+
+void CColorEngine::SetSlices(int nRows, CFrameSliceSink *pSink)
+{
+	m_nSliceRows = nRows > 0 ? nRows : 0;
+	m_pSliceSink = pSink;
+}
+
+void CColorEngine::SetOverlay(CFrameOverlay *pOverlay)
+{
+	m_pOverlay = pOverlay;
+	m_nOverlayGeneration = pOverlay != NULL ? pOverlay->Generation() : 0;
+	m_nGeneration++;
+}
+
+void CColorEngine::SetKey(CFrameKey *pKey)
+{
+	m_pKey = pKey;
+	m_nKeyGeneration = pKey != NULL ? pKey->Generation() : 0;
+	m_nGeneration++;
+}
+
+void CColorEngine::SetReuse(CFrameReuse *pReuse)
+{
+	m_pReuse = pReuse;
+	if (pReuse != NULL)
+		pReuse->Invalidate();
+}
+
+void CColorEngine::SetFingerprint(CFrameFingerprint *pFingerprint)
+{
+	m_pFingerprint = pFingerprint;
+	if (pFingerprint != NULL)
+		pFingerprint->Invalidate();
+}
+
+void CColorEngine::SetLumaCurve(CLumaCurve *pCurve)
+{
+	m_pCurve = pCurve;
+	SelectLuma(pCurve != NULL ? pCurve->Acquire() : m_Luma);
+}
+
+//
+// Point the kernels at pTable, or at pTable followed by the range change
+// when that is all the conversion does to luma
+//
+void CColorEngine::SelectLuma(const unsigned char *pTable)
+{
+	m_pLumaSrc = pTable;
+	if (m_bRange && (!m_bMatrix || m_bBypassChroma))
+	{
+		for (int i = 0; i < 256; i++)
+			m_LumaOut[i] = m_RangeY[RANGE_PAD + pTable[i]];
+		m_pLuma = m_LumaOut;
+	}
+	else
+	{
+		m_pLuma = pTable;
+	}
+
+	m_bLumaOps = false;
+	for (int i = 0; i < 256; i++)
+	{
+		if (m_pLuma[i] != i)
+			m_bLumaOps = true;
+	}
+	SelectKernels();
+}
+
+//
+// The conversion is affine in the codes, so it is measured by converting
+// the neutral grey and one step along U and along V. Grey stays grey, so
+// output chroma only depends on input chroma: that part goes into the
+// chroma tables. Output luma is the range-mapped input luma plus a weighted
+// sum of the adjusted chroma, which m_Cross holds in input luma codes.
+//
+void CColorEngine::SetColorSpaces(const ColorSpace &in, const ColorSpace &out)
+{
+	if (m_pTrace != NULL)
+		m_pTrace->Record(TRACE_LUT_START, TRACE_TABLE_SPACES);
+	m_In = in;
+	m_Out = out;
+
+	double y0, u0, v0, yu, uu, vu, yv, uv, vv;
+	ColorSpaceConvert(in, out, 128, 128, 128, &y0, &u0, &v0);
+	ColorSpaceConvert(in, out, 128, 129, 128, &yu, &uu, &vu);
+	ColorSpaceConvert(in, out, 128, 128, 129, &yv, &uv, &vv);
+	m_Chroma[0][0] = uu - u0; m_Chroma[0][1] = uv - u0;
+	m_Chroma[1][0] = vu - v0; m_Chroma[1][1] = vv - v0;
+	m_bChroma = fabs(m_Chroma[0][0] - 1) > 1e-9 || fabs(m_Chroma[0][1]) > 1e-9 ||
+		fabs(m_Chroma[1][0]) > 1e-9 || fabs(m_Chroma[1][1] - 1) > 1e-9;
+
+	// Luma per input chroma step, in input luma codes
+	double ly0, ly1, lu, lv;
+	ColorSpaceConvert(in, out, 0, 128, 128, &ly0, &lu, &lv);
+	ColorSpaceConvert(in, out, 1, 128, 128, &ly1, &lu, &lv);
+	m_CrossU = (yu - y0) / (ly1 - ly0);
+	m_CrossV = (yv - y0) / (ly1 - ly0);
+	m_bMatrix = fabs(m_CrossU) * 128 >= 0.5 || fabs(m_CrossV) * 128 >= 0.5;
+
+	m_bRange = false;
+	for (int i = -RANGE_PAD; i < 256 + RANGE_PAD; i++)
+	{
+		double Y = ly0 + (ly1 - ly0) * i;
+		int n = (int)floor(Y + 0.5);
+		if (n < 0) n = 0;
+		if (n > 255) n = 255;
+		m_RangeY[RANGE_PAD + i] = (unsigned char)n;
+		if (i >= 0 && i < 256 && n != i)
+			m_bRange = true;
+	}
+
+	BuildChroma();
+	SelectLuma(m_pLumaSrc);
+	if (m_pTrace != NULL)
+		m_pTrace->Record(TRACE_LUT_END, TRACE_TABLE_SPACES);
+}
+
+void CColorEngine::Apply(unsigned char y, unsigned char u, unsigned char v,
+	unsigned char *pY, unsigned char *pU, unsigned char *pV) const
+{
+	unsigned char u2 = m_ChromaU[u][v];
+	unsigned char v2 = m_ChromaV[u][v];
+	*pY = m_RangeY[RANGE_PAD + m_Luma[y] + m_Cross[u][v]];
+	*pU = u2;
+	*pV = v2;
+}
+
+void CColorEngine::SetStatsRowStep(int nStep)
+{
+	m_nStatsStep = nStep < 1 ? 1 : nStep;
+}
+
+void CColorEngine::UpdateLuma(unsigned char Brightness, unsigned char Contrast, unsigned char Gamma)
+{
+	if (m_pTrace != NULL)
+		m_pTrace->Record(TRACE_LUT_START, TRACE_TABLE_LUMA);
+	double C = (double)Contrast / 127.0;
+	double G = (double)Gamma;
+	if ( G < 0.0001) G = 0.01;
+	G = 128.0/G;
+	for ( int i = 0; i < 256; i++)
+	{
+		double L =  ((i-16) * C)+ (Brightness-127) + 16;
+		// pow() of a negative level is NaN, so clamp to black first
+		if (L < 0 ) L = 0;
+		L = 255.0 * pow((L/255.0),G);
+		if (L < 0 ) L = 0;
+		if (L > 255) L = 255;
+		m_Luma[i] = (unsigned char)L;
+	}
+	if (m_pCurve == NULL)
+		SelectLuma(m_Luma);
+	if (m_pTrace != NULL)
+		m_pTrace->Record(TRACE_LUT_END, TRACE_TABLE_LUMA);
+}
+
+void CColorEngine::UpdateChroma(unsigned char Hue, unsigned char Saturation)
+{
+	if (m_pTrace != NULL)
+		m_pTrace->Record(TRACE_LUT_START, TRACE_TABLE_CHROMA);
+	m_Hue = Hue;
+	m_Saturation = Saturation;
+	BuildChroma();
+	if (m_pTrace != NULL)
+		m_pTrace->Record(TRACE_LUT_END, TRACE_TABLE_CHROMA);
+}
+
+void CColorEngine::BuildChroma()
+{
+	double H = (double)m_Hue - 128.0;
+	H *= 180.0/128.0;
+	double cosH = cos(H*PI/180.0);
+	double sinH = sin(H*PI/180.0);
+
+	int S = m_Saturation/4;
+
+	for ( int i = 0; i < 256; i++)
+	{
+		for ( int j = 0; j < 256; j++)
+		{
+			double Cu = (((i - 128) * cosH + (j-128) * sinH) * S)/32 + 128;
+			double Cv = (((j - 128) * cosH - (i-128) * sinH) * S)/32 + 128;
+			if (Cu < 0) Cu = 0;
+			if (Cu > 255) Cu = 255;
+			if (Cv < 0) Cv = 0;
+			if (Cv > 255) Cv = 255;
+
+			// The conversion starts from the adjusted chroma
+			double Du = Cu - 128, Dv = Cv - 128;
+			m_Cross[i][j] = (signed char)floor(m_CrossU * Du + m_CrossV * Dv + 0.5);
+			if (m_bChroma)
+			{
+				double Ou = m_Chroma[0][0] * Du + m_Chroma[0][1] * Dv + 128.5;
+				double Ov = m_Chroma[1][0] * Du + m_Chroma[1][1] * Dv + 128.5;
+				Cu = Ou < 0 ? 0 : (Ou > 255 ? 255 : Ou);
+				Cv = Ov < 0 ? 0 : (Ov > 255 ? 255 : Ov);
+			}
+			m_ChromaU[i][j] = (unsigned char)Cu;
+			m_ChromaV[i][j] = (unsigned char)Cv;
+		}
+	}
+
+	m_bChromaOps = false;
+	for (int i = 0; i < 256 && !m_bChromaOps; i++)
+	{
+		for (int j = 0; j < 256; j++)
+		{
+			if (m_ChromaU[i][j] != i || m_ChromaV[i][j] != j)
+			{
+				m_bChromaOps = true;
+				break;
+			}
+		}
+	}
+	SelectKernels();
+}
+
+CLumaCurve::CLumaCurve()
+	: m_lLatest(1), m_nFront(0), m_nBack(2)
+{
+	for (int t = 0; t < 3; t++)
+	{
+		for (int i = 0; i < 256; i++)
+			m_Tables[t][i] = (unsigned char)i;
+	}
+}
+
+void CLumaCurve::Publish(const unsigned char *pTable)
+{
+	memcpy(m_Tables[m_nBack], pTable, 256);
+	long lOld = FrameInterlockedExchange(&m_lLatest, m_nBack | FRESH);
+	m_nBack = (int)(lOld & ~FRESH);
+}
+
+const unsigned char *CLumaCurve::Acquire()
+{
+	if (FrameInterlockedExchangeAdd(&m_lLatest, 0) & FRESH)
+	{
+		long lOld = FrameInterlockedExchange(&m_lLatest, m_nFront);
+		m_nFront = (int)(lOld & ~FRESH);
+	}
+	return m_Tables[m_nFront];
+}
+
+const char *CColorEngine::KernelName(ColorKernel kernel)
+{
+	switch (kernel)
+	{
+	case KERNEL_INPLACE:  return "inplace";
+	case KERNEL_DIRECT:   return "direct";
+	case KERNEL_UNROLLED: return "unrolled";
+	default:              return "unknown";
+	}
+}
+
+//
+// The filter's ghost blend: (dst + ref) / 2 rounded down
+//
+template <int ISA>
+static inline void BlendRow(unsigned char *pb, const unsigned char *pRef, size_t cb)
+{
+	size_t i = 0;
+#ifdef FRAME_SSE2
+	if (ISA == FRAME_ISA_SSE2)
+	{
+		// pavgb rounds up; take the odd bit back
+		const __m128i one = _mm_set1_epi8(1);
+		for (; i + 16 <= cb; i += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(pb + i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(pRef + i));
+			__m128i r = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+			_mm_storeu_si128((__m128i *)(pb + i), r);
+		}
+	}
+#endif
+	for (; i < cb; i++)
+		pb[i] = (unsigned char)((pb[i] + pRef[i]) >> 1);
+}
+
+//
+// One macropixel in registers: luma and chroma in, processed luma and chroma
+// out. pLuma is m_pLuma, held in a local by the caller since every byte
+// store could otherwise have changed it.
+//
+template <int OPS>
+inline void CColorEngine::TransformMacro(const unsigned char *pLuma,
+	unsigned int &y0, unsigned int &u, unsigned int &y1, unsigned int &v) const
+{
+	if (OPS & OPS_MATRIX)
+	{
+		const unsigned char *pRange = m_RangeY + RANGE_PAD;
+		int off = m_Cross[u][v];
+		y0 = pRange[pLuma[y0] + off];
+		y1 = pRange[pLuma[y1] + off];
+	}
+	else if (OPS & OPS_LUMA)
+	{
+		y0 = pLuma[y0];
+		y1 = pLuma[y1];
+	}
+	if (OPS & OPS_CHROMA)
+	{
+		unsigned int u2 = m_ChromaU[u][v];
+		v = m_ChromaV[u][v];
+		u = u2;
+	}
+}
+
+//
+// The same written straight to the macropixel at d, leaving the processed
+// chroma in u and v. The luma lookups follow the first store, which keeps
+// the compiler from gathering the four bytes into one store through a
+// chain of shifts; that is slower than the byte stores.
+//
+template <int Y0, int U, int Y1, int V, int OPS>
+inline void CColorEngine::StoreMacro(const unsigned char *pLuma, unsigned char *d,
+	unsigned int y0, unsigned int &u, unsigned int y1, unsigned int &v) const
+{
+	unsigned int u2 = u, v2 = v;
+	if (OPS & OPS_CHROMA)
+	{
+		u2 = m_ChromaU[u][v];
+		v2 = m_ChromaV[u][v];
+	}
+	if (OPS & OPS_MATRIX)
+	{
+		const unsigned char *pRange = m_RangeY + RANGE_PAD;
+		int off = m_Cross[u][v];
+		d[Y0] = pRange[pLuma[y0] + off];
+		d[Y1] = pRange[pLuma[y1] + off];
+	}
+	else if (OPS & OPS_LUMA)
+	{
+		d[Y0] = pLuma[y0];
+		d[Y1] = pLuma[y1];
+	}
+	else
+	{
+		d[Y0] = (unsigned char)y0;
+		d[Y1] = (unsigned char)y1;
+	}
+	d[U] = (unsigned char)u2;
+	d[V] = (unsigned char)v2;
+	u = u2;
+	v = v2;
+}
+
+//
+// Count n samples nStep bytes apart into the lanes of a histogram in turn
+//
+static inline void CountLanes(unsigned int (*pLanes)[256], const unsigned char *pb, int n, int nStep)
+{
+	int j = 0;
+	for (; j + 4 <= n; j += 4, pb += nStep * 4)
+	{
+		pLanes[0][pb[0]]++;
+		pLanes[1][pb[nStep]]++;
+		pLanes[2][pb[nStep * 2]]++;
+		pLanes[3][pb[nStep * 3]]++;
+	}
+	for (; j < n; j++, pb += nStep)
+		pLanes[0][*pb]++;
+}
+
+//
+// Packed 4:2:2 rows. The template arguments are the byte offsets of Y0, U,
+// Y1 and V inside a macropixel, the ColorKernel, the OPS_ flags and the
+// FrameIsa. Without any operation a row is a copy.
+//
+template <int Y0, int U, int Y1, int V, int KERNEL, int OPS, int ISA>
+void CColorEngine::ProcessRowsPacked(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats)
+{
+	enum
+	{
+		STATS = (OPS & OPS_STATS) != 0,
+		MATRIX = (OPS & OPS_MATRIX) != 0,
+		COPY = (OPS & (OPS_LUMA | OPS_CHROMA | OPS_STATS)) == 0
+	};
+	const int nMacro = (src.nWidth + 1) / 2;
+	const size_t cbRow = (size_t)nMacro * 4;
+
+	unsigned char *pbSource = src.pbTop + src.lStride * nFirstRow;
+	unsigned char *pbTarget = dst.pbTop + dst.lStride * nFirstRow;
+
+	const unsigned char *pLuma = m_pLuma;
+	unsigned int (*pHistY)[256] = STATS ? pStats->LumaInLanes : NULL;
+	unsigned int (*pHistU)[256] = STATS ? pStats->ChromaULanes : NULL;
+	unsigned int (*pHistV)[256] = STATS ? pStats->ChromaVLanes : NULL;
+
+	for (int i = nFirstRow; i < nLastRow; i++)
+	{
+		// With an odd width the last Y1 is padding; take back the count
+		// the kernel is about to add for it.
+		if (STATS && (src.nWidth & 1))
+			pHistY[0][pbSource[(nMacro - 1) * 4 + Y1]]--;
+
+		if (COPY)
+		{
+			if (pbTarget != pbSource)
+				memcpy(pbTarget, pbSource, cbRow);
+		}
+		else if (KERNEL == KERNEL_INPLACE)
+		{
+			for (int j = 0; j < nMacro * 4; j += 4)
+			{
+				unsigned int y0 = pbSource[j+Y0], u = pbSource[j+U];
+				unsigned int y1 = pbSource[j+Y1], v = pbSource[j+V];
+				if (STATS)
+				{
+					// Lanes 0 and 1, then 2 and 3 on the next macropixel
+					pHistY[(j >> 1) & 2][y0]++;
+					pHistY[((j >> 1) & 2) + 1][y1]++;
+				}
+				StoreMacro<Y0, U, Y1, V, OPS>(pLuma, pbSource + j, y0, u, y1, v);
+				if (STATS)
+				{
+					pHistU[(j >> 2) & 3][u]++;
+					pHistV[(j >> 2) & 3][v]++;
+				}
+			}
+			memcpy(pbTarget, pbSource, cbRow);
+		}
+		else if (KERNEL == KERNEL_DIRECT)
+		{
+			for (int j = 0; j < nMacro * 4; j += 4)
+			{
+				unsigned int y0 = pbSource[j+Y0], u = pbSource[j+U];
+				unsigned int y1 = pbSource[j+Y1], v = pbSource[j+V];
+				if (STATS)
+				{
+					// Lanes 0 and 1, then 2 and 3 on the next macropixel
+					pHistY[(j >> 1) & 2][y0]++;
+					pHistY[((j >> 1) & 2) + 1][y1]++;
+				}
+				StoreMacro<Y0, U, Y1, V, OPS>(pLuma, pbTarget + j, y0, u, y1, v);
+				if (STATS)
+				{
+					pHistU[(j >> 2) & 3][u]++;
+					pHistV[(j >> 2) & 3][v]++;
+				}
+			}
+		}
+		else
+		{
+			// Little-endian: the byte at offset n sits at bits 8n..8n+7
+			int j = 0;
+			for (; j + 2 <= nMacro; j += 2)
+			{
+				unsigned int p[2];
+				memcpy(p, pbSource + j * 4, 8);
+				for (int k = 0; k < 2; k++)
+				{
+					unsigned int y0 = (p[k] >> (Y0 * 8)) & 0xff;
+					unsigned int y1 = (p[k] >> (Y1 * 8)) & 0xff;
+					unsigned int u = (p[k] >> (U * 8)) & 0xff;
+					unsigned int v = (p[k] >> (V * 8)) & 0xff;
+					if (STATS)
+					{
+						pHistY[k * 2][y0]++;
+						pHistY[k * 2 + 1][y1]++;
+					}
+					TransformMacro<OPS>(pLuma, y0, u, y1, v);
+					p[k] = (y0 << (Y0 * 8))
+						| (u << (U * 8))
+						| (y1 << (Y1 * 8))
+						| (v << (V * 8));
+					if (STATS)
+					{
+						pHistU[(j & 2) + k][u]++;
+						pHistV[(j & 2) + k][v]++;
+					}
+				}
+				memcpy(pbTarget + j * 4, p, 8);
+			}
+			for (; j < nMacro; j++)
+			{
+				const unsigned char *s = pbSource + j * 4;
+				unsigned char *d = pbTarget + j * 4;
+				unsigned int y0 = s[Y0], u = s[U], y1 = s[Y1], v = s[V];
+				if (STATS)
+				{
+					pHistY[0][y0]++;
+					pHistY[1][y1]++;
+				}
+				StoreMacro<Y0, U, Y1, V, OPS>(pLuma, d, y0, u, y1, v);
+				if (STATS)
+				{
+					pHistU[0][u]++;
+					pHistV[0][v]++;
+				}
+			}
+		}
+
+		// Luma out is not a function of luma in, so count it directly
+		if (STATS && MATRIX)
+			CountLanes(pStats->LumaLanes, pbTarget + Y0, src.nWidth, Y1 - Y0);
+		if (OPS & OPS_BLEND)
+			BlendRow<ISA>(pbTarget, blend.pbTop + blend.lStride * i, cbRow);
+		pbSource += src.lStride;
+		pbTarget += dst.lStride;
+	}
+}
+
+//
+// Planar rows. With vertical subsampling chroma row n belongs to luma rows
+// 2n and 2n+1, so a band must start on an even row. Luma goes first: with
+// a matrix it reads the source chroma of its block, which an in-place
+// chroma pass would already have replaced.
+//
+template <int OPS, int ISA>
+void CColorEngine::ProcessRowsPlanar(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats)
+{
+	enum { STATS = (OPS & OPS_STATS) != 0 };
+	int sx, sy;
+	FrameChromaShift(src.format, &sx, &sy);
+	const int nWidth = src.nWidth;
+	const int nWidthUV = (src.nWidth + sx) >> sx;
+
+	const unsigned char *pLuma = m_pLuma;
+	const unsigned char *pRange = m_RangeY + RANGE_PAD;
+	unsigned int (*pHistY)[256] = STATS ? pStats->LumaInLanes : NULL;
+	unsigned int (*pHistU)[256] = STATS ? pStats->ChromaULanes : NULL;
+	unsigned int (*pHistV)[256] = STATS ? pStats->ChromaVLanes : NULL;
+
+	for (int i = nFirstRow; i < nLastRow; i++)
+	{
+		const unsigned char *s = src.pbTop + src.lStride * i;
+		unsigned char *d = dst.pbTop + dst.lStride * i;
+		if (OPS & OPS_MATRIX)
+		{
+			const unsigned char *su = src.pbU + src.lStrideUV * (i >> sy);
+			const unsigned char *sv = src.pbV + src.lStrideUV * (i >> sy);
+			for (int j = 0; j < nWidth; j++)
+			{
+				if (STATS)
+					pHistY[j & 3][s[j]]++;
+				d[j] = pRange[pLuma[s[j]] + m_Cross[su[j >> sx]][sv[j >> sx]]];
+				if (STATS)
+					pStats->LumaLanes[j & 3][d[j]]++;
+			}
+		}
+		else if (OPS & OPS_LUMA)
+		{
+			for (int j = 0; j < nWidth; j++)
+			{
+				if (STATS)
+					pHistY[j & 3][s[j]]++;
+				d[j] = pLuma[s[j]];
+			}
+		}
+		else
+		{
+			if (STATS)
+				CountLanes(pHistY, s, nWidth, 1);
+			if (d != s)
+				memcpy(d, s, nWidth);
+		}
+		if (OPS & OPS_BLEND)
+			BlendRow<ISA>(d, blend.pbTop + blend.lStride * i, nWidth);
+	}
+
+	for (int i = (nFirstRow + sy) >> sy; i < (nLastRow + sy) >> sy; i++)
+	{
+		const unsigned char *su = src.pbU + src.lStrideUV * i;
+		const unsigned char *sv = src.pbV + src.lStrideUV * i;
+		unsigned char *du = dst.pbU + dst.lStrideUV * i;
+		unsigned char *dv = dst.pbV + dst.lStrideUV * i;
+		if (OPS & OPS_CHROMA)
+		{
+			for (int j = 0; j < nWidthUV; j++)
+			{
+				unsigned char u = su[j];
+				unsigned char v = sv[j];
+				du[j] = m_ChromaU[u][v];
+				dv[j] = m_ChromaV[u][v];
+			}
+		}
+		else if (du != su)
+		{
+			memcpy(du, su, nWidthUV);
+			memcpy(dv, sv, nWidthUV);
+		}
+		if (STATS)
+		{
+			CountLanes(pHistU, du, nWidthUV, 1);
+			CountLanes(pHistV, dv, nWidthUV, 1);
+		}
+		if (OPS & OPS_BLEND)
+		{
+			BlendRow<ISA>(du, blend.pbU + blend.lStrideUV * i, nWidthUV);
+			BlendRow<ISA>(dv, blend.pbV + blend.lStrideUV * i, nWidthUV);
+		}
+	}
+}
+
+//
+// 3D LUT rows, packed 4:2:2. Both pixels of a macropixel are looked up with
+// the shared chroma and the two chroma results are averaged. With
+// OPS_LUMA and OPS_CHROMA the control tables map the codes first. The cube
+// kernels sample the statistics rows themselves.
+//
+template <int Y0, int U, int Y1, int V, int OPS, int ISA>
+void CColorEngine::ProcessRowsPackedCube(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats)
+{
+	enum { STATS = (OPS & OPS_STATS) != 0, CONTROLS = (OPS & OPS_LUMA) != 0 };
+	const int nMacro = (src.nWidth + 1) / 2;
+	const CColorLattice &lattice = m_Lattice;
+	const unsigned char *pLuma = m_pLumaSrc;
+
+	for (int i = nFirstRow; i < nLastRow; i++)
+	{
+		const unsigned char *s = src.pbTop + src.lStride * i;
+		unsigned char *d = dst.pbTop + dst.lStride * i;
+		if (STATS && (src.nWidth & 1))
+			pStats->LumaIn[s[(nMacro - 1) * 4 + Y1]]--;
+
+		for (int j = 0; j < nMacro * 4; j += 4)
+		{
+			int y0 = s[j+Y0], u = s[j+U], y1 = s[j+Y1], v = s[j+V];
+			int ly0 = y0, lu = u, ly1 = y1, lv = v;
+			if (CONTROLS)
+			{
+				ly0 = pLuma[y0];
+				ly1 = pLuma[y1];
+				lu = m_ChromaU[u][v];
+				lv = m_ChromaV[u][v];
+			}
+#ifdef FRAME_SSE2
+			if (ISA == FRAME_ISA_SSE2)
+			{
+				__m128i a = lattice.LookupSSE2(ly0, lu, lv);
+				__m128i b = lattice.LookupSSE2(ly1, lu, lv);
+				__m128i uv = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(a, b), _mm_set1_epi32(16)), 5);
+				d[j+Y0] = (unsigned char)((_mm_cvtsi128_si32(a) + 8) >> 4);
+				d[j+Y1] = (unsigned char)((_mm_cvtsi128_si32(b) + 8) >> 4);
+				d[j+U] = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+				d[j+V] = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(uv, 8));
+			}
+			else
+#endif
+			{
+				int ya, ua, va, yb, ub, vb;
+				lattice.Lookup(ly0, lu, lv, &ya, &ua, &va);
+				lattice.Lookup(ly1, lu, lv, &yb, &ub, &vb);
+				d[j+Y0] = (unsigned char)((ya + 8) >> 4);
+				d[j+Y1] = (unsigned char)((yb + 8) >> 4);
+				d[j+U] = (unsigned char)((ua + ub + 16) >> 5);
+				d[j+V] = (unsigned char)((va + vb + 16) >> 5);
+			}
+			if (STATS)
+			{
+				pStats->LumaIn[y0]++;
+				pStats->LumaIn[y1]++;
+				pStats->ChromaU[d[j+U]]++;
+				pStats->ChromaV[d[j+V]]++;
+			}
+		}
+
+		// Luma out is not a function of luma in here, so count it directly
+		if (STATS)
+			CountLanes(pStats->LumaLanes, d + Y0, src.nWidth, Y1 - Y0);
+		if (OPS & OPS_BLEND)
+			BlendRow<ISA>(d, blend.pbTop + blend.lStride * i, (size_t)nMacro * 4);
+	}
+}
+
+//
+// 3D LUT rows, planar. Luma is looked up per pixel with the chroma of its
+// block; chroma is looked up once per sample at the mean luma of the block.
+// With OPS_LUMA and OPS_CHROMA the control tables map the codes first, the
+// mean luma included. Blocks are handled in column strips so that
+// everything a strip reads is read before it is written, which keeps
+// in-place processing correct. The range must start on a block row; band
+// splitting already guarantees that.
+//
+template <int OPS, int ISA>
+void CColorEngine::ProcessRowsPlanarCube(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats)
+{
+	enum { STATS = (OPS & OPS_STATS) != 0, CONTROLS = (OPS & OPS_LUMA) != 0 };
+	int sx, sy;
+	FrameChromaShift(src.format, &sx, &sy);
+	const int nWidthUV = (src.nWidth + sx) >> sx;
+	const CColorLattice &lattice = m_Lattice;
+	const unsigned char *pLuma = m_pLumaSrc;
+	enum { STRIP = 256 };
+	unsigned char tu[STRIP], tv[STRIP];
+	unsigned char lu[STRIP], lv[STRIP];   // Block chroma for the lattice
+
+	for (int c = nFirstRow >> sy; (c << sy) < nLastRow; c++)
+	{
+		int r0 = c << sy;
+		int r1 = r0 + (1 << sy);
+		if (r1 > src.nHeight)
+			r1 = src.nHeight;
+
+		const unsigned char *su = src.pbU + src.lStrideUV * c;
+		const unsigned char *sv = src.pbV + src.lStrideUV * c;
+		unsigned char *du = dst.pbU + dst.lStrideUV * c;
+		unsigned char *dv = dst.pbV + dst.lStrideUV * c;
+
+		for (int j0 = 0; j0 < nWidthUV; j0 += STRIP)
+		{
+			int j1 = j0 + STRIP < nWidthUV ? j0 + STRIP : nWidthUV;
+
+			// Chroma at the mean luma of each block
+			for (int j = j0; j < j1; j++)
+			{
+				int x0 = j << sx;
+				int x1 = (x0 + (1 << sx)) < src.nWidth ? x0 + (1 << sx) : src.nWidth;
+				int sum = 0, n = 0;
+				for (int r = r0; r < r1; r++)
+				{
+					const unsigned char *s = src.pbTop + src.lStride * r;
+					for (int x = x0; x < x1; x++)
+						sum += s[x];
+					n += x1 - x0;
+				}
+				int ym = (sum + n / 2) / n;
+				lu[j - j0] = su[j];
+				lv[j - j0] = sv[j];
+				if (CONTROLS)
+				{
+					ym = pLuma[ym];
+					lu[j - j0] = m_ChromaU[su[j]][sv[j]];
+					lv[j - j0] = m_ChromaV[su[j]][sv[j]];
+				}
+				int yo, uo, vo;
+				lattice.Lookup(ym, lu[j - j0], lv[j - j0], &yo, &uo, &vo);
+				tu[j - j0] = (unsigned char)((uo + 8) >> 4);
+				tv[j - j0] = (unsigned char)((vo + 8) >> 4);
+			}
+
+			// Luma with the source chroma of its block
+			int x0 = j0 << sx;
+			int x1 = (j1 << sx) < src.nWidth ? (j1 << sx) : src.nWidth;
+			for (int r = r0; r < r1; r++)
+			{
+				const unsigned char *s = src.pbTop + src.lStride * r;
+				unsigned char *d = dst.pbTop + dst.lStride * r;
+				for (int x = x0; x < x1; x++)
+				{
+					int y = s[x];
+					int ly = CONTROLS ? pLuma[y] : y;
+					d[x] = (unsigned char)((lattice.LookupY(ly, lu[(x >> sx) - j0], lv[(x >> sx) - j0]) + 8) >> 4);
+					if (STATS)
+					{
+						pStats->LumaIn[y]++;
+						pStats->Luma[d[x]]++;
+					}
+				}
+			}
+
+			for (int j = j0; j < j1; j++)
+			{
+				du[j] = tu[j - j0];
+				dv[j] = tv[j - j0];
+				if (STATS)
+				{
+					pStats->ChromaU[du[j]]++;
+					pStats->ChromaV[dv[j]]++;
+				}
+			}
+		}
+
+		if (OPS & OPS_BLEND)
+		{
+			for (int r = r0; r < r1; r++)
+				BlendRow<ISA>(dst.pbTop + dst.lStride * r, blend.pbTop + blend.lStride * r, src.nWidth);
+			BlendRow<ISA>(du, blend.pbU + blend.lStrideUV * c, nWidthUV);
+			BlendRow<ISA>(dv, blend.pbV + blend.lStrideUV * c, nWidthUV);
+		}
+	}
+}
+
+//
+// The kernel matrix. Every combination of flags SelectKernels() can ask
+// for has its own instantiation; MATRIX never comes without LUMA. The
+// instruction set only tells the blend and the cube lookups apart, since
+// the table lookups have no vector form before AVX2 gathers.
+//
+#define KERNEL_OPS(X) \
+	X(0) X(1) X(3) X(4) X(5) X(7) X(8) X(9) X(11) X(12) X(13) X(15) \
+	X(16) X(17) X(19) X(20) X(21) X(23) X(24) X(25) X(27) X(28) X(29) X(31)
+#define CUBE_OPS(X) X(0) X(8) X(16) X(24) X(5) X(13) X(21) X(29)
+#define KERNEL_ISA(OPS) (((OPS) & OPS_BLEND) ? ISA : FRAME_ISA_SCALAR)
+
+template <int Y0, int U, int Y1, int V, int KERNEL, int ISA>
+CColorEngine::RowKernel CColorEngine::PackedKernel(int nOps)
+{
+	switch (nOps)
+	{
+#define X(OPS) case OPS: return &CColorEngine::ProcessRowsPacked<Y0, U, Y1, V, KERNEL, OPS, KERNEL_ISA(OPS)>;
+	KERNEL_OPS(X)
+#undef X
+	}
+	return NULL;
+}
+
+template <int ISA>
+CColorEngine::RowKernel CColorEngine::PlanarKernel(int nOps)
+{
+	switch (nOps)
+	{
+#define X(OPS) case OPS: return &CColorEngine::ProcessRowsPlanar<OPS, KERNEL_ISA(OPS)>;
+	KERNEL_OPS(X)
+#undef X
+	}
+	return NULL;
+}
+
+template <int ISA>
+CColorEngine::RowKernel CColorEngine::CubeKernel(FrameFormat format, int nOps, bool bControls)
+{
+	// The lattice does the matrix and the range; the control tables go in
+	// front of it as OPS_LUMA and OPS_CHROMA
+	nOps &= OPS_STATS | OPS_BLEND;
+	if (bControls)
+		nOps |= OPS_LUMA | OPS_CHROMA;
+	switch (format)
+	{
+	case FRAME_FORMAT_UYVY:
+		switch (nOps)
+		{
+#define X(OPS) case OPS: return &CColorEngine::ProcessRowsPackedCube<1, 0, 3, 2, OPS, ISA>;
+		CUBE_OPS(X)
+#undef X
+		}
+		break;
+	case FRAME_FORMAT_I420:
+	case FRAME_FORMAT_I422:
+	case FRAME_FORMAT_I444:
+		switch (nOps)
+		{
+#define X(OPS) case OPS: return &CColorEngine::ProcessRowsPlanarCube<OPS, KERNEL_ISA(OPS)>;
+		CUBE_OPS(X)
+#undef X
+		}
+		break;
+	case FRAME_FORMAT_YUY2:
+	default:
+		switch (nOps)
+		{
+#define X(OPS) case OPS: return &CColorEngine::ProcessRowsPackedCube<0, 1, 2, 3, OPS, ISA>;
+		CUBE_OPS(X)
+#undef X
+		}
+		break;
+	}
+	return NULL;
+}
+
+template <int ISA>
+CColorEngine::RowKernel CColorEngine::Kernel(FrameFormat format, ColorKernel kernel, int nOps)
+{
+	if (FramePlanar(format))
+		return PlanarKernel<ISA>(nOps);
+	bool bUYVY = format == FRAME_FORMAT_UYVY;
+	switch (kernel)
+	{
+	case KERNEL_INPLACE:
+		return bUYVY ? PackedKernel<1, 0, 3, 2, KERNEL_INPLACE, ISA>(nOps)
+			: PackedKernel<0, 1, 2, 3, KERNEL_INPLACE, ISA>(nOps);
+	case KERNEL_DIRECT:
+		return bUYVY ? PackedKernel<1, 0, 3, 2, KERNEL_DIRECT, ISA>(nOps)
+			: PackedKernel<0, 1, 2, 3, KERNEL_DIRECT, ISA>(nOps);
+	case KERNEL_UNROLLED:
+	default:
+		return bUYVY ? PackedKernel<1, 0, 3, 2, KERNEL_UNROLLED, ISA>(nOps)
+			: PackedKernel<0, 1, 2, 3, KERNEL_UNROLLED, ISA>(nOps);
+	}
+}
+
+//
+// Pick the instantiations for the current parameters. The cube kernels
+// take the same path for every memory walk.
+//
+void CColorEngine::SelectKernels()
+{
+	// Every change of the tables comes through here; rows kept from the
+	// frames before are no good any more
+	m_nGeneration++;
+
+	int nOps = 0;
+	if (m_bMatrix && !m_bBypassLuma && !m_bBypassChroma)
+		nOps |= OPS_LUMA | OPS_MATRIX;
+	else if (m_bLumaOps && !m_bBypassLuma)
+		nOps |= OPS_LUMA;
+	if (m_bChromaOps && !m_bBypassChroma)
+		nOps |= OPS_CHROMA;
+	const bool bCube = m_bCube && !m_bBypassLuma && !m_bBypassChroma;
+	m_bMovesOnly = nOps == 0 && !bCube;
+
+	for (int f = 0; f < FRAME_FORMAT_COUNT; f++)
+	{
+		for (int k = 0; k < KERNEL_COUNT; k++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				int n = nOps | ((i & 1) ? OPS_STATS : 0) | ((i & 2) ? OPS_BLEND : 0);
+				RowKernel &pKernel = m_Kernels[f][k][i];
+#ifdef FRAME_SSE2
+				if (m_Isa == FRAME_ISA_SSE2)
+				{
+					pKernel = bCube ? CubeKernel<FRAME_ISA_SSE2>((FrameFormat)f, n, m_bCubeControls)
+						: Kernel<FRAME_ISA_SSE2>((FrameFormat)f, (ColorKernel)k, n);
+					continue;
+				}
+#endif
+				pKernel = bCube ? CubeKernel<FRAME_ISA_SCALAR>((FrameFormat)f, n, m_bCubeControls)
+					: Kernel<FRAME_ISA_SCALAR>((FrameFormat)f, (ColorKernel)k, n);
+			}
+		}
+	}
+}
+
+void CColorEngine::ProcessRowsYUY2(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel)
+{
+	FrameDesc srcYUY2 = src;
+	srcYUY2.format = FRAME_FORMAT_YUY2;
+	ProcessRange(srcYUY2, dst, nFirstRow, nLastRow, kernel, NULL, m_Blend, 0);
+}
+
+void CColorEngine::ProcessRows(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats)
+{
+	ProcessSampled(src, dst, nFirstRow, nLastRow, kernel, pStats, m_Blend, 0);
+}
+
+void CColorEngine::ProcessSampled(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, const FrameDesc &blend,
+	int nRowBase)
+{
+	if (pStats == NULL || m_nStatsStep == 1)
+	{
+		ProcessRange(src, dst, nFirstRow, nLastRow, kernel, pStats, blend, nRowBase);
+		return;
+	}
+
+	// Sample every m_nStatsStep-th row of the frame and run the plain
+	// kernels over the rows in between. With 4:2:0 the step is rounded up
+	// to whole chroma blocks and a sample takes both rows of its block, so
+	// that no range ever processes half a block.
+	int sx, sy = 0;
+	if (FramePlanar(src.format))
+		FrameChromaShift(src.format, &sx, &sy);
+	const int nStep = (m_nStatsStep + (1 << sy) - 1) >> sy << sy;
+	int i = nFirstRow;
+	while (i < nLastRow)
+	{
+		int nNext = (i / nStep) * nStep;
+		if (nNext == i)
+		{
+			nNext = i + (1 << sy);
+			if (nNext > nLastRow)
+				nNext = nLastRow;
+			ProcessRange(src, dst, i, nNext, kernel, pStats, blend, nRowBase);
+			i = nNext;
+			continue;
+		}
+		nNext += nStep;
+		if (nNext > nLastRow)
+			nNext = nLastRow;
+		ProcessRange(src, dst, i, nNext, kernel, NULL, blend, nRowBase);
+		i = nNext;
+	}
+}
+
+//
+// Large targets: the kernels write a few rows at a time into a buffer that
+// stays in the L1 cache, and the rows go on to the target with
+// non-temporal stores, so that the frame does not evict the tables and the
+// source on its way out and its lines are never read for ownership. The
+// source rows the next groups read are prefetched meanwhile.
+//
+void CColorEngine::ProcessRange(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, const FrameDesc &blend,
+	int nRowBase)
+{
+	if (!m_bStream)
+	{
+		RunKernels(src, dst, nFirstRow, nLastRow, kernel, pStats, blend, nRowBase);
+		return;
+	}
+
+	int sx = 0, sy = 0;
+	const bool bPlanar = FramePlanar(src.format);
+	if (bPlanar)
+		FrameChromaShift(src.format, &sx, &sy);
+	const size_t cbRow = bPlanar ? (size_t)src.nWidth : (size_t)((src.nWidth + 1) / 2) * 4;
+	const size_t cbRowUV = bPlanar ? (size_t)((src.nWidth + sx) >> sx) : 0;
+	const ptrdiff_t lStride = (ptrdiff_t)((cbRow + 15) & ~15);
+	const ptrdiff_t lStrideUV = (ptrdiff_t)((cbRowUV + 15) & ~15);
+
+	// Whole chroma blocks per group; rows too wide for the buffer take the
+	// plain stores
+	const int nBlock = 1 << sy;
+	const int nGroup = (int)(STREAM_BYTES / ((size_t)lStride * nBlock + (size_t)lStrideUV * 2)) * nBlock;
+	if (nGroup == 0)
+	{
+		RunKernels(src, dst, nFirstRow, nLastRow, kernel, pStats, blend, nRowBase);
+		return;
+	}
+
+	unsigned char buffer[STREAM_BYTES + 16];
+	unsigned char *pb = buffer + (-(ptrdiff_t)buffer & 15);
+	unsigned char *pbU = pb + lStride * nGroup;
+	unsigned char *pbV = pbU + lStrideUV * (nGroup >> sy);
+	for (int y = nFirstRow; y < nLastRow; y += nGroup)
+	{
+		int nEnd = nLastRow - y > nGroup ? y + nGroup : nLastRow;
+		int nFetchEnd = nEnd + m_nPrefetchRows < src.nHeight ? nEnd + m_nPrefetchRows : src.nHeight;
+		for (int i = y + m_nPrefetchRows; i < nFetchEnd; i++)
+		{
+			FramePrefetch(src.pbTop + src.lStride * i, cbRow);
+			if (bPlanar && (i & (nBlock - 1)) == 0)
+			{
+				FramePrefetch(src.pbU + src.lStrideUV * (i >> sy), cbRowUV);
+				FramePrefetch(src.pbV + src.lStrideUV * (i >> sy), cbRowUV);
+			}
+		}
+
+		// The buffer as the target rows [y, nEnd)
+		FrameDesc rows = dst;
+		rows.pbTop = pb - lStride * y;
+		rows.lStride = lStride;
+		if (bPlanar)
+		{
+			rows.pbU = pbU - lStrideUV * (y >> sy);
+			rows.pbV = pbV - lStrideUV * (y >> sy);
+			rows.lStrideUV = lStrideUV;
+		}
+		RunKernels(src, rows, y, nEnd, kernel, pStats, blend, nRowBase);
+
+		for (int i = y; i < nEnd; i++)
+			FrameStreamCopy(dst.pbTop + dst.lStride * i, pb + lStride * (i - y), cbRow);
+		if (bPlanar)
+		{
+			for (int i = y >> sy; i < (nEnd + nBlock - 1) >> sy; i++)
+			{
+				ptrdiff_t lOffset = lStrideUV * (i - (y >> sy));
+				FrameStreamCopy(dst.pbU + dst.lStrideUV * i, pbU + lOffset, cbRowUV);
+				FrameStreamCopy(dst.pbV + dst.lStrideUV * i, pbV + lOffset, cbRowUV);
+			}
+		}
+	}
+	FrameStreamFence();
+}
+
+//
+// Run the kernel SelectKernels() picked, with the blend over the rows the
+// blend frame covers, then key, composite the overlay and add the rows to
+// the preview and fingerprint them while they are in the cache
+//
+void CColorEngine::RunKernels(const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, const FrameDesc &blend,
+	int nRowBase)
+{
+	const int nFirst = nFirstRow;
+	RowKernel *pKernels = m_Kernels[src.format][kernel];
+	const int nStats = pStats != NULL ? 1 : 0;
+
+	// A blend that ends inside a 4:2:0 row pair stops above it; the odd
+	// last row of the frame is a pair of its own
+	int nBlend = blend.nHeight < nLastRow ? blend.nHeight : nLastRow;
+	if (src.format == FRAME_FORMAT_I420 && nBlend < nLastRow)
+		nBlend &= ~1;
+	if (nFirstRow < nBlend)
+	{
+		(this->*pKernels[nStats | 2])(src, dst, nFirstRow, nBlend, blend, pStats);
+		nFirstRow = nBlend;
+	}
+	if (nFirstRow < nLastRow)
+		(this->*pKernels[nStats])(src, dst, nFirstRow, nLastRow, blend, pStats);
+	if (m_bKey)
+		m_pKey->KeyRows(dst, nFirst, nLastRow, nRowBase, m_Isa);
+	if (m_bOverlay)
+		m_pOverlay->CompositeRows(dst, nFirst, nLastRow, nRowBase, m_Isa);
+	if (m_bPreview)
+		m_pPreview->AddRows(dst, nFirst, nLastRow, nRowBase, m_Isa);
+	if (m_bFingerprint)
+		m_pFingerprint->HashRows(dst, nFirst, nLastRow, nRowBase);
+}
+
+//
+// Band splitting for Process and the stages
+//
+struct ProcessJob
+{
+	CColorEngine *pEngine;
+	const FrameDesc *pSrc;
+	const FrameDesc *pDst;
+	CFrameStage *pStage;      // Produces the target rows, or NULL
+	ColorKernel kernel;
+	FrameStats *pPartials;    // One per band, or NULL
+	CFrameReuse *pReuse;      // Copies the unchanged rows, or NULL
+	CFrameMotion *pMotion;    // Samples the source rows, or NULL
+	CFrameTrace *pTrace;      // Records the bands, or NULL
+	int nFirstRow;            // The rows split into bands: the frame or a slice
+	int nLastRow;
+	int nAlign;               // Rows a band starts on, a power of two
+};
+
+static void ProcessBand(void *pContext, int nBand, int nBands)
+{
+	ProcessJob *pJob = (ProcessJob *)pContext;
+	int nRows = pJob->nLastRow - pJob->nFirstRow;
+	int nFirst = pJob->nFirstRow + (int)((long long)nRows * nBand / nBands);
+	int nLast = pJob->nFirstRow + (int)((long long)nRows * (nBand + 1) / nBands);
+
+	// Keep 4:2:0 chroma rows and preview rows inside one band
+	if (pJob->nAlign > 1)
+	{
+		nFirst &= ~(pJob->nAlign - 1);
+		if (nBand + 1 < nBands)
+			nLast &= ~(pJob->nAlign - 1);
+	}
+	FrameStats *pPartial = pJob->pPartials ? &pJob->pPartials[nBand] : NULL;
+	if (pJob->pTrace)
+		pJob->pTrace->Record(TRACE_BAND_START, nBand);
+	if (pJob->pStage)
+	{
+		pJob->pStage->ProcessRows(pJob->pEngine, *pJob->pSrc, *pJob->pDst, nFirst, nLast,
+			pJob->kernel, pPartial, nBand);
+	}
+	else if (pJob->pReuse)
+	{
+		pJob->pReuse->ProcessRows(pJob->pEngine, *pJob->pSrc, *pJob->pDst, nFirst, nLast, pJob->kernel);
+	}
+	else
+	{
+		pJob->pEngine->ProcessRows(*pJob->pSrc, *pJob->pDst, nFirst, nLast, pJob->kernel, pPartial);
+	}
+
+	// The source rows this band has just read; a stage reads the ones its
+	// target rows map to
+	if (pJob->pMotion)
+	{
+		const FrameDesc &src = *pJob->pSrc;
+		const FrameDesc &dst = *pJob->pDst;
+		if (pJob->pStage && src.nHeight != dst.nHeight)
+		{
+			nFirst = (int)((long long)nFirst * src.nHeight / dst.nHeight);
+			nLast = (int)((long long)nLast * src.nHeight / dst.nHeight);
+		}
+		pJob->pMotion->SampleRows(src, nFirst, nLast);
+	}
+	if (pJob->pTrace)
+		pJob->pTrace->Record(TRACE_BAND_END, nBand);
+}
+
+void CColorEngine::ProcessYUY2(const FrameDesc &src, const FrameDesc &dst,
+	ColorKernel kernel, CFrameWorkers *pWorkers, FrameStats *pStats)
+{
+	FrameDesc srcYUY2 = src;
+	srcYUY2.format = FRAME_FORMAT_YUY2;
+	Process(srcYUY2, dst, kernel, pWorkers, pStats);
+}
+
+void CColorEngine::Process(const FrameDesc &src, const FrameDesc &dst,
+	ColorKernel kernel, CFrameWorkers *pWorkers, FrameStats *pStats)
+{
+	ProcessFrame(src, dst, NULL, kernel, pWorkers, pStats);
+}
+
+void CColorEngine::ProcessScaled(const FrameDesc &src, const FrameDesc &dst, CFrameScaler *pScaler,
+	ColorKernel kernel, CFrameWorkers *pWorkers, FrameStats *pStats)
+{
+	if (src.nWidth == dst.nWidth && src.nHeight == dst.nHeight)
+		pScaler = NULL;
+	ProcessFrame(src, dst, pScaler, kernel, pWorkers, pStats);
+}
+
+void CColorEngine::ProcessStage(const FrameDesc &src, const FrameDesc &dst, CFrameStage *pStage,
+	ColorKernel kernel, CFrameWorkers *pWorkers, FrameStats *pStats)
+{
+	ProcessFrame(src, dst, pStage, kernel, pWorkers, pStats);
+}
+
+void CColorEngine::ProcessRowGroup(const FrameDesc &rows, const FrameDesc &dst, int nRow,
+	ColorKernel kernel, FrameStats *pStats)
+{
+	// Sample the same rows as ProcessRows() would over the whole frame
+	int sx, sy = 0;
+	if (FramePlanar(rows.format))
+		FrameChromaShift(rows.format, &sx, &sy);
+	const int nStep = (m_nStatsStep + (1 << sy) - 1) >> sy << sy;
+
+	FrameDesc target = dst;
+	target.pbTop = dst.pbTop + dst.lStride * nRow;
+	if (FramePlanar(rows.format))
+	{
+		target.pbU = dst.pbU + dst.lStrideUV * (nRow >> sy);
+		target.pbV = dst.pbV + dst.lStrideUV * (nRow >> sy);
+	}
+	target.nHeight = rows.nHeight;
+
+	// and the blend frame with it
+	FrameDesc blend = m_Blend;
+	if (blend.nHeight > nRow)
+	{
+		blend.pbTop += blend.lStride * nRow;
+		if (FramePlanar(rows.format))
+		{
+			blend.pbU += blend.lStrideUV * (nRow >> sy);
+			blend.pbV += blend.lStrideUV * (nRow >> sy);
+		}
+		blend.nHeight -= nRow;
+	}
+	else
+	{
+		blend.nHeight = 0;
+	}
+	ProcessSampled(rows, target, 0, rows.nHeight, kernel, nRow % nStep == 0 ? pStats : NULL, blend, nRow);
+}
+
+void CColorEngine::ProcessFrame(const FrameDesc &src, const FrameDesc &dst, CFrameStage *pStage,
+	ColorKernel kernel, CFrameWorkers *pWorkers, FrameStats *pStats)
+{
+	int nBands = pWorkers != NULL ? pWorkers->GetThreadCount() : 1;
+
+	// Every band of this frame uses the same luma table. A new table comes
+	// in another buffer, so the same one needs no new kernels.
+	if (m_pCurve != NULL)
+	{
+		const unsigned char *pTable = m_pCurve->Acquire();
+		if (pTable != m_pLumaSrc)
+		{
+			if (m_pTrace != NULL)
+				m_pTrace->Record(TRACE_LUT_START, TRACE_TABLE_CURVE);
+			SelectLuma(pTable);
+			if (m_pTrace != NULL)
+				m_pTrace->Record(TRACE_LUT_END, TRACE_TABLE_CURVE);
+		}
+	}
+
+	m_bStream = Streaming(dst);
+
+	// Layers converted for this target before the workers start; a layer
+	// that changed changes the output like a parameter
+	m_bOverlay = m_pOverlay != NULL && !m_pOverlay->Empty();
+	if (m_pOverlay != NULL && m_pOverlay->Generation() != m_nOverlayGeneration)
+	{
+		m_nOverlayGeneration = m_pOverlay->Generation();
+		m_nGeneration++;
+	}
+	if (m_bOverlay)
+		m_pOverlay->Prepare(dst.format, m_Out);
+
+	// The same for the key and its background
+	m_bKey = m_pKey != NULL && m_pKey->Enabled();
+	if (m_pKey != NULL && m_pKey->Generation() != m_nKeyGeneration)
+	{
+		m_nKeyGeneration = m_pKey->Generation();
+		m_nGeneration++;
+	}
+	if (m_bKey)
+		m_pKey->Prepare(dst, m_Out);
+
+	// A preview needs every row transformed
+	m_bPreview = m_pPreview != NULL && m_pPreview->BeginFrame(dst);
+
+	// A reused row keeps its fingerprint of the last frame, which needs one
+	m_bFingerprint = m_pFingerprint != NULL;
+	bool bRowsHashed = !m_bFingerprint || m_pFingerprint->BeginFrame(dst);
+
+	// Rows are reused where the source row alone decides the target row
+	CFrameReuse *pReuse = m_pReuse != NULL && pStage == NULL && pStats == NULL && !m_bPreview &&
+		bRowsHashed ? m_pReuse : NULL;
+	if (pReuse != NULL)
+		pReuse->BeginFrame(src, dst, m_nGeneration);
+	else if (m_pReuse != NULL)
+		m_pReuse->Invalidate();
+	if (m_pMotion != NULL)
+		m_pMotion->BeginFrame(src);
+
+	if (pStats != NULL)
+	{
+		if (m_nPartials < nBands)
+		{
+			delete [] m_pPartials;
+			m_pPartials = new FrameStats[nBands];
+			m_nPartials = nBands;
+		}
+		for (int i = 0; i < nBands; i++)
+			m_pPartials[i].Clear();
+	}
+
+	if (pStage != NULL)
+		pStage->Prepare(src, dst, nBands);
+
+	// A staged frame is split by the rows it produces. Slices are whole
+	// 4:2:0 chroma rows and whole preview rows.
+	int nHeight = pStage != NULL ? dst.nHeight : src.nHeight;
+	int nSlice = m_nSliceRows > 0 && m_nSliceRows < nHeight ? m_nSliceRows : nHeight;
+	int nAlign = src.format == FRAME_FORMAT_I420 ? 2 : 1;
+	if (m_bPreview)
+		nAlign = m_pPreview->RowAlignment();
+	nSlice = (nSlice + nAlign - 1) & ~(nAlign - 1);
+
+	ProcessJob job = { this, &src, &dst, pStage, kernel, pStats ? m_pPartials : NULL, pReuse, m_pMotion,
+		m_pTrace, 0, 0, nAlign };
+	for (int nRow = 0; nRow < nHeight; nRow += nSlice)
+	{
+		job.nFirstRow = nRow;
+		job.nLastRow = nHeight - nRow > nSlice ? nRow + nSlice : nHeight;
+		if (nBands == 1)
+			ProcessBand(&job, 0, 1);
+		else
+			pWorkers->Run(ProcessBand, &job, nBands);
+		if (m_nSliceRows > 0 && m_pSliceSink != NULL)
+			m_pSliceSink->SliceDone(dst, job.nFirstRow, job.nLastRow);
+	}
+	if (pReuse != NULL)
+		pReuse->EndFrame();
+	if (m_pMotion != NULL)
+		m_pMotion->EndFrame();
+	if (m_bFingerprint)
+		m_pFingerprint->EndFrame();
+	m_bPreview = false;
+	m_bFingerprint = false;
+
+	if (pStats != NULL)
+	{
+		pStats->Clear();
+		for (int i = 0; i < nBands; i++)
+			pStats->Add(m_pPartials[i]);
+
+		// Luma is a pure table lookup or passes through, so the processed
+		// histogram follows exactly from the source one. The cube and matrix
+		// kernels count it themselves unless they are bypassed.
+		if (m_bBypassLuma)
+		{
+			for (int i = 0; i < 256; i++)
+				pStats->Luma[i] += pStats->LumaIn[i];
+		}
+		else if (m_bBypassChroma || (!m_bCube && !m_bMatrix))
+		{
+			for (int i = 0; i < 256; i++)
+				pStats->Luma[m_pLuma[i]] += pStats->LumaIn[i];
+		}
+
+		// A sampled frame reads as the whole one
+		int sx = 1, sy = 0;
+		if (FramePlanar(src.format))
+			FrameChromaShift(src.format, &sx, &sy);
+		int nWidth = pStage != NULL ? dst.nWidth : src.nWidth;
+		unsigned long long nLumaFrame = (unsigned long long)nWidth * nHeight;
+		unsigned long long nChromaFrame = (unsigned long long)((nWidth + sx) >> sx) *
+			((nHeight + (1 << sy) - 1) >> sy);
+		pStats->Finish(nLumaFrame, nChromaFrame);
+	}
+}
+
+//
+// Frame layout helpers
+//
+bool FramePlanar(FrameFormat format)
+{
+	return format == FRAME_FORMAT_I420 || format == FRAME_FORMAT_I422 || format == FRAME_FORMAT_I444;
+}
+
+void FrameChromaShift(FrameFormat format, int *pShiftX, int *pShiftY)
+{
+	*pShiftX = format == FRAME_FORMAT_I444 ? 0 : 1;
+	*pShiftY = format == FRAME_FORMAT_I420 ? 1 : 0;
+}
+
+size_t FrameBytes(FrameFormat format, int nWidth, int nHeight)
+{
+	if (FramePlanar(format))
+	{
+		int sx, sy;
+		FrameChromaShift(format, &sx, &sy);
+		size_t cbUV = (size_t)((nWidth + sx) >> sx) * ((nHeight + sy) >> sy);
+		return (size_t)nWidth * nHeight + 2 * cbUV;
+	}
+	return (size_t)((nWidth + 1) / 2) * 4 * nHeight;
+}
+
+FrameDesc FrameLayout(unsigned char *pb, FrameFormat format, int nWidth, int nHeight)
+{
+	FrameDesc desc;
+	desc.pbTop = pb;
+	desc.nWidth = nWidth;
+	desc.nHeight = nHeight;
+	desc.format = format;
+	if (FramePlanar(format))
+	{
+		int sx, sy;
+		FrameChromaShift(format, &sx, &sy);
+		desc.lStride = nWidth;
+		desc.lStrideUV = (nWidth + sx) >> sx;
+		desc.pbU = pb + (size_t)nWidth * nHeight;
+		desc.pbV = desc.pbU + (size_t)desc.lStrideUV * ((nHeight + sy) >> sy);
+	}
+	else
+	{
+		desc.lStride = (ptrdiff_t)((nWidth + 1) / 2) * 4;
+		desc.lStrideUV = 0;
+		desc.pbU = NULL;
+		desc.pbV = NULL;
+	}
+	return desc;
+}
+
+static const char *g_FormatNames[FRAME_FORMAT_COUNT] = { "yuy2", "uyvy", "i420", "i422", "i444" };
+
+const char *FrameFormatName(FrameFormat format)
+{
+	if (format < 0 || format >= FRAME_FORMAT_COUNT)
+		return "unknown";
+	return g_FormatNames[format];
+}
+
+bool FrameFormatFromName(const char *pszName, FrameFormat *pFormat)
+{
+	for (int i = 0; i < FRAME_FORMAT_COUNT; i++)
+	{
+		if (strcmp(pszName, g_FormatNames[i]) == 0)
+		{
+			*pFormat = (FrameFormat)i;
+			return true;
+		}
+	}
+	return false;
+}
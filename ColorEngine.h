@@ -0,0 +1,471 @@
+#pragma once
+#include "FramePlatform.h"
+#include "FrameWorkers.h"
+#include "FrameStats.h"
+#include "ColorSpace.h"
+#include "ColorCube.h"
+
+//
+// Pixel layouts understood by the engine
+//
+enum FrameFormat
+{
+	FRAME_FORMAT_YUY2 = 0,  // Packed 4:2:2, Y0 U Y1 V
+	FRAME_FORMAT_UYVY,      // Packed 4:2:2, U Y0 V Y1
+	FRAME_FORMAT_I420,      // Planar 4:2:0, Y plane then U and V at half size
+	FRAME_FORMAT_I422,      // Planar 4:2:2, U and V at half width
+	FRAME_FORMAT_I444,      // Planar 4:4:4
+	FRAME_FORMAT_COUNT
+};
+
+//
+// FrameDesc
+//
+// Describes the pixels of one frame: the first byte of the top row, the
+// distance in bytes from one row to the next one down (negative for
+// bottom-up images) and the size in pixels. Planar formats also carry
+// the two chroma planes; packed formats leave them NULL.
+//
+struct FrameDesc
+{
+	unsigned char *pbTop;
+	ptrdiff_t lStride;
+	int nWidth;
+	int nHeight;
+	FrameFormat format;
+	unsigned char *pbU;
+	unsigned char *pbV;
+	ptrdiff_t lStrideUV;
+};
+
+// Largest width or height the engine and the tools take; every byte offset
+// into a frame of that size fits 31 bits, whatever the stride
+const int g_FrameMaxSize = 16384;
+
+// Size in bytes of a tightly packed frame
+size_t FrameBytes(FrameFormat format, int nWidth, int nHeight);
+
+// Describe a tightly packed frame that starts at pb
+FrameDesc FrameLayout(unsigned char *pb, FrameFormat format, int nWidth, int nHeight);
+
+// Planar formats: horizontal and vertical chroma subsampling as shifts
+bool FramePlanar(FrameFormat format);
+void FrameChromaShift(FrameFormat format, int *pShiftX, int *pShiftY);
+
+const char *FrameFormatName(FrameFormat format);
+bool FrameFormatFromName(const char *pszName, FrameFormat *pFormat);
+
+//
+// Kernel variants for the YUY2 pass. All of them produce the same pixels,
+// they only differ in how the memory is walked.
+//
+enum ColorKernel
+{
+	KERNEL_INPLACE = 0,  // Original filter loop: transform the source in place, then copy it out
+	KERNEL_DIRECT,       // Read the source and write the target in one pass
+	KERNEL_UNROLLED,     // Two macropixels per iteration with 32-bit loads and stores
+	KERNEL_COUNT
+};
+
+//
+// When the target goes out with non-temporal stores. They save reading the
+// target lines for ownership and keep the frame from evicting the tables,
+// but cost a pass over an L1 buffer: that pays off where the kernels only
+// move pixels, and loses to the plain stores where a single thread is
+// busy with the tables.
+//
+enum StreamMode
+{
+	STREAM_OFF = 0,
+	STREAM_AUTO,      // Targets of g_FrameStreamBytes and up whose kernels only copy, blend or count
+	STREAM_ON
+};
+
+class CFrameScaler;
+class CFrameReuse;
+class CFrameMotion;
+class CFrameOverlay;
+class CFrameKey;
+class CFramePreview;
+class CFrameFingerprint;
+class CFrameTrace;
+
+//
+// CFrameSink
+//
+// Where a CFrameStage hands the rows it produced: the colour engine, or an
+// intermediate frame of a CFramePipeline.
+//
+class CFrameSink
+{
+public:
+	virtual ~CFrameSink() {}
+
+	// Take all rows of the scratch frame rows as target rows nRow.. of dst.
+	// pStats is that band's partial statistics, or NULL.
+	virtual void ProcessRowGroup(const FrameDesc &rows, const FrameDesc &dst, int nRow,
+		ColorKernel kernel, FrameStats *pStats) = 0;
+};
+
+//
+// CFrameStage
+//
+// Work in front of the colour kernels that produces the rows they
+// transform, such as a resize or a spatial filter. The engine splits the
+// target rows into bands and calls ProcessRows() for each one; the stage
+// reads what it needs of the source, builds the rows in scratch memory and
+// hands them to the sink while they are still in cache. Stages only read
+// the source, so bands may overlap in what they read.
+//
+class CFrameStage
+{
+public:
+	virtual ~CFrameStage() {}
+
+	// Called once per frame before the bands run
+	virtual void Prepare(const FrameDesc &src, const FrameDesc &dst, int nBands) = 0;
+
+	// Source rows [*pFirst, *pLast) that target rows [nFirstRow, nLastRow)
+	// read, clamped to the frame. Valid after Prepare().
+	virtual void InputRows(int nFirstRow, int nLastRow, int *pFirst, int *pLast) const = 0;
+
+	// Produce target rows [nFirstRow, nLastRow). nBand selects the scratch
+	// of the calling worker; pStats is that band's partial statistics.
+	virtual void ProcessRows(CFrameSink *pSink, const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, int nBand) = 0;
+};
+
+//
+// CFrameSliceSink
+//
+// Told about the target rows of a frame as they are finished, when the
+// engine processes a frame in slices
+//
+class CFrameSliceSink
+{
+public:
+	virtual ~CFrameSliceSink() {}
+
+	// Target rows [nFirstRow, nLastRow) of dst are final. Slices come in
+	// order from the top, on the thread that processes the frame.
+	virtual void SliceDone(const FrameDesc &dst, int nFirstRow, int nLastRow) = 0;
+};
+
+//
+// CLumaCurve
+//
+// A luma table that one thread can replace while another one processes
+// frames with it. Publish() fills a spare buffer and swaps it in with a
+// single interlocked exchange; Acquire() picks up the newest table at the
+// start of a frame. Three buffers mean that neither side ever waits and a
+// frame never sees a half-written table.
+//
+class CLumaCurve
+{
+public:
+	CLumaCurve();
+
+	// Producer side (one thread)
+	void Publish(const unsigned char *pTable);
+
+	// Consumer side (one thread): the table to use for the next frame
+	const unsigned char *Acquire();
+
+private:
+	enum { FRESH = 4 };
+
+	unsigned char m_Tables[3][256];
+	volatile long m_lLatest;   // Index of the newest table, | FRESH until acquired
+	int m_nFront;              // Owned by the consumer
+	int m_nBack;               // Owned by the producer
+};
+
+//
+// CColorEngine
+//
+// Platform-neutral brightness/contrast/hue/saturation/gamma engine. The
+// adjustments are folded into a 256 entry luma table and two 256x256
+// chroma tables, which the kernels then apply to every pixel.
+//
+// A conversion between YUV encodings rides along in the same tables. Range
+// and chroma conversion are pure table changes; a matrix change also moves
+// luma by a weighted sum of the chroma, which a third 256x256 table holds
+// and the kernels add before a final range table.
+//
+class CColorEngine : public CFrameSink
+{
+public:
+	CColorEngine();
+	~CColorEngine();
+
+	// Rebuild the lookup tables after a parameter change. They, the kernels
+	// and the generation change together, so never while a frame is processed
+	void UpdateLuma(unsigned char Brightness, unsigned char Contrast, unsigned char Gamma);
+	void UpdateChroma(unsigned char Hue, unsigned char Saturation);
+
+	// Transform a YUY2 frame. The size is taken from the source; the target
+	// must be at least as large. pWorkers splits the frame into row bands.
+	// When pStats is given it receives the finished statistics of the frame.
+	void ProcessYUY2(const FrameDesc &src, const FrameDesc &dst,
+		ColorKernel kernel = KERNEL_DIRECT, CFrameWorkers *pWorkers = NULL,
+		FrameStats *pStats = NULL);
+
+	// Transform rows [nFirstRow, nLastRow) of a YUY2 frame
+	void ProcessRowsYUY2(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel);
+
+	// Transform a frame of any FrameFormat; source and target must share it.
+	// Planar formats always use the direct kernel.
+	void Process(const FrameDesc &src, const FrameDesc &dst,
+		ColorKernel kernel = KERNEL_DIRECT, CFrameWorkers *pWorkers = NULL,
+		FrameStats *pStats = NULL);
+
+	// Resize src to the size of dst with pScaler in the same pass as the
+	// transform. Both frames share a format; the statistics describe the
+	// scaled frame. Equal sizes fall through to Process().
+	void ProcessScaled(const FrameDesc &src, const FrameDesc &dst, CFrameScaler *pScaler,
+		ColorKernel kernel = KERNEL_DIRECT, CFrameWorkers *pWorkers = NULL,
+		FrameStats *pStats = NULL);
+
+	// Transform a frame through pStage, which produces the target rows.
+	// The bands follow the target height. Without a stage this is Process().
+	void ProcessStage(const FrameDesc &src, const FrameDesc &dst, CFrameStage *pStage,
+		ColorKernel kernel = KERNEL_DIRECT, CFrameWorkers *pWorkers = NULL,
+		FrameStats *pStats = NULL);
+
+	// CFrameSink: transform all rows of the scratch frame rows into dst,
+	// starting at target row nRow. pStats is passed on only when nRow is
+	// one of the rows an unstaged frame would sample.
+	virtual void ProcessRowGroup(const FrameDesc &rows, const FrameDesc &dst, int nRow,
+		ColorKernel kernel, FrameStats *pStats);
+
+	// Transform a range of rows. pStats, when given, accumulates the
+	// histograms of these rows only; the caller clears and finishes it.
+	void ProcessRows(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats = NULL);
+
+	// Grade through a 3D LUT instead of the five controls. With
+	// bBakeControls the control tables, or the luma curve, look every
+	// pixel up in front of the cube at full resolution; the lattice only
+	// holds the conversion and the cube, so UpdateLuma() and UpdateChroma()
+	// take effect without another SetCube(). Every kernel variant takes
+	// the same path while a cube is set.
+	void SetCube(const CColorCube &cube, bool bBakeControls);
+	void ClearCube();
+	bool HasCube() const { return m_bCube; }
+
+	// Convert from in to out in the same pass. The adjustments work on the
+	// input codes. Call SetCube() again afterwards; both start as BT.601
+	// limited range, which is no conversion at all.
+	void SetColorSpaces(const ColorSpace &in, const ColorSpace &out);
+	const ColorSpace &InputSpace() const { return m_In; }
+	const ColorSpace &OutputSpace() const { return m_Out; }
+
+	// Take the luma table from pCurve at the start of every Process() call
+	// instead of the one built by UpdateLuma(). NULL goes back to UpdateLuma().
+	void SetLumaCurve(CLumaCurve *pCurve);
+
+	// Average every transformed target row with the same row of blend,
+	// rounding down. blend has the format and the width of the target;
+	// rows from blend.nHeight down are left alone, and the statistics
+	// describe the rows before the blend. NULL turns it off. With reuse
+	// on, the pixels of blend are taken to stay the same until SetBlend()
+	// is called with another frame.
+	void SetBlend(const FrameDesc *pBlend);
+
+	// Shed work under load: pass chroma, or luma and chroma, of the source
+	// through whatever the parameters say. The matrix and the cube go with
+	// either; luma without chroma keeps the levels and the range change.
+	void SetBypass(bool bLuma, bool bChroma);
+
+	// Process frames in slices of nRows target rows from the top, all
+	// workers on one slice before the next, and tell pSink about each slice
+	// as soon as it is done. 0 processes every frame as a whole.
+	void SetSlices(int nRows, CFrameSliceSink *pSink);
+
+	// Write the target past the cache with non-temporal stores, and
+	// prefetch the source nPrefetchRows rows ahead meanwhile. Takes SSE2.
+	void SetStreaming(StreamMode mode, int nPrefetchRows = 0);
+	bool Streaming(const FrameDesc &dst) const;
+
+	// Copy the rows whose source has not changed since the previous frame
+	// from the output kept in pReuse instead of transforming them, or leave
+	// them in a target that still holds them (see FrameReuse.h). Frames
+	// through a stage or with statistics are transformed in full; NULL
+	// turns it off.
+	void SetReuse(CFrameReuse *pReuse);
+
+	// Measure the motion between the source frames with pMotion while they
+	// are processed, whatever the path; NULL turns it off
+	void SetMotion(CFrameMotion *pMotion) { m_pMotion = pMotion; }
+
+	// Composite the layers of pOverlay over every target row after the
+	// transform and the blend, whatever the path; the statistics describe
+	// the rows before. NULL turns it off.
+	void SetOverlay(CFrameOverlay *pOverlay);
+
+	// Key every target row with pKey after the transform and the blend and
+	// before the overlay, whatever the path, while it is enabled; the
+	// statistics describe the rows before. NULL turns it off.
+	void SetKey(CFrameKey *pKey);
+
+	// Make a box-filtered thumbnail of every target frame in pPreview as
+	// the rows are finished, whatever the path. Frames with a preview are
+	// transformed in full. NULL turns it off.
+	void SetPreview(CFramePreview *pPreview) { m_pPreview = pPreview; }
+
+	// Fingerprint every target frame with pFingerprint as the rows are
+	// finished, whatever the path. Reused rows keep the hashes of the last
+	// frame, so reuse waits for a frame hashed in full. NULL turns it off.
+	void SetFingerprint(CFrameFingerprint *pFingerprint);
+
+	// Record the bands and the table rebuilds in pTrace while it is
+	// enabled; NULL turns it off
+	void SetTrace(CFrameTrace *pTrace) { m_pTrace = pTrace; }
+
+	// Instruction set of the kernels; FrameIsaBest() unless set lower
+	void SetIsa(FrameIsa isa);
+	FrameIsa GetIsa() const { return m_Isa; }
+
+	// Gather statistics from every nStep-th row only. 1, the default, counts
+	// every pixel; larger steps trade exactness for a cheaper pass, and the
+	// finished histograms are scaled to the whole frame. Use an even step
+	// for I420 so that the sampled rows also carry chroma.
+	void SetStatsRowStep(int nStep);
+	int GetStatsRowStep() const { return m_nStatsStep; }
+
+	static const char *KernelName(ColorKernel kernel);
+
+	// What the kernels do to a pixel with luma y and chroma u, v, using the
+	// tables of UpdateLuma() and UpdateChroma() rather than a luma curve
+	void Apply(unsigned char y, unsigned char u, unsigned char v,
+		unsigned char *pY, unsigned char *pU, unsigned char *pV) const;
+
+private:
+	// What the kernels do to every pixel, as a set of template flags
+	enum
+	{
+		OPS_LUMA = 1,      // Luma through the table
+		OPS_MATRIX = 2,    // Luma also depends on chroma; always with OPS_LUMA
+		OPS_CHROMA = 4,    // Chroma through the tables
+		OPS_STATS = 8,     // Histograms of the rows
+		OPS_BLEND = 16     // Average with the blend frame afterwards
+	};
+
+	// The kernel matrix: one instantiation per layout, memory walk, set of
+	// operations and instruction set, so that the loops test none of them
+	typedef void (CColorEngine::*RowKernel)(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats);
+	template <int OPS>
+	void TransformMacro(const unsigned char *pLuma,
+		unsigned int &y0, unsigned int &u, unsigned int &y1, unsigned int &v) const;
+	template <int Y0, int U, int Y1, int V, int OPS>
+	void StoreMacro(const unsigned char *pLuma, unsigned char *d,
+		unsigned int y0, unsigned int &u, unsigned int y1, unsigned int &v) const;
+	template <int Y0, int U, int Y1, int V, int KERNEL, int OPS, int ISA>
+	void ProcessRowsPacked(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats);
+	template <int OPS, int ISA>
+	void ProcessRowsPlanar(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats);
+	template <int Y0, int U, int Y1, int V, int OPS, int ISA>
+	void ProcessRowsPackedCube(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats);
+	template <int OPS, int ISA>
+	void ProcessRowsPlanarCube(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, const FrameDesc &blend, FrameStats *pStats);
+	template <int Y0, int U, int Y1, int V, int KERNEL, int ISA>
+	static RowKernel PackedKernel(int nOps);
+	template <int ISA>
+	static RowKernel PlanarKernel(int nOps);
+	template <int ISA>
+	static RowKernel CubeKernel(FrameFormat format, int nOps, bool bControls);
+	template <int ISA>
+	static RowKernel Kernel(FrameFormat format, ColorKernel kernel, int nOps);
+	void SelectKernels();
+
+	// nRowBase is the target row that row 0 of dst is, for the key, the
+	// overlay, the preview and the fingerprint
+	void ProcessSampled(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, const FrameDesc &blend,
+		int nRowBase);
+	void ProcessRange(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, const FrameDesc &blend,
+		int nRowBase);
+	void RunKernels(const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, const FrameDesc &blend,
+		int nRowBase);
+	void ProcessFrame(const FrameDesc &src, const FrameDesc &dst, CFrameStage *pStage,
+		ColorKernel kernel, CFrameWorkers *pWorkers, FrameStats *pStats);
+	void SelectLuma(const unsigned char *pTable);
+	void BuildChroma();
+
+	int m_nStatsStep;
+
+	bool m_bCube;
+	bool m_bCubeControls;          // The control tables run in front of the lattice
+	CColorLattice m_Lattice;
+
+	CLumaCurve *m_pCurve;
+	const unsigned char *m_pLumaSrc;   // m_Luma or a curve
+	const unsigned char *m_pLuma;      // Table used by the kernels: m_pLumaSrc, or m_LumaOut
+
+	// Colour space conversion
+	enum { RANGE_PAD = 128 };
+	ColorSpace m_In;
+	ColorSpace m_Out;
+	bool m_bRange;                 // Luma codes change between the ranges
+	bool m_bMatrix;                // Luma depends on chroma
+	double m_CrossU;               // Luma shift per adjusted chroma step, in input codes
+	double m_CrossV;
+	double m_Chroma[2][2];         // Input chroma to output chroma around 128
+	bool m_bChroma;
+	unsigned char m_RangeY[256 + 2 * RANGE_PAD];   // Input luma code + RANGE_PAD to output code
+	unsigned char m_LumaOut[256];  // m_RangeY after m_pLumaSrc, without a matrix
+	unsigned char m_Hue;
+	unsigned char m_Saturation;
+
+	// One partial FrameStats per band, merged at the end of the frame
+	FrameStats *m_pPartials;
+	int m_nPartials;
+
+	CColorEngine(const CColorEngine &);
+	CColorEngine &operator=(const CColorEngine &);
+
+	unsigned char m_Luma[256];
+	unsigned char m_ChromaU[256][256];
+	unsigned char m_ChromaV[256][256];
+	signed char m_Cross[256][256];   // Luma shift for a chroma pair, in input codes
+
+	// Chosen by SelectKernels() whenever a parameter changes, by format,
+	// memory walk and (statistics, blend)
+	RowKernel m_Kernels[FRAME_FORMAT_COUNT][KERNEL_COUNT][4];
+	FrameIsa m_Isa;
+	bool m_bLumaOps;               // The luma table is not the identity
+	bool m_bChromaOps;             // Nor are the chroma tables
+	FrameDesc m_Blend;             // nHeight 0 when off
+	bool m_bBypassLuma;
+	bool m_bBypassChroma;
+	int m_nSliceRows;              // 0 when off
+	CFrameSliceSink *m_pSliceSink;
+	enum { STREAM_BYTES = 16 * 1024 };  // Rows the kernels write at a time when streaming
+	StreamMode m_StreamMode;
+	int m_nPrefetchRows;
+	bool m_bMovesOnly;             // The kernels do no table lookups
+	bool m_bStream;                // This frame goes out with non-temporal stores
+
+	CFrameReuse *m_pReuse;
+	unsigned long m_nGeneration;   // Changes with anything that changes the output
+	CFrameMotion *m_pMotion;
+	CFrameOverlay *m_pOverlay;
+	unsigned long m_nOverlayGeneration;  // Of the layers last seen
+	bool m_bOverlay;               // This frame has layers
+	CFrameKey *m_pKey;
+	unsigned long m_nKeyGeneration;  // Of the key settings last seen
+	bool m_bKey;                   // This frame is keyed
+	CFramePreview *m_pPreview;
+	bool m_bPreview;               // This frame has a preview
+	CFrameFingerprint *m_pFingerprint;
+	bool m_bFingerprint;           // This frame is fingerprinted
+	CFrameTrace *m_pTrace;
+};
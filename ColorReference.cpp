@@ -0,0 +1,40 @@
+#include <math.h>
+#include "ColorReference.h"
+
+static double Clamp255(double x)
+{
+	if (x < 0) return 0;
+	if (x > 255) return 255;
+	return x;
+}
+
+CColorReference::CColorReference(const ColorParams &params)
+{
+	m_Contrast = (double)params.Contrast / 127.0;
+	m_Offset = (double)params.Brightness - 127.0;
+
+	double G = (double)params.Gamma;
+	if (G < 0.0001) G = 0.01;
+	m_Exponent = 128.0 / G;
+
+	double H = ((double)params.Hue - 128.0) * 180.0 / 128.0;
+	m_Cos = cos(H * 3.14159265358979323846 / 180.0);
+	m_Sin = sin(H * 3.14159265358979323846 / 180.0);
+
+	m_Gain = ((double)params.Saturation / 4.0) / 32.0;
+}
+
+double CColorReference::Luma(unsigned char y) const
+{
+	// Clamp before the power so that a negative level maps to black
+	double L = Clamp255((y - 16) * m_Contrast + m_Offset + 16);
+	return Clamp255(255.0 * pow(L / 255.0, m_Exponent));
+}
+
+void CColorReference::Chroma(unsigned char u, unsigned char v, double *pU, double *pV) const
+{
+	double cu = (double)u - 128.0;
+	double cv = (double)v - 128.0;
+	*pU = Clamp255((cu * m_Cos + cv * m_Sin) * m_Gain + 128.0);
+	*pV = Clamp255((cv * m_Cos - cu * m_Sin) * m_Gain + 128.0);
+}
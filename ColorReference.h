@@ -0,0 +1,40 @@
+#pragma once
+
+//
+// ColorParams
+//
+// The five user controls, as stored by the filter (0..255, 127 = neutral).
+//
+struct ColorParams
+{
+	unsigned char Brightness;
+	unsigned char Contrast;
+	unsigned char Hue;
+	unsigned char Saturation;
+	unsigned char Gamma;
+};
+
+//
+// CColorReference
+//
+// Double-precision model of the adjustments, without any table, integer
+// truncation or saturation quantization. Used to measure how far the
+// table-driven kernels drift from the intended result.
+//
+class CColorReference
+{
+public:
+	CColorReference(const ColorParams &params);
+
+	// Exact luma and chroma, clamped to [0, 255] but not rounded
+	double Luma(unsigned char y) const;
+	void Chroma(unsigned char u, unsigned char v, double *pU, double *pV) const;
+
+private:
+	double m_Contrast;    // Multiplier applied around black (16)
+	double m_Offset;      // Brightness offset
+	double m_Exponent;    // Gamma exponent
+	double m_Cos;         // Hue rotation
+	double m_Sin;
+	double m_Gain;        // Saturation gain
+};
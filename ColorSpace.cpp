@@ -0,0 +1,97 @@
+#include <string.h>
+#include "ColorSpace.h"
+
+// Luma weights of red and blue; green takes the rest
+static const double g_Kr[COLOR_MATRIX_COUNT] = { 0.299, 0.2126, 0.2627 };
+static const double g_Kb[COLOR_MATRIX_COUNT] = { 0.114, 0.0722, 0.0593 };
+
+static const char *g_MatrixNames[COLOR_MATRIX_COUNT] = { "601", "709", "2020" };
+
+ColorSpace MakeColorSpace(ColorMatrix matrix, bool bFullRange)
+{
+	ColorSpace space;
+	space.matrix = matrix;
+	space.bFullRange = bFullRange;
+	return space;
+}
+
+bool ColorSpaceEqual(const ColorSpace &a, const ColorSpace &b)
+{
+	return a.matrix == b.matrix && a.bFullRange == b.bFullRange;
+}
+
+const char *ColorMatrixName(ColorMatrix matrix)
+{
+	if (matrix < 0 || matrix >= COLOR_MATRIX_COUNT)
+		return "unknown";
+	return g_MatrixNames[matrix];
+}
+
+bool ColorSpaceFromName(const char *pszName, ColorSpace *pSpace)
+{
+	const char *pszRange = strchr(pszName, ':');
+	size_t cch = pszRange ? (size_t)(pszRange - pszName) : strlen(pszName);
+	bool bFull = false;
+	if (pszRange != NULL)
+	{
+		if (strcmp(pszRange + 1, "full") == 0)
+			bFull = true;
+		else if (strcmp(pszRange + 1, "limited") != 0)
+			return false;
+	}
+	for (int i = 0; i < COLOR_MATRIX_COUNT; i++)
+	{
+		if (strlen(g_MatrixNames[i]) == cch && strncmp(pszName, g_MatrixNames[i], cch) == 0)
+		{
+			*pSpace = MakeColorSpace((ColorMatrix)i, bFull);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Code = offset + scale * normalized value
+static void RangeScale(const ColorSpace &space, double *pYOffset, double *pYScale, double *pCScale)
+{
+	*pYOffset = space.bFullRange ? 0.0 : 16.0;
+	*pYScale = space.bFullRange ? 255.0 : 219.0;
+	*pCScale = space.bFullRange ? 255.0 : 224.0;
+}
+
+void ColorSpaceToRGB(const ColorSpace &space, double Y, double U, double V,
+	double *pR, double *pG, double *pB)
+{
+	double yo, ys, cs;
+	RangeScale(space, &yo, &ys, &cs);
+	const double Kr = g_Kr[space.matrix], Kb = g_Kb[space.matrix];
+
+	double y = (Y - yo) / ys;
+	double cb = (U - 128.0) / cs;
+	double cr = (V - 128.0) / cs;
+	double r = y + 2 * (1 - Kr) * cr;
+	double b = y + 2 * (1 - Kb) * cb;
+	*pR = r;
+	*pG = (y - Kr * r - Kb * b) / (1 - Kr - Kb);
+	*pB = b;
+}
+
+void ColorSpaceFromRGB(const ColorSpace &space, double R, double G, double B,
+	double *pY, double *pU, double *pV)
+{
+	double yo, ys, cs;
+	RangeScale(space, &yo, &ys, &cs);
+	const double Kr = g_Kr[space.matrix], Kb = g_Kb[space.matrix];
+
+	double y = Kr * R + (1 - Kr - Kb) * G + Kb * B;
+	*pY = yo + ys * y;
+	*pU = 128.0 + cs * (B - y) / (2 * (1 - Kb));
+	*pV = 128.0 + cs * (R - y) / (2 * (1 - Kr));
+}
+
+void ColorSpaceConvert(const ColorSpace &in, const ColorSpace &out,
+	double Y, double U, double V, double *pY, double *pU, double *pV)
+{
+	double r, g, b;
+	ColorSpaceToRGB(in, Y, U, V, &r, &g, &b);
+	ColorSpaceFromRGB(out, r, g, b, pY, pU, pV);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+//
+// Y'CbCr encodings the engine converts between
+//
+enum ColorMatrix
+{
+	COLOR_MATRIX_BT601 = 0,   // SD
+	COLOR_MATRIX_BT709,       // HD
+	COLOR_MATRIX_BT2020,      // UHD, non-constant luminance
+	COLOR_MATRIX_COUNT
+};
+
+//
+// ColorSpace
+//
+// The matrix and the code range of 8-bit YUV. Limited range puts black at
+// 16 and white at 235 with chroma in 16..240; full range uses 0..255 for
+// both.
+//
+struct ColorSpace
+{
+	ColorMatrix matrix;
+	bool bFullRange;
+};
+
+ColorSpace MakeColorSpace(ColorMatrix matrix, bool bFullRange);
+bool ColorSpaceEqual(const ColorSpace &a, const ColorSpace &b);
+
+// "601", "709" or "2020", optionally followed by ":full" or ":limited"
+bool ColorSpaceFromName(const char *pszName, ColorSpace *pSpace);
+const char *ColorMatrixName(ColorMatrix matrix);
+
+// 8-bit codes to R'G'B' in 0..1 and back, without clamping
+void ColorSpaceToRGB(const ColorSpace &space, double Y, double U, double V,
+	double *pR, double *pG, double *pB);
+void ColorSpaceFromRGB(const ColorSpace &space, double R, double G, double B,
+	double *pY, double *pU, double *pV);
+
+// Codes in one space to codes in another, without clamping
+void ColorSpaceConvert(const ColorSpace &in, const ColorSpace &out,
+	double Y, double U, double V, double *pY, double *pU, double *pV);
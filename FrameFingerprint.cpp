@@ -0,0 +1,182 @@
+#include <string.h>
+#include "FrameFingerprint.h"
+#include "FrameReuse.h"
+
+//
+// Sum of the luma of columns [x0, x1) of one row: every byte of a planar
+// row, or every other byte of a packed one starting at y0
+//
+static unsigned int LumaSum(const unsigned char *pRow, int nStep, int y0, int x0, int x1)
+{
+	unsigned int nSum = 0;
+	int x = x0;
+#ifdef FRAME_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	if (nStep == 1)
+	{
+		for (; x + 16 <= x1; x += 16)
+			sum = _mm_add_epi32(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(pRow + x)), zero));
+	}
+	else
+	{
+		// Packed: the luma bytes alone. The load starts on the macropixel,
+		// so that a UYVY row is not read past its end.
+		const __m128i mask = _mm_set1_epi16(y0 == 0 ? 0x00FF : (short)0xFF00);
+		if ((x & 1) != 0 && x < x1)
+			nSum += pRow[2 * x++ + y0];
+		for (; x + 8 <= x1; x += 8)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i *)(pRow + 2 * x));
+			sum = _mm_add_epi32(sum, _mm_sad_epu8(_mm_and_si128(pixels, mask), zero));
+		}
+	}
+	sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+	nSum += (unsigned int)_mm_cvtsi128_si32(sum);
+#endif
+	for (; x < x1; x++)
+		nSum += pRow[x * nStep + y0];
+	return nSum;
+}
+
+static int BitCount(unsigned long long v)
+{
+	int n = 0;
+	for (; v != 0; v &= v - 1)
+		n++;
+	return n;
+}
+
+CFrameFingerprint::CFrameFingerprint()
+	: m_nFrozenFrames(0), m_Format(FRAME_FORMAT_YUY2), m_nWidth(0), m_nHeight(0), m_nStep(1),
+	  m_bRowsValid(false), m_bPrevious(false)
+{
+	memset(m_Edges, 0, sizeof(m_Edges));
+	Reset();
+}
+
+void CFrameFingerprint::SetFrozenFrames(unsigned long nFrames)
+{
+	CFrameAutoLock lock(&m_Lock);
+	m_nFrozenFrames = nFrames;
+	m_Info.bFrozen = nFrames > 0 && m_Info.nFrozen >= nFrames;
+}
+
+void CFrameFingerprint::Reset()
+{
+	CFrameAutoLock lock(&m_Lock);
+	memset(&m_Info, 0, sizeof(m_Info));
+	m_bRowsValid = false;
+	m_bPrevious = false;
+}
+
+bool CFrameFingerprint::BeginFrame(const FrameDesc &dst)
+{
+	if (dst.format != m_Format || dst.nWidth != m_nWidth || dst.nHeight != m_nHeight)
+	{
+		m_Format = dst.format;
+		m_nWidth = dst.nWidth;
+		m_nHeight = dst.nHeight;
+		int sx, sy = 0;
+		if (FramePlanar(m_Format))
+			FrameChromaShift(m_Format, &sx, &sy);
+		m_Rows.assign(m_nHeight, 0);
+		m_Chroma.assign(FramePlanar(m_Format) ? (m_nHeight + (1 << sy) - 1) >> sy : 0, 0);
+
+		// Small frames sample every row, so that each grid row has some
+		m_nStep = m_nHeight >= GRID_ROWS * ROW_STEP * 2 ? ROW_STEP : 1;
+		m_Sums.assign((size_t)((m_nHeight + m_nStep - 1) / m_nStep) * GRID_COLUMNS, 0);
+		for (int c = 0; c <= GRID_COLUMNS; c++)
+			m_Edges[c] = (int)((long long)c * m_nWidth / GRID_COLUMNS);
+		m_bRowsValid = false;
+	}
+	return m_bRowsValid;
+}
+
+void CFrameFingerprint::HashRows(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase)
+{
+	const bool bPlanar = FramePlanar(m_Format);
+	int sx = 0, sy = 0;
+	if (bPlanar)
+		FrameChromaShift(m_Format, &sx, &sy);
+	const size_t cbRow = bPlanar ? (size_t)m_nWidth : (size_t)((m_nWidth + 1) / 2) * 4;
+	const size_t cbRowUV = bPlanar ? (size_t)((m_nWidth + (1 << sx) - 1) >> sx) : 0;
+	const int nStep = bPlanar ? 1 : 2;
+	const int y0 = m_Format == FRAME_FORMAT_UYVY ? 1 : 0;
+
+	for (int r = nFirstRow; r < nLastRow; r++)
+	{
+		const int t = r + nRowBase;
+		const unsigned char *pRow = dst.pbTop + dst.lStride * r;
+		m_Rows[t] = FrameHash(pRow, cbRow, 0);
+
+		// A chroma row goes with the first of its luma rows
+		if (bPlanar && (t & ((1 << sy) - 1)) == 0)
+		{
+			ptrdiff_t lOffset = dst.lStrideUV * (r >> sy);
+			m_Chroma[t >> sy] = FrameHash(dst.pbV + lOffset, cbRowUV,
+				FrameHash(dst.pbU + lOffset, cbRowUV, 0));
+		}
+
+		if (t % m_nStep == 0)
+		{
+			unsigned int *pSums = &m_Sums[(size_t)(t / m_nStep) * GRID_COLUMNS];
+			for (int c = 0; c < GRID_COLUMNS; c++)
+				pSums[c] = LumaSum(pRow, nStep, y0, m_Edges[c], m_Edges[c + 1]);
+		}
+	}
+}
+
+void CFrameFingerprint::EndFrame()
+{
+	// The row hashes in order, seeded with the layout, make the frame hash
+	unsigned long long nSeed = ((unsigned long long)m_Format << 48) ^
+		((unsigned long long)m_nWidth << 24) ^ (unsigned long long)m_nHeight;
+	unsigned long long nHash = nSeed;
+	if (!m_Rows.empty())
+		nHash = FrameHash((const unsigned char *)&m_Rows[0], m_Rows.size() * sizeof(m_Rows[0]), nSeed);
+	if (!m_Chroma.empty())
+	{
+		nHash = FrameHash((const unsigned char *)&m_Chroma[0],
+			m_Chroma.size() * sizeof(m_Chroma[0]), nHash);
+	}
+
+	// Grid rows of equal shares of the sampled rows; a bit is set where a
+	// cell is brighter than the one to its right. The cells of one grid
+	// row have the same height, so the sums compare across their widths.
+	const int nSampled = (int)(m_Sums.size() / GRID_COLUMNS);
+	unsigned long long nPerceptual = 0;
+	for (int g = 0; g < GRID_ROWS; g++)
+	{
+		unsigned long long Cells[GRID_COLUMNS] = { 0 };
+		for (int s = g * nSampled / GRID_ROWS; s < (g + 1) * nSampled / GRID_ROWS; s++)
+		{
+			const unsigned int *pSums = &m_Sums[(size_t)s * GRID_COLUMNS];
+			for (int c = 0; c < GRID_COLUMNS; c++)
+				Cells[c] += pSums[c];
+		}
+		for (int c = 0; c + 1 < GRID_COLUMNS; c++)
+		{
+			unsigned long long nLeft = Cells[c] * (unsigned)(m_Edges[c + 2] - m_Edges[c + 1]);
+			unsigned long long nRight = Cells[c + 1] * (unsigned)(m_Edges[c + 1] - m_Edges[c]);
+			nPerceptual = nPerceptual << 1 | (nLeft > nRight ? 1 : 0);
+		}
+	}
+	m_bRowsValid = true;
+
+	CFrameAutoLock lock(&m_Lock);
+	bool bSame = m_bPrevious && nHash == m_Info.nHash;
+	m_Info.nDistance = m_bPrevious ? BitCount(nPerceptual ^ m_Info.nPerceptual) : 64;
+	m_Info.nFrame++;
+	m_Info.nHash = nHash;
+	m_Info.nPerceptual = nPerceptual;
+	m_Info.nFrozen = bSame ? m_Info.nFrozen + 1 : 0;
+	m_Info.bFrozen = m_nFrozenFrames > 0 && m_Info.nFrozen >= m_nFrozenFrames;
+	m_bPrevious = true;
+}
+
+void CFrameFingerprint::GetInfo(FrameFingerprintInfo *pInfo)
+{
+	CFrameAutoLock lock(&m_Lock);
+	*pInfo = m_Info;
+}
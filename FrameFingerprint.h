@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+
+//
+// What CFrameFingerprint found in one frame
+//
+struct FrameFingerprintInfo
+{
+	unsigned long nFrame;            // Frames since the last Reset(), this one included
+	unsigned long long nHash;        // Of every target byte: equal for equal frames
+	unsigned long long nPerceptual;  // Difference hash of the luma: close for similar frames
+	int nDistance;                   // Bits of nPerceptual that differ from the last frame's; 64 for the first
+	unsigned long nFrozen;           // Frames since the target last changed, 0 when it did
+	bool bFrozen;                    // nFrozen has reached the alarm threshold
+};
+
+//
+// CFrameFingerprint
+//
+// Fingerprints of every target frame, taken while the frame is processed,
+// for deduplication and to notice a frozen feed. The workers hash each
+// target row with FrameHash() while it is still in the cache, and the row
+// hashes make the frame hash at the end of the frame. One row in four also
+// adds its luma to 9 column sums; the sums make a grid of 9x8 means, and a
+// bit of the perceptual hash says whether a mean is brighter than the one
+// to its right. The perceptual hash of a frame changes in a few bits at
+// most when it is re-encoded, scaled or slightly retouched.
+//
+// Given to CColorEngine::SetFingerprint(). A row that row reuse copies has
+// the hash it had in the previous frame. GetInfo() may be called on any
+// thread; the rest on the thread that processes the frames.
+//
+class CFrameFingerprint
+{
+public:
+	CFrameFingerprint();
+
+	// Frames without a change for the frozen alarm; 0 never raises it
+	void SetFrozenFrames(unsigned long nFrames);
+
+	// Forget the previous frame and the counters
+	void Reset();
+
+	// Hash the next frame in full: rows the engine reuses keep their old
+	// hash, which frames it processed without the fingerprint would spoil
+	void Invalidate() { m_bRowsValid = false; }
+
+	// Start of a frame of the engine; true when the row hashes of the last
+	// frame are for targets like dst, so that reused rows may keep theirs
+	bool BeginFrame(const FrameDesc &dst);
+
+	// Hash rows [nFirstRow, nLastRow) of dst, whose row 0 is target row
+	// nRowBase; workers take disjoint ranges on whole 4:2:0 row pairs
+	void HashRows(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase);
+
+	// End of the frame: the frame hashes, and the comparison with the last
+	void EndFrame();
+
+	// The last frame
+	void GetInfo(FrameFingerprintInfo *pInfo);
+
+private:
+	enum { GRID_COLUMNS = 9, GRID_ROWS = 8, ROW_STEP = 4 };
+
+	CFrameCritSec m_Lock;            // Protects m_Info
+	FrameFingerprintInfo m_Info;
+	unsigned long m_nFrozenFrames;
+
+	FrameFormat m_Format;
+	int m_nWidth;
+	int m_nHeight;
+	int m_nStep;                     // Rows from one sampled row to the next
+	int m_Edges[GRID_COLUMNS + 1];   // First column of every grid column
+	std::vector<unsigned long long> m_Rows;     // Hash of every target row
+	std::vector<unsigned long long> m_Chroma;   // Of every planar chroma row
+	std::vector<unsigned int> m_Sums;           // Grid column sums of every sampled row
+	bool m_bRowsValid;               // The last frame was hashed in full
+	bool m_bPrevious;                // m_Info holds a frame
+};
@@ -0,0 +1,457 @@
+#include <math.h>
+#include <string.h>
+#include "FrameKey.h"
+
+static inline unsigned char Code(double v)
+{
+	return (unsigned char)(v <= 0 ? 0 : (v >= 255 ? 255 : (int)(v + 0.5)));
+}
+
+//
+// The per-pixel arithmetic, which the SSE2 loops below repeat lane by
+// lane. Alpha is single precision throughout so that both give the same
+// bytes; the mixes are exact to the rounding of x / 255.
+//
+static inline unsigned char KeyAlpha(int du, int dv, float fTolerance, float fScale)
+{
+	float a = (sqrtf((float)(du * du + dv * dv)) - fTolerance) * fScale + 0.5f;
+	return (unsigned char)(a <= 0 ? 0 : (a >= 255 ? 255 : (int)a));
+}
+
+static inline unsigned char Mix(unsigned int f, unsigned int b, unsigned int a)
+{
+	unsigned int t = f * a + b * (255 - a) + 128;
+	return (unsigned char)((t + (t >> 8)) >> 8);
+}
+
+static inline unsigned char Matte(unsigned int a, int nBlack, int nRange)
+{
+	unsigned int t = a * nRange + 128;
+	return (unsigned char)(nBlack + ((t + (t >> 8)) >> 8));
+}
+
+#ifdef FRAME_SSE2
+struct KeyVectors
+{
+	__m128i key;                     // U, V, U, V... in 16-bit lanes
+	__m128 tolerance;
+	__m128 scale;
+	__m128i black;
+	__m128i range;
+};
+
+// Alphas of the four U, V pairs in the 16-bit lanes of uv, in 32-bit lanes
+static inline __m128i AlphaPairs(__m128i uv, const KeyVectors &k)
+{
+	__m128i d = _mm_sub_epi16(uv, k.key);
+	__m128 f = _mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(d, d)));
+	f = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(f, k.tolerance), k.scale), _mm_set1_ps(0.5f));
+	f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+	return _mm_cvttps_epi32(f);
+}
+
+// Mix() on 16-bit lanes
+static inline __m128i MixLanes(__m128i f, __m128i b, __m128i a)
+{
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(f, a),
+		_mm_mullo_epi16(b, _mm_sub_epi16(_mm_set1_epi16(255), a)));
+	t = _mm_add_epi16(t, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// Matte() on 16-bit lanes
+static inline __m128i MatteLanes(__m128i a, const KeyVectors &k)
+{
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(a, k.range), _mm_set1_epi16(128));
+	return _mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8), k.black);
+}
+
+// Mix 16 bytes of d with b by 16 alphas
+static inline __m128i MixBytes(__m128i d, __m128i b, __m128i a)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = MixLanes(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(a, zero));
+	__m128i hi = MixLanes(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(a, zero));
+	return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+//
+// One row of planar bytes: mixed with the background, or the matte, by
+// alphas that each cover 1 << sx bytes
+//
+static void KeyPlaneRow(unsigned char *d, const unsigned char *b, const unsigned char *pAlpha,
+	int n, int sx, int nBlack, int nRange, FrameIsa isa)
+{
+	int i = 0;
+#ifdef FRAME_SSE2
+	if (isa >= FRAME_ISA_SSE2)
+	{
+		KeyVectors k;
+		k.black = _mm_set1_epi16((short)nBlack);
+		k.range = _mm_set1_epi16((short)nRange);
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i a;
+			if (sx == 0)
+			{
+				a = _mm_loadu_si128((const __m128i *)(pAlpha + i));
+			}
+			else
+			{
+				a = _mm_loadl_epi64((const __m128i *)(pAlpha + (i >> 1)));
+				a = _mm_unpacklo_epi8(a, a);
+			}
+			__m128i out;
+			if (b != NULL)
+			{
+				out = MixBytes(_mm_loadu_si128((const __m128i *)(d + i)),
+					_mm_loadu_si128((const __m128i *)(b + i)), a);
+			}
+			else
+			{
+				const __m128i zero = _mm_setzero_si128();
+				out = _mm_packus_epi16(MatteLanes(_mm_unpacklo_epi8(a, zero), k),
+					MatteLanes(_mm_unpackhi_epi8(a, zero), k));
+			}
+			_mm_storeu_si128((__m128i *)(d + i), out);
+		}
+	}
+#else
+	(void)isa;
+#endif
+	for (; i < n; i++)
+	{
+		unsigned int a = pAlpha[i >> sx];
+		d[i] = b != NULL ? Mix(d[i], b[i], a) : Matte(a, nBlack, nRange);
+	}
+}
+
+CFrameKey::CFrameKey()
+	: m_bEnabled(false), m_Output(KEY_COMPOSITE), m_nTolerance(40), m_nSoftness(30), m_nGeneration(0),
+	  m_nKeyU(128), m_nKeyV(128), m_fTolerance(0), m_fScale(1), m_nBlack(16), m_nRange(219),
+	  m_nBgraWidth(0), m_nBgraHeight(0), m_bLive(false),
+	  m_StillSpace(MakeColorSpace(COLOR_MATRIX_BT601, false)), m_bStillValid(false)
+{
+	m_Rgb[0] = 0;
+	m_Rgb[1] = 255;
+	m_Rgb[2] = 0;
+	memset(&m_Background, 0, sizeof(m_Background));
+	memset(&m_Live, 0, sizeof(m_Live));
+	memset(&m_StillFrame, 0, sizeof(m_StillFrame));
+}
+
+void CFrameKey::SetKey(unsigned char r, unsigned char g, unsigned char b, int nTolerance, int nSoftness)
+{
+	m_Rgb[0] = r;
+	m_Rgb[1] = g;
+	m_Rgb[2] = b;
+	m_nTolerance = nTolerance > 0 ? nTolerance : 0;
+	m_nSoftness = nSoftness > 1 ? nSoftness : 1;
+	m_nGeneration++;
+}
+
+void CFrameKey::SetEnabled(bool bEnabled)
+{
+	if (bEnabled != m_bEnabled)
+	{
+		m_bEnabled = bEnabled;
+		m_nGeneration++;
+	}
+}
+
+void CFrameKey::SetOutput(KeyOutput output)
+{
+	if (output != m_Output)
+	{
+		m_Output = output;
+		m_nGeneration++;
+	}
+}
+
+bool CFrameKey::SetBackground(const unsigned char *pBgra, ptrdiff_t lStride, int nWidth, int nHeight)
+{
+	if (pBgra != NULL && (nWidth <= 0 || nHeight <= 0 || nWidth > g_FrameMaxSize || nHeight > g_FrameMaxSize))
+		return false;
+	if (pBgra == NULL)
+	{
+		m_Bgra.clear();
+		m_nBgraWidth = m_nBgraHeight = 0;
+	}
+	else
+	{
+		m_Bgra.resize((size_t)nWidth * nHeight * 4);
+		for (int i = 0; i < nHeight; i++)
+			memcpy(&m_Bgra[(size_t)nWidth * 4 * i], pBgra + lStride * i, (size_t)nWidth * 4);
+		m_nBgraWidth = nWidth;
+		m_nBgraHeight = nHeight;
+	}
+	m_bStillValid = false;
+	m_nGeneration++;
+	return true;
+}
+
+void CFrameKey::SetBackgroundFrame(const FrameDesc *pFrame)
+{
+	m_bLive = pFrame != NULL;
+	if (pFrame != NULL)
+		m_Live = *pFrame;
+	m_nGeneration++;
+}
+
+void CFrameKey::Prepare(const FrameDesc &dst, const ColorSpace &space)
+{
+	double y, u, v;
+	ColorSpaceFromRGB(space, m_Rgb[0] / 255.0, m_Rgb[1] / 255.0, m_Rgb[2] / 255.0, &y, &u, &v);
+	m_nKeyU = Code(u);
+	m_nKeyV = Code(v);
+	m_fTolerance = (float)m_nTolerance;
+	m_fScale = 255.0f / m_nSoftness;
+	m_nBlack = space.bFullRange ? 0 : 16;
+	m_nRange = space.bFullRange ? 255 : 219;
+
+	if (m_Output != KEY_COMPOSITE)
+	{
+		m_Background.pbTop = NULL;
+		return;
+	}
+	if (m_bLive && m_Live.format == dst.format && m_Live.nWidth >= dst.nWidth && m_Live.nHeight >= dst.nHeight)
+	{
+		m_Background = m_Live;
+		return;
+	}
+	if (!m_bStillValid || m_StillFrame.format != dst.format || m_StillFrame.nWidth != dst.nWidth ||
+		m_StillFrame.nHeight != dst.nHeight || !ColorSpaceEqual(space, m_StillSpace))
+	{
+		m_StillSpace = space;
+		ConvertBackground(dst);
+	}
+	m_Background = m_StillFrame;
+}
+
+//
+// The still image stretched to the target with the nearest pixel, chroma
+// averaged over its block; black without one
+//
+void CFrameKey::ConvertBackground(const FrameDesc &dst)
+{
+	const int nWidth = dst.nWidth, nHeight = dst.nHeight;
+	m_Still.resize(FrameBytes(dst.format, nWidth, nHeight));
+	m_StillFrame = FrameLayout(&m_Still[0], dst.format, nWidth, nHeight);
+	m_bStillValid = true;
+
+	int sx = 1, sy = 0;
+	const bool bPlanar = FramePlanar(dst.format);
+	if (bPlanar)
+		FrameChromaShift(dst.format, &sx, &sy);
+	const int nWidthUV = (nWidth + (1 << sx) - 1) >> sx;
+	const int nHeightUV = (nHeight + (1 << sy) - 1) >> sy;
+	std::vector<unsigned char> Y((size_t)nWidth * nHeight, (unsigned char)m_nBlack);
+	std::vector<double> U((size_t)nWidthUV * nHeightUV, m_Bgra.empty() ? 128 : 0), V(U);
+	if (!m_Bgra.empty())
+	{
+		std::vector<int> N(U.size(), 0);
+		for (int i = 0; i < nHeight; i++)
+		{
+			const unsigned char *pRow = &m_Bgra[(size_t)m_nBgraWidth * 4 * ((long long)i * m_nBgraHeight / nHeight)];
+			for (int j = 0; j < nWidth; j++)
+			{
+				const unsigned char *pb = pRow + 4 * ((long long)j * m_nBgraWidth / nWidth);
+				double dy, du, dv;
+				ColorSpaceFromRGB(m_StillSpace, pb[2] / 255.0, pb[1] / 255.0, pb[0] / 255.0, &dy, &du, &dv);
+				Y[(size_t)nWidth * i + j] = Code(dy);
+				size_t c = (size_t)nWidthUV * (i >> sy) + (j >> sx);
+				U[c] += du;
+				V[c] += dv;
+				N[c]++;
+			}
+		}
+		for (size_t c = 0; c < U.size(); c++)
+		{
+			U[c] /= N[c];
+			V[c] /= N[c];
+		}
+	}
+
+	const FrameDesc &bg = m_StillFrame;
+	if (!bPlanar)
+	{
+		// An odd last pair repeats its pixel
+		const int y0 = dst.format == FRAME_FORMAT_UYVY ? 1 : 0;
+		for (int i = 0; i < nHeight; i++)
+		{
+			unsigned char *pb = bg.pbTop + bg.lStride * i;
+			for (int c = 0; c < nWidthUV; c++, pb += 4)
+			{
+				size_t k = (size_t)nWidth * i + 2 * c;
+				pb[y0] = Y[k];
+				pb[y0 + 2] = 2 * c + 1 < nWidth ? Y[k + 1] : Y[k];
+				pb[1 - y0] = Code(U[(size_t)nWidthUV * i + c]);
+				pb[3 - y0] = Code(V[(size_t)nWidthUV * i + c]);
+			}
+		}
+		return;
+	}
+	for (int i = 0; i < nHeight; i++)
+		memcpy(bg.pbTop + bg.lStride * i, &Y[(size_t)nWidth * i], nWidth);
+	for (int i = 0; i < nHeightUV; i++)
+	{
+		for (int c = 0; c < nWidthUV; c++)
+		{
+			bg.pbU[bg.lStrideUV * i + c] = Code(U[(size_t)nWidthUV * i + c]);
+			bg.pbV[bg.lStrideUV * i + c] = Code(V[(size_t)nWidthUV * i + c]);
+		}
+	}
+}
+
+unsigned char CFrameKey::Alpha(unsigned char u, unsigned char v) const
+{
+	return KeyAlpha(u - m_nKeyU, v - m_nKeyV, m_fTolerance, m_fScale);
+}
+
+void CFrameKey::KeyRows(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase, FrameIsa isa) const
+{
+	if (FramePlanar(dst.format))
+		KeyRowsPlanar(dst, nFirstRow, nLastRow, nRowBase, isa);
+	else
+		KeyRowsPacked(dst, nFirstRow, nLastRow, nRowBase, isa);
+}
+
+//
+// Y0 U Y1 V or U Y0 V Y1: the alpha of a pair covers its four bytes
+//
+void CFrameKey::KeyRowsPacked(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase,
+	FrameIsa isa) const
+{
+	const int nBytes = (dst.nWidth + 1) / 2 * 4;
+	const int iY = dst.format == FRAME_FORMAT_UYVY ? 1 : 0;
+	const int iC = 1 - iY;
+	const bool bMatte = m_Output == KEY_MATTE;
+#ifdef FRAME_SSE2
+	KeyVectors k;
+	k.key = _mm_set_epi16((short)m_nKeyV, (short)m_nKeyU, (short)m_nKeyV, (short)m_nKeyU,
+		(short)m_nKeyV, (short)m_nKeyU, (short)m_nKeyV, (short)m_nKeyU);
+	k.tolerance = _mm_set1_ps(m_fTolerance);
+	k.scale = _mm_set1_ps(m_fScale);
+	k.black = _mm_set1_epi16((short)m_nBlack);
+	k.range = _mm_set1_epi16((short)m_nRange);
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	const __m128i grey = iY == 0 ? _mm_set1_epi16((short)0x8000) : _mm_set1_epi16(0x0080);
+	const __m128i zero = _mm_setzero_si128();
+#endif
+	for (int r = nFirstRow; r < nLastRow; r++)
+	{
+		unsigned char *d = dst.pbTop + dst.lStride * r;
+		const unsigned char *b = bMatte ? NULL : m_Background.pbTop + m_Background.lStride * (r + nRowBase);
+		int i = 0;
+#ifdef FRAME_SSE2
+		if (isa >= FRAME_ISA_SSE2)
+		{
+			for (; i + 16 <= nBytes; i += 16)
+			{
+				__m128i p = _mm_loadu_si128((const __m128i *)(d + i));
+				__m128i uv = iC == 1 ? _mm_srli_epi16(p, 8) : _mm_and_si128(p, lowBytes);
+				__m128i a = AlphaPairs(uv, k);
+
+				// One alpha per 16-bit lane of its pair, then per byte
+				a = _mm_packs_epi32(a, a);
+				a = _mm_unpacklo_epi16(a, a);
+				__m128i out;
+				if (bMatte)
+				{
+					__m128i m = MatteLanes(a, k);
+					out = _mm_or_si128(iY == 0 ? m : _mm_slli_epi16(m, 8), grey);
+				}
+				else
+				{
+					__m128i bb = _mm_loadu_si128((const __m128i *)(b + i));
+					__m128i lo = MixLanes(_mm_unpacklo_epi8(p, zero), _mm_unpacklo_epi8(bb, zero), _mm_unpacklo_epi32(a, a));
+					__m128i hi = MixLanes(_mm_unpackhi_epi8(p, zero), _mm_unpackhi_epi8(bb, zero), _mm_unpackhi_epi32(a, a));
+					out = _mm_packus_epi16(lo, hi);
+				}
+				_mm_storeu_si128((__m128i *)(d + i), out);
+			}
+		}
+#else
+		(void)isa;
+#endif
+		for (; i < nBytes; i += 4)
+		{
+			unsigned int a = KeyAlpha(d[i + iC] - m_nKeyU, d[i + iC + 2] - m_nKeyV, m_fTolerance, m_fScale);
+			if (bMatte)
+			{
+				d[i + iY] = d[i + iY + 2] = Matte(a, m_nBlack, m_nRange);
+				d[i + iC] = d[i + iC + 2] = 128;
+			}
+			else
+			{
+				for (int j = 0; j < 4; j++)
+					d[i + j] = Mix(d[i + j], b[i + j], a);
+			}
+		}
+	}
+}
+
+//
+// Planar: the alphas of a chroma row, then the luma rows it covers, then
+// the chroma itself
+//
+void CFrameKey::KeyRowsPlanar(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase,
+	FrameIsa isa) const
+{
+	int sx, sy;
+	FrameChromaShift(dst.format, &sx, &sy);
+	const int nWidthUV = (dst.nWidth + sx) >> sx;
+	const bool bMatte = m_Output == KEY_MATTE;
+	const FrameDesc &bg = m_Background;
+	unsigned char alpha[g_FrameMaxSize + 16];
+#ifdef FRAME_SSE2
+	KeyVectors k;
+	k.key = _mm_set_epi16((short)m_nKeyV, (short)m_nKeyU, (short)m_nKeyV, (short)m_nKeyU,
+		(short)m_nKeyV, (short)m_nKeyU, (short)m_nKeyV, (short)m_nKeyU);
+	k.tolerance = _mm_set1_ps(m_fTolerance);
+	k.scale = _mm_set1_ps(m_fScale);
+	const __m128i zero = _mm_setzero_si128();
+#endif
+	for (int c = nFirstRow >> sy; c << sy < nLastRow; c++)
+	{
+		unsigned char *pU = dst.pbU + dst.lStrideUV * c;
+		unsigned char *pV = dst.pbV + dst.lStrideUV * c;
+		int i = 0;
+#ifdef FRAME_SSE2
+		if (isa >= FRAME_ISA_SSE2)
+		{
+			for (; i + 8 <= nWidthUV; i += 8)
+			{
+				__m128i u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pU + i)), zero);
+				__m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pV + i)), zero);
+				__m128i lo = AlphaPairs(_mm_unpacklo_epi16(u, v), k);
+				__m128i hi = AlphaPairs(_mm_unpackhi_epi16(u, v), k);
+				__m128i a = _mm_packs_epi32(lo, hi);
+				_mm_storel_epi64((__m128i *)(alpha + i), _mm_packus_epi16(a, a));
+			}
+		}
+#endif
+		for (; i < nWidthUV; i++)
+			alpha[i] = KeyAlpha(pU[i] - m_nKeyU, pV[i] - m_nKeyV, m_fTolerance, m_fScale);
+
+		const int nStart = c << sy > nFirstRow ? c << sy : nFirstRow;
+		const int nEnd = (c + 1) << sy < nLastRow ? (c + 1) << sy : nLastRow;
+		for (int r = nStart; r < nEnd; r++)
+		{
+			KeyPlaneRow(dst.pbTop + dst.lStride * r, bMatte ? NULL : bg.pbTop + bg.lStride * (r + nRowBase),
+				alpha, dst.nWidth, sx, m_nBlack, m_nRange, isa);
+		}
+		if (bMatte)
+		{
+			memset(pU, 128, nWidthUV);
+			memset(pV, 128, nWidthUV);
+		}
+		else
+		{
+			const int cb = c + (nRowBase >> sy);
+			KeyPlaneRow(pU, bg.pbU + bg.lStrideUV * cb, alpha, nWidthUV, 0, m_nBlack, m_nRange, isa);
+			KeyPlaneRow(pV, bg.pbV + bg.lStrideUV * cb, alpha, nWidthUV, 0, m_nBlack, m_nRange, isa);
+		}
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+#include "ColorSpace.h"
+
+//
+// What CFrameKey makes of the keyed target
+//
+enum KeyOutput
+{
+	KEY_COMPOSITE = 0,   // The foreground over the background
+	KEY_MATTE,           // The alpha as a grey picture, black where keyed out
+	KEY_OUTPUT_COUNT
+};
+
+//
+// CFrameKey
+//
+// Chroma key for green and blue screens, in the same pass as the colour
+// transform. The alpha of a pixel follows the distance of its chroma from
+// the chroma of the key colour, which is the hue and saturation distance:
+// 0 up to the tolerance, 255 from the tolerance plus the softness on, and
+// linear in between. The distance is taken with SSE2 multiply-adds and a
+// square root on four or eight chroma samples at a time, so there is no
+// table to rebuild when the key changes. There is one alpha per chroma
+// sample, shared by the luma pixels of its block.
+//
+// The key is matched in the transformed target, after the adjustments and
+// the blend, and before an overlay. The background is a live frame of the
+// target format and at least its size, or a still BGRA image stretched to
+// the target, or black.
+//
+// Given to CColorEngine::SetKey(). The settings change between frames;
+// KeyRows() is called by the workers on disjoint rows.
+//
+class CFrameKey
+{
+public:
+	CFrameKey();
+
+	// Key colour in 8-bit R'G'B', and the tolerance and the softness in
+	// chroma codes. The softness is at least 1.
+	void SetKey(unsigned char r, unsigned char g, unsigned char b, int nTolerance, int nSoftness);
+	void SetEnabled(bool bEnabled);
+	bool Enabled() const { return m_bEnabled; }
+	void SetOutput(KeyOutput output);
+
+	// A still background, copied; NULL goes back to black
+	bool SetBackground(const unsigned char *pBgra, ptrdiff_t lStride, int nWidth, int nHeight);
+
+	// A live background that takes precedence over the still one: the
+	// caller's frame, read while the frames are processed. Call again for
+	// every new background frame when reuse is on. NULL turns it off.
+	void SetBackgroundFrame(const FrameDesc *pFrame);
+
+	// Changes whenever the settings or the background do
+	unsigned long Generation() const { return m_nGeneration; }
+
+	// Match the key and take the background for targets like dst, whose
+	// pixels are in this colour space
+	void Prepare(const FrameDesc &dst, const ColorSpace &space);
+
+	// Key rows [nFirstRow, nLastRow) of dst, whose row 0 is target row
+	// nRowBase. nFirstRow is on a whole 4:2:0 row pair.
+	void KeyRows(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase, FrameIsa isa) const;
+
+	// The alpha of one chroma pair after Prepare(), as the rows get it
+	unsigned char Alpha(unsigned char u, unsigned char v) const;
+
+private:
+	void KeyRowsPacked(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase, FrameIsa isa) const;
+	void KeyRowsPlanar(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase, FrameIsa isa) const;
+	void ConvertBackground(const FrameDesc &dst);
+
+	bool m_bEnabled;
+	KeyOutput m_Output;
+	unsigned char m_Rgb[3];
+	int m_nTolerance;
+	int m_nSoftness;
+	unsigned long m_nGeneration;
+
+	// Prepare(): the key in target codes, and the matte's black and white
+	int m_nKeyU;
+	int m_nKeyV;
+	float m_fTolerance;
+	float m_fScale;                  // Alpha per chroma code past the tolerance
+	int m_nBlack;
+	int m_nRange;
+	FrameDesc m_Background;          // pbTop NULL for none
+
+	// The still image, and the background made of it or of black
+	std::vector<unsigned char> m_Bgra;
+	int m_nBgraWidth;
+	int m_nBgraHeight;
+	bool m_bLive;
+	FrameDesc m_Live;
+	std::vector<unsigned char> m_Still;
+	FrameDesc m_StillFrame;          // Layout of m_Still
+	ColorSpace m_StillSpace;
+	bool m_bStillValid;              // m_Still is made of the current image
+};
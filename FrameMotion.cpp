@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include "FrameMotion.h"
+
+// A block whose mean moves by more than this many codes counts as moving
+static const int g_nMovingCodes = 6;
+
+// A cut: a difference of at least g_dCutSad codes and g_dCutRatio times the
+// recent average, which follows the frames with a weight of g_dAverageWeight
+static const double g_dCutSad = 20.0;
+static const double g_dCutRatio = 3.0;
+static const double g_dAverageWeight = 1.0 / 8;
+
+//
+// Means of the 8 pixel blocks of one row of luma: every byte of a planar
+// row, or every other byte of a packed one starting at y0
+//
+static void BlockMeans(const unsigned char *pRow, int nStep, int y0, int nWidth, unsigned char *pOut)
+{
+	int x = 0;
+#ifdef FRAME_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	if (nStep == 1)
+	{
+		for (; x + 16 <= nWidth; x += 16)
+		{
+			__m128i sad = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(pRow + x)), zero);
+			pOut[x >> 3] = (unsigned char)((_mm_cvtsi128_si32(sad) + 4) >> 3);
+			pOut[(x >> 3) + 1] = (unsigned char)((_mm_cvtsi128_si32(_mm_srli_si128(sad, 8)) + 4) >> 3);
+		}
+	}
+	else
+	{
+		// Packed: the luma bytes alone, four to a half
+		const __m128i mask = _mm_set1_epi16(0x00FF);
+		for (; x + 8 <= nWidth; x += 8)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i *)(pRow + 2 * x));
+			__m128i luma = y0 == 0 ? _mm_and_si128(pixels, mask) : _mm_srli_epi16(pixels, 8);
+			__m128i sad = _mm_sad_epu8(luma, zero);
+			sad = _mm_add_epi32(sad, _mm_srli_si128(sad, 8));
+			pOut[x >> 3] = (unsigned char)((_mm_cvtsi128_si32(sad) + 4) >> 3);
+		}
+	}
+#endif
+	for (; x < nWidth; x += 8)
+	{
+		int n = nWidth - x < 8 ? nWidth - x : 8;
+		int nSum = 0;
+		for (int i = 0; i < n; i++)
+			nSum += pRow[(x + i) * nStep + y0];
+		pOut[x >> 3] = (unsigned char)((nSum + n / 2) / n);
+	}
+}
+
+CFrameMotion::CFrameMotion()
+	: m_Format(FRAME_FORMAT_YUY2), m_nWidth(0), m_nHeight(0), m_nColumns(0), m_nRows(0),
+	  m_bPrevious(false), m_dAverageSad(0)
+{
+	Reset();
+}
+
+void CFrameMotion::Reset()
+{
+	CFrameAutoLock lock(&m_Lock);
+	memset(&m_Info, 0, sizeof(m_Info));
+	m_bPrevious = false;
+	m_dAverageSad = 0;
+}
+
+void CFrameMotion::BeginFrame(const FrameDesc &src)
+{
+	if (src.format != m_Format || src.nWidth != m_nWidth || src.nHeight != m_nHeight)
+	{
+		m_Format = src.format;
+		m_nWidth = src.nWidth;
+		m_nHeight = src.nHeight;
+		m_nColumns = (m_nWidth + (1 << BLOCK_SHIFT) - 1) >> BLOCK_SHIFT;
+		m_nRows = (m_nHeight + (1 << BLOCK_SHIFT) - 1) >> BLOCK_SHIFT;
+		m_Thumb.assign((size_t)m_nColumns * m_nRows, 0);
+		m_Previous.assign(m_Thumb.size(), 0);
+		m_bPrevious = false;
+	}
+}
+
+void CFrameMotion::SampleRows(const FrameDesc &src, int nFirstRow, int nLastRow)
+{
+	// Every block row is sampled in its middle, the last one maybe higher
+	const int nStep = FramePlanar(m_Format) ? 1 : 2;
+	const int y0 = m_Format == FRAME_FORMAT_UYVY ? 1 : 0;
+	for (int r = nFirstRow >> BLOCK_SHIFT; r < m_nRows && r << BLOCK_SHIFT < nLastRow; r++)
+	{
+		int y = (r << BLOCK_SHIFT) + (1 << BLOCK_SHIFT) / 2 - 1;
+		if (y >= m_nHeight)
+			y = m_nHeight - 1;
+		if (y < nFirstRow || y >= nLastRow)
+			continue;
+		BlockMeans(src.pbTop + src.lStride * y, nStep, y0, m_nWidth, &m_Thumb[(size_t)r * m_nColumns]);
+	}
+}
+
+void CFrameMotion::EndFrame()
+{
+	double dSad = 0;
+	int nMoving = 0;
+	if (m_bPrevious && !m_Thumb.empty())
+	{
+		unsigned long long nSum = 0;
+		size_t nMovingBlocks = 0;
+		for (size_t i = 0; i < m_Thumb.size(); i++)
+		{
+			int d = abs((int)m_Thumb[i] - (int)m_Previous[i]);
+			nSum += d;
+			if (d > g_nMovingCodes)
+				nMovingBlocks++;
+		}
+		dSad = (double)nSum / m_Thumb.size();
+		nMoving = (int)((nMovingBlocks * 100 + m_Thumb.size() / 2) / m_Thumb.size());
+	}
+
+	// The first frame starts a scene. A cut does not count towards the
+	// recent motion, so that the frames after it are measured against the
+	// scene before.
+	bool bCut = !m_bPrevious ||
+		(dSad >= g_dCutSad && dSad >= g_dCutRatio * m_dAverageSad);
+	if (!m_bPrevious)
+		m_dAverageSad = 0;
+	else if (!bCut)
+		m_dAverageSad += (dSad - m_dAverageSad) * g_dAverageWeight;
+	m_Thumb.swap(m_Previous);
+	m_bPrevious = true;
+
+	CFrameAutoLock lock(&m_Lock);
+	m_Info.nFrame++;
+	m_Info.dSad = dSad;
+	m_Info.nMoving = nMoving;
+	m_Info.bSceneChange = bCut;
+	if (bCut)
+	{
+		m_Info.nSinceSceneChange = 0;
+		m_Info.nSceneChanges++;
+	}
+	else
+	{
+		m_Info.nSinceSceneChange++;
+	}
+}
+
+void CFrameMotion::GetInfo(FrameMotionInfo *pInfo)
+{
+	CFrameAutoLock lock(&m_Lock);
+	*pInfo = m_Info;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+
+//
+// What CFrameMotion found in one frame
+//
+struct FrameMotionInfo
+{
+	unsigned long nFrame;            // Frames since the last Reset(), this one included
+	double dSad;                     // Mean absolute difference of the block means, in luma codes
+	int nMoving;                     // Percent of the blocks whose mean moved noticeably
+	bool bSceneChange;               // A cut: the first frame, or a jump well above the recent motion
+	unsigned long nSinceSceneChange; // Frames since the last cut, 0 on one
+	unsigned long nSceneChanges;     // Cuts since the last Reset()
+};
+
+//
+// CFrameMotion
+//
+// Scene change and motion detection while the frame is processed. Every
+// worker reduces one row in eight of the source rows it has just read to
+// the means of 8 pixel blocks of luma, which makes a thumbnail of 1/64 of
+// the frame. At the end of the frame the thumbnail is compared with the
+// previous one: the mean absolute difference measures the motion, and a
+// difference well above its recent average marks a cut.
+//
+// Given to CColorEngine::SetMotion(). GetInfo() may be called on any
+// thread; the rest on the thread that processes the frames.
+//
+class CFrameMotion
+{
+public:
+	CFrameMotion();
+
+	// Forget the previous frame and the counters
+	void Reset();
+
+	// Start of a frame of the engine
+	void BeginFrame(const FrameDesc &src);
+
+	// Sample the thumbnail rows of src among rows [nFirstRow, nLastRow);
+	// workers take disjoint ranges
+	void SampleRows(const FrameDesc &src, int nFirstRow, int nLastRow);
+
+	// End of the frame: compare with the previous one and decide
+	void EndFrame();
+
+	// The last frame
+	void GetInfo(FrameMotionInfo *pInfo);
+
+private:
+	enum { BLOCK_SHIFT = 3 };        // 8x8 blocks
+
+	CFrameCritSec m_Lock;            // Protects m_Info
+	FrameMotionInfo m_Info;
+
+	FrameFormat m_Format;
+	int m_nWidth;
+	int m_nHeight;
+	int m_nColumns;                  // Thumbnail size
+	int m_nRows;
+	std::vector<unsigned char> m_Thumb;      // This frame
+	std::vector<unsigned char> m_Previous;   // The one before, when m_bPrevious
+	bool m_bPrevious;
+	double m_dAverageSad;            // Recent motion, cuts left out
+};
@@ -0,0 +1,293 @@
+#include <string.h>
+#include "FrameOverlay.h"
+
+//
+// d = p + d * inv / 255 over n bytes, rounded; p never exceeds 255 - inv,
+// so the sum stays a byte
+//
+static void BlendBytes(unsigned char *d, const unsigned char *p, const unsigned char *inv, int n,
+	FrameIsa isa)
+{
+	int i = 0;
+#ifdef FRAME_SSE2
+	if (isa >= FRAME_ISA_SSE2)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi16(128);
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i dd = _mm_loadu_si128((const __m128i *)(d + i));
+			__m128i ii = _mm_loadu_si128((const __m128i *)(inv + i));
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dd, zero), _mm_unpacklo_epi8(ii, zero)), round);
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dd, zero), _mm_unpackhi_epi8(ii, zero)), round);
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+			__m128i out = _mm_adds_epu8(_mm_packus_epi16(lo, hi), _mm_loadu_si128((const __m128i *)(p + i)));
+			_mm_storeu_si128((__m128i *)(d + i), out);
+		}
+	}
+#else
+	(void)isa;
+#endif
+	for (; i < n; i++)
+	{
+		unsigned int t = d[i] * inv[i] + 128;
+		unsigned int v = p[i] + ((t + (t >> 8)) >> 8);
+		d[i] = (unsigned char)(v < 255 ? v : 255);
+	}
+}
+
+static inline unsigned char Code(double v)
+{
+	return (unsigned char)(v <= 0 ? 0 : (v >= 255 ? 255 : (int)(v + 0.5)));
+}
+
+CFrameOverlay::CFrameOverlay()
+	: m_nGeneration(0), m_Format(FRAME_FORMAT_YUY2), m_Space(MakeColorSpace(COLOR_MATRIX_BT601, false))
+{
+	for (int i = 0; i < MAX_LAYERS; i++)
+	{
+		m_Layers[i].bSet = false;
+		m_Layers[i].bConverted = false;
+	}
+}
+
+bool CFrameOverlay::SetLayer(int nLayer, const unsigned char *pBgra, ptrdiff_t lStride,
+	int nWidth, int nHeight, int x, int y)
+{
+	if (nLayer < 0 || nLayer >= MAX_LAYERS || pBgra == NULL || nWidth <= 0 || nHeight <= 0 ||
+		nWidth > g_FrameMaxSize || nHeight > g_FrameMaxSize)
+		return false;
+	Layer &layer = m_Layers[nLayer];
+	layer.Bgra.resize((size_t)nWidth * nHeight * 4);
+	for (int i = 0; i < nHeight; i++)
+		memcpy(&layer.Bgra[(size_t)nWidth * 4 * i], pBgra + lStride * i, (size_t)nWidth * 4);
+	layer.nWidth = nWidth;
+	layer.nHeight = nHeight;
+	layer.x = x;
+	layer.y = y;
+	layer.bSet = true;
+	layer.bConverted = false;
+	m_nGeneration++;
+	return true;
+}
+
+void CFrameOverlay::ClearLayer(int nLayer)
+{
+	if (nLayer < 0 || nLayer >= MAX_LAYERS || !m_Layers[nLayer].bSet)
+		return;
+	Layer &layer = m_Layers[nLayer];
+	layer.bSet = false;
+	layer.bConverted = false;
+	layer.Bgra.clear();
+	for (int p = 0; p < 3; p++)
+	{
+		layer.Planes[p].Premultiplied.clear();
+		layer.Planes[p].Inverse.clear();
+	}
+	m_nGeneration++;
+}
+
+void CFrameOverlay::Clear()
+{
+	for (int i = 0; i < MAX_LAYERS; i++)
+		ClearLayer(i);
+}
+
+bool CFrameOverlay::Empty() const
+{
+	for (int i = 0; i < MAX_LAYERS; i++)
+	{
+		if (m_Layers[i].bSet)
+			return false;
+	}
+	return true;
+}
+
+void CFrameOverlay::Prepare(FrameFormat format, const ColorSpace &space)
+{
+	bool bChanged = format != m_Format || !ColorSpaceEqual(space, m_Space);
+	m_Format = format;
+	m_Space = space;
+	for (int i = 0; i < MAX_LAYERS; i++)
+	{
+		Layer &layer = m_Layers[i];
+		if (layer.bSet && (bChanged || !layer.bConverted))
+			Convert(layer);
+	}
+}
+
+//
+// The premultiplied YUVA of a layer in the target layout. Chroma is the
+// alpha weighted average over its block, with the pixels outside the layer
+// transparent, and its alpha the mean alpha of the block.
+//
+void CFrameOverlay::Convert(Layer &layer) const
+{
+	int sx = 1, sy = 0;
+	const bool bPlanar = FramePlanar(m_Format);
+	if (bPlanar)
+		FrameChromaShift(m_Format, &sx, &sy);
+	const int x = layer.x >> sx << sx;
+	const int y = layer.y >> sy << sy;
+	const int nWidth = layer.nWidth;
+	const int nHeight = layer.nHeight;
+	const int nWidthUV = (nWidth + (1 << sx) - 1) >> sx;
+	const int nHeightUV = (nHeight + (1 << sy) - 1) >> sy;
+	const int nBlock = 1 << (sx + sy);
+
+	// Luma and alpha per pixel, premultiplied chroma and alpha per block
+	std::vector<unsigned char> Y((size_t)nWidth * nHeight), A((size_t)nWidth * nHeight);
+	std::vector<double> U((size_t)nWidthUV * nHeightUV, 0), V(U.size(), 0), AUV(U.size(), 0);
+	for (int i = 0; i < nHeight; i++)
+	{
+		const unsigned char *pb = &layer.Bgra[(size_t)nWidth * 4 * i];
+		for (int j = 0; j < nWidth; j++, pb += 4)
+		{
+			double dy, du, dv;
+			ColorSpaceFromRGB(m_Space, pb[2] / 255.0, pb[1] / 255.0, pb[0] / 255.0, &dy, &du, &dv);
+			size_t k = (size_t)nWidth * i + j;
+			Y[k] = Code(dy * pb[3] / 255);
+			A[k] = pb[3];
+			size_t c = (size_t)nWidthUV * (i >> sy) + (j >> sx);
+			U[c] += Code(du) * (pb[3] / 255.0) / nBlock;
+			V[c] += Code(dv) * (pb[3] / 255.0) / nBlock;
+			AUV[c] += (double)pb[3] / nBlock;
+		}
+	}
+
+	if (!bPlanar)
+	{
+		// Y0 U Y1 V or U Y0 V Y1 for every pair; the second pixel of an odd
+		// last pair is transparent
+		const int y0 = m_Format == FRAME_FORMAT_UYVY ? 1 : 0;
+		const int u = 1 - y0, v = 3 - y0;
+		Plane &plane = layer.Planes[0];
+		plane.nBytes = nWidthUV * 4;
+		plane.nRows = nHeight;
+		plane.x = x * 2;
+		plane.y = y;
+		plane.Premultiplied.assign((size_t)plane.nBytes * nHeight, 0);
+		plane.Inverse.assign(plane.Premultiplied.size(), 255);
+		for (int i = 0; i < nHeight; i++)
+		{
+			unsigned char *pP = &plane.Premultiplied[(size_t)plane.nBytes * i];
+			unsigned char *pI = &plane.Inverse[(size_t)plane.nBytes * i];
+			for (int j = 0; j < nWidth; j++)
+			{
+				size_t k = (size_t)nWidth * i + j;
+				int b = (j >> 1) * 4 + y0 + (j & 1) * 2;
+				pP[b] = Y[k];
+				pI[b] = (unsigned char)(255 - A[k]);
+			}
+			for (int c = 0; c < nWidthUV; c++)
+			{
+				size_t k = (size_t)nWidthUV * i + c;
+				unsigned char a = Code(AUV[k]);
+				pP[c * 4 + u] = Code(U[k]) < a ? Code(U[k]) : a;
+				pP[c * 4 + v] = Code(V[k]) < a ? Code(V[k]) : a;
+				pI[c * 4 + u] = pI[c * 4 + v] = (unsigned char)(255 - a);
+			}
+		}
+		Spans(plane);
+		layer.Planes[1].Premultiplied.clear();
+		layer.Planes[2].Premultiplied.clear();
+	}
+	else
+	{
+		Plane &plane = layer.Planes[0];
+		plane.nBytes = nWidth;
+		plane.nRows = nHeight;
+		plane.x = x;
+		plane.y = y;
+		plane.Premultiplied = Y;
+		plane.Inverse.resize(A.size());
+		for (size_t k = 0; k < A.size(); k++)
+			plane.Inverse[k] = (unsigned char)(255 - A[k]);
+		Spans(plane);
+		for (int p = 1; p < 3; p++)
+		{
+			const std::vector<double> &C = p == 1 ? U : V;
+			Plane &chroma = layer.Planes[p];
+			chroma.nBytes = nWidthUV;
+			chroma.nRows = nHeightUV;
+			chroma.x = x >> sx;
+			chroma.y = y >> sy;
+			chroma.Premultiplied.resize(C.size());
+			chroma.Inverse.resize(C.size());
+			for (size_t k = 0; k < C.size(); k++)
+			{
+				unsigned char a = Code(AUV[k]);
+				chroma.Premultiplied[k] = Code(C[k]) < a ? Code(C[k]) : a;
+				chroma.Inverse[k] = (unsigned char)(255 - a);
+			}
+			Spans(chroma);
+		}
+	}
+	layer.bConverted = true;
+}
+
+void CFrameOverlay::Spans(Plane &plane)
+{
+	plane.SpanStart.resize(plane.nRows);
+	plane.SpanEnd.resize(plane.nRows);
+	for (int i = 0; i < plane.nRows; i++)
+	{
+		const unsigned char *pI = &plane.Inverse[(size_t)plane.nBytes * i];
+		int s = 0, e = plane.nBytes;
+		while (s < e && pI[s] == 255)
+			s++;
+		while (e > s && pI[e - 1] == 255)
+			e--;
+		plane.SpanStart[i] = s;
+		plane.SpanEnd[i] = e;
+	}
+}
+
+void CFrameOverlay::CompositePlane(const Plane &plane, unsigned char *pbRow0, ptrdiff_t lStride,
+	int nWidthBytes, int nFirstRow, int nLastRow, int nRowBase, FrameIsa isa)
+{
+	int nFirst = plane.y - nRowBase > nFirstRow ? plane.y - nRowBase : nFirstRow;
+	int nLast = plane.y + plane.nRows - nRowBase < nLastRow ? plane.y + plane.nRows - nRowBase : nLastRow;
+	for (int r = nFirst; r < nLast; r++)
+	{
+		int i = r + nRowBase - plane.y;
+		int s = plane.SpanStart[i], e = plane.SpanEnd[i];
+		if (plane.x + s < 0)
+			s = -plane.x;
+		if (plane.x + e > nWidthBytes)
+			e = nWidthBytes - plane.x;
+		if (s >= e)
+			continue;
+		size_t k = (size_t)plane.nBytes * i + s;
+		BlendBytes(pbRow0 + lStride * r + plane.x + s, &plane.Premultiplied[k], &plane.Inverse[k], e - s, isa);
+	}
+}
+
+void CFrameOverlay::CompositeRows(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase,
+	FrameIsa isa) const
+{
+	const bool bPlanar = FramePlanar(dst.format);
+	int sx = 0, sy = 0;
+	if (bPlanar)
+		FrameChromaShift(dst.format, &sx, &sy);
+	for (int l = 0; l < MAX_LAYERS; l++)
+	{
+		const Layer &layer = m_Layers[l];
+		if (!layer.bSet || !layer.bConverted)
+			continue;
+		if (!bPlanar)
+		{
+			CompositePlane(layer.Planes[0], dst.pbTop, dst.lStride, (dst.nWidth + 1) / 2 * 4,
+				nFirstRow, nLastRow, nRowBase, isa);
+			continue;
+		}
+		CompositePlane(layer.Planes[0], dst.pbTop, dst.lStride, dst.nWidth,
+			nFirstRow, nLastRow, nRowBase, isa);
+		const int nWidthUV = (dst.nWidth + sx) >> sx;
+		const int nFirstUV = nFirstRow >> sy;
+		const int nLastUV = (nLastRow + (1 << sy) - 1) >> sy;
+		CompositePlane(layer.Planes[1], dst.pbU, dst.lStrideUV, nWidthUV, nFirstUV, nLastUV, nRowBase >> sy, isa);
+		CompositePlane(layer.Planes[2], dst.pbV, dst.lStrideUV, nWidthUV, nFirstUV, nLastUV, nRowBase >> sy, isa);
+	}
+}
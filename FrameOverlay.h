@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+#include "ColorSpace.h"
+
+//
+// CFrameOverlay
+//
+// Logos, channel bugs and lower thirds composited into the target rows in
+// the same pass as the colour transform. A layer is given once as a BGRA
+// image with straight alpha; Prepare() converts it to premultiplied YUVA in
+// the layout and colour space of the target, chroma averaged over its
+// block, and keeps the conversion until the format or the space changes.
+// Compositing is then out = premultiplied + target * (255 - alpha) / 255
+// on whole bytes, over the span of every row that is not transparent, so
+// the cost per frame follows the visible area of the layers.
+//
+// Given to CColorEngine::SetOverlay(). The layers are set between frames;
+// CompositeRows() is called by the workers on disjoint rows.
+//
+class CFrameOverlay
+{
+public:
+	enum { MAX_LAYERS = 8 };
+
+	CFrameOverlay();
+
+	// Layer nLayer, drawn above the lower ones, with its top left corner at
+	// target pixel (x, y); it may reach past the edges of the target. x
+	// goes down to a whole chroma block, as does y for 4:2:0.
+	bool SetLayer(int nLayer, const unsigned char *pBgra, ptrdiff_t lStride,
+		int nWidth, int nHeight, int x, int y);
+	void ClearLayer(int nLayer);
+	void Clear();
+	bool Empty() const;
+
+	// Changes whenever a layer does
+	unsigned long Generation() const { return m_nGeneration; }
+
+	// Convert the layers for targets of this format and colour space
+	void Prepare(FrameFormat format, const ColorSpace &space);
+
+	// Composite the layers over rows [nFirstRow, nLastRow) of dst, whose
+	// row 0 is target row nRowBase. nFirstRow is on a whole 4:2:0 row pair.
+	void CompositeRows(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase,
+		FrameIsa isa) const;
+
+private:
+	// One plane of a converted layer: premultiplied bytes and 255 - alpha
+	// for each of them, and the opaque span of every row
+	struct Plane
+	{
+		int nBytes;                  // Per row
+		int nRows;
+		int x;                       // Target byte and row of the top left corner
+		int y;
+		std::vector<unsigned char> Premultiplied;
+		std::vector<unsigned char> Inverse;
+		std::vector<int> SpanStart;  // First and past the last byte that is not transparent
+		std::vector<int> SpanEnd;
+	};
+
+	struct Layer
+	{
+		bool bSet;
+		std::vector<unsigned char> Bgra;
+		int nWidth;
+		int nHeight;
+		int x;
+		int y;
+		bool bConverted;             // Planes are for m_Format and m_Space
+		Plane Planes[3];             // Packed rows, or Y, U and V
+	};
+
+	void Convert(Layer &layer) const;
+	static void Spans(Plane &plane);
+	static void CompositePlane(const Plane &plane, unsigned char *pbRow0, ptrdiff_t lStride,
+		int nWidthBytes, int nFirstRow, int nLastRow, int nRowBase, FrameIsa isa);
+
+	Layer m_Layers[MAX_LAYERS];
+	unsigned long m_nGeneration;
+	FrameFormat m_Format;
+	ColorSpace m_Space;
+};
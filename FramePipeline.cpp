@@ -0,0 +1,196 @@
+#include <string.h>
+#include "FramePipeline.h"
+
+//
+// CFrameCopySink
+//
+// Stores the rows of an inner stage unchanged in an intermediate frame
+//
+class CFrameCopySink : public CFrameSink
+{
+public:
+	virtual void ProcessRowGroup(const FrameDesc &rows, const FrameDesc &dst, int nRow,
+		ColorKernel, FrameStats *)
+	{
+		if (!FramePlanar(rows.format))
+		{
+			const size_t cb = (size_t)((rows.nWidth + 1) / 2) * 4;
+			for (int y = 0; y < rows.nHeight; y++)
+				memcpy(dst.pbTop + dst.lStride * (nRow + y), rows.pbTop + rows.lStride * y, cb);
+			return;
+		}
+		int sx, sy;
+		FrameChromaShift(rows.format, &sx, &sy);
+		for (int y = 0; y < rows.nHeight; y++)
+			memcpy(dst.pbTop + dst.lStride * (nRow + y), rows.pbTop + rows.lStride * y, rows.nWidth);
+		const size_t cbUV = (size_t)((rows.nWidth + sx) >> sx);
+		const int nRowsUV = (rows.nHeight + (1 << sy) - 1) >> sy;
+		for (int y = 0; y < nRowsUV; y++)
+		{
+			ptrdiff_t lOffset = dst.lStrideUV * ((nRow >> sy) + y);
+			memcpy(dst.pbU + lOffset, rows.pbU + rows.lStrideUV * y, cbUV);
+			memcpy(dst.pbV + lOffset, rows.pbV + rows.lStrideUV * y, cbUV);
+		}
+	}
+};
+
+static CFrameCopySink g_CopySink;
+
+CFramePipeline::CFramePipeline()
+	: m_nStages(0), m_Format(FRAME_FORMAT_YUY2), m_nWidth(0), m_nHeight(0),
+	  m_nBlockRows(1), m_nTileRows(0), m_nFixedTileRows(0)
+{
+}
+
+void CFramePipeline::Add(CFrameStage *pStage)
+{
+	if (m_nStages < MAX_STAGES)
+		m_pStages[m_nStages++] = pStage;
+}
+
+void CFramePipeline::Prepare(const FrameDesc &src, const FrameDesc &dst, int nBands)
+{
+	m_Format = dst.format;
+	m_nWidth = dst.nWidth;
+	m_nHeight = dst.nHeight;
+	int sx, sy = 0;
+	if (FramePlanar(m_Format))
+		FrameChromaShift(m_Format, &sx, &sy);
+	m_nBlockRows = 1 << sy;
+
+	// The inner stages read and write intermediates of the target size
+	for (int i = 0; i < m_nStages; i++)
+		m_pStages[i]->Prepare(i == 0 ? src : dst, dst, nBands);
+
+	// Tiles whose intermediates fit the budget together, in whole chroma
+	// blocks and never so short that the filter reach dominates
+	size_t cbRow = FrameBytes(m_Format, m_nWidth, 2 * m_nBlockRows) / (2 * m_nBlockRows);
+	size_t cbTile = cbRow * (m_nStages > 1 ? m_nStages - 1 : 1);
+	int nRows = (int)(g_FrameTileBytes / (cbTile > 0 ? cbTile : 1));
+	if (nRows < 16)
+		nRows = 16;
+	if (m_nFixedTileRows > 0)
+		nRows = m_nFixedTileRows < m_nHeight ? m_nFixedTileRows : m_nHeight;
+	if (nRows < m_nBlockRows)
+		nRows = m_nBlockRows;
+	m_nTileRows = nRows & ~(m_nBlockRows - 1);
+
+	// Rows of the previous frame are no use, nor its layout
+	if (m_Scratch.size() < (size_t)nBands)
+		m_Scratch.resize(nBands);
+	for (size_t i = 0; i < m_Scratch.size(); i++)
+	{
+		for (int j = 0; j < MAX_STAGES - 1; j++)
+			m_Scratch[i].Rows[j].nCapacity = 0;
+	}
+}
+
+void CFramePipeline::InputRows(int nFirstRow, int nLastRow, int *pFirst, int *pLast) const
+{
+	for (int i = m_nStages - 1; i >= 0; i--)
+		m_pStages[i]->InputRows(nFirstRow, nLastRow, &nFirstRow, &nLastRow);
+	*pFirst = nFirstRow;
+	*pLast = nLastRow;
+}
+
+//
+// The intermediate as a frame addressed with the row numbers of the target,
+// so the stages need not know about tiles; rows outside the range are never
+// touched.
+//
+FrameDesc CFramePipeline::View(Intermediate &rows)
+{
+	FrameDesc view = FrameLayout(&rows.Buffer[0], m_Format, m_nWidth, rows.nCapacity);
+	view.pbTop -= view.lStride * rows.nFirstRow;
+	if (FramePlanar(m_Format))
+	{
+		int sx, sy;
+		FrameChromaShift(m_Format, &sx, &sy);
+		view.pbU -= view.lStrideUV * (rows.nFirstRow >> sy);
+		view.pbV -= view.lStrideUV * (rows.nFirstRow >> sy);
+	}
+	view.nHeight = m_nHeight;
+	return view;
+}
+
+//
+// Makes the intermediate hold rows [nFirstRow, nLastRow). The rows it
+// already has from the tile above are moved to the top; returns the first
+// row the stage still has to produce.
+//
+int CFramePipeline::Keep(Intermediate &rows, int nFirstRow, int nLastRow)
+{
+	int nKeepEnd = rows.nLastRow < nLastRow ? rows.nLastRow : nLastRow;
+	if (nLastRow - nFirstRow > rows.nCapacity)
+	{
+		// The chroma planes follow the luma rows in a planar layout, so a
+		// larger capacity moves them; start over
+		rows.nCapacity = nLastRow - nFirstRow + 2 * m_nBlockRows;
+		rows.Buffer.resize(FrameBytes(m_Format, m_nWidth, rows.nCapacity));
+		nKeepEnd = nFirstRow;
+	}
+	else if (nFirstRow < rows.nFirstRow || nFirstRow >= nKeepEnd)
+		nKeepEnd = nFirstRow;
+	else if (nFirstRow > rows.nFirstRow)
+	{
+		FrameDesc view = FrameLayout(&rows.Buffer[0], m_Format, m_nWidth, rows.nCapacity);
+		int nSkip = nFirstRow - rows.nFirstRow;
+		int nKeep = nKeepEnd - nFirstRow;
+		if (!FramePlanar(m_Format))
+			memmove(view.pbTop, view.pbTop + view.lStride * nSkip, view.lStride * nKeep);
+		else
+		{
+			int sx, sy;
+			FrameChromaShift(m_Format, &sx, &sy);
+			memmove(view.pbTop, view.pbTop + view.lStride * nSkip, view.lStride * nKeep);
+			int nSkipUV = nSkip >> sy;
+			int nKeepUV = ((nKeepEnd + m_nBlockRows - 1) >> sy) - (nFirstRow >> sy);
+			memmove(view.pbU, view.pbU + view.lStrideUV * nSkipUV, view.lStrideUV * nKeepUV);
+			memmove(view.pbV, view.pbV + view.lStrideUV * nSkipUV, view.lStrideUV * nKeepUV);
+		}
+	}
+	rows.nFirstRow = nFirstRow;
+	rows.nLastRow = nLastRow;
+	return nKeepEnd;
+}
+
+void CFramePipeline::ProcessRows(CFrameSink *pSink, const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, int nBand)
+{
+	if (m_nStages == 1)
+	{
+		m_pStages[0]->ProcessRows(pSink, src, dst, nFirstRow, nLastRow, kernel, pStats, nBand);
+		return;
+	}
+
+	Scratch &s = m_Scratch[nBand];
+	const int nMask = m_nBlockRows - 1;
+	for (int nTile = nFirstRow; nTile < nLastRow; nTile += m_nTileRows)
+	{
+		int nTileEnd = nLastRow - nTile < m_nTileRows ? nLastRow : nTile + m_nTileRows;
+
+		// The rows every stage has to produce, from the last one back
+		int nFirst[MAX_STAGES], nLast[MAX_STAGES];
+		nFirst[m_nStages - 1] = nTile;
+		nLast[m_nStages - 1] = nTileEnd;
+		for (int i = m_nStages - 1; i > 0; i--)
+		{
+			int a, b;
+			m_pStages[i]->InputRows(nFirst[i], nLast[i], &a, &b);
+			nFirst[i - 1] = a & ~nMask;
+			nLast[i - 1] = ((b + nMask) & ~nMask) < m_nHeight ? (b + nMask) & ~nMask : m_nHeight;
+		}
+
+		// and forward through the intermediates
+		FrameDesc in = src;
+		for (int i = 0; i + 1 < m_nStages; i++)
+		{
+			int nFrom = Keep(s.Rows[i], nFirst[i], nLast[i]);
+			FrameDesc out = View(s.Rows[i]);
+			if (nFrom < nLast[i])
+				m_pStages[i]->ProcessRows(&g_CopySink, in, out, nFrom, nLast[i], kernel, NULL, nBand);
+			in = out;
+		}
+		m_pStages[m_nStages - 1]->ProcessRows(pSink, in, dst, nTile, nTileEnd, kernel, pStats, nBand);
+	}
+}
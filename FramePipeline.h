@@ -0,0 +1,73 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+
+//
+// CFramePipeline
+//
+// A chain of stages in front of the colour kernels, itself run as one
+// CFrameStage. Each band is cut into tiles of target rows small enough that
+// the intermediate frames of a tile stay in the L2 cache: the first stage
+// reads the source rows the tile needs into a band-local intermediate, the
+// next stage reads that one, and the last hands its rows to the engine. The
+// frame is read once and written once however many stages there are. The
+// intermediate rows under a filter's reach at the bottom of a tile are kept
+// for the next tile of the band rather than worked again.
+//
+// Only the first stage may change the frame size. Every intermediate has
+// the size and the format of the target.
+//
+class CFramePipeline : public CFrameStage
+{
+public:
+	enum { MAX_STAGES = 4 };
+
+	CFramePipeline();
+
+	// Stages in processing order, at least one; the pipeline does not own them
+	void Clear() { m_nStages = 0; }
+	void Add(CFrameStage *pStage);
+	int StageCount() const { return m_nStages; }
+
+	// Target rows per tile; 0 sizes the tiles for the L2 budget, a large
+	// value runs every stage over a whole band before the next one
+	void SetTileRows(int nRows) { m_nFixedTileRows = nRows; }
+
+	virtual void Prepare(const FrameDesc &src, const FrameDesc &dst, int nBands);
+	virtual void InputRows(int nFirstRow, int nLastRow, int *pFirst, int *pLast) const;
+	virtual void ProcessRows(CFrameSink *pSink, const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, int nBand);
+
+private:
+	// Rows [nFirstRow, nLastRow) of a target-sized frame, laid out as a
+	// frame of nCapacity rows
+	struct Intermediate
+	{
+		Intermediate() : nCapacity(0), nFirstRow(0), nLastRow(0) {}
+
+		std::vector<unsigned char> Buffer;
+		int nCapacity;
+		int nFirstRow;
+		int nLastRow;
+	};
+
+	// Intermediates of one band, one per stage but the last
+	struct Scratch
+	{
+		Intermediate Rows[MAX_STAGES - 1];
+	};
+
+	FrameDesc View(Intermediate &rows);
+	int Keep(Intermediate &rows, int nFirstRow, int nLastRow);
+
+	CFrameStage *m_pStages[MAX_STAGES];
+	int m_nStages;
+	FrameFormat m_Format;        // Of the target and the intermediates
+	int m_nWidth;
+	int m_nHeight;
+	int m_nBlockRows;            // 2 for 4:2:0, else 1
+	int m_nTileRows;
+	int m_nFixedTileRows;
+	std::vector<Scratch> m_Scratch;
+};
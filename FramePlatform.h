@@ -0,0 +1,371 @@
+#pragma once
+//
+// Thin portability layer used by the platform-neutral parts of the filter
+// (the colour engine and its helpers) so that they build both inside the
+// DirectShow DLL and as plain Linux programs under tools/.
+//
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+// SSE2 is part of every x64 target; 32-bit builds need /arch:SSE2 or -msse2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAME_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//
+// Instruction sets the kernels are built for
+//
+enum FrameIsa
+{
+	FRAME_ISA_SCALAR = 0,
+	FRAME_ISA_SSE2,
+	FRAME_ISA_COUNT
+};
+
+// The widest instruction set of this build
+inline FrameIsa FrameIsaBest()
+{
+#ifdef FRAME_SSE2
+	return FRAME_ISA_SSE2;
+#else
+	return FRAME_ISA_SCALAR;
+#endif
+}
+
+inline const char *FrameIsaName(FrameIsa isa)
+{
+	return isa == FRAME_ISA_SSE2 ? "sse2" : "scalar";
+}
+
+// Alignment used for every frame sized buffer (one cache line).
+const size_t g_FrameAlign = 64;
+
+// Working set a tiled pass aims for: half of a typical 256 KB L2, leaving
+// the other half to the source and target lines it streams through.
+const size_t g_FrameTileBytes = 128 * 1024;
+
+// Target frames from this size up may be written with non-temporal stores,
+// past the cache: a 4k YUY2 frame and up no longer fits in a typical L3
+// next to the source, so caching it would only evict everything else.
+const size_t g_FrameStreamBytes = 12 * 1024 * 1024;
+
+//
+// Non-temporal copy, for rows that go out of the cache anyway. The copies
+// of one thread are only ordered with other threads' reads after
+// FrameStreamFence().
+//
+inline void FrameStreamCopy(unsigned char *pbDst, const unsigned char *pbSrc, size_t cb)
+{
+#ifdef FRAME_SSE2
+	size_t cbHead = (size_t)(-(ptrdiff_t)pbDst & 15);
+	if (cbHead > cb)
+		cbHead = cb;
+	memcpy(pbDst, pbSrc, cbHead);
+	size_t i = cbHead;
+	for (; i + 64 <= cb; i += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(pbSrc + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(pbSrc + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(pbSrc + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(pbSrc + i + 48));
+		_mm_stream_si128((__m128i *)(pbDst + i), a);
+		_mm_stream_si128((__m128i *)(pbDst + i + 16), b);
+		_mm_stream_si128((__m128i *)(pbDst + i + 32), c);
+		_mm_stream_si128((__m128i *)(pbDst + i + 48), d);
+	}
+	for (; i + 16 <= cb; i += 16)
+		_mm_stream_si128((__m128i *)(pbDst + i), _mm_loadu_si128((const __m128i *)(pbSrc + i)));
+	memcpy(pbDst + i, pbSrc + i, cb - i);
+#else
+	memcpy(pbDst, pbSrc, cb);
+#endif
+}
+
+inline void FrameStreamFence()
+{
+#ifdef FRAME_SSE2
+	_mm_sfence();
+#endif
+}
+
+// Ask for the cache lines of [pb, pb + cb) ahead of use
+inline void FramePrefetch(const unsigned char *pb, size_t cb)
+{
+#ifdef FRAME_SSE2
+	for (size_t i = 0; i < cb; i += 64)
+		_mm_prefetch((const char *)(pb + i), _MM_HINT_T0);
+#endif
+}
+
+//
+// Aligned heap allocation
+//
+inline void *FrameAlloc(size_t cb)
+{
+#ifdef _WIN32
+	return _aligned_malloc(cb, g_FrameAlign);
+#else
+	void *pv = NULL;
+	if (posix_memalign(&pv, g_FrameAlign, cb) != 0)
+		return NULL;
+	return pv;
+#endif
+}
+
+inline void FrameFree(void *pv)
+{
+#ifdef _WIN32
+	_aligned_free(pv);
+#else
+	free(pv);
+#endif
+}
+
+//
+// Monotonic time in seconds
+//
+inline double FrameSeconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER f, t;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / (double)f.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+//
+// Monotonic time in ticks of FrameTickFrequency() per second, for time
+// stamps that have to be cheap to take
+//
+inline long long FrameTicks()
+{
+#ifdef _WIN32
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+inline long long FrameTickFrequency()
+{
+#ifdef _WIN32
+	LARGE_INTEGER f;
+	QueryPerformanceFrequency(&f);
+	return f.QuadPart;
+#else
+	return 1000000000;
+#endif
+}
+
+// Identifier of the calling thread as the system shows it. Linux has no
+// cheap call for it, so each thread asks once.
+inline unsigned long FrameThreadId()
+{
+#ifdef _WIN32
+	return GetCurrentThreadId();
+#else
+	static __thread unsigned long s_nThreadId = 0;
+	if (s_nThreadId == 0)
+		s_nThreadId = (unsigned long)syscall(SYS_gettid);
+	return s_nThreadId;
+#endif
+}
+
+inline int FrameCpuCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#endif
+}
+
+//
+// Interlocked operations
+//
+inline long FrameInterlockedIncrement(volatile long *pl)
+{
+#ifdef _WIN32
+	return InterlockedIncrement(pl);
+#else
+	return __sync_add_and_fetch(pl, 1);
+#endif
+}
+
+inline long FrameInterlockedExchangeAdd(volatile long *pl, long lAdd)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd(pl, lAdd);
+#else
+	return __sync_fetch_and_add(pl, lAdd);
+#endif
+}
+
+inline long FrameInterlockedExchange(volatile long *pl, long lValue)
+{
+#ifdef _WIN32
+	return InterlockedExchange(pl, lValue);
+#else
+	// __sync_lock_test_and_set is only an acquire barrier
+	long lOld = __sync_lock_test_and_set(pl, lValue);
+	__sync_synchronize();
+	return lOld;
+#endif
+}
+
+// Full barrier: no load or store moves across it, in the compiler or the CPU
+inline void FrameMemoryBarrier()
+{
+#ifdef _WIN32
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+//
+// Critical section
+//
+class CFrameCritSec
+{
+public:
+#ifdef _WIN32
+	CFrameCritSec() { InitializeCriticalSection(&m_cs); }
+	~CFrameCritSec() { DeleteCriticalSection(&m_cs); }
+	void Lock() { EnterCriticalSection(&m_cs); }
+	void Unlock() { LeaveCriticalSection(&m_cs); }
+	CRITICAL_SECTION m_cs;
+#else
+	CFrameCritSec() { pthread_mutex_init(&m_cs, NULL); }
+	~CFrameCritSec() { pthread_mutex_destroy(&m_cs); }
+	void Lock() { pthread_mutex_lock(&m_cs); }
+	void Unlock() { pthread_mutex_unlock(&m_cs); }
+	pthread_mutex_t m_cs;
+#endif
+private:
+	CFrameCritSec(const CFrameCritSec &);
+	CFrameCritSec &operator=(const CFrameCritSec &);
+};
+
+class CFrameAutoLock
+{
+public:
+	CFrameAutoLock(CFrameCritSec *pLock) : m_pLock(pLock) { m_pLock->Lock(); }
+	~CFrameAutoLock() { m_pLock->Unlock(); }
+private:
+	CFrameCritSec *m_pLock;
+};
+
+//
+// Condition variable, always used together with a CFrameCritSec
+//
+class CFrameCondition
+{
+public:
+#ifdef _WIN32
+	CFrameCondition() { InitializeConditionVariable(&m_cv); }
+	~CFrameCondition() {}
+	void Wait(CFrameCritSec *pLock) { SleepConditionVariableCS(&m_cv, &pLock->m_cs, INFINITE); }
+	void Signal() { WakeConditionVariable(&m_cv); }
+	void Broadcast() { WakeAllConditionVariable(&m_cv); }
+private:
+	CONDITION_VARIABLE m_cv;
+#else
+	CFrameCondition() { pthread_cond_init(&m_cv, NULL); }
+	~CFrameCondition() { pthread_cond_destroy(&m_cv); }
+	void Wait(CFrameCritSec *pLock) { pthread_cond_wait(&m_cv, &pLock->m_cs); }
+	void Signal() { pthread_cond_signal(&m_cv); }
+	void Broadcast() { pthread_cond_broadcast(&m_cv); }
+private:
+	pthread_cond_t m_cv;
+#endif
+	CFrameCondition(const CFrameCondition &);
+	CFrameCondition &operator=(const CFrameCondition &);
+};
+
+//
+// Thread
+//
+typedef void (*FRAMETHREADPROC)(void *pv);
+
+class CFrameThread
+{
+public:
+	CFrameThread() : m_bStarted(false), m_pfn(NULL), m_pv(NULL) {}
+	~CFrameThread() { Join(); }
+
+	bool Start(FRAMETHREADPROC pfn, void *pv)
+	{
+		m_pfn = pfn;
+		m_pv = pv;
+#ifdef _WIN32
+		m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+		m_bStarted = (m_hThread != NULL);
+#else
+		m_bStarted = (pthread_create(&m_hThread, NULL, ThreadProc, this) == 0);
+#endif
+		return m_bStarted;
+	}
+
+	void Join()
+	{
+		if (!m_bStarted)
+			return;
+#ifdef _WIN32
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+#else
+		pthread_join(m_hThread, NULL);
+#endif
+		m_bStarted = false;
+	}
+
+private:
+#ifdef _WIN32
+	static DWORD WINAPI ThreadProc(LPVOID pv)
+	{
+		CFrameThread *pThis = (CFrameThread *)pv;
+		pThis->m_pfn(pThis->m_pv);
+		return 0;
+	}
+	HANDLE m_hThread;
+#else
+	static void *ThreadProc(void *pv)
+	{
+		CFrameThread *pThis = (CFrameThread *)pv;
+		pThis->m_pfn(pThis->m_pv);
+		return NULL;
+	}
+	pthread_t m_hThread;
+#endif
+	bool m_bStarted;
+	FRAMETHREADPROC m_pfn;
+	void *m_pv;
+
+	CFrameThread(const CFrameThread &);
+	CFrameThread &operator=(const CFrameThread &);
+};
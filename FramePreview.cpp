@@ -0,0 +1,334 @@
+#include <string.h>
+#include "FramePreview.h"
+
+CFramePreview::CFramePreview()
+	: m_nFactor(4), m_nShift(2), m_nSumsFactor(0), m_nShiftX(1), m_nShiftY(0)
+{
+	memset(&m_Frame, 0, sizeof(m_Frame));
+	for (int i = 0; i < 3; i++)
+		m_Planes[i].nSamples = 0;
+}
+
+bool CFramePreview::SetFactor(int nFactor)
+{
+	if (nFactor != 2 && nFactor != 4 && nFactor != 8)
+		return false;
+	m_nFactor = nFactor;
+	m_nShift = nFactor == 2 ? 1 : (nFactor == 4 ? 2 : 3);
+	return true;
+}
+
+void CFramePreview::PreviewSize(FrameFormat format, int nWidth, int nHeight, int nFactor,
+	int *pWidth, int *pHeight)
+{
+	int sx = 1, sy = 0;
+	if (FramePlanar(format))
+		FrameChromaShift(format, &sx, &sy);
+	*pWidth = nWidth / nFactor >> sx << sx;
+	*pHeight = nHeight / nFactor >> sy << sy;
+	if (*pWidth <= 0 || *pHeight <= 0)
+		*pWidth = *pHeight = 0;
+}
+
+bool CFramePreview::BeginFrame(const FrameDesc &dst)
+{
+	int nWidth, nHeight;
+	PreviewSize(dst.format, dst.nWidth, dst.nHeight, m_nFactor, &nWidth, &nHeight);
+	if (nWidth == 0)
+	{
+		memset(&m_Frame, 0, sizeof(m_Frame));
+		return false;
+	}
+	if (nWidth == m_Frame.nWidth && nHeight == m_Frame.nHeight && dst.format == m_Frame.format &&
+		m_nSumsFactor == m_nFactor)
+		return true;
+
+	// Sums start at zero and go back to it as each preview row is done
+	m_Buffer.resize(FrameBytes(dst.format, nWidth, nHeight));
+	m_Frame = FrameLayout(&m_Buffer[0], dst.format, nWidth, nHeight);
+	m_nSumsFactor = m_nFactor;
+	m_nShiftX = 1;
+	m_nShiftY = 0;
+	if (FramePlanar(dst.format))
+		FrameChromaShift(dst.format, &m_nShiftX, &m_nShiftY);
+	m_Rows.resize((size_t)nWidth * 2 * nHeight);
+	m_Planes[0].nSamples = nWidth;
+	m_Planes[0].Sums.assign((size_t)nWidth * nHeight, 0);
+	for (int p = 1; p < 3; p++)
+	{
+		m_Planes[p].nSamples = nWidth >> m_nShiftX;
+		m_Planes[p].Sums.assign((size_t)(nWidth >> m_nShiftX) * (nHeight >> m_nShiftY), 0);
+	}
+	return true;
+}
+
+#ifdef FRAME_SSE2
+// Adjacent pairs of 16-bit sums of a and b, a first
+static inline __m128i SumPairs(__m128i a, __m128i b)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	return _mm_packs_epi32(_mm_madd_epi16(a, ones), _mm_madd_epi16(b, ones));
+}
+
+// Sums of eight runs of 1 << S bytes from pb
+template <int S> static inline __m128i SumBytes(const unsigned char *pb)
+{
+	return SumPairs(SumBytes<S - 1>(pb), SumBytes<S - 1>(pb + (8 << (S - 1))));
+}
+
+template <> inline __m128i SumBytes<0>(const unsigned char *pb)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pb), _mm_setzero_si128());
+}
+
+// Sums of eight runs of 1 << S luma samples from the packed pb
+template <int S> static inline __m128i SumLuma(const unsigned char *pb, int iY)
+{
+	return SumPairs(SumLuma<S - 1>(pb, iY), SumLuma<S - 1>(pb + (16 << (S - 1)), iY));
+}
+
+template <> inline __m128i SumLuma<0>(const unsigned char *pb, int iY)
+{
+	__m128i p = _mm_loadu_si128((const __m128i *)pb);
+	return iY == 0 ? _mm_and_si128(p, _mm_set1_epi16(0x00FF)) : _mm_srli_epi16(p, 8);
+}
+
+// Sums of eight runs of 1 << S U and V samples from the packed pb
+template <int S> static inline void SumChroma(const unsigned char *pb, int iC, __m128i *pU, __m128i *pV)
+{
+	__m128i u0, v0, u1, v1;
+	SumChroma<S - 1>(pb, iC, &u0, &v0);
+	SumChroma<S - 1>(pb + (32 << (S - 1)), iC, &u1, &v1);
+	*pU = SumPairs(u0, u1);
+	*pV = SumPairs(v0, v1);
+}
+
+template <> inline void SumChroma<0>(const unsigned char *pb, int iC, __m128i *pU, __m128i *pV)
+{
+	const __m128i low = _mm_set1_epi16(0x00FF);
+	const __m128i first = _mm_set1_epi32(0xFFFF);
+	__m128i a = _mm_loadu_si128((const __m128i *)pb);
+	__m128i b = _mm_loadu_si128((const __m128i *)(pb + 16));
+	a = iC == 0 ? _mm_and_si128(a, low) : _mm_srli_epi16(a, 8);
+	b = iC == 0 ? _mm_and_si128(b, low) : _mm_srli_epi16(b, 8);
+	*pU = _mm_packs_epi32(_mm_and_si128(a, first), _mm_and_si128(b, first));
+	*pV = _mm_packs_epi32(_mm_srli_epi32(a, 16), _mm_srli_epi32(b, 16));
+}
+
+static inline void AddSums(unsigned short *pSums, __m128i sums)
+{
+	_mm_storeu_si128((__m128i *)pSums, _mm_add_epi16(_mm_loadu_si128((const __m128i *)pSums), sums));
+}
+
+// The samples of the rows done with SSE2, eight sums at a time
+template <int S> static int AddPlaneSse2(unsigned short *pSums, int nSamples, const unsigned char *pb)
+{
+	int x = 0;
+	for (; x + 8 <= nSamples; x += 8)
+		AddSums(pSums + x, SumBytes<S>(pb + (x << S)));
+	return x;
+}
+
+template <int S> static int AddLumaSse2(unsigned short *pY, int nSamples, const unsigned char *pb, int iY)
+{
+	int x = 0;
+	for (; x + 8 <= nSamples; x += 8)
+		AddSums(pY + x, SumLuma<S>(pb + (x << (S + 1)), iY));
+	return x;
+}
+
+template <int S> static int AddChromaSse2(unsigned short *pU, unsigned short *pV, int nSamples,
+	const unsigned char *pb, int iC)
+{
+	int m = 0;
+	for (; m + 8 <= nSamples; m += 8)
+	{
+		__m128i u, v;
+		SumChroma<S>(pb + (m << (S + 2)), iC, &u, &v);
+		AddSums(pU + m, u);
+		AddSums(pV + m, v);
+	}
+	return m;
+}
+#endif
+
+//
+// Each target row is summed across first, nFactor samples to a sum, and
+// the sums are added up down the rows of a preview row
+//
+void CFramePreview::AddPlaneRow(Plane &plane, int nRow, const unsigned char *pb, FrameIsa isa)
+{
+	unsigned short *pSums = &plane.Sums[(size_t)plane.nSamples * nRow];
+	const int f = m_nFactor;
+	int x = 0;
+#ifdef FRAME_SSE2
+	if (isa >= FRAME_ISA_SSE2)
+	{
+		switch (m_nShift)
+		{
+		case 1: x = AddPlaneSse2<1>(pSums, plane.nSamples, pb); break;
+		case 2: x = AddPlaneSse2<2>(pSums, plane.nSamples, pb); break;
+		default: x = AddPlaneSse2<3>(pSums, plane.nSamples, pb); break;
+		}
+	}
+#else
+	(void)isa;
+#endif
+	for (; x < plane.nSamples; x++)
+	{
+		unsigned int nSum = pSums[x];
+		for (int k = 0; k < f; k++)
+			nSum += pb[x * f + k];
+		pSums[x] = (unsigned short)nSum;
+	}
+}
+
+//
+// Y0 U Y1 V or U Y0 V Y1, split into the luma, U and V sums
+//
+void CFramePreview::AddPackedRow(int nRow, const unsigned char *pb, FrameIsa isa)
+{
+	unsigned short *pY = &m_Planes[0].Sums[(size_t)m_Planes[0].nSamples * nRow];
+	unsigned short *pU = &m_Planes[1].Sums[(size_t)m_Planes[1].nSamples * nRow];
+	unsigned short *pV = &m_Planes[2].Sums[(size_t)m_Planes[2].nSamples * nRow];
+	const int f = m_nFactor;
+	const int iY = m_Frame.format == FRAME_FORMAT_UYVY ? 1 : 0;
+	const int iC = 1 - iY;
+	int x = 0, m = 0;
+#ifdef FRAME_SSE2
+	if (isa >= FRAME_ISA_SSE2)
+	{
+		const int nY = m_Planes[0].nSamples, nC = m_Planes[1].nSamples;
+		switch (m_nShift)
+		{
+		case 1:
+			x = AddLumaSse2<1>(pY, nY, pb, iY);
+			m = AddChromaSse2<1>(pU, pV, nC, pb, iC);
+			break;
+		case 2:
+			x = AddLumaSse2<2>(pY, nY, pb, iY);
+			m = AddChromaSse2<2>(pU, pV, nC, pb, iC);
+			break;
+		default:
+			x = AddLumaSse2<3>(pY, nY, pb, iY);
+			m = AddChromaSse2<3>(pU, pV, nC, pb, iC);
+			break;
+		}
+	}
+#else
+	(void)isa;
+#endif
+	for (; x < m_Planes[0].nSamples; x++)
+	{
+		unsigned int nSum = pY[x];
+		for (int k = 0; k < f; k++)
+			nSum += pb[2 * (x * f + k) + iY];
+		pY[x] = (unsigned short)nSum;
+	}
+	for (; m < m_Planes[1].nSamples; m++)
+	{
+		unsigned int nSumU = pU[m], nSumV = pV[m];
+		for (int k = 0; k < f; k++)
+		{
+			nSumU += pb[4 * (m * f + k) + iC];
+			nSumV += pb[4 * (m * f + k) + iC + 2];
+		}
+		pU[m] = (unsigned short)nSumU;
+		pV[m] = (unsigned short)nSumV;
+	}
+}
+
+//
+// The box averages of a preview row from its sums, which start over
+//
+void CFramePreview::FinishPlane(int nPlane, int nRow, unsigned char *pbOut, FrameIsa isa)
+{
+	Plane &plane = m_Planes[nPlane];
+	unsigned short *pSums = &plane.Sums[(size_t)plane.nSamples * nRow];
+	const int nShift = 2 * m_nShift;
+	const int nRound = 1 << (nShift - 1);
+	int x = 0;
+#ifdef FRAME_SSE2
+	if (isa >= FRAME_ISA_SSE2)
+	{
+		const __m128i round = _mm_set1_epi16((short)nRound);
+		for (; x + 16 <= plane.nSamples; x += 16)
+		{
+			__m128i a = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i *)(pSums + x)), round), nShift);
+			__m128i b = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i *)(pSums + x + 8)), round), nShift);
+			_mm_storeu_si128((__m128i *)(pbOut + x), _mm_packus_epi16(a, b));
+		}
+	}
+#else
+	(void)isa;
+#endif
+	for (; x < plane.nSamples; x++)
+		pbOut[x] = (unsigned char)((pSums[x] + nRound) >> nShift);
+	memset(pSums, 0, plane.nSamples * sizeof(unsigned short));
+}
+
+//
+// The packed preview row from the luma, U and V averages
+//
+void CFramePreview::FinishPacked(int nRow, FrameIsa isa)
+{
+	const int nPairs = m_Frame.nWidth / 2;
+	unsigned char *pY = &m_Rows[(size_t)m_Frame.nWidth * 2 * nRow];
+	unsigned char *pU = pY + m_Frame.nWidth;
+	unsigned char *pV = pU + nPairs;
+	FinishPlane(0, nRow, pY, isa);
+	FinishPlane(1, nRow, pU, isa);
+	FinishPlane(2, nRow, pV, isa);
+	unsigned char *pOut = m_Frame.pbTop + m_Frame.lStride * nRow;
+	const int iY = m_Frame.format == FRAME_FORMAT_UYVY ? 1 : 0;
+	const int iC = 1 - iY;
+	for (int m = 0; m < nPairs; m++)
+	{
+		pOut[4 * m + iY] = pY[2 * m];
+		pOut[4 * m + iY + 2] = pY[2 * m + 1];
+		pOut[4 * m + iC] = pU[m];
+		pOut[4 * m + iC + 2] = pV[m];
+	}
+}
+
+void CFramePreview::AddRows(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase, FrameIsa isa)
+{
+	const int f = m_nFactor;
+	const bool bPlanar = FramePlanar(dst.format);
+	for (int r = nFirstRow; r < nLastRow; r++)
+	{
+		const int t = r + nRowBase;
+		const int p = t >> m_nShift;
+		if (p >= m_Frame.nHeight)
+			break;
+		if (bPlanar)
+			AddPlaneRow(m_Planes[0], p, dst.pbTop + dst.lStride * r, isa);
+		else
+			AddPackedRow(p, dst.pbTop + dst.lStride * r, isa);
+		if ((t & (f - 1)) != f - 1)
+			continue;
+		if (bPlanar)
+			FinishPlane(0, p, m_Frame.pbTop + m_Frame.lStride * p, isa);
+		else
+			FinishPacked(p, isa);
+	}
+	if (!bPlanar)
+		return;
+
+	const int sy = m_nShiftY;
+	const int nRowsUV = m_Frame.nHeight >> sy;
+	for (int c = nFirstRow >> sy; c < (nLastRow + (1 << sy) - 1) >> sy; c++)
+	{
+		const int t = c + (nRowBase >> sy);
+		const int p = t >> m_nShift;
+		if (p >= nRowsUV)
+			break;
+		AddPlaneRow(m_Planes[1], p, dst.pbU + dst.lStrideUV * c, isa);
+		AddPlaneRow(m_Planes[2], p, dst.pbV + dst.lStrideUV * c, isa);
+		if ((t & (f - 1)) == f - 1)
+		{
+			FinishPlane(1, p, m_Frame.pbU + m_Frame.lStrideUV * p, isa);
+			FinishPlane(2, p, m_Frame.pbV + m_Frame.lStrideUV * p, isa);
+		}
+	}
+}
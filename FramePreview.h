@@ -0,0 +1,73 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+
+//
+// CFramePreview
+//
+// A thumbnail of every target frame, made while the frame is processed:
+// each preview pixel is the box average of nFactor x nFactor target
+// pixels, and its chroma of the chroma samples under it. The workers sum
+// each target row across while it is still in the cache, add it to a row
+// of 16-bit sums, and make the preview row of the sums when its last
+// target row is in.
+// The preview has the format of the target and a size of whole chroma
+// blocks, rounded down; the target rows and columns past it are left out.
+//
+// Given to CColorEngine::SetPreview(), which keeps the bands on whole
+// preview rows so that no two workers share one. Frame() holds the
+// preview of the last frame until the next one starts.
+//
+class CFramePreview
+{
+public:
+	CFramePreview();
+
+	// 2, 4 or 8
+	bool SetFactor(int nFactor);
+	int Factor() const { return m_nFactor; }
+
+	// The preview size for targets of this format and size; 0 by 0 when
+	// the target is smaller than one chroma block of the preview
+	static void PreviewSize(FrameFormat format, int nWidth, int nHeight, int nFactor,
+		int *pWidth, int *pHeight);
+
+	// Start of a frame of the engine; false when there is no preview of dst
+	bool BeginFrame(const FrameDesc &dst);
+
+	// Target rows a band starts on: whole preview rows, and whole preview
+	// chroma rows for 4:2:0
+	int RowAlignment() const { return m_nFactor << m_nShiftY; }
+
+	// Add rows [nFirstRow, nLastRow) of dst, whose row 0 is target row
+	// nRowBase. Rows come from the top within a band.
+	void AddRows(const FrameDesc &dst, int nFirstRow, int nLastRow, int nRowBase, FrameIsa isa);
+
+	// The preview of the last frame
+	const FrameDesc &Frame() const { return m_Frame; }
+
+private:
+	// Sums of the target samples under each preview sample, a row of them
+	// for every preview row
+	struct Plane
+	{
+		int nSamples;                // Preview samples per row
+		std::vector<unsigned short> Sums;
+	};
+
+	void AddPlaneRow(Plane &plane, int nRow, const unsigned char *pb, FrameIsa isa);
+	void AddPackedRow(int nRow, const unsigned char *pb, FrameIsa isa);
+	void FinishPlane(int nPlane, int nRow, unsigned char *pbOut, FrameIsa isa);
+	void FinishPacked(int nRow, FrameIsa isa);
+
+	int m_nFactor;
+	int m_nShift;                    // log2 of m_nFactor
+	int m_nSumsFactor;               // m_nFactor when the sums were sized
+	int m_nShiftX;                   // Chroma subsampling of the target
+	int m_nShiftY;
+	FrameDesc m_Frame;
+	std::vector<unsigned char> m_Buffer;
+	Plane m_Planes[3];               // Y, U and V, packed targets split up
+	std::vector<unsigned char> m_Rows; // Packed rows before they are interleaved
+};
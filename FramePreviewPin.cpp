@@ -0,0 +1,110 @@
+#include "FrameProcessFilter.h"
+#include "FramePreviewPin.h"
+
+CFramePreviewPin::CFramePreviewPin(CFrameProcessFilter *pFilter, CCritSec *pLock, HRESULT *phr)
+	: CBaseOutputPin(NAME("Preview output pin"), pFilter, pLock, phr, g_PreviewPinName),
+	  m_pFrameFilter(pFilter), m_pQueue(NULL)
+{
+}
+
+CFramePreviewPin::~CFramePreviewPin()
+{
+	delete m_pQueue;
+}
+
+HRESULT CFramePreviewPin::CheckMediaType(const CMediaType *pmt)
+{
+	return m_pFrameFilter->CheckPreviewType(pmt);
+}
+
+HRESULT CFramePreviewPin::GetMediaType(int iPosition, CMediaType *pmt)
+{
+	return m_pFrameFilter->GetPreviewType(iPosition, pmt);
+}
+
+HRESULT CFramePreviewPin::SetMediaType(const CMediaType *pmt)
+{
+	HRESULT hr = CBaseOutputPin::SetMediaType(pmt);
+	if (FAILED(hr))
+		return hr;
+	return m_pFrameFilter->SetPreviewType(pmt);
+}
+
+HRESULT CFramePreviewPin::DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp)
+{
+	return m_pFrameFilter->DecidePreviewBufferSize(pAlloc, pProp);
+}
+
+HRESULT CFramePreviewPin::Active()
+{
+	HRESULT hr = CBaseOutputPin::Active();
+	if (FAILED(hr) || m_pQueue != NULL)
+		return hr;
+	hr = S_OK;
+	m_pQueue = new CFramePreviewQueue(GetConnected(), &hr, TRUE, FALSE);
+	if (m_pQueue == NULL)
+		return E_OUTOFMEMORY;
+	if (FAILED(hr))
+	{
+		delete m_pQueue;
+		m_pQueue = NULL;
+	}
+	return hr;
+}
+
+HRESULT CFramePreviewPin::Inactive()
+{
+	delete m_pQueue;
+	m_pQueue = NULL;
+	return CBaseOutputPin::Inactive();
+}
+
+//
+// The queue releases the sample once it is sent; the caller keeps its own
+// reference as with CBaseOutputPin::Deliver()
+//
+HRESULT CFramePreviewPin::Deliver(IMediaSample *pSample)
+{
+	if (m_pQueue == NULL)
+		return VFW_E_NOT_COMMITTED;
+	pSample->AddRef();
+	return m_pQueue->Receive(pSample);
+}
+
+HRESULT CFramePreviewPin::DeliverEndOfStream()
+{
+	if (m_pQueue != NULL)
+		m_pQueue->EOS();
+	return S_OK;
+}
+
+HRESULT CFramePreviewPin::DeliverBeginFlush()
+{
+	if (m_pQueue != NULL)
+		m_pQueue->BeginFlush();
+	return S_OK;
+}
+
+HRESULT CFramePreviewPin::DeliverEndFlush()
+{
+	if (m_pQueue != NULL)
+		m_pQueue->EndFlush();
+	return S_OK;
+}
+
+HRESULT CFramePreviewPin::DeliverNewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+{
+	if (m_pQueue != NULL)
+		m_pQueue->NewSegment(tStart, tStop, dRate);
+	return S_OK;
+}
+
+STDMETHODIMP CFramePreviewPin::Notify(IBaseFilter *pSender, Quality q)
+{
+	return S_OK;
+}
+
+int CFramePreviewPin::QueueDepth()
+{
+	return m_pQueue != NULL ? m_pQueue->Depth() : 0;
+}
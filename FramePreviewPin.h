@@ -0,0 +1,64 @@
+#pragma once
+#include <streams.h>  // DirectShow base class library
+
+class CFrameProcessFilter;
+
+//
+// CFramePreviewQueue
+//
+// The output queue of the pin, which also tells how many samples wait in
+// it for its thread
+//
+class CFramePreviewQueue : public COutputQueue
+{
+public:
+	CFramePreviewQueue(IPin *pInputPin, HRESULT *phr, BOOL bAuto, BOOL bQueue)
+		: COutputQueue(pInputPin, phr, bAuto, bQueue) {}
+
+	int Depth()
+	{
+		CAutoLock lock(this);
+		return m_List != NULL ? m_List->GetCount() : m_nBatched;
+	}
+};
+
+//
+// CFramePreviewPin
+//
+// The second output pin of the filter, "Preview". The filter decides its
+// media type and buffers and fills its samples (IFramePreview); the pin
+// sends them through a queue of its own, which gets a thread when the
+// downstream pin may block, so that a preview renderer waiting for the
+// time of a frame does not hold up the main output.
+//
+class CFramePreviewPin : public CBaseOutputPin
+{
+public:
+	CFramePreviewPin(CFrameProcessFilter *pFilter, CCritSec *pLock, HRESULT *phr);
+	~CFramePreviewPin();
+
+	HRESULT CheckMediaType(const CMediaType *pmt);
+	HRESULT GetMediaType(int iPosition, CMediaType *pmt);
+	HRESULT SetMediaType(const CMediaType *pmt);
+	HRESULT DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp);
+
+	// The queue lives from Active() to Inactive()
+	HRESULT Active();
+	HRESULT Inactive();
+	HRESULT Deliver(IMediaSample *pSample);
+	HRESULT DeliverEndOfStream();
+	HRESULT DeliverBeginFlush();
+	HRESULT DeliverEndFlush();
+	HRESULT DeliverNewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+
+	// Quality messages of the preview renderer are dropped; the main output
+	// is the one quality control follows
+	STDMETHODIMP Notify(IBaseFilter *pSender, Quality q);
+
+	// Samples waiting to be sent, 0 while inactive
+	int QueueDepth();
+
+private:
+	CFrameProcessFilter *m_pFrameFilter;
+	CFramePreviewQueue *m_pQueue;
+};
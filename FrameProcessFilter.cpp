@@ -1,6 +1,133 @@
+#include <math.h>
 #include "FrameProcessFilter.h"
 #include "FrmProcessPropPage.h"
 
+//
+// Both VIDEOINFOHEADER and VIDEOINFOHEADER2 are accepted; the rest of the
+// filter works on the fields they share.
+//
+static BITMAPINFOHEADER *GetBitmapHeader(const AM_MEDIA_TYPE *pmt)
+{
+    if (pmt->formattype == FORMAT_VideoInfo2)
+        return &((VIDEOINFOHEADER2 *)pmt->pbFormat)->bmiHeader;
+    return &((VIDEOINFOHEADER *)pmt->pbFormat)->bmiHeader;
+}
+
+static const RECT *GetTargetRect(const AM_MEDIA_TYPE *pmt)
+{
+    if (pmt->formattype == FORMAT_VideoInfo2)
+        return &((VIDEOINFOHEADER2 *)pmt->pbFormat)->rcTarget;
+    return &((VIDEOINFOHEADER *)pmt->pbFormat)->rcTarget;
+}
+
+//
+// Bytes from one row to the next: for 'normal' formats biWidth is in
+// pixels, expanded to bytes and rounded up to a multiple of 4; otherwise
+// biWidth is in bytes
+//
+static LONG GetStride(const BITMAPINFOHEADER &bmi)
+{
+    if (bmi.biBitCount != 0 && 0 == (7 & bmi.biBitCount))
+        return (bmi.biWidth * (bmi.biBitCount / 8) + 3) & ~3;
+    return bmi.biWidth;
+}
+
+//
+// Bytes a sample of the format has to hold
+//
+static size_t GetImageBytes(const VIDEOINFOHEADER *pvih)
+{
+    return (size_t)GetStride(pvih->bmiHeader) * (size_t)abs(pvih->bmiHeader.biHeight);
+}
+
+//
+// Frame size of the format: of the target rectangle, if there is one
+//
+static void GetFrameSize(const VIDEOINFOHEADER &vih, int *pWidth, int *pHeight)
+{
+    *pWidth = vih.bmiHeader.biWidth;
+    *pHeight = abs(vih.bmiHeader.biHeight);
+    if (!IsRectEmpty(&vih.rcTarget))
+    {
+        *pWidth = vih.rcTarget.right - vih.rcTarget.left;
+        *pHeight = vih.rcTarget.bottom - vih.rcTarget.top;
+    }
+}
+
+static void CopyVideoInfo(VIDEOINFOHEADER *pVih, const AM_MEDIA_TYPE *pmt)
+{
+    if (pmt->formattype == FORMAT_VideoInfo2)
+    {
+        const VIDEOINFOHEADER2 *pVih2 = (const VIDEOINFOHEADER2 *)pmt->pbFormat;
+        pVih->rcSource = pVih2->rcSource;
+        pVih->rcTarget = pVih2->rcTarget;
+        pVih->dwBitRate = pVih2->dwBitRate;
+        pVih->dwBitErrorRate = pVih2->dwBitErrorRate;
+        pVih->AvgTimePerFrame = pVih2->AvgTimePerFrame;
+        pVih->bmiHeader = pVih2->bmiHeader;
+    }
+    else
+    {
+        CopyMemory(pVih, pmt->pbFormat, sizeof(VIDEOINFOHEADER));
+    }
+}
+
+//
+// With AMCONTROL_COLORINFO_PRESENT the upper bits of dwControlFlags hold a
+// DXVA_ExtendedFormat: NominalRange in bits 12-14 and VideoTransferMatrix in
+// bits 15-17. Matrix values 4 and 5 are the BT.2020 ones Media Foundation
+// uses. Anything unknown falls back to the usual guess from the height.
+//
+static const int g_RangeShift = 12;
+static const int g_MatrixShift = 15;
+static const DWORD g_RangeFull = 1;        // DXVA_NominalRange_0_255
+static const DWORD g_RangeLimited = 2;     // DXVA_NominalRange_16_235
+static const DWORD g_MatrixBT709 = 1;
+static const DWORD g_MatrixBT601 = 2;
+static const DWORD g_MatrixSMPTE240M = 3;
+static const DWORD g_MatrixBT2020_10 = 4;
+static const DWORD g_MatrixBT2020_12 = 5;
+
+static ColorSpace GetTypeColorSpace(const AM_MEDIA_TYPE *pmt)
+{
+    const BITMAPINFOHEADER *pBmi = GetBitmapHeader(pmt);
+    ColorSpace space = MakeColorSpace(abs(pBmi->biHeight) >= 720 ? COLOR_MATRIX_BT709 : COLOR_MATRIX_BT601, false);
+
+    if (pmt->formattype == FORMAT_VideoInfo2)
+    {
+        DWORD dwFlags = ((const VIDEOINFOHEADER2 *)pmt->pbFormat)->dwControlFlags;
+        if (dwFlags & AMCONTROL_COLORINFO_PRESENT)
+        {
+            DWORD dwRange = (dwFlags >> g_RangeShift) & 7;
+            DWORD dwMatrix = (dwFlags >> g_MatrixShift) & 7;
+            if (dwRange == g_RangeFull)
+                space.bFullRange = true;
+            if (dwMatrix == g_MatrixBT709 || dwMatrix == g_MatrixSMPTE240M)
+                space.matrix = COLOR_MATRIX_BT709;
+            else if (dwMatrix == g_MatrixBT601)
+                space.matrix = COLOR_MATRIX_BT601;
+            else if (dwMatrix == g_MatrixBT2020_10 || dwMatrix == g_MatrixBT2020_12)
+                space.matrix = COLOR_MATRIX_BT2020;
+        }
+    }
+    return space;
+}
+
+// Write space into the extended format of a VIDEOINFOHEADER2 type
+static void SetTypeColorSpace(AM_MEDIA_TYPE *pmt, const ColorSpace &space)
+{
+    if (pmt->formattype != FORMAT_VideoInfo2)
+        return;
+    static const DWORD matrix[COLOR_MATRIX_COUNT] = { g_MatrixBT601, g_MatrixBT709, g_MatrixBT2020_10 };
+    VIDEOINFOHEADER2 *pVih2 = (VIDEOINFOHEADER2 *)pmt->pbFormat;
+    DWORD dwFlags = pVih2->dwControlFlags;
+    dwFlags &= ~((7 << g_RangeShift) | (7 << g_MatrixShift));
+    dwFlags |= AMCONTROL_USED | AMCONTROL_COLORINFO_PRESENT;
+    dwFlags |= (space.bFullRange ? g_RangeFull : g_RangeLimited) << g_RangeShift;
+    dwFlags |= matrix[space.matrix] << g_MatrixShift;
+    pVih2->dwControlFlags = dwFlags;
+}
+
 bool CFrameProcessFilter::IsValidYV12(const CMediaType *pmt)
 {
     // Note: The pmt->formattype member indicates what kind of data
@@ -9,19 +136,26 @@ bool CFrameProcessFilter::IsValidYV12(const CMediaType *pmt)
     // what we think it is. 	
     if ((pmt->majortype == MEDIATYPE_Video) &&
         (pmt->subtype == MEDIASUBTYPE_YUY2) &&
-        (pmt->formattype == FORMAT_VideoInfo) &&
         (pmt->pbFormat != NULL) &&
-        (pmt->cbFormat >= sizeof(VIDEOINFOHEADER)))
+        ((pmt->formattype == FORMAT_VideoInfo && pmt->cbFormat >= sizeof(VIDEOINFOHEADER)) ||
+         (pmt->formattype == FORMAT_VideoInfo2 && pmt->cbFormat >= sizeof(VIDEOINFOHEADER2))))
     {
-        VIDEOINFOHEADER *pVih = reinterpret_cast<VIDEOINFOHEADER*>(pmt->pbFormat);
-        BITMAPINFOHEADER *pBmi = &(pVih->bmiHeader);
+        BITMAPINFOHEADER *pBmi = GetBitmapHeader(pmt);
 
-        // Sanity check
+        // Sanity check. The size limits keep the byte offsets of every row
+        // within a LONG, and the target rectangle, if any, has to lie in the
+        // bitmap and start on a whole YUY2 pixel pair.
         //if ((pBmi->biBitCount = 12) &&
          //   (pBmi->biCompression = FCC('YV12')) &&
-        if ((pBmi->biBitCount = 16) &&
-            (pBmi->biCompression = FCC('YUY2')) &&
-		(pBmi->biSizeImage >= DIBSIZE(*pBmi)))
+        const RECT *prc = GetTargetRect(pmt);
+        if ((pBmi->biBitCount == 16) &&
+            (pBmi->biCompression == FCC('YUY2')) &&
+            (pBmi->biWidth > 0 && pBmi->biWidth <= g_MaxFrameWidth) &&
+            (pBmi->biHeight != 0 && abs(pBmi->biHeight) <= g_MaxFrameHeight) &&
+		(pBmi->biSizeImage >= DIBSIZE(*pBmi)) &&
+            (IsRectEmpty(prc) ||
+             (prc->left >= 0 && (prc->left & 1) == 0 && prc->right <= pBmi->biWidth &&
+              prc->top >= 0 && prc->bottom <= abs(pBmi->biHeight))))
         {
             return true;
         }
@@ -50,20 +184,7 @@ void CFrameProcessFilter::GetVideoInfoParameters(
     bool bYuv
     )
 {
-    LONG lStride;
-
-
-    //  For 'normal' formats, biWidth is in pixels. 
-    //  Expand to bytes and round up to a multiple of 4.
-    if (pvih->bmiHeader.biBitCount != 0 &&
-        0 == (7 & pvih->bmiHeader.biBitCount)) 
-    {
-        lStride = (pvih->bmiHeader.biWidth * (pvih->bmiHeader.biBitCount / 8) + 3) & ~3;
-    } 
-    else   // Otherwise, biWidth is in bytes.
-    {
-        lStride = pvih->bmiHeader.biWidth;
-    }
+    LONG lStride = GetStride(pvih->bmiHeader);
 
     //  If rcTarget is empty, use the whole image.
     if (IsRectEmpty(&pvih->rcTarget)) 
@@ -79,7 +200,7 @@ void CFrameProcessFilter::GetVideoInfoParameters(
         else        // Bottom-up bitmap
         {
             *plStrideInBytes = -lStride;    // Stride goes "up"
-            *ppbTop = pbData + lStride * (*pdwHeight - 1);  // Bottom row is first.
+            *ppbTop = pbData + (ptrdiff_t)lStride * ((ptrdiff_t)*pdwHeight - 1);  // Bottom row is first.
         }
     } 
     else   // rcTarget is NOT empty. Use a sub-rectangle in the image.
@@ -93,14 +214,14 @@ void CFrameProcessFilter::GetVideoInfoParameters(
             // and and over by the target rectangle.
             *plStrideInBytes = lStride;     
             *ppbTop = pbData +
-                     lStride * pvih->rcTarget.top +
+                     (ptrdiff_t)lStride * pvih->rcTarget.top +
                      (pvih->bmiHeader.biBitCount * pvih->rcTarget.left) / 8;
         } 
         else  // Bottom-up bitmap.
         {
             *plStrideInBytes = -lStride;
             *ppbTop = pbData +
-                     lStride * (pvih->bmiHeader.biHeight - pvih->rcTarget.top - 1) +
+                     (ptrdiff_t)lStride * (pvih->bmiHeader.biHeight - pvih->rcTarget.top - 1) +
                      (pvih->bmiHeader.biBitCount * pvih->rcTarget.left) / 8;
         }
     }
@@ -139,11 +260,10 @@ HRESULT CFrameProcessFilter::CheckTransform(const CMediaType *mtIn, const CMedia
         return VFW_E_TYPE_NOT_ACCEPTED;
     }
 	
-    BITMAPINFOHEADER *pBmi = HEADER(mtIn);
-    BITMAPINFOHEADER *pBmi2 = HEADER(mtOut);
+    // Any other frame size is reached through the scaler
+    BITMAPINFOHEADER *pBmi2 = GetBitmapHeader(mtOut);
 
-    if ((pBmi->biWidth <= pBmi2->biWidth) &&
-        (pBmi->biHeight == abs(pBmi2->biHeight)))
+    if (pBmi2->biWidth > 0 && pBmi2->biHeight != 0)
     {
        return S_OK;
     }
@@ -162,14 +282,21 @@ HRESULT CFrameProcessFilter::GetMediaType(int iPosition, CMediaType *pMediaType)
     // The output pin calls this method only if the input pin is connected.
     ASSERT(m_pInput->IsConnected());
 
-    // There is only one output type that we want, which is the input type.
+    // There is only one output type that we want, which is the input type,
+    // tagged with the output colour space when the filter converts.
     if (iPosition < 0)
     {
         return E_INVALIDARG;
     }
     else if (iPosition == 0)
     {  // retrieves the media type for the current pin connection
-        return m_pInput->ConnectionMediaType(pMediaType);
+        HRESULT hr = m_pInput->ConnectionMediaType(pMediaType);
+        CAutoLock lock(&m_csPending);
+        if (SUCCEEDED(hr) && m_OutMatrix != FRAMEMATRIX_AUTO)
+        {
+            SetTypeColorSpace(pMediaType, OutputSpace());
+        }
+        return hr;
     }
     return VFW_S_NO_MORE_ITEMS;
 }
@@ -223,6 +350,8 @@ HRESULT CFrameProcessFilter::DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_P
     // For buffer size, find the maximum of the upstream size and 
     // the downstream filter's request.
     pProp->cbBuffer = max(InputProps.cbBuffer, pProp->cbBuffer);
+    // A scaled output can need more than the input
+    pProp->cbBuffer = max((long)m_VihOut.bmiHeader.biSizeImage, pProp->cbBuffer);
 	   
     // Now set the properties on the allocator that was given to us,
     ALLOCATOR_PROPERTIES Actual;
@@ -260,8 +389,7 @@ HRESULT CFrameProcessFilter::SetMediaType(PIN_DIRECTION direction, const CMediaT
 {
     if (direction == PINDIR_INPUT)
     {
-        ASSERT(pmt->formattype == FORMAT_VideoInfo);
-        VIDEOINFOHEADER *pVih = (VIDEOINFOHEADER*)pmt->pbFormat;
+        ASSERT(pmt->formattype == FORMAT_VideoInfo || pmt->formattype == FORMAT_VideoInfo2);
 
         // WARNING! In general you cannot just copy a VIDEOINFOHEADER
         // struct, because the BITMAPINFOHEADER member may be followed by
@@ -269,15 +397,23 @@ HRESULT CFrameProcessFilter::SetMediaType(PIN_DIRECTION direction, const CMediaT
         // structure in the DShow SDK docs.) Here it's OK because we just
         // want the information that's in the VIDEOINFOHEADER stuct itself.
 
-        CopyMemory(&m_VihIn, pVih, sizeof(VIDEOINFOHEADER));
+        CopyVideoInfo(&m_VihIn, pmt);
+        {
+            CAutoLock lock(&m_csPending);
+            m_TypeSpace = GetTypeColorSpace(pmt);
+        }
+        UpdateColorSpaces();
+        m_Qos.SetFrameTime(m_VihIn.AvgTimePerFrame / 10000000.0);
     }
     else   // output pin
     {
         ASSERT(direction == PINDIR_OUTPUT);
-        ASSERT(pmt->formattype == FORMAT_VideoInfo);
-        VIDEOINFOHEADER *pVih = (VIDEOINFOHEADER*)pmt->pbFormat;
+        ASSERT(pmt->formattype == FORMAT_VideoInfo || pmt->formattype == FORMAT_VideoInfo2);
 		
-        CopyMemory(&m_VihOut, pVih, sizeof(VIDEOINFOHEADER));
+        CopyVideoInfo(&m_VihOut, pmt);
+
+        // A copy of a frame of another size is no use for the blend
+        m_Ghost.clear();
     }
     return S_OK;
 }
@@ -285,20 +421,62 @@ HRESULT CFrameProcessFilter::SetMediaType(PIN_DIRECTION direction, const CMediaT
 //----------------------------------------------------------------------------
 // CFrameProcessFilter::Transform
 //
-// Transform the image.
+// Transform the image, in the trace as a frame in and out. A frame that
+// takes too long is an anomaly, which saves the trace when a file is set.
 //
 // pSource: Contains the source image.
 // pDest:   Write the transformed image here.
 //-----------------------------------------------------------------------------
 HRESULT CFrameProcessFilter::Transform(IMediaSample *pSource, IMediaSample *pDest)
+{
+	if (!m_Trace.Enabled())
+		return TransformFrame(pSource, pDest);
+
+	DWORD dwFrame = m_dwGhostCount;
+	long long nStart = FrameTicks();
+	m_Trace.Record(TRACE_FRAME_IN, dwFrame);
+	HRESULT hr = TransformFrame(pSource, pDest);
+	m_Trace.Record(TRACE_FRAME_OUT, dwFrame);
+
+	long long nMicroseconds = (FrameTicks() - nStart) * 1000000 / FrameTickFrequency();
+	if (m_TraceAnomaly > 0 && nMicroseconds >= m_TraceAnomaly)
+	{
+		// The frame is late already: leave the snapshot and the file to
+		// the trace thread rather than stall the frames after it as well
+		m_Trace.Record(TRACE_ANOMALY, (unsigned int)nMicroseconds);
+		double dNow = FrameSeconds();
+		if (m_bTraceThread && (m_dTraceSaved == 0 || dNow - m_dTraceSaved >= g_TraceSaveInterval))
+		{
+			m_dTraceSaved = dNow;
+			CFrameAutoLock lock(&m_TraceLock);
+			m_bTraceSave = true;
+			m_TraceWake.Signal();
+		}
+	}
+	return hr;
+}
+
+HRESULT CFrameProcessFilter::TransformFrame(IMediaSample *pSource, IMediaSample *pDest)
 {
     // Note: The filter has already set the sample properties on pOut,
     // (see CTransformFilter::InitializeOutputSample).
     // You can override the timestamps if you need - but not in our case.
 
-    // The filter already locked m_csReceive so we're OK.
-    // Look for format changes from the video renderer.
+    // The filter already locked m_csReceive so we're OK. Settings made
+    // since the last frame take effect with this one.
+    ApplyPending();
+
+    // Look for format changes from upstream, which the source announces
+    // on the first sample of the new format.
     CMediaType *pmt = 0;
+    if (S_OK == pSource->GetMediaType((AM_MEDIA_TYPE**)&pmt) && pmt)
+    {
+        m_pInput->SetMediaType(pmt);
+        DeleteMediaType(pmt);
+        pmt = 0;
+    }
+
+    // Look for format changes from the video renderer.
     if (S_OK == pDest->GetMediaType((AM_MEDIA_TYPE**)&pmt) && pmt)
     {
 
@@ -312,284 +490,521 @@ HRESULT CFrameProcessFilter::Transform(IMediaSample *pSource, IMediaSample *pDes
     pSource->GetPointer(&pBufferIn);
     pDest->GetPointer(&pBufferOut);
 
+    // A sample too small for the negotiated format would be read or written
+    // past its end; skip the frame instead
+    if ((size_t)pSource->GetSize() < GetImageBytes(&m_VihIn) ||
+        (size_t)pDest->GetSize() < GetImageBytes(&m_VihOut))
+    {
+        return S_FALSE;
+    }
+
     long cbByte = 0;
     // Process the buffers
     //HRESULT hr = ProcessFrameYV12(pBufferIn, pBufferOut, &cbByte);
+	m_pSliceSample = pDest;
+	bool bPreview = m_pPreviewPin != NULL && m_pPreviewPin->IsConnected();
+	m_Engine.SetPreview(bPreview ? &m_Preview : NULL);
 	HRESULT hr = ProcessFrameYUY2(pBufferIn, pBufferOut, &cbByte);
+	m_pSliceSample = NULL;
+	if (bPreview && hr == S_OK)
+		DeliverPreview(pDest);
+
+	// The motion of the frame goes with the time of its sample
+	if (m_bMotion)
+	{
+		REFERENCE_TIME tStart, tStop;
+		FrameMotionInfo motion;
+		m_Motion.GetInfo(&motion);
+		CAutoLock lock(&m_csStats);
+		m_LastMotion = motion;
+		m_MotionTime = pDest->GetTime(&tStart, &tStop) == S_OK ? tStart : -1;
+	}
+
+	// And so does its fingerprint
+	if (m_bFingerprint)
+	{
+		REFERENCE_TIME tStart, tStop;
+		FrameFingerprintInfo fingerprint;
+		m_Fingerprint.GetInfo(&fingerprint);
+		CAutoLock lock(&m_csStats);
+		m_LastFingerprint = fingerprint;
+		m_FingerprintTime = pDest->GetTime(&tStart, &tStop) == S_OK ? tStart : -1;
+	}
 
     // Set the size of the destination image.
-    ASSERT(pDest->GetSize() >= cbByte);
-    
     pDest->SetActualDataLength(cbByte);
     return hr;
 }
 
-#define PI 3.1415926
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::InitializeOutputSample
+//
+// The wait for an output buffer, in the trace
+//-----------------------------------------------------------------------------
+HRESULT CFrameProcessFilter::InitializeOutputSample(IMediaSample *pSample, IMediaSample **ppOutSample)
+{
+	m_Trace.Record(TRACE_ALLOC_START, 0);
+	HRESULT hr = CTransformFilter::InitializeOutputSample(pSample, ppOutSample);
+	m_Trace.Record(TRACE_ALLOC_END, FAILED(hr) ? 1 : 0);
+	return hr;
+}
 
-void CFrameProcessFilter::InitArrays()
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::StartStreaming
+//
+// A new stream starts: count frames from zero again, let the automatic
+// levels settle on the new pictures instead of the old ones and start at
+// full quality.
+//-----------------------------------------------------------------------------
+HRESULT CFrameProcessFilter::StartStreaming()
 {
-	// Luma precomputed data
-	for ( int i = 0; i < 256; i++ )
 	{
-		for ( int j = 0; j < 256; j++)
-		{
-			double C = (double)j / 127.0;
-			double Lu = (double)i;
-
-			Lu = ((Lu-16) * C);
-			if ( Lu < 0)
-			{
-				Lu = 0;	
-			}	
-			m_Lumas1[i][j] = (short)Lu;
-		}
+		CAutoLock lock(&m_csStats);
+		m_dwFrames = 0;
 	}
-
-	for ( int i = 0; i < 512; i++ )
+	m_AutoLevels.Reset();
+	m_Qos.Reset();
+	m_Reuse.Reset();
+	m_Motion.Reset();
+	m_Fingerprint.Reset();
 	{
-		for ( int j = 0; j < 256; j++)
-		{
-			int B =  (int)j;	
-			int Lu = (int)i;
-
-			Lu = Lu + (B-127) + 16;
-			if ( Lu < 0 ) Lu = 0;
-			if (Lu > 255) Lu = 255;
-			m_Lumas2[i][j] = (unsigned char)Lu;
-		}
+		CAutoLock lock(&m_csStats);
+		memset(&m_LastMotion, 0, sizeof(m_LastMotion));
+		m_MotionTime = -1;
+		memset(&m_LastFingerprint, 0, sizeof(m_LastFingerprint));
+		m_FingerprintTime = -1;
 	}
+	m_dwGhostCount = 0;
+	m_Ghost.clear();
+	return CTransformFilter::StartStreaming();
+}
 
-	// Gamma correction
-	for ( int i = 0; i < 256; i++ )
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::CompleteConnect
+//
+// When the output connects, find out whether the downstream filter takes
+// slices: its input pin or the filter itself may implement
+// IFrameSliceCallback.
+//-----------------------------------------------------------------------------
+HRESULT CFrameProcessFilter::CompleteConnect(PIN_DIRECTION direction, IPin *pReceivePin)
+{
+	if (direction == PINDIR_OUTPUT)
 	{
-		for ( int j = 0; j < 256; j++)
+		CAutoLock lock(&m_csReceive);
+		if (m_pDownstreamSlices != NULL)
 		{
-			double G = (double)j;
-			if ( G < 0.0001) G = 0.01;
-			G = 128.0/G;
-			double Lu = (double)i;
-			Lu = 255.0 * pow((Lu/255.0),G);
-			if (Lu < 0) Lu = 0;
-			if (Lu > 255) Lu = 255;
-			m_Lumas3[i][j] = (unsigned char)Lu;
+			m_pDownstreamSlices->Release();
+			m_pDownstreamSlices = NULL;
 		}
-	}
-
-	// Chroma precomputed data
-	//__asm {emms};
-	/*for (int i=-180,ii=0;i<=180;ii++,i++)
-	{
-		double Hue=(i * 3.1415926) / 180.0;
-		hueSin[ii]=int(sin(Hue) * 128);
-		hueCos[ii]=int(cos(Hue) * 128);
-	}*/
-
-	// U-128(V-128)*Cos
-	for ( int i = 0; i < 256; i++)
-	{
-		for ( int j = 0; j < 256; j++)
+		if (FAILED(pReceivePin->QueryInterface(IID_IFrameSliceCallback, (void **)&m_pDownstreamSlices)))
 		{
-			double H = (double)j - 128.0;
-			H *= 180.0/128.0;
-			int Cr = (int)((i - 128) * cos(H*PI/180.0) + 180);
-			// -180 -> 0 -> 180
-			if (Cr < 0) Cr = 0;
-			if (Cr > 360) Cr = 360;
-			m_Chromas1[i][j] = (short)Cr;
+			m_pDownstreamSlices = NULL;
+			PIN_INFO info;
+			if (SUCCEEDED(pReceivePin->QueryPinInfo(&info)) && info.pFilter != NULL)
+			{
+				if (FAILED(info.pFilter->QueryInterface(IID_IFrameSliceCallback, (void **)&m_pDownstreamSlices)))
+					m_pDownstreamSlices = NULL;
+				info.pFilter->Release();
+			}
 		}
 	}
+	return CTransformFilter::CompleteConnect(direction, pReceivePin);
+}
 
-	// U-128(V-128)*Sin
-	for ( int i = 0; i < 256; i++)
+HRESULT CFrameProcessFilter::BreakConnect(PIN_DIRECTION direction)
+{
+	if (direction == PINDIR_OUTPUT)
 	{
-		for ( int j = 0; j < 256; j++)
+		CAutoLock lock(&m_csReceive);
+		if (m_pDownstreamSlices != NULL)
 		{
-			double H = (double)j - 128.0;
-			H *= 180.0/128.0;
-			int Cr = (int)((i - 128) * sin(H*PI/180.0) + 180);
-			// -180 -> 0 -> 180
-			if (Cr < 0) Cr = 0;
-			if (Cr > 360) Cr = 360;
-			m_Chromas2[i][j] = (short)Cr;
+			m_pDownstreamSlices->Release();
+			m_pDownstreamSlices = NULL;
 		}
 	}
+	return CTransformFilter::BreakConnect(direction);
+}
 
-	//(U-128) x Cos(H) + (V-128) x Sin(H)
-	for ( int i = 0; i < 360; i++)
-	{
-		for ( int j = 0; j < 360; j++)
-		{
-			int Cr1 = i - 180;
-			int Cr2 = j - 180;
-			int Cr = (Cr1 + Cr2) + 180;
-			if (Cr < 0) Cr = 0;
-			if (Cr > 360) Cr = 360;
-			m_Chromas3[i][j] = (short)Cr;
-		}
-	}
+CFrameProcessFilter::~CFrameProcessFilter()
+{
+	StopTraceThread();
+	if (m_pSliceCallback != NULL)
+		m_pSliceCallback->Release();
+	if (m_pDownstreamSlices != NULL)
+		m_pDownstreamSlices->Release();
+	delete m_pPreviewPin;
+}
 
-	//(U-128) x Cos(H) - (V-128) x Sin(H)
-	for ( int i = 0; i < 360; i++)
-	{
-		for ( int j = 0; j < 360; j++)
-		{
-			int Cr1 = i - 180;
-			int Cr2 = j - 180;
-			int Cr = (Cr1 - Cr2) + 180;
-			if (Cr < 0) Cr = 0;
-			if (Cr > 360) Cr = 360;
-			m_Chromas4[i][j] = (short)Cr;
-		}
-	}
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::GetPinCount, GetPin, FindPin
+//
+// The preview pin is pin 2. CTransformFilter makes the input and the output
+// pin when they are first asked for; the preview pin is made with them.
+//-----------------------------------------------------------------------------
+int CFrameProcessFilter::GetPinCount()
+{
+	return CTransformFilter::GetPinCount() + 1;
+}
 
-	// Saturation
-	for ( int i = 0; i < 360; i++)
+CBasePin *CFrameProcessFilter::GetPin(int n)
+{
+	if (n != 2)
+		return CTransformFilter::GetPin(n);
+	if (m_pPreviewPin == NULL && CTransformFilter::GetPin(0) != NULL)
 	{
-		for ( int j = 0; j < 256; j++)
+		HRESULT hr = S_OK;
+		m_pPreviewPin = new CFramePreviewPin(this, &m_csFilter, &hr);
+		if (m_pPreviewPin != NULL && FAILED(hr))
 		{
-			int Cr = i - 180;
-			int S = j/4;
-			int res =  (Cr * S)/32 + 128;
-			if (res < 0) res = 0;
-			if (res > 255) res = 255;
-			m_Chromas5[i][j] = (unsigned char )res;
-
+			delete m_pPreviewPin;
+			m_pPreviewPin = NULL;
 		}
 	}
-
+	return m_pPreviewPin;
 }
 
-unsigned char CFrameProcessFilter::ProcessLuma(unsigned char src)
+STDMETHODIMP CFrameProcessFilter::FindPin(LPCWSTR Id, IPin **ppPin)
 {
-	short C = m_Lumas1[src][m_Contrast];
-	unsigned char L =  m_Lumas2[C][m_Brightness];	
-	return m_Lumas3[L][m_Gamma];
+	CheckPointer(Id, E_POINTER);
+	CheckPointer(ppPin, E_POINTER);
+	if (wcscmp(Id, g_PreviewPinName) != 0)
+		return CTransformFilter::FindPin(Id, ppPin);
+	*ppPin = GetPin(2);
+	if (*ppPin == NULL)
+		return VFW_E_NOT_FOUND;
+	(*ppPin)->AddRef();
+	return S_OK;
 }
 
-void CFrameProcessFilter::ProcessChroma(unsigned char srcU, unsigned char srcV,
-	unsigned char *dstU, unsigned char *dstV)
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::Stop, EndOfStream, BeginFlush, EndFlush, NewSegment
+//
+// CTransformFilter passes these on to its own output pin only.
+//-----------------------------------------------------------------------------
+STDMETHODIMP CFrameProcessFilter::Stop()
 {
-	short p1 = m_Chromas1[srcU][m_Hue]; // Cos
-	short p2 = m_Chromas2[srcV][m_Hue]; // Sin
-	short p3 = m_Chromas3[p1][p2];
-
-	/*double H = (double)m_Hue - 128.0;
-	H *= 180.0/128.0;
-	int sat = m_Saturation/4.0;
-	double u = (double)srcU - 128;
-	double v = (double)srcV - 128;
-	double u2 = u * cos(H*PI/180.0) + v * sin(H*PI/180.0);
-	u = ((int)(u2 * m_Saturation/4.0) >> 6) + 128;*/
-
-	*dstU = m_Chromas5[p3][m_Saturation];
-
-	/*if (  (int)u != *dstU
-		&& (int)u != *dstU-1
-		&& (int)u != *dstU+1
-		&& (int)u != *dstU-2
-		&& (int)u != *dstU+2
-		&& (int)u != *dstU-3
-		&& (int)u != *dstU+3
-		&& (int)u != *dstU-4
-		&& (int)u != *dstU+4
-		&& (int)u != *dstU-5
-		&& (int)u != *dstU+5
-		&& (int)u != *dstU-6
-		&& (int)u != *dstU+6
-		&& (int)u != *dstU-7
-		&& (int)u != *dstU+7
-		&& (int)u != *dstU-8
-		&& (int)u != *dstU+8
-		)
-
-	{
-		int t = 4;
-		t = 4;
-
-	}*/
-
-	short p4 = m_Chromas1[srcV][m_Hue]; // Cos
-	short p5 = m_Chromas2[srcU][m_Hue]; // Sin
-	short p6 = m_Chromas3[p4][p5];
-	*dstV = m_Chromas5[p6][m_Saturation];
+	HRESULT hr = CTransformFilter::Stop();
+	if (m_pPreviewPin != NULL && m_pPreviewPin->IsConnected())
+		m_pPreviewPin->Inactive();
+	return hr;
+}
 
-	// Old
-	/*double h = (double)m_Hue;
-	h -= 128;
-	h *= 180.0/128.0;
+HRESULT CFrameProcessFilter::EndOfStream()
+{
+	if (m_pPreviewPin != NULL && m_pPreviewPin->IsConnected())
+		m_pPreviewPin->DeliverEndOfStream();
+	return CTransformFilter::EndOfStream();
+}
 
-	int sat = m_Saturation/4.0;
+HRESULT CFrameProcessFilter::BeginFlush()
+{
+	if (m_pPreviewPin != NULL && m_pPreviewPin->IsConnected())
+		m_pPreviewPin->DeliverBeginFlush();
+	return CTransformFilter::BeginFlush();
+}
 
-	int Cos = hueCos[(int)h+180];
-	int Sin = hueSin[(int)h+180];
+HRESULT CFrameProcessFilter::EndFlush()
+{
+	if (m_pPreviewPin != NULL && m_pPreviewPin->IsConnected())
+		m_pPreviewPin->DeliverEndFlush();
+	return CTransformFilter::EndFlush();
+}
 
-	int u = srcU - 128;
-    int v = srcV - 128;
+HRESULT CFrameProcessFilter::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+{
+	if (m_pPreviewPin != NULL && m_pPreviewPin->IsConnected())
+		m_pPreviewPin->DeliverNewSegment(tStart, tStop, dRate);
+	return CTransformFilter::NewSegment(tStart, tStop, dRate);
+}
 
-	
-	int u2 = ((u * Cos)>>7) + ((v * Sin)>>7);
-    int v2 = ((v * Cos)>>7) - ((u * Sin)>>7);
+//
+// Size of the preview of the output frames: of the output type, or of the
+// input type until the output is connected. False without a preview.
+//
+bool CFrameProcessFilter::GetPreviewSize(int *pWidth, int *pHeight)
+{
+	*pWidth = *pHeight = 0;
+	if (m_pInput == NULL || !m_pInput->IsConnected())
+		return false;
+	int nWidth, nHeight;
+	GetFrameSize(m_pOutput->IsConnected() ? m_VihOut : m_VihIn, &nWidth, &nHeight);
+	CFramePreview::PreviewSize(FRAME_FORMAT_YUY2, nWidth, nHeight, m_Preview.Factor(), pWidth, pHeight);
+	return *pWidth > 0;
+}
 
-    u = ((u2 * sat) >> 6) + 128;
-    v = ((v2 * sat) >> 6) + 128;
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::CheckPreviewType
+//
+// YUY2 of the preview size; the renderer may ask for wider rows or a target
+// rectangle of that size.
+//-----------------------------------------------------------------------------
+HRESULT CFrameProcessFilter::CheckPreviewType(const CMediaType *pmt)
+{
+	int nWidth, nHeight;
+	if (!IsValidYV12(pmt) || !GetPreviewSize(&nWidth, &nHeight))
+		return VFW_E_TYPE_NOT_ACCEPTED;
+	VIDEOINFOHEADER vih;
+	CopyVideoInfo(&vih, pmt);
+	int nTypeWidth, nTypeHeight;
+	GetFrameSize(vih, &nTypeWidth, &nTypeHeight);
+	if (nTypeWidth != nWidth || nTypeHeight != nHeight)
+		return VFW_E_TYPE_NOT_ACCEPTED;
+	return S_OK;
+}
 
-    if (u < 0) u = 0;
-    if (u > 255) u = 255;
-    if (v < 0) v = 0;
-    if (v > 255) v = 255;
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::GetPreviewType
+//
+// The one type the preview pin offers: YUY2 of the preview size at the
+// frame rate of the input.
+//-----------------------------------------------------------------------------
+HRESULT CFrameProcessFilter::GetPreviewType(int iPosition, CMediaType *pmt)
+{
+	if (iPosition < 0)
+		return E_INVALIDARG;
+	int nWidth, nHeight;
+	if (iPosition > 0 || !GetPreviewSize(&nWidth, &nHeight))
+		return VFW_S_NO_MORE_ITEMS;
+
+	VIDEOINFOHEADER *pVih = (VIDEOINFOHEADER *)pmt->AllocFormatBuffer(sizeof(VIDEOINFOHEADER));
+	if (pVih == NULL)
+		return E_OUTOFMEMORY;
+	ZeroMemory(pVih, sizeof(VIDEOINFOHEADER));
+	pVih->AvgTimePerFrame = m_VihIn.AvgTimePerFrame;
+	BITMAPINFOHEADER &bmi = pVih->bmiHeader;
+	bmi.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.biWidth = nWidth;
+	bmi.biHeight = nHeight;
+	bmi.biPlanes = 1;
+	bmi.biBitCount = 16;
+	bmi.biCompression = FCC('YUY2');
+	bmi.biSizeImage = DIBSIZE(bmi);
+
+	pmt->SetType(&MEDIATYPE_Video);
+	pmt->SetSubtype(&MEDIASUBTYPE_YUY2);
+	pmt->SetFormatType(&FORMAT_VideoInfo);
+	pmt->SetTemporalCompression(FALSE);
+	pmt->SetSampleSize(bmi.biSizeImage);
+	return S_OK;
+}
 
-    *dstU = u;
-    *dstV = v;*/
+HRESULT CFrameProcessFilter::SetPreviewType(const CMediaType *pmt)
+{
+	CopyVideoInfo(&m_VihPreview, pmt);
+	return S_OK;
+}
 
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::DecidePreviewBufferSize
+//
+// One buffer with the renderer and one to fill at least; a frame that finds
+// none free goes without a preview rather than waiting for one.
+//-----------------------------------------------------------------------------
+HRESULT CFrameProcessFilter::DecidePreviewBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp)
+{
+	if (pProp->cbAlign == 0)
+		pProp->cbAlign = 1;
+	if (pProp->cBuffers < 2)
+		pProp->cBuffers = 2;
+	pProp->cbBuffer = max((long)GetImageBytes(&m_VihPreview), pProp->cbBuffer);
+
+	ALLOCATOR_PROPERTIES Actual;
+	HRESULT hr = pAlloc->SetProperties(pProp, &Actual);
+	if (FAILED(hr))
+		return hr;
+	if (Actual.cbBuffer < pProp->cbBuffer)
+		return E_FAIL;
+	return S_OK;
 }
 
-void CFrameProcessFilter::UpdateLuma()
+//
+// Send the preview of the frame just processed, timed like its output
+// sample. A preview type of another size than the preview, after the
+// output type changed, gets nothing until the pin is connected again.
+//
+void CFrameProcessFilter::DeliverPreview(IMediaSample *pDest)
 {
-	double C = (double)m_Contrast / 127.0;
-	double G = (double)m_Gamma;
-	if ( G < 0.0001) G = 0.01;
-	G = 128.0/G;
-	for ( int i = 0; i < 256; i++)
+	const FrameDesc &preview = m_Preview.Frame();
+	IMediaSample *pSample = NULL;
+	if (preview.nWidth == 0 ||
+		FAILED(m_pPreviewPin->GetDeliveryBuffer(&pSample, NULL, NULL, AM_GBF_NOWAIT)))
+		return;
+
+	CMediaType *pmt = 0;
+	if (S_OK == pSample->GetMediaType((AM_MEDIA_TYPE**)&pmt) && pmt)
 	{
-		double L =  ((i-16) * C)+ (m_Brightness-127) + 16;
-		L = 255.0 * pow((L/255.0),G);
-		if (L < 0 ) L = 0;
-		if (L > 255) L = 255;
-		m_Luma[i] = (unsigned char)L;
+		m_pPreviewPin->SetMediaType(pmt);
+		DeleteMediaType(pmt);
 	}
+	BYTE *pBuffer, *pbTop;
+	DWORD dwWidth, dwHeight;
+	LONG lStride;
+	pSample->GetPointer(&pBuffer);
+	GetVideoInfoParameters(&m_VihPreview, pBuffer, &dwWidth, &dwHeight, &lStride, &pbTop, true);
+	if ((int)dwWidth == preview.nWidth && (int)dwHeight == preview.nHeight &&
+		(size_t)pSample->GetSize() >= GetImageBytes(&m_VihPreview))
+	{
+		for (int y = 0; y < preview.nHeight; y++)
+			CopyMemory(pbTop + (ptrdiff_t)lStride * y, preview.pbTop + preview.lStride * y, preview.nWidth * 2);
+		REFERENCE_TIME tStart, tStop;
+		HRESULT hr = pDest->GetTime(&tStart, &tStop);
+		if (SUCCEEDED(hr))
+			pSample->SetTime(&tStart, hr == S_OK ? &tStop : NULL);
+		pSample->SetSyncPoint(TRUE);
+		pSample->SetDiscontinuity(pDest->IsDiscontinuity() == S_OK);
+		pSample->SetActualDataLength((long)GetImageBytes(&m_VihPreview));
+		m_pPreviewPin->Deliver(pSample);
+		if (m_Trace.Enabled())
+			m_Trace.Record(TRACE_QUEUE_DEPTH, m_pPreviewPin->QueueDepth());
+	}
+	pSample->Release();
 }
 
-void CFrameProcessFilter::UpdateChroma()
+//
+// The engine finished a slice of the frame in m_pSliceSample
+//
+void CFrameProcessFilter::SliceDone(const FrameDesc &dst, int nFirstRow, int nLastRow)
 {
-	double H = (double)m_Hue - 128.0;
-	H *= 180.0/128.0;
-	double cosH = cos(H*PI/180.0);
-	double sinH = sin(H*PI/180.0);
+	if (m_pSliceCallback != NULL)
+		m_pSliceCallback->SliceReady(m_pSliceSample, nFirstRow, nLastRow, dst.nHeight);
+	if (m_pDownstreamSlices != NULL)
+		m_pDownstreamSlices->SliceReady(m_pSliceSample, nFirstRow, nLastRow, dst.nHeight);
+}
 
-	int S = m_Saturation/4;
+//----------------------------------------------------------------------------
+// CFrameProcessFilter::AlterQuality
+//
+// A quality message from downstream, on whatever thread the renderer sends
+// it. The next frame decides whether to shed work; once there is nothing
+// left to shed the messages go upstream as well, so that the source drops
+// frames instead.
+//-----------------------------------------------------------------------------
+HRESULT CFrameProcessFilter::AlterQuality(Quality q)
+{
+	if (!m_bQuality)
+		return S_FALSE;
+	m_Qos.Notify(q.Late / 10000000.0, q.Proportion);
+	return m_Qos.Level() == FRAME_QOS_PASSTHROUGH ? S_FALSE : S_OK;
+}
 
-	for ( int i = 0; i < 256; i++)
+//
+// The engine picks its kernels and bumps its generation along with the
+// tables, so a setting never changes under a frame: the streaming thread
+// applies what the setters left in the pending state before each frame,
+// holding m_csReceive. m_csPending is only held to copy the settings.
+//
+void CFrameProcessFilter::ApplyPending()
+{
+	DWORD dwPending;
+	unsigned char Brightness, Contrast, Hue, Saturation, Gamma;
+	BOOL bAutoLevels;
 	{
-		for ( int j = 0; j < 256; j++)
+		CAutoLock lock(&m_csPending);
+		dwPending = m_dwPending;
+		m_dwPending = 0;
+		Brightness = m_Brightness;
+		Contrast = m_Contrast;
+		Hue = m_Hue;
+		Saturation = m_Saturation;
+		Gamma = m_Gamma;
+		bAutoLevels = m_bAutoLevels;
+		if (dwPending & PENDING_CUBE)
 		{
-			double Cr = (((i - 128) * cosH + (j-128) * sinH) * S)/32 + 128;
-			if (Cr < 0) Cr = 0;
-			if (Cr > 256) Cr = 256;
-			m_ChromaU[i][j] = (unsigned char)Cr;
+			if (m_bCube)
+				m_Cube = m_PendingCube;
+			m_bCubeOn = m_bCube;
+			m_bCubeBakeOn = m_bCubeBake;
 		}
 	}
-
-	for ( int i = 0; i < 256; i++)
+	if (dwPending == 0)
+		return;
+
+	if (dwPending & PENDING_LUMA)
+		m_Engine.UpdateLuma(Brightness, Contrast, Gamma);
+	if (dwPending & PENDING_CHROMA)
+		m_Engine.UpdateChroma(Hue, Saturation);
+	if ((dwPending & PENDING_AUTOLEVELS) && bAutoLevels != m_bAutoLevelsOn)
 	{
-		for ( int j = 0; j < 256; j++)
+		if (bAutoLevels)
+		{
+			m_AutoLevels.Reset();
+			if (m_AutoLevels.Start())
+			{
+				m_Engine.SetLumaCurve(m_AutoLevels.Curve());
+				m_bAutoLevelsOn = TRUE;
+			}
+			else
+			{
+				// Nothing to analyse the frames: show the levels as off
+				CAutoLock lock(&m_csPending);
+				m_bAutoLevels = FALSE;
+			}
+		}
+		else
 		{
-			double Cr = (((j - 128) * cosH - (i-128) * sinH) * S)/32 + 128;
-			if (Cr < 0) Cr = 0;
-			if (Cr > 256) Cr = 256;
-			m_ChromaV[i][j] = (unsigned char)Cr;
+			m_Engine.SetLumaCurve(NULL);
+			m_AutoLevels.Stop();
+			m_bAutoLevelsOn = FALSE;
 		}
 	}
+	if ((dwPending & PENDING_CUBE) && !m_bCubeOn)
+		m_Engine.ClearCube();
+	if (dwPending & PENDING_SPACES)
+		UpdateColorSpaces();
+	else if (dwPending & PENDING_CUBE)
+		UpdateCube();
+}
+
+//
+// Rebuild the engine's lattice from m_Cube. Baked levels run through the
+// control tables in front of it, so only the colour spaces and the cube
+// itself call for a new one; that takes a few milliseconds, so it happens
+// under the streaming lock rather than under a frame.
+//
+static ColorSpace MakeSpace(DWORD Matrix, BOOL FullRange)
+{
+	ColorMatrix matrix = Matrix == FRAMEMATRIX_BT709 ? COLOR_MATRIX_BT709 :
+		(Matrix == FRAMEMATRIX_BT2020 ? COLOR_MATRIX_BT2020 : COLOR_MATRIX_BT601);
+	return MakeColorSpace(matrix, FullRange != FALSE);
+}
 
+ColorSpace CFrameProcessFilter::InputSpace() const
+{
+	if (m_InMatrix == FRAMEMATRIX_AUTO)
+		return m_TypeSpace;
+	return MakeSpace(m_InMatrix, m_bInFullRange);
+}
+
+ColorSpace CFrameProcessFilter::OutputSpace() const
+{
+	if (m_OutMatrix == FRAMEMATRIX_AUTO)
+		return InputSpace();
+	return MakeSpace(m_OutMatrix, m_bOutFullRange);
+}
+
+//
+// Hand the colour spaces to the engine; a cube is converted with them, so
+// it is rebuilt as well
+//
+void CFrameProcessFilter::UpdateColorSpaces()
+{
+	CAutoLock lock(&m_csReceive);
+	ColorSpace in, out;
+	{
+		CAutoLock lockPending(&m_csPending);
+		in = InputSpace();
+		out = OutputSpace();
+	}
+	m_Engine.SetColorSpaces(in, out);
+	UpdateCube();
+}
+
+void CFrameProcessFilter::UpdateCube()
+{
+	if (!m_bCubeOn)
+		return;
+	CAutoLock lock(&m_csReceive);
+	m_Engine.SetCube(m_Cube, m_bCubeBakeOn != FALSE);
 }
 	
 
@@ -675,103 +1090,115 @@ void CFrameProcessFilter::UpdateChroma()
 
 }*/
 
-BYTE g_frm[3686400];
-int n = 500;
-int cur = 0;
-
 HRESULT CFrameProcessFilter::ProcessFrameYUY2(BYTE *pbInput, BYTE *pbOutput, long *pcbByte)
 {
 
     DWORD dwWidth, dwHeight;      // Width and height in pixels
+    DWORD dwWidthOut, dwHeightOut;
     LONG  lStrideIn, lStrideOut;  // Stride in bytes
     BYTE  *pbSource, *pbTarget;   // First byte in first row, for source and target.
 
     *pcbByte = m_VihOut.bmiHeader.biSizeImage;
 
     GetVideoInfoParameters(&m_VihIn, pbInput, &dwWidth, &dwHeight, &lStrideIn, &pbSource, true);
-    GetVideoInfoParameters(&m_VihOut, pbOutput, &dwWidth, &dwHeight, &lStrideOut, &pbTarget, true);
-	
-//	DWORD start = timeGetTime();
-	BYTE *pbSource2 = (BYTE *)g_frm;
-
-	unsigned int i = 0;
-	for (i = 0; i < dwHeight; i++)
-    {
-		for ( int j = 0; j < lStrideIn; j+=4)
-		{
-			
-			/*pbSource[j] = m_Luma[pbSource[j]];
-			pbSource[j+1] = m_ChromaU[pbSource[j+1]][pbSource[j+3]];
-			pbSource[j+2] = m_Luma[pbSource[j+2]];
-			pbSource[j+3] = m_ChromaV[pbSource[j+1]][pbSource[j+3]];*/
-
-			pbSource[j] = m_Luma[pbSource[j]];
-			BYTE u = pbSource[j+1];
-			pbSource[j+1] = m_ChromaU[u][pbSource[j+3]];
-			pbSource[j+2] = m_Luma[pbSource[j+2]];
-			pbSource[j+3] = m_ChromaV[u][pbSource[j+3]];
-
-			if ( cur > n)
-			{
-				pbSource[j] = 0.5*(double)pbSource[j] + 0.5*(double)pbSource2[j];
-				pbSource[j+1] = 0.5*(double)pbSource[j+1] + 0.5*(double)pbSource2[j+1];
-				pbSource[j+2] = 0.5*(double)pbSource[j+2] + 0.5*(double)pbSource2[j+2];
-				pbSource[j+3] = 0.5*(double)pbSource[j+3] + 0.5*(double)pbSource2[j+3];
-				/*pbSource[j] = pbSource2[j];
-				pbSource[j+1] = pbSource2[j+1];
-				pbSource[j+2] = pbSource2[j+2];
-				pbSource[j+3] = pbSource2[j+3];*/
-			}
-
-		}
-		if (cur == n)
+    GetVideoInfoParameters(&m_VihOut, pbOutput, &dwWidthOut, &dwHeightOut, &lStrideOut, &pbTarget, true);
+
+	// The colour transform reads the source and writes the target directly.
+	// A resize to the output frame size and the unsharp mask run in front of
+	// it, all of them on one tile of rows before the next while it is in
+	// the cache.
+	FrameDesc src = FrameLayout(pbSource, FRAME_FORMAT_YUY2, (int)dwWidth, (int)dwHeight);
+	src.lStride = lStrideIn;
+	FrameDesc dst = FrameLayout(pbTarget, FRAME_FORMAT_YUY2, (int)dwWidthOut, (int)dwHeightOut);
+	dst.lStride = lStrideOut;
+	// Automatic levels need the histogram even when nobody reads the statistics
+	bool bStats = m_bStats || m_bAutoLevelsOn;
+
+	// Under load the optional stages go first, then the chroma tables, then
+	// the colour transform altogether. The resize always stays.
+	m_QosLevel = m_bQuality ? m_Qos.NextFrame() : FRAME_QOS_FULL;
+	bool bOptional = m_QosLevel < FRAME_QOS_NO_OPTIONAL;
+	m_Engine.SetBypass(m_QosLevel >= FRAME_QOS_PASSTHROUGH, m_QosLevel >= FRAME_QOS_NO_CHROMA);
+
+	// From frame g_GhostFrame on every output frame is averaged with a copy
+	// of that frame, taken at the size of the output type
+	const size_t cbGhost = FrameBytes(FRAME_FORMAT_YUY2, (int)dwWidthOut, (int)dwHeightOut);
+	FrameDesc ghost = FrameLayout(m_Ghost.empty() ? NULL : &m_Ghost[0],
+		FRAME_FORMAT_YUY2, (int)dwWidthOut, (int)dwHeightOut);
+	m_Engine.SetBlend(m_Ghost.size() == cbGhost && bOptional ? &ghost : NULL);
+
+	// Slices only while someone takes them
+	bool bSlices = m_SliceRows > 0 && (m_pSliceCallback != NULL || m_pDownstreamSlices != NULL);
+	m_Engine.SetSlices(bSlices ? (int)m_SliceRows : 0, this);
+
+	m_Pipeline.Clear();
+	if (dwWidth != dwWidthOut || dwHeight != dwHeightOut)
+		m_Pipeline.Add(&m_Scaler);
+	if (m_Sharpen.Enabled() && bOptional)
+		m_Pipeline.Add(&m_Sharpen);
+	m_Engine.ProcessStage(src, dst, m_Pipeline.StageCount() > 0 ? &m_Pipeline : NULL,
+		KERNEL_DIRECT, &m_Workers, bStats ? &m_Stats : NULL);
+	if (m_bStats)
+		PublishStats();
+	if (m_bAutoLevelsOn)
+	{
+		// A new scene gets its own levels at once
+		FrameMotionInfo motion;
+		if (m_bMotion)
 		{
-			CopyMemory(pbSource2, pbSource,lStrideIn);
-			
+			m_Motion.GetInfo(&motion);
+			if (motion.bSceneChange && motion.nFrame > 1)
+				m_AutoLevels.Reset();
 		}
-		
-		//CopyMemory(pbTarget,pbSource, lStrideOut*2);
-		CopyMemory(pbTarget,pbSource, lStrideIn);		
-
-		pbTarget += lStrideOut;
-		pbSource += lStrideIn;
-
-		//if (cur == n)
-			pbSource2 += lStrideIn;
+		m_AutoLevels.Feed(m_Stats);
 	}
 
-	cur++;
-
-	/*if (cur > n)
+	if (m_dwGhostCount == g_GhostFrame)
 	{
-		GetVideoInfoParameters(&m_VihIn, pbInput, &dwWidth, &dwHeight, &lStrideIn, &pbSource, true);
-		GetVideoInfoParameters(&m_VihOut, pbOutput, &dwWidth, &dwHeight, &lStrideOut, &pbTarget, true);
+		m_Ghost.resize(cbGhost);
+		ghost = FrameLayout(&m_Ghost[0], FRAME_FORMAT_YUY2, (int)dwWidthOut, (int)dwHeightOut);
+		for (int i = 0; i < ghost.nHeight; i++)
+			CopyMemory(ghost.pbTop + ghost.lStride * i, pbTarget + (ptrdiff_t)lStrideOut * i, ghost.lStride);
+	}
 
-		//	
+	m_dwGhostCount++;
 
-		for (i = 0; i < dwHeight; i++)
-		{
-			for ( int j = 0; j < lStrideIn; j++)
-			{
-				pbSource[j] = pbSource2[j];
-			}
-
-			CopyMemory(pbTarget,pbSource, lStrideIn);		
+    return S_OK;
 
-			pbTarget += lStrideOut;
-			pbSource += lStrideIn;
-			pbSource2 += lStrideIn;
-		}	
-	}*/
-		
+}
 
 
-    return S_OK;
+//
+// Copy the statistics of the frame just processed to m_LastStats
+//
+void CFrameProcessFilter::PublishStats()
+{
+	CAutoLock lock(&m_csStats);
 
+	FRAMESTATS &s = m_LastStats;
+	s.FrameNumber = ++m_dwFrames;
+	s.RowStep = m_Engine.GetStatsRowStep();
+	for (int i = 0; i < 256; i++)
+	{
+		s.LumaInHistogram[i] = m_Stats.LumaIn[i];
+		s.LumaHistogram[i] = m_Stats.Luma[i];
+		s.ChromaUHistogram[i] = m_Stats.ChromaU[i];
+		s.ChromaVHistogram[i] = m_Stats.ChromaV[i];
+	}
+	s.LumaMean = m_Stats.dLumaMean;
+	s.LumaMin = m_Stats.nLumaMin;
+	s.LumaMax = m_Stats.nLumaMax;
+	s.LumaInMean = m_Stats.dLumaInMean;
+	s.LumaInMin = m_Stats.nLumaInMin;
+	s.LumaInMax = m_Stats.nLumaInMax;
+	s.ChromaUMean = m_Stats.dUMean;
+	s.ChromaVMean = m_Stats.dVMean;
+	s.ChromaUSpread = m_Stats.dUSpread;
+	s.ChromaVSpread = m_Stats.dVSpread;
+	s.QualityLevel = (DWORD)m_QosLevel;
 }
 
 
-
 // COM stuff
 
 //----------------------------------------------------------------------------
@@ -838,7 +1265,10 @@ STDAPI DllUnregisterServer()
 //
 // NonDelegatingQueryInterface
 //
-// Reveals IFrameProcessor and ISpecifyPropertyPages
+// Reveals IFrameProcessor, IFrameStatistics, IFrameAutoLevels, IFrameColorCube,
+// IFrameColorSpace, IFrameScaling, IFrameSharpen, IFrameQuality, IFrameSlices,
+// IFrameRowReuse, IFrameMotion, IFrameOverlay, IFrameChromaKey, IFramePreview,
+// IFrameFingerprint, IFrameTrace and ISpecifyPropertyPages
 //
 STDMETHODIMP CFrameProcessFilter::NonDelegatingQueryInterface(REFIID riid, void **ppv)
 {
@@ -847,6 +1277,51 @@ STDMETHODIMP CFrameProcessFilter::NonDelegatingQueryInterface(REFIID riid, void
     if (riid == IID_IFrameProcessor) {
         return GetInterface((IFrameProcessor *) this, ppv);
 
+    } else if (riid == IID_IFrameStatistics) {
+        return GetInterface((IFrameStatistics *) this, ppv);
+
+    } else if (riid == IID_IFrameAutoLevels) {
+        return GetInterface((IFrameAutoLevels *) this, ppv);
+
+    } else if (riid == IID_IFrameColorCube) {
+        return GetInterface((IFrameColorCube *) this, ppv);
+
+    } else if (riid == IID_IFrameColorSpace) {
+        return GetInterface((IFrameColorSpace *) this, ppv);
+
+    } else if (riid == IID_IFrameScaling) {
+        return GetInterface((IFrameScaling *) this, ppv);
+
+    } else if (riid == IID_IFrameSharpen) {
+        return GetInterface((IFrameSharpen *) this, ppv);
+
+    } else if (riid == IID_IFrameQuality) {
+        return GetInterface((IFrameQuality *) this, ppv);
+
+    } else if (riid == IID_IFrameSlices) {
+        return GetInterface((IFrameSlices *) this, ppv);
+
+    } else if (riid == IID_IFrameRowReuse) {
+        return GetInterface((IFrameRowReuse *) this, ppv);
+
+    } else if (riid == IID_IFrameMotion) {
+        return GetInterface((IFrameMotion *) this, ppv);
+
+    } else if (riid == IID_IFrameOverlay) {
+        return GetInterface((IFrameOverlay *) this, ppv);
+
+    } else if (riid == IID_IFrameChromaKey) {
+        return GetInterface((IFrameChromaKey *) this, ppv);
+
+    } else if (riid == IID_IFramePreview) {
+        return GetInterface((IFramePreview *) this, ppv);
+
+    } else if (riid == IID_IFrameFingerprint) {
+        return GetInterface((IFrameFingerprint *) this, ppv);
+
+    } else if (riid == IID_IFrameTrace) {
+        return GetInterface((IFrameTrace *) this, ppv);
+
     } else if (riid == IID_ISpecifyPropertyPages) {
         return GetInterface((ISpecifyPropertyPages *) this, ppv);
 
@@ -886,8 +1361,10 @@ STDMETHODIMP CFrameProcessFilter::get_BrightnessLevel(unsigned char *BrightnessL
 }
 STDMETHODIMP CFrameProcessFilter::put_BrightnessLevel(unsigned char BrightnessLevel)
 {
+  CAutoLock lock(&m_csPending);
   m_Brightness = BrightnessLevel;
-  UpdateLuma();
+  m_dwPending |= PENDING_LUMA;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_BRIGHTNESS << 16 | BrightnessLevel);
   return NOERROR;
 }
 STDMETHODIMP CFrameProcessFilter::get_ContrastLevel(unsigned char *ContrastLevel)
@@ -897,8 +1374,10 @@ STDMETHODIMP CFrameProcessFilter::get_ContrastLevel(unsigned char *ContrastLevel
 }
 STDMETHODIMP CFrameProcessFilter::put_ContrastLevel(unsigned char ContrastLevel)
 {
+  CAutoLock lock(&m_csPending);
   m_Contrast = ContrastLevel;
-  UpdateLuma();
+  m_dwPending |= PENDING_LUMA;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_CONTRAST << 16 | ContrastLevel);
   return NOERROR;
 }
 STDMETHODIMP CFrameProcessFilter::get_HueLevel(unsigned char *HueLevel)
@@ -908,8 +1387,10 @@ STDMETHODIMP CFrameProcessFilter::get_HueLevel(unsigned char *HueLevel)
 }
 STDMETHODIMP CFrameProcessFilter::put_HueLevel(unsigned char HueLevel)
 {
+  CAutoLock lock(&m_csPending);
   m_Hue = HueLevel;
-  UpdateChroma();
+  m_dwPending |= PENDING_CHROMA;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_HUE << 16 | HueLevel);
   return NOERROR;
 }
 STDMETHODIMP CFrameProcessFilter::get_SaturationLevel(unsigned char *SaturationLevel)
@@ -919,8 +1400,10 @@ STDMETHODIMP CFrameProcessFilter::get_SaturationLevel(unsigned char *SaturationL
 }
 STDMETHODIMP CFrameProcessFilter::put_SaturationLevel(unsigned char SaturationLevel)
 {
+  CAutoLock lock(&m_csPending);
   m_Saturation = SaturationLevel;
-  UpdateChroma();
+  m_dwPending |= PENDING_CHROMA;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_SATURATION << 16 | SaturationLevel);
   return NOERROR;
 }
 STDMETHODIMP CFrameProcessFilter::get_GammaCorrectionLevel(unsigned char *GammaCorrectionLevel)
@@ -930,7 +1413,598 @@ STDMETHODIMP CFrameProcessFilter::get_GammaCorrectionLevel(unsigned char *GammaC
 }
 STDMETHODIMP CFrameProcessFilter::put_GammaCorrectionLevel(unsigned char GammaCorrectionLevel)
 {
+  CAutoLock lock(&m_csPending);
   m_Gamma = GammaCorrectionLevel;
-  UpdateLuma();
+  m_dwPending |= PENDING_LUMA;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_GAMMA << 16 | GammaCorrectionLevel);
+  m_AutoLevels.SetGamma(m_Gamma);
+  return NOERROR;
+}
+
+//
+// IFrameStatistics implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_StatisticsEnabled(BOOL *Enabled)
+{
+  CheckPointer(Enabled, E_POINTER);
+  *Enabled = m_bStats;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_StatisticsEnabled(BOOL Enabled)
+{
+  // Take the streaming lock so that a frame never sees half a change
+  CAutoLock lock(&m_csReceive);
+  m_bStats = Enabled;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::get_StatisticsRowStep(DWORD *RowStep)
+{
+  CheckPointer(RowStep, E_POINTER);
+  *RowStep = m_Engine.GetStatsRowStep();
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_StatisticsRowStep(DWORD RowStep)
+{
+  if (RowStep < 1)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  m_Engine.SetStatsRowStep((int)RowStep);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::GetFrameStatistics(FRAMESTATS *Stats)
+{
+  CheckPointer(Stats, E_POINTER);
+  CAutoLock lock(&m_csStats);
+  if (m_dwFrames == 0)
+    return S_FALSE;
+  *Stats = m_LastStats;
+  return NOERROR;
+}
+
+//
+// IFrameAutoLevels implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_AutoLevels(BOOL *Enabled)
+{
+  CheckPointer(Enabled, E_POINTER);
+  *Enabled = m_bAutoLevels;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_AutoLevels(BOOL Enabled)
+{
+  // The analysis starts and stops with the next frame
+  CAutoLock lock(&m_csPending);
+  m_bAutoLevels = Enabled ? TRUE : FALSE;
+  m_dwPending |= PENDING_AUTOLEVELS;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::get_AutoLevelsSmoothing(DWORD *Frames)
+{
+  CheckPointer(Frames, E_POINTER);
+  *Frames = m_AutoLevels.GetSmoothing();
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_AutoLevelsSmoothing(DWORD Frames)
+{
+  if (Frames < 1)
+    return E_INVALIDARG;
+  m_AutoLevels.SetSmoothing((int)Frames);
+  return NOERROR;
+}
+
+//
+// IFrameColorCube implementation
+//
+STDMETHODIMP CFrameProcessFilter::LoadCube(const WCHAR *Path)
+{
+  CheckPointer(Path, E_POINTER);
+  FILE *fp = _wfopen(Path, L"r");
+  if (fp == NULL)
+    return E_FAIL;
+  CColorCube cube;
+  bool bOk = cube.Load(fp);
+  fclose(fp);
+  if (!bOk)
+    return E_FAIL;
+
+  CAutoLock lock(&m_csPending);
+  m_PendingCube = cube;
+  m_bCube = TRUE;
+  m_dwPending |= PENDING_CUBE;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_CUBE << 16 | 1);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::ClearCube()
+{
+  CAutoLock lock(&m_csPending);
+  m_bCube = FALSE;
+  m_dwPending |= PENDING_CUBE;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_CUBE << 16 | 0);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::get_CubeLoaded(BOOL *Loaded)
+{
+  CheckPointer(Loaded, E_POINTER);
+  *Loaded = m_bCube;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::get_CubeBakeLevels(BOOL *Bake)
+{
+  CheckPointer(Bake, E_POINTER);
+  *Bake = m_bCubeBake;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_CubeBakeLevels(BOOL Bake)
+{
+  CAutoLock lock(&m_csPending);
+  m_bCubeBake = Bake;
+  m_dwPending |= PENDING_CUBE;
+  return NOERROR;
+}
+
+//
+// IFrameColorSpace implementation
+//
+static DWORD MatrixOf(const ColorSpace &space)
+{
+  return space.matrix == COLOR_MATRIX_BT709 ? FRAMEMATRIX_BT709 :
+    (space.matrix == COLOR_MATRIX_BT2020 ? FRAMEMATRIX_BT2020 : FRAMEMATRIX_BT601);
+}
+STDMETHODIMP CFrameProcessFilter::get_InputColorSpace(DWORD *Matrix, BOOL *FullRange)
+{
+  CheckPointer(Matrix, E_POINTER);
+  CheckPointer(FullRange, E_POINTER);
+  CAutoLock lock(&m_csPending);
+  ColorSpace space = InputSpace();
+  *Matrix = MatrixOf(space);
+  *FullRange = space.bFullRange ? TRUE : FALSE;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_InputColorSpace(DWORD Matrix, BOOL FullRange)
+{
+  if (Matrix > FRAMEMATRIX_BT2020)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csPending);
+  m_InMatrix = Matrix;
+  m_bInFullRange = FullRange;
+  m_dwPending |= PENDING_SPACES;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_COLOR_SPACE << 16 | 0);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::get_OutputColorSpace(DWORD *Matrix, BOOL *FullRange)
+{
+  CheckPointer(Matrix, E_POINTER);
+  CheckPointer(FullRange, E_POINTER);
+  CAutoLock lock(&m_csPending);
+  ColorSpace space = OutputSpace();
+  *Matrix = MatrixOf(space);
+  *FullRange = space.bFullRange ? TRUE : FALSE;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_OutputColorSpace(DWORD Matrix, BOOL FullRange)
+{
+  if (Matrix > FRAMEMATRIX_BT2020)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csPending);
+  m_OutMatrix = Matrix;
+  m_bOutFullRange = FullRange;
+  m_dwPending |= PENDING_SPACES;
+  m_Trace.Record(TRACE_PARAMETER, TRACE_PARAM_COLOR_SPACE << 16 | 1);
+  return NOERROR;
+}
+
+//
+// IFrameScaling implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_ScaleFilter(DWORD *Filter)
+{
+  CheckPointer(Filter, E_POINTER);
+  CAutoLock lock(&m_csReceive);
+  *Filter = (DWORD)m_Scaler.GetFilter();
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_ScaleFilter(DWORD Filter)
+{
+  if (Filter > FRAMESCALE_LANCZOS)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  m_Scaler.SetFilter((ScaleFilter)Filter);
+  return NOERROR;
+}
+
+//
+// IFrameSharpen implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_SharpenRadius(DWORD *Radius)
+{
+  CheckPointer(Radius, E_POINTER);
+  CAutoLock lock(&m_csReceive);
+  *Radius = (DWORD)m_Sharpen.GetRadius();
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_SharpenRadius(DWORD Radius)
+{
+  if (Radius < 1 || Radius > CFrameSharpen::MAX_RADIUS)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  m_Sharpen.SetParameters((int)Radius, m_Sharpen.GetAmount());
   return NOERROR;
 }
+STDMETHODIMP CFrameProcessFilter::get_SharpenAmount(LONG *Amount)
+{
+  CheckPointer(Amount, E_POINTER);
+  CAutoLock lock(&m_csReceive);
+  *Amount = (LONG)floor(m_Sharpen.GetAmount() * 100 + 0.5);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_SharpenAmount(LONG Amount)
+{
+  if (Amount < -100 || Amount > 400)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  m_Sharpen.SetParameters(m_Sharpen.GetRadius(), Amount / 100.0);
+  return NOERROR;
+}
+
+//
+// IFrameQuality implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_QualityControl(BOOL *Enabled)
+{
+  CheckPointer(Enabled, E_POINTER);
+  *Enabled = m_bQuality;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_QualityControl(BOOL Enabled)
+{
+  CAutoLock lock(&m_csReceive);
+  if (Enabled == m_bQuality)
+    return NOERROR;
+  m_bQuality = Enabled;
+  m_Qos.Reset();
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::get_QualityLevel(DWORD *Level)
+{
+  CheckPointer(Level, E_POINTER);
+  *Level = m_bQuality ? (DWORD)m_Qos.Level() : (DWORD)FRAMEQOS_FULL;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::GetQualityStatistics(FRAMEQUALITY *Quality)
+{
+  CheckPointer(Quality, E_POINTER);
+  FrameQosStats qs;
+  m_Qos.GetStats(&qs);
+  Quality->Level = (DWORD)qs.nLevel;
+  Quality->Frames = qs.nFrames;
+  Quality->Messages = qs.nMessages;
+  Quality->Sheds = qs.nSheds;
+  Quality->Recoveries = qs.nRecoveries;
+  for (int i = 0; i < FRAME_QOS_LEVEL_COUNT; i++)
+    Quality->FramesAtLevel[i] = qs.nFramesAt[i];
+  Quality->LastDecisionFrame = qs.nLastDecision;
+  Quality->LastDecisionLate = (LONGLONG)(qs.dLastDecisionLate * 10000000.0);
+  Quality->Late = (LONGLONG)(qs.dLate * 10000000.0);
+  Quality->Proportion = qs.lProportion;
+  return NOERROR;
+}
+
+//
+// IFrameSlices implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_SliceRows(DWORD *Rows)
+{
+  CheckPointer(Rows, E_POINTER);
+  *Rows = m_SliceRows;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_SliceRows(DWORD Rows)
+{
+  if (Rows > 65536)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  m_SliceRows = Rows;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::SetSliceCallback(IFrameSliceCallback *Callback)
+{
+  CAutoLock lock(&m_csReceive);
+  if (Callback != NULL)
+    Callback->AddRef();
+  if (m_pSliceCallback != NULL)
+    m_pSliceCallback->Release();
+  m_pSliceCallback = Callback;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::get_DownstreamSlices(BOOL *Supported)
+{
+  CheckPointer(Supported, E_POINTER);
+  CAutoLock lock(&m_csReceive);
+  *Supported = m_pDownstreamSlices != NULL;
+  return NOERROR;
+}
+
+//
+// IFrameRowReuse implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_RowReuse(BOOL *Enabled)
+{
+  CheckPointer(Enabled, E_POINTER);
+  *Enabled = m_bReuse;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_RowReuse(BOOL Enabled)
+{
+  CAutoLock lock(&m_csReceive);
+  m_bReuse = Enabled;
+  m_Engine.SetReuse(m_bReuse ? &m_Reuse : NULL);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::GetReuseStatistics(FRAMEREUSE *Reuse)
+{
+  CheckPointer(Reuse, E_POINTER);
+  FrameReuseStats rs;
+  m_Reuse.GetStats(&rs);
+  Reuse->Frames = rs.nFrames;
+  Reuse->FullFrames = rs.nFullFrames;
+  Reuse->Rows = rs.nRows;
+  Reuse->RowsReused = rs.nRowsReused;
+  Reuse->ReuseRatio = rs.nRows > 0 ? (double)rs.nRowsReused / rs.nRows : 0;
+  return NOERROR;
+}
+
+//
+// IFrameMotion implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_MotionDetection(BOOL *Enabled)
+{
+  CheckPointer(Enabled, E_POINTER);
+  *Enabled = m_bMotion;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_MotionDetection(BOOL Enabled)
+{
+  CAutoLock lock(&m_csReceive);
+  if (Enabled == m_bMotion)
+    return NOERROR;
+  m_bMotion = Enabled;
+  m_Motion.Reset();
+  m_Engine.SetMotion(m_bMotion ? &m_Motion : NULL);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::GetFrameMotion(FRAMEMOTION *Motion)
+{
+  CheckPointer(Motion, E_POINTER);
+  CAutoLock lock(&m_csStats);
+  const FrameMotionInfo &mi = m_LastMotion;
+  Motion->Frame = mi.nFrame;
+  Motion->StartTime = m_MotionTime;
+  Motion->Sad = mi.dSad;
+  Motion->MovingPercent = (DWORD)mi.nMoving;
+  Motion->SceneChange = mi.bSceneChange ? TRUE : FALSE;
+  Motion->FramesSinceSceneChange = mi.nSinceSceneChange;
+  Motion->SceneChanges = mi.nSceneChanges;
+  return NOERROR;
+}
+
+//
+// IFrameOverlay implementation
+//
+STDMETHODIMP CFrameProcessFilter::SetOverlay(DWORD Layer, const BYTE *Bgra, LONG Stride,
+  DWORD Width, DWORD Height, LONG X, LONG Y)
+{
+  CheckPointer(Bgra, E_POINTER);
+  if (Layer >= CFrameOverlay::MAX_LAYERS || Width == 0 || Height == 0 ||
+      Width > (DWORD)g_MaxFrameWidth || Height > (DWORD)g_MaxFrameHeight ||
+      (Stride < 0 ? -(LONGLONG)Stride : (LONGLONG)Stride) < (LONGLONG)Width * 4 ||
+      X < -g_MaxFrameWidth || X > g_MaxFrameWidth || Y < -g_MaxFrameHeight || Y > g_MaxFrameHeight)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  if (!m_Overlay.SetLayer((int)Layer, Bgra, Stride, (int)Width, (int)Height, X, Y))
+    return E_INVALIDARG;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::ClearOverlay(DWORD Layer)
+{
+  if (Layer >= CFrameOverlay::MAX_LAYERS)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  m_Overlay.ClearLayer((int)Layer);
+  return NOERROR;
+}
+
+//
+// IFrameChromaKey implementation
+//
+STDMETHODIMP CFrameProcessFilter::GetChromaKey(FRAMECHROMAKEY *Key)
+{
+  CheckPointer(Key, E_POINTER);
+  CAutoLock lock(&m_csReceive);
+  *Key = m_KeySettings;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::SetChromaKey(const FRAMECHROMAKEY *Key)
+{
+  CheckPointer(Key, E_POINTER);
+  if (Key->Tolerance > 362 || Key->Softness < 1 || Key->Softness > 362)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  m_KeySettings = *Key;
+  m_Key.SetKey(Key->Red, Key->Green, Key->Blue, (int)Key->Tolerance, (int)Key->Softness);
+  m_Key.SetOutput(Key->Matte ? KEY_MATTE : KEY_COMPOSITE);
+  m_Key.SetEnabled(Key->Enabled != FALSE);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::SetChromaKeyBackground(const BYTE *Bgra, LONG Stride,
+  DWORD Width, DWORD Height)
+{
+  if (Bgra != NULL && (Width == 0 || Height == 0 ||
+      Width > (DWORD)g_MaxFrameWidth || Height > (DWORD)g_MaxFrameHeight ||
+      (Stride < 0 ? -(LONGLONG)Stride : (LONGLONG)Stride) < (LONGLONG)Width * 4))
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  if (!m_Key.SetBackground(Bgra, Stride, (int)Width, (int)Height))
+    return E_INVALIDARG;
+  return NOERROR;
+}
+
+//
+// IFramePreview implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_PreviewFactor(DWORD *Factor)
+{
+  CheckPointer(Factor, E_POINTER);
+  *Factor = (DWORD)m_Preview.Factor();
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_PreviewFactor(DWORD Factor)
+{
+  if (Factor != 2 && Factor != 4 && Factor != 8)
+    return E_INVALIDARG;
+  CAutoLock lock(&m_csReceive);
+  // The preview size is in the media type of the pin
+  if (m_pPreviewPin != NULL && m_pPreviewPin->IsConnected())
+    return VFW_E_ALREADY_CONNECTED;
+  m_Preview.SetFactor((int)Factor);
+  return NOERROR;
+}
+
+//
+// IFrameFingerprint implementation
+//
+STDMETHODIMP CFrameProcessFilter::get_Fingerprint(BOOL *Enabled)
+{
+  CheckPointer(Enabled, E_POINTER);
+  *Enabled = m_bFingerprint;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_Fingerprint(BOOL Enabled)
+{
+  CAutoLock lock(&m_csReceive);
+  if (Enabled == m_bFingerprint)
+    return NOERROR;
+  m_bFingerprint = Enabled;
+  m_Fingerprint.Reset();
+  m_Engine.SetFingerprint(m_bFingerprint ? &m_Fingerprint : NULL);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::get_FrozenThreshold(DWORD *Frames)
+{
+  CheckPointer(Frames, E_POINTER);
+  *Frames = m_FrozenThreshold;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_FrozenThreshold(DWORD Frames)
+{
+  CAutoLock lock(&m_csReceive);
+  m_FrozenThreshold = Frames;
+  m_Fingerprint.SetFrozenFrames(Frames);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::GetFrameFingerprint(FRAMEFINGERPRINT *Fingerprint)
+{
+  CheckPointer(Fingerprint, E_POINTER);
+  CAutoLock lock(&m_csStats);
+  const FrameFingerprintInfo &fi = m_LastFingerprint;
+  Fingerprint->Frame = fi.nFrame;
+  Fingerprint->StartTime = m_FingerprintTime;
+  Fingerprint->Hash = fi.nHash;
+  Fingerprint->PerceptualHash = fi.nPerceptual;
+  Fingerprint->PerceptualDistance = (DWORD)fi.nDistance;
+  Fingerprint->FrozenFrames = fi.nFrozen;
+  Fingerprint->Frozen = fi.bFrozen ? TRUE : FALSE;
+  return NOERROR;
+}
+
+//
+// IFrameTrace implementation
+//
+HRESULT CFrameProcessFilter::SaveTraceFile(const WCHAR *Path)
+{
+  FILE *fp = _wfopen(Path, L"wb");
+  if (fp == NULL)
+    return E_FAIL;
+  bool bOk = m_Trace.Save(fp);
+  if (fclose(fp) != 0)
+    bOk = false;
+  return bOk ? NOERROR : E_FAIL;
+}
+STDMETHODIMP CFrameProcessFilter::get_Tracing(BOOL *Enabled)
+{
+  CheckPointer(Enabled, E_POINTER);
+  *Enabled = m_Trace.Enabled() ? TRUE : FALSE;
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::put_Tracing(BOOL Enabled)
+{
+  m_Trace.SetEnabled(Enabled != FALSE);
+  return NOERROR;
+}
+STDMETHODIMP CFrameProcessFilter::SaveTrace(const WCHAR *Path)
+{
+  CheckPointer(Path, E_POINTER);
+  // The ring is read while the workers may still write to it
+  return SaveTraceFile(Path);
+}
+STDMETHODIMP CFrameProcessFilter::SetTraceAnomaly(DWORD Microseconds, const WCHAR *Path)
+{
+  CAutoLock lock(&m_csReceive);
+  bool bSave = Microseconds > 0 && Path != NULL && Path[0] != 0;
+  if (!bSave)
+    StopTraceThread();
+  {
+    CFrameAutoLock lockTrace(&m_TraceLock);
+    m_TraceFile = bSave ? Path : L"";
+    m_bTraceSave = false;
+  }
+  if (bSave && !m_bTraceThread)
+  {
+    m_bTraceExit = false;
+    m_bTraceThread = m_TraceThread.Start(TraceThreadProc, this);
+    if (!m_bTraceThread)
+      return E_FAIL;
+  }
+  m_TraceAnomaly = Microseconds;
+  m_dTraceSaved = 0;
+  return NOERROR;
+}
+
+void CFrameProcessFilter::StopTraceThread()
+{
+  if (!m_bTraceThread)
+    return;
+  {
+    CFrameAutoLock lock(&m_TraceLock);
+    m_bTraceExit = true;
+    m_TraceWake.Signal();
+  }
+  m_TraceThread.Join();
+  m_bTraceThread = false;
+}
+
+void CFrameProcessFilter::TraceThreadProc(void *pv)
+{
+  ((CFrameProcessFilter *)pv)->TraceThread();
+}
+
+//
+// Saves the trace after an anomaly. The ring is read while the streaming
+// thread and the workers go on writing to it, as with SaveTrace().
+//
+void CFrameProcessFilter::TraceThread()
+{
+  for (;;)
+  {
+    std::wstring file;
+    {
+      CFrameAutoLock lock(&m_TraceLock);
+      while (!m_bTraceExit && !m_bTraceSave)
+        m_TraceWake.Wait(&m_TraceLock);
+      if (m_bTraceExit)
+        return;
+      m_bTraceSave = false;
+      file = m_TraceFile;
+    }
+    SaveTraceFile(file.c_str());
+  }
+}
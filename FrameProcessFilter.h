@@ -2,13 +2,46 @@
 #include <streams.h>  // DirectShow base class library
 #include <initguid.h>
 #include <aviriff.h>  // defines 'FCC' macro
+#include <dvdmedia.h> // VIDEOINFOHEADER2
+#include <vector>
+#include <string>
 #include "IFrameProcessor.h"
 #include "consts.h"
+#include "ColorEngine.h"
+#include "AutoLevels.h"
+#include "FrameScaler.h"
+#include "FrameSharpen.h"
+#include "FramePipeline.h"
+#include "FrameQos.h"
+#include "FrameReuse.h"
+#include "FrameMotion.h"
+#include "FrameOverlay.h"
+#include "FrameKey.h"
+#include "FramePreview.h"
+#include "FramePreviewPin.h"
+#include "FrameFingerprint.h"
+#include "FrameTrace.h"
 
 
 class CFrameProcessFilter : public CTransformFilter,
 						    public IFrameProcessor,
-							public ISpecifyPropertyPages
+							public IFrameStatistics,
+							public IFrameAutoLevels,
+							public IFrameColorCube,
+							public IFrameColorSpace,
+							public IFrameScaling,
+							public IFrameSharpen,
+							public IFrameQuality,
+							public IFrameSlices,
+							public IFrameRowReuse,
+							public IFrameMotion,
+							public IFrameOverlay,
+							public IFrameChromaKey,
+							public IFramePreview,
+							public IFrameFingerprint,
+							public IFrameTrace,
+							public ISpecifyPropertyPages,
+							private CFrameSliceSink
 {
 private:
     VIDEOINFOHEADER m_VihIn;   // Holds the current video format (input)
@@ -26,37 +59,147 @@ private:
 	//HRESULT ProcessFrameYV12(BYTE *pbInput, BYTE *pbOutput, long *pcbByte);
 	HRESULT ProcessFrameYUY2(BYTE *pbInput, BYTE *pbOutput, long *pcbByte);
 
-	unsigned char m_Brightness;
+	// Settings from the application's threads. The setters only store
+	// them and raise a PENDING_* flag under m_csPending; the next frame
+	// hands them to the engine under m_csReceive. A paused renderer blocks
+	// in Receive with the streaming lock held, so a setter that waited for
+	// it would hang the property page until the graph ran.
+	enum
+	{
+		PENDING_LUMA = 1,
+		PENDING_CHROMA = 2,
+		PENDING_AUTOLEVELS = 4,
+		PENDING_CUBE = 8,
+		PENDING_SPACES = 16
+	};
+	CCritSec m_csPending;      // Never held for long, nor while waiting for m_csReceive
+	DWORD m_dwPending;
+	void ApplyPending();
+
+	unsigned char m_Brightness;   // Guarded by m_csPending
 	unsigned char m_Contrast;
 	unsigned char m_Hue;
 	unsigned char m_Saturation;
 	unsigned char m_Gamma;
 
-	short m_Lumas1[256][256];
-	unsigned char m_Lumas2[512][256];
-	unsigned char m_Lumas3[256][256];
+	CColorEngine m_Engine;     // Lookup tables and kernels
+	CFrameWorkers m_Workers;   // Threads for the per-frame kernels
+
+	// Frame statistics
+	BOOL m_bStats;
+	FrameStats m_Stats;        // Filled by the engine on the streaming thread
+	FRAMESTATS m_LastStats;    // Copy handed out by GetFrameStatistics
+	DWORD m_dwFrames;
+	CCritSec m_csStats;        // Protects m_LastStats and m_dwFrames
+	void PublishStats();
+
+	// Automatic levels
+	BOOL m_bAutoLevels;        // As set; guarded by m_csPending
+	BOOL m_bAutoLevelsOn;      // What the frames do
+	CAutoLevels m_AutoLevels;
+
+	// 3D LUT, kept so that the lattice can be rebuilt when the colour
+	// spaces change
+	CColorCube m_PendingCube;  // As loaded; guarded by m_csPending
+	BOOL m_bCube;              // Likewise
+	BOOL m_bCubeBake;          // Likewise
+	CColorCube m_Cube;         // What the engine has
+	BOOL m_bCubeOn;
+	BOOL m_bCubeBakeOn;
+	void UpdateCube();
+
+	// Colour spaces: FRAMEMATRIX_AUTO follows the input media type. All
+	// guarded by m_csPending, and so are InputSpace() and OutputSpace().
+	DWORD m_InMatrix;
+	BOOL m_bInFullRange;
+	DWORD m_OutMatrix;
+	BOOL m_bOutFullRange;
+	ColorSpace m_TypeSpace;    // What the input media type says
+	ColorSpace InputSpace() const;
+	ColorSpace OutputSpace() const;
+	void UpdateColorSpaces();
+
+	// Resize to the output frame size
+	CFrameScaler m_Scaler;
+
+	// Unsharp mask in front of the colour kernels
+	CFrameSharpen m_Sharpen;
 
+	// The enabled stages of the frame, run tile by tile
+	CFramePipeline m_Pipeline;
 
-	short m_Chromas1[256][256];
-	short m_Chromas2[256][256];
-	short m_Chromas3[360][360];
-	short m_Chromas4[360][360];
-	unsigned char m_Chromas5[360][256];
+	// Quality control: the level the next frame is processed at
+	BOOL m_bQuality;
+	CFrameQos m_Qos;
+	int m_QosLevel;            // Of the last frame, for the statistics
 
-	//int hueSin[360+1],hueCos[360+1];
-	unsigned int gammaTab[256];
-	void InitArrays();
+	// Slice mode: the engine reports every finished slice to SliceDone(),
+	// which passes it on to the application and the downstream filter
+	DWORD m_SliceRows;
+	IFrameSliceCallback *m_pSliceCallback;      // Application
+	IFrameSliceCallback *m_pDownstreamSlices;   // Downstream filter
+	IMediaSample *m_pSliceSample;               // Output sample in the making
+	virtual void SliceDone(const FrameDesc &dst, int nFirstRow, int nLastRow);
 
-	unsigned char ProcessLuma(unsigned char src);
-	//unsigned char ProcessChromaU(unsigned char srcU, unsigned char srcV);
-	void ProcessChroma(unsigned char srcU, unsigned char srcV,
-		unsigned char *dstU, unsigned char *dstV);
+	// Row reuse; the output buffers come from the downstream allocator, so
+	// unchanged rows are always copied
+	BOOL m_bReuse;
+	CFrameReuse m_Reuse;
 
-	unsigned char m_Luma[256];
-	unsigned char m_ChromaU[256][256];
-	unsigned char m_ChromaV[256][256];
-	void UpdateLuma();
-	void UpdateChroma();
+	// Motion detection; the last frame's result is handed out together
+	// with the time stamp of its sample
+	BOOL m_bMotion;
+	CFrameMotion m_Motion;
+	FrameMotionInfo m_LastMotion;  // Protected by m_csStats
+	REFERENCE_TIME m_MotionTime;   // Likewise
+
+	// Layers composited over the output
+	CFrameOverlay m_Overlay;
+
+	// Keying of the output, and its settings as they were given
+	CFrameKey m_Key;
+	FRAMECHROMAKEY m_KeySettings;
+
+	// Preview of the output frames on a second output pin, made in the same
+	// pass while the pin is connected
+	CFramePreviewPin *m_pPreviewPin;
+	CFramePreview m_Preview;
+	VIDEOINFOHEADER m_VihPreview;  // Of the preview pin
+	bool GetPreviewSize(int *pWidth, int *pHeight);
+	void DeliverPreview(IMediaSample *pDest);
+
+	// Fingerprints of the output frames; the last frame's is handed out
+	// together with the time stamp of its sample
+	BOOL m_bFingerprint;
+	CFrameFingerprint m_Fingerprint;
+	FrameFingerprintInfo m_LastFingerprint;  // Protected by m_csStats
+	REFERENCE_TIME m_FingerprintTime;        // Likewise
+	DWORD m_FrozenThreshold;
+
+	// Trace of the hot path. Transform() times each frame; one that takes
+	// m_TraceAnomaly microseconds or more records the anomaly and wakes
+	// m_TraceThread, which saves the trace to m_TraceFile. The streaming
+	// thread never snapshots the ring or writes the file itself.
+	CFrameTrace m_Trace;
+	DWORD m_TraceAnomaly;
+	double m_dTraceSaved;          // FrameSeconds() of the last save on an anomaly
+	CFrameThread m_TraceThread;
+	CFrameCritSec m_TraceLock;
+	CFrameCondition m_TraceWake;
+	bool m_bTraceThread;           // m_TraceThread is running
+	std::wstring m_TraceFile;      // Guarded by m_TraceLock
+	bool m_bTraceSave;             // Likewise; an anomaly waits to be saved
+	bool m_bTraceExit;             // Likewise
+	static void TraceThreadProc(void *pv);
+	void TraceThread();
+	void StopTraceThread();
+	HRESULT TransformFrame(IMediaSample *pSource, IMediaSample *pDest);
+	HRESULT SaveTraceFile(const WCHAR *Path);
+
+	// Output frame g_GhostFrame of the stream, which the later ones are
+	// averaged with; empty before that frame and after a change of format
+	std::vector<BYTE> m_Ghost;
+	DWORD m_dwGhostCount;      // Frames since the stream started
 public:
     CFrameProcessFilter(LPUNKNOWN pUnk, HRESULT *phr)
 		:  CTransformFilter((TCHAR *)g_Name, pUnk, CLSID_FrameProcessor)    
@@ -66,9 +209,66 @@ public:
 		m_Hue = g_DefaultHueLevel;
 		m_Saturation = g_DefaultSaturationLevel;
 		m_Gamma = g_DefaultGammaLevel;
-		UpdateLuma();
-		UpdateChroma();
+		m_Workers.SetThreadCount(FrameCpuCount());
+		m_bStats = FALSE;
+		m_dwFrames = 0;
+		m_dwPending = 0;
+		m_bAutoLevels = FALSE;
+		m_bAutoLevelsOn = FALSE;
+		m_bCube = FALSE;
+		m_bCubeBake = TRUE;
+		m_bCubeOn = FALSE;
+		m_bCubeBakeOn = TRUE;
+		m_InMatrix = FRAMEMATRIX_AUTO;
+		m_bInFullRange = FALSE;
+		m_OutMatrix = FRAMEMATRIX_AUTO;
+		m_bOutFullRange = FALSE;
+		m_TypeSpace = MakeColorSpace(COLOR_MATRIX_BT601, false);
+		m_Scaler.SetFilter((ScaleFilter)g_DefaultScaleFilter);
+		m_Sharpen.SetParameters(g_DefaultSharpenRadius, g_DefaultSharpenAmount / 100.0);
+		m_AutoLevels.SetSmoothing(g_DefaultAutoLevelsSmoothing);
+		m_AutoLevels.SetGamma(m_Gamma);
+		m_Engine.SetStatsRowStep(g_DefaultStatsRowStep);
+		m_bQuality = g_DefaultQualityControl ? TRUE : FALSE;
+		m_QosLevel = FRAME_QOS_FULL;
+		m_SliceRows = g_DefaultSliceRows;
+		m_pSliceCallback = NULL;
+		m_pDownstreamSlices = NULL;
+		m_pSliceSample = NULL;
+		m_dwGhostCount = 0;
+		m_bReuse = g_DefaultRowReuse ? TRUE : FALSE;
+		m_Engine.SetReuse(m_bReuse ? &m_Reuse : NULL);
+		m_bMotion = g_DefaultMotionDetection ? TRUE : FALSE;
+		m_Engine.SetMotion(m_bMotion ? &m_Motion : NULL);
+		memset(&m_LastMotion, 0, sizeof(m_LastMotion));
+		m_MotionTime = -1;
+		m_Engine.SetOverlay(&m_Overlay);
+		memset(&m_KeySettings, 0, sizeof(m_KeySettings));
+		m_KeySettings.Green = 255;
+		m_KeySettings.Tolerance = g_DefaultKeyTolerance;
+		m_KeySettings.Softness = g_DefaultKeySoftness;
+		m_Key.SetKey(0, 255, 0, g_DefaultKeyTolerance, g_DefaultKeySoftness);
+		m_Engine.SetKey(&m_Key);
+		m_pPreviewPin = NULL;
+		m_Preview.SetFactor(g_DefaultPreviewFactor);
+		memset(&m_VihPreview, 0, sizeof(m_VihPreview));
+		m_bFingerprint = g_DefaultFingerprint ? TRUE : FALSE;
+		m_FrozenThreshold = g_DefaultFrozenThreshold;
+		m_Fingerprint.SetFrozenFrames(m_FrozenThreshold);
+		m_Engine.SetFingerprint(m_bFingerprint ? &m_Fingerprint : NULL);
+		memset(&m_LastFingerprint, 0, sizeof(m_LastFingerprint));
+		m_FingerprintTime = -1;
+		m_Trace.SetEnabled(g_DefaultTracing != 0);
+		m_Engine.SetTrace(&m_Trace);
+		m_TraceAnomaly = 0;
+		m_dTraceSaved = 0;
+		m_bTraceThread = false;
+		m_bTraceSave = false;
+		m_bTraceExit = false;
+		m_Engine.UpdateLuma(m_Brightness, m_Contrast, m_Gamma);
+		m_Engine.UpdateChroma(m_Hue, m_Saturation);
 	}
+	~CFrameProcessFilter();
 
 	  // Overridden CTransformFilter methods
     HRESULT CheckInputType(const CMediaType *mtIn);
@@ -76,6 +276,28 @@ public:
     HRESULT DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp);
     HRESULT GetMediaType(int iPosition, CMediaType *pMediaType);
     HRESULT Transform(IMediaSample *pIn, IMediaSample *pOut);
+    HRESULT InitializeOutputSample(IMediaSample *pSample, IMediaSample **ppOutSample);
+    HRESULT StartStreaming();
+    HRESULT AlterQuality(Quality q);
+    HRESULT CompleteConnect(PIN_DIRECTION direction, IPin *pReceivePin);
+    HRESULT BreakConnect(PIN_DIRECTION direction);
+
+	// The preview pin comes after the input and the output pin, and gets
+	// the stream events and the stop as well
+	int GetPinCount();
+	CBasePin *GetPin(int n);
+	STDMETHODIMP FindPin(LPCWSTR Id, IPin **ppPin);
+	STDMETHODIMP Stop();
+	HRESULT EndOfStream();
+	HRESULT BeginFlush();
+	HRESULT EndFlush();
+	HRESULT NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+
+	// Media types and buffers of the preview pin
+	HRESULT CheckPreviewType(const CMediaType *pmt);
+	HRESULT GetPreviewType(int iPosition, CMediaType *pmt);
+	HRESULT SetPreviewType(const CMediaType *pmt);
+	HRESULT DecidePreviewBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp);
 
     // Override this so we can grab the video format
     HRESULT SetMediaType(PIN_DIRECTION direction, const CMediaType *pmt);
@@ -83,7 +305,10 @@ public:
 	 // Static object-creation method (for the class factory)
     static CUnknown * WINAPI CreateInstance(LPUNKNOWN pUnk, HRESULT *pHr); 
 
-	// Reveals IFrameProcessor and ISpecifyPropertyPages
+	// Reveals IFrameProcessor, IFrameStatistics, IFrameAutoLevels, IFrameColorCube, IFrameColorSpace,
+	// IFrameScaling, IFrameSharpen, IFrameQuality, IFrameSlices, IFrameRowReuse,
+	// IFrameMotion, IFrameOverlay, IFrameChromaKey, IFramePreview, IFrameFingerprint,
+	// IFrameTrace and ISpecifyPropertyPages
     STDMETHODIMP NonDelegatingQueryInterface(REFIID riid, void ** ppv);
 
     DECLARE_IUNKNOWN;
@@ -107,5 +332,120 @@ public:
     STDMETHODIMP put_SaturationLevel(unsigned char SaturationLevel);
 	STDMETHODIMP get_GammaCorrectionLevel(unsigned char *GammaCorrectionLevel);
     STDMETHODIMP put_GammaCorrectionLevel(unsigned char GammaCorrectionLevel);
+
+	//
+	// IFrameStatistics implementation
+	//
+	STDMETHODIMP get_StatisticsEnabled(BOOL *Enabled);
+	STDMETHODIMP put_StatisticsEnabled(BOOL Enabled);
+	STDMETHODIMP get_StatisticsRowStep(DWORD *RowStep);
+	STDMETHODIMP put_StatisticsRowStep(DWORD RowStep);
+	STDMETHODIMP GetFrameStatistics(FRAMESTATS *Stats);
+
+	//
+	// IFrameAutoLevels implementation
+	//
+	STDMETHODIMP get_AutoLevels(BOOL *Enabled);
+	STDMETHODIMP put_AutoLevels(BOOL Enabled);
+	STDMETHODIMP get_AutoLevelsSmoothing(DWORD *Frames);
+	STDMETHODIMP put_AutoLevelsSmoothing(DWORD Frames);
+
+	//
+	// IFrameColorCube implementation
+	//
+	STDMETHODIMP LoadCube(const WCHAR *Path);
+	STDMETHODIMP ClearCube();
+	STDMETHODIMP get_CubeLoaded(BOOL *Loaded);
+	STDMETHODIMP get_CubeBakeLevels(BOOL *Bake);
+	STDMETHODIMP put_CubeBakeLevels(BOOL Bake);
+
+	//
+	// IFrameColorSpace implementation
+	//
+	STDMETHODIMP get_InputColorSpace(DWORD *Matrix, BOOL *FullRange);
+	STDMETHODIMP put_InputColorSpace(DWORD Matrix, BOOL FullRange);
+	STDMETHODIMP get_OutputColorSpace(DWORD *Matrix, BOOL *FullRange);
+	STDMETHODIMP put_OutputColorSpace(DWORD Matrix, BOOL FullRange);
+
+	//
+	// IFrameScaling implementation
+	//
+	STDMETHODIMP get_ScaleFilter(DWORD *Filter);
+	STDMETHODIMP put_ScaleFilter(DWORD Filter);
+
+	//
+	// IFrameSharpen implementation
+	//
+	STDMETHODIMP get_SharpenRadius(DWORD *Radius);
+	STDMETHODIMP put_SharpenRadius(DWORD Radius);
+	STDMETHODIMP get_SharpenAmount(LONG *Amount);
+	STDMETHODIMP put_SharpenAmount(LONG Amount);
+
+	//
+	// IFrameQuality implementation
+	//
+	STDMETHODIMP get_QualityControl(BOOL *Enabled);
+	STDMETHODIMP put_QualityControl(BOOL Enabled);
+	STDMETHODIMP get_QualityLevel(DWORD *Level);
+	STDMETHODIMP GetQualityStatistics(FRAMEQUALITY *Quality);
+
+	//
+	// IFrameSlices implementation
+	//
+	STDMETHODIMP get_SliceRows(DWORD *Rows);
+	STDMETHODIMP put_SliceRows(DWORD Rows);
+	STDMETHODIMP SetSliceCallback(IFrameSliceCallback *Callback);
+	STDMETHODIMP get_DownstreamSlices(BOOL *Supported);
+
+	//
+	// IFrameRowReuse implementation
+	//
+	STDMETHODIMP get_RowReuse(BOOL *Enabled);
+	STDMETHODIMP put_RowReuse(BOOL Enabled);
+	STDMETHODIMP GetReuseStatistics(FRAMEREUSE *Reuse);
+
+	//
+	// IFrameMotion implementation
+	//
+	STDMETHODIMP get_MotionDetection(BOOL *Enabled);
+	STDMETHODIMP put_MotionDetection(BOOL Enabled);
+	STDMETHODIMP GetFrameMotion(FRAMEMOTION *Motion);
+
+	//
+	// IFrameOverlay implementation
+	//
+	STDMETHODIMP SetOverlay(DWORD Layer, const BYTE *Bgra, LONG Stride, DWORD Width, DWORD Height,
+		LONG X, LONG Y);
+	STDMETHODIMP ClearOverlay(DWORD Layer);
+
+	//
+	// IFrameChromaKey implementation
+	//
+	STDMETHODIMP GetChromaKey(FRAMECHROMAKEY *Key);
+	STDMETHODIMP SetChromaKey(const FRAMECHROMAKEY *Key);
+	STDMETHODIMP SetChromaKeyBackground(const BYTE *Bgra, LONG Stride, DWORD Width, DWORD Height);
+
+	//
+	// IFramePreview implementation
+	//
+	STDMETHODIMP get_PreviewFactor(DWORD *Factor);
+	STDMETHODIMP put_PreviewFactor(DWORD Factor);
+
+	//
+	// IFrameFingerprint implementation
+	//
+	STDMETHODIMP get_Fingerprint(BOOL *Enabled);
+	STDMETHODIMP put_Fingerprint(BOOL Enabled);
+	STDMETHODIMP get_FrozenThreshold(DWORD *Frames);
+	STDMETHODIMP put_FrozenThreshold(DWORD Frames);
+	STDMETHODIMP GetFrameFingerprint(FRAMEFINGERPRINT *Fingerprint);
+
+	//
+	// IFrameTrace implementation
+	//
+	STDMETHODIMP get_Tracing(BOOL *Enabled);
+	STDMETHODIMP put_Tracing(BOOL Enabled);
+	STDMETHODIMP SaveTrace(const WCHAR *Path);
+	STDMETHODIMP SetTraceAnomaly(DWORD Microseconds, const WCHAR *Path);
 };
 
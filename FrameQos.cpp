@@ -0,0 +1,118 @@
+#include <string.h>
+#include "FrameQos.h"
+
+// Frames after a step before the next shed
+static const unsigned long g_nHoldFrames = 8;
+
+// Frames on early messages before a level is taken back, at first and at
+// most after a few steps that turned out too early
+static const unsigned long g_nCalmFrames = 60;
+static const unsigned long g_nMaxCalmFrames = 16 * 60;
+
+// Lateness that sheds a level and earliness that counts as calm, in frames
+static const double g_dShedLate = 0.5;
+static const double g_dCalmEarly = 0.25;
+
+// Below this proportion the renderer is flooded even if nothing is late yet
+static const long g_lShedProportion = 900;
+
+CFrameQos::CFrameQos()
+	: m_dFrameTime(1.0 / 30)
+{
+	Reset();
+}
+
+void CFrameQos::Reset()
+{
+	CFrameAutoLock lock(&m_Lock);
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_Stats.nLevel = FRAME_QOS_FULL;
+	m_Stats.lProportion = 1000;
+	m_bFresh = false;
+	m_nHeld = g_nHoldFrames;
+	m_nCalm = 0;
+	m_nCalmNeeded = g_nCalmFrames;
+	m_bRecovered = false;
+}
+
+void CFrameQos::SetFrameTime(double dSeconds)
+{
+	CFrameAutoLock lock(&m_Lock);
+	m_dFrameTime = dSeconds > 0 ? dSeconds : 1.0 / 30;
+}
+
+void CFrameQos::Notify(double dLate, long lProportion)
+{
+	CFrameAutoLock lock(&m_Lock);
+	m_Stats.nMessages++;
+	m_Stats.dLate = dLate;
+	m_Stats.lProportion = lProportion;
+	m_bFresh = true;
+}
+
+int CFrameQos::NextFrame()
+{
+	CFrameAutoLock lock(&m_Lock);
+	m_Stats.nFrames++;
+	m_nHeld++;
+
+	// Only a new message sheds, so one late frame is not acted on twice;
+	// earliness holds until a message says otherwise
+	const int nLevel = m_Stats.nLevel;
+	bool bLate = m_bFresh && (m_Stats.dLate > g_dShedLate * m_dFrameTime ||
+		m_Stats.lProportion < g_lShedProportion);
+	bool bEarly = m_Stats.dLate < -g_dCalmEarly * m_dFrameTime && m_Stats.lProportion >= 1000;
+	m_bFresh = false;
+
+	if (bLate)
+	{
+		m_nCalm = 0;
+		if (m_nHeld >= g_nHoldFrames && nLevel < FRAME_QOS_PASSTHROUGH)
+		{
+			if (!m_bRecovered || m_nHeld >= 4 * m_nCalmNeeded)
+				m_nCalmNeeded = g_nCalmFrames;
+			else if (m_nCalmNeeded < g_nMaxCalmFrames)
+				m_nCalmNeeded *= 2;
+			Step(nLevel + 1);
+		}
+	}
+	else if (bEarly)
+	{
+		if (nLevel > FRAME_QOS_FULL && ++m_nCalm >= m_nCalmNeeded)
+			Step(nLevel - 1);
+	}
+	else
+	{
+		// Between the thresholds nothing changes, but the calm starts over
+		m_nCalm = 0;
+	}
+
+	m_Stats.nFramesAt[m_Stats.nLevel]++;
+	return m_Stats.nLevel;
+}
+
+void CFrameQos::Step(int nLevel)
+{
+	if (nLevel > m_Stats.nLevel)
+		m_Stats.nSheds++;
+	else
+		m_Stats.nRecoveries++;
+	m_bRecovered = nLevel < m_Stats.nLevel;
+	m_Stats.nLevel = nLevel;
+	m_Stats.nLastDecision = m_Stats.nFrames;
+	m_Stats.dLastDecisionLate = m_Stats.dLate;
+	m_nHeld = 0;
+	m_nCalm = 0;
+}
+
+int CFrameQos::Level()
+{
+	CFrameAutoLock lock(&m_Lock);
+	return m_Stats.nLevel;
+}
+
+void CFrameQos::GetStats(FrameQosStats *pStats)
+{
+	CFrameAutoLock lock(&m_Lock);
+	*pStats = m_Stats;
+}
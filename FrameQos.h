@@ -0,0 +1,78 @@
+#pragma once
+#include "FramePlatform.h"
+
+//
+// Work the filter gives up under load, one step at a time
+//
+enum FrameQosLevel
+{
+	FRAME_QOS_FULL = 0,          // Everything
+	FRAME_QOS_NO_OPTIONAL,       // Without the unsharp mask and the blend
+	FRAME_QOS_NO_CHROMA,         // Chroma passes through as well
+	FRAME_QOS_PASSTHROUGH,       // Copied; only resized when the size changes
+	FRAME_QOS_LEVEL_COUNT
+};
+
+//
+// What CFrameQos has seen and decided since the last Reset()
+//
+struct FrameQosStats
+{
+	int nLevel;                  // FrameQosLevel in effect
+	unsigned long nFrames;
+	unsigned long nMessages;     // Quality messages
+	unsigned long nSheds;        // Steps to a higher level
+	unsigned long nRecoveries;   // Steps back
+	unsigned long nFramesAt[FRAME_QOS_LEVEL_COUNT];
+	unsigned long nLastDecision; // Frame of the last step, 0 before the first
+	double dLastDecisionLate;    // Lateness that step was taken on
+	double dLate;                // Last message: seconds late, negative when early
+	long lProportion;            // Last message: 1000 keeps the rate
+};
+
+//
+// CFrameQos
+//
+// Load shedding driven by the quality messages of the renderer. While the
+// frames come in late the filter sheds a level, at most one per hold period
+// so that the effect of a step shows before the next one is taken. When the
+// frames have been early by a margin for a calm period it takes a level
+// back. A step that turns out too early, i.e. a shed soon after a
+// recovery, doubles the calm period for the next recovery so that the
+// level does not swing back and forth.
+//
+// Notify() may be called on any thread; NextFrame() on the streaming thread.
+//
+class CFrameQos
+{
+public:
+	CFrameQos();
+
+	// Forget the level and the counters, e.g. when the stream restarts
+	void Reset();
+
+	// Duration of a frame in seconds, which the thresholds scale with
+	void SetFrameTime(double dSeconds);
+
+	// A quality message: dLate seconds late, negative when early, and the
+	// proportion of the rate the renderer can take, 1000 being all of it
+	void Notify(double dLate, long lProportion);
+
+	// Decide the level for the coming frame and count it
+	int NextFrame();
+
+	int Level();
+	void GetStats(FrameQosStats *pStats);
+
+private:
+	void Step(int nLevel);
+
+	CFrameCritSec m_Lock;
+	double m_dFrameTime;
+	FrameQosStats m_Stats;
+	bool m_bFresh;               // A message arrived since the last frame
+	unsigned long m_nHeld;       // Frames since the last step
+	unsigned long m_nCalm;       // Frames in a row on early messages
+	unsigned long m_nCalmNeeded;
+	bool m_bRecovered;           // The last step was a recovery
+};
@@ -0,0 +1,260 @@
+#include <string.h>
+#include "FrameReuse.h"
+
+static const unsigned long long g_P1 = 11400714785074694791ULL;
+static const unsigned long long g_P2 = 14029467366897019727ULL;
+static const unsigned long long g_P3 = 1609587929392839161ULL;
+static const unsigned long long g_P4 = 9650029242287828579ULL;
+static const unsigned long long g_P5 = 2870177450012600261ULL;
+
+static inline unsigned long long Rotl(unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long Read64(const unsigned char *pb)
+{
+	unsigned long long v;
+	memcpy(&v, pb, sizeof(v));
+	return v;
+}
+
+static inline unsigned long long Round(unsigned long long acc, unsigned long long v)
+{
+	return Rotl(acc + v * g_P2, 31) * g_P1;
+}
+
+unsigned long long FrameHash(const unsigned char *pb, size_t cb, unsigned long long nSeed)
+{
+	const unsigned char *pbEnd = pb + cb;
+	unsigned long long h;
+	if (cb >= 32)
+	{
+		unsigned long long v1 = nSeed + g_P1 + g_P2;
+		unsigned long long v2 = nSeed + g_P2;
+		unsigned long long v3 = nSeed;
+		unsigned long long v4 = nSeed - g_P1;
+		for (; pbEnd - pb >= 32; pb += 32)
+		{
+			v1 = Round(v1, Read64(pb));
+			v2 = Round(v2, Read64(pb + 8));
+			v3 = Round(v3, Read64(pb + 16));
+			v4 = Round(v4, Read64(pb + 24));
+		}
+		h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+	}
+	else
+	{
+		h = nSeed + g_P5;
+	}
+	h += cb;
+
+	for (; pbEnd - pb >= 8; pb += 8)
+		h = Rotl(h ^ Round(0, Read64(pb)), 27) * g_P1 + g_P4;
+	for (; pb < pbEnd; pb++)
+		h = Rotl(h ^ (*pb * g_P5), 11) * g_P1;
+
+	h ^= h >> 33;
+	h *= g_P2;
+	h ^= h >> 29;
+	h *= g_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+CFrameReuse::CFrameReuse()
+	: m_bValid(false), m_nKey(0), m_Format(FRAME_FORMAT_YUY2), m_nWidth(0), m_nHeight(0),
+	  m_nBlockShift(0), m_Last(), m_bTargetsKept(false), m_nFrame(0), m_pTarget(NULL),
+	  m_nTargetFrame(0)
+{
+	Reset();
+}
+
+void CFrameReuse::Reset()
+{
+	CFrameAutoLock lock(&m_Lock);
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	memset(m_Targets, 0, sizeof(m_Targets));
+	m_bValid = false;
+}
+
+void CFrameReuse::SetTargetsKept(bool bKept)
+{
+	m_bTargetsKept = bKept;
+	memset(m_Targets, 0, sizeof(m_Targets));
+}
+
+void CFrameReuse::BeginFrame(const FrameDesc &src, const FrameDesc &dst, unsigned long nKey)
+{
+	if (src.format != m_Format || src.nWidth != m_nWidth || src.nHeight != m_nHeight)
+	{
+		m_Format = src.format;
+		m_nWidth = src.nWidth;
+		m_nHeight = src.nHeight;
+		m_nBlockShift = src.format == FRAME_FORMAT_I420 ? 1 : 0;
+		int nBlocks = (m_nHeight + (1 << m_nBlockShift) - 1) >> m_nBlockShift;
+		m_Hashes.assign(nBlocks, 0);
+		m_ChangedAt.assign(nBlocks, 0);
+		m_Action.assign(nBlocks, ACTION_TRANSFORM);
+		m_Output.resize(FrameBytes(m_Format, m_nWidth, m_nHeight));
+		m_Last = FrameLayout(&m_Output[0], m_Format, m_nWidth, m_nHeight);
+		m_bValid = false;
+	}
+	if (nKey != m_nKey)
+	{
+		m_nKey = nKey;
+		m_bValid = false;
+	}
+	m_nFrame++;
+
+	// A frame in full leaves nothing to trust in the targets either
+	if (!m_bValid)
+		memset(m_Targets, 0, sizeof(m_Targets));
+	m_pTarget = NULL;
+	m_nTargetFrame = 0;
+	if (!m_bTargetsKept)
+		return;
+
+	// The target's entry, or else the one unused the longest, which holds
+	// nothing until the frame is done
+	for (int i = 0; i < MAX_TARGETS; i++)
+	{
+		Target &t = m_Targets[i];
+		if (t.nFrame != 0 && t.pbTop == dst.pbTop && t.lStride == dst.lStride &&
+			t.pbU == dst.pbU && t.pbV == dst.pbV && t.lStrideUV == dst.lStrideUV)
+		{
+			m_pTarget = &t;
+			m_nTargetFrame = t.nFrame;
+			return;
+		}
+		if (m_pTarget == NULL || t.nFrame < m_pTarget->nFrame)
+			m_pTarget = &t;
+	}
+	m_pTarget->pbTop = dst.pbTop;
+	m_pTarget->lStride = dst.lStride;
+	m_pTarget->pbU = dst.pbU;
+	m_pTarget->pbV = dst.pbV;
+	m_pTarget->lStrideUV = dst.lStrideUV;
+	m_pTarget->nFrame = 0;
+}
+
+//
+// One hash over the rows of a block and the chroma rows that go with them
+//
+unsigned long long CFrameReuse::HashRows(const FrameDesc &src, int nBlock) const
+{
+	int nFirst = nBlock << m_nBlockShift;
+	int nLast = nFirst + (1 << m_nBlockShift) < m_nHeight ? nFirst + (1 << m_nBlockShift) : m_nHeight;
+	unsigned long long h = 0;
+	if (!FramePlanar(m_Format))
+	{
+		const size_t cbRow = (size_t)((m_nWidth + 1) / 2) * 4;
+		for (int y = nFirst; y < nLast; y++)
+			h = FrameHash(src.pbTop + src.lStride * y, cbRow, h);
+		return h;
+	}
+	int sx, sy;
+	FrameChromaShift(m_Format, &sx, &sy);
+	const size_t cbRowUV = (size_t)((m_nWidth + sx) >> sx);
+	for (int y = nFirst; y < nLast; y++)
+		h = FrameHash(src.pbTop + src.lStride * y, m_nWidth, h);
+	h = FrameHash(src.pbU + src.lStrideUV * nBlock, cbRowUV, h);
+	return FrameHash(src.pbV + src.lStrideUV * nBlock, cbRowUV, h);
+}
+
+void CFrameReuse::CopyRows(const FrameDesc &from, const FrameDesc &to, int nFirstRow, int nLastRow) const
+{
+	if (!FramePlanar(m_Format))
+	{
+		const size_t cbRow = (size_t)((m_nWidth + 1) / 2) * 4;
+		for (int y = nFirstRow; y < nLastRow; y++)
+			memcpy(to.pbTop + to.lStride * y, from.pbTop + from.lStride * y, cbRow);
+		return;
+	}
+	int sx, sy;
+	FrameChromaShift(m_Format, &sx, &sy);
+	const size_t cbRowUV = (size_t)((m_nWidth + sx) >> sx);
+	for (int y = nFirstRow; y < nLastRow; y++)
+		memcpy(to.pbTop + to.lStride * y, from.pbTop + from.lStride * y, m_nWidth);
+	for (int y = nFirstRow >> sy; y < (nLastRow + (1 << sy) - 1) >> sy; y++)
+	{
+		memcpy(to.pbU + to.lStrideUV * y, from.pbU + from.lStrideUV * y, cbRowUV);
+		memcpy(to.pbV + to.lStrideUV * y, from.pbV + from.lStrideUV * y, cbRowUV);
+	}
+}
+
+void CFrameReuse::ProcessRows(CColorEngine *pEngine, const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel)
+{
+	const int nFirstBlock = nFirstRow >> m_nBlockShift;
+	const int nLastBlock = (nLastRow + (1 << m_nBlockShift) - 1) >> m_nBlockShift;
+	for (int b = nFirstBlock; b < nLastBlock; b++)
+	{
+		unsigned long long h = HashRows(src, b);
+		if (!m_bValid || h != m_Hashes[b])
+		{
+			m_Hashes[b] = h;
+			m_ChangedAt[b] = m_nFrame;
+			m_Action[b] = ACTION_TRANSFORM;
+		}
+		else
+		{
+			m_Action[b] = m_ChangedAt[b] <= m_nTargetFrame ? ACTION_KEEP : ACTION_COPY;
+		}
+	}
+
+	// Runs of blocks that go the same way
+	for (int b = nFirstBlock; b < nLastBlock; )
+	{
+		int e = b + 1;
+		while (e < nLastBlock && m_Action[e] == m_Action[b])
+			e++;
+		int nFirst = b << m_nBlockShift;
+		int nLast = e << m_nBlockShift < nLastRow ? e << m_nBlockShift : nLastRow;
+		if (m_Action[b] == ACTION_TRANSFORM)
+		{
+			pEngine->ProcessRows(src, dst, nFirst, nLast, kernel, NULL);
+			CopyRows(dst, m_Last, nFirst, nLast);
+		}
+		else if (m_Action[b] == ACTION_COPY)
+		{
+			CopyRows(m_Last, dst, nFirst, nLast);
+		}
+		b = e;
+	}
+}
+
+void CFrameReuse::EndFrame()
+{
+	unsigned long long nReused = 0, nKept = 0;
+	for (size_t b = 0; b < m_Action.size(); b++)
+	{
+		if (m_Action[b] != ACTION_TRANSFORM)
+		{
+			int nFirst = (int)b << m_nBlockShift;
+			int nLast = nFirst + (1 << m_nBlockShift) < m_nHeight ? nFirst + (1 << m_nBlockShift) : m_nHeight;
+			nReused += nLast - nFirst;
+			if (m_Action[b] == ACTION_KEEP)
+				nKept += nLast - nFirst;
+		}
+	}
+
+	// The target now holds this frame
+	if (m_pTarget != NULL)
+		m_pTarget->nFrame = m_nFrame;
+
+	CFrameAutoLock lock(&m_Lock);
+	m_Stats.nFrames++;
+	if (!m_bValid)
+		m_Stats.nFullFrames++;
+	m_Stats.nRows += m_nHeight;
+	m_Stats.nRowsReused += nReused;
+	m_Stats.nRowsKept += nKept;
+	m_bValid = true;
+}
+
+void CFrameReuse::GetStats(FrameReuseStats *pStats)
+{
+	CFrameAutoLock lock(&m_Lock);
+	*pStats = m_Stats;
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+
+// 64-bit hash of cb bytes in the manner of xxHash64: four independent
+// multiply-rotate lanes over 32-byte blocks, so that it runs at memory
+// speed without vector instructions
+unsigned long long FrameHash(const unsigned char *pb, size_t cb, unsigned long long nSeed);
+
+//
+// What CFrameReuse has done since the last Reset()
+//
+struct FrameReuseStats
+{
+	unsigned long nFrames;           // Frames processed with reuse on
+	unsigned long nFullFrames;       // Of them processed in full: the first, or after a change
+	unsigned long long nRows;
+	unsigned long long nRowsReused;  // Rows not transformed
+	unsigned long long nRowsKept;    // Of them left as they were in the target
+};
+
+//
+// CFrameReuse
+//
+// Skips the rows of a frame that are the same as in the previous frame,
+// for mostly static content such as screen capture. Every row of the
+// source is hashed and compared with the hash of the same row one frame
+// earlier; a changed row is transformed as usual and its output kept, an
+// unchanged one gets the kept output of the previous frame. 4:2:0 rows go
+// by pairs, with the chroma row they share.
+//
+// Given to CColorEngine::SetReuse(), which decides per frame whether reuse
+// applies and invalidates it whenever anything but the source changes the
+// output. The rows of a band are compared and copied by the worker that
+// transforms them.
+//
+// Copying saves the table lookups but not the memory traffic. A caller
+// whose target buffers keep their pixels from one frame to the next, such
+// as a pool of buffers nobody else writes to, can say so with
+// SetTargetsKept(); a target seen before then only gets the rows that
+// changed since it was last written, and a static frame costs little more
+// than the hashing.
+//
+class CFrameReuse
+{
+public:
+	CFrameReuse();
+
+	// Forget the previous frame and the counters
+	void Reset();
+
+	// Process the next frame in full, e.g. after one that was not seen
+	void Invalidate() { m_bValid = false; }
+
+	// Whether the targets keep the pixels written to them; off by default
+	void SetTargetsKept(bool bKept);
+
+	// Start of a frame of the engine: src and dst share their size and
+	// format, nKey changes whenever the output of a row would
+	void BeginFrame(const FrameDesc &src, const FrameDesc &dst, unsigned long nKey);
+
+	// Transform rows [nFirstRow, nLastRow) of src into dst with pEngine.
+	// Where the source has not changed the rows are copied from the
+	// previous output instead, or left alone in a target that holds them.
+	// nFirstRow is on a whole 4:2:0 row pair.
+	void ProcessRows(CColorEngine *pEngine, const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel);
+
+	// End of the frame: count the rows and keep the hashes for the next one
+	void EndFrame();
+
+	void GetStats(FrameReuseStats *pStats);
+
+private:
+	enum { MAX_TARGETS = 8 };
+	enum { ACTION_TRANSFORM, ACTION_COPY, ACTION_KEEP };
+
+	// A target buffer and the frame it holds the output of
+	struct Target
+	{
+		unsigned char *pbTop;
+		ptrdiff_t lStride;
+		unsigned char *pbU;
+		unsigned char *pbV;
+		ptrdiff_t lStrideUV;
+		unsigned long nFrame;        // 0 for an empty entry
+	};
+
+	unsigned long long HashRows(const FrameDesc &src, int nBlock) const;
+	void CopyRows(const FrameDesc &from, const FrameDesc &to, int nFirstRow, int nLastRow) const;
+
+	CFrameCritSec m_Lock;            // Protects m_Stats
+	FrameReuseStats m_Stats;
+
+	// Previous frame
+	bool m_bValid;
+	unsigned long m_nKey;
+	FrameFormat m_Format;
+	int m_nWidth;
+	int m_nHeight;
+	int m_nBlockShift;               // Rows per block: 2 for 4:2:0, else 1
+	std::vector<unsigned long long> m_Hashes;
+	std::vector<unsigned char> m_Output;
+	FrameDesc m_Last;                // m_Output as a frame
+	std::vector<unsigned long> m_ChangedAt;   // Frame of the last change, per block
+
+	// Targets written before, while they keep their pixels
+	bool m_bTargetsKept;
+	Target m_Targets[MAX_TARGETS];
+	unsigned long m_nFrame;          // Frames since the targets were last forgotten
+	Target *m_pTarget;               // This frame's entry
+	unsigned long m_nTargetFrame;    // What this frame's target holds; 0 unknown
+
+	// This frame: what becomes of every block
+	std::vector<unsigned char> m_Action;
+};
@@ -0,0 +1,547 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include "FrameScaler.h"
+
+#define PI 3.14159265358979
+
+static const char *g_FilterNames[SCALE_FILTER_COUNT] = { "bilinear", "bicubic", "lanczos" };
+
+// Half width of each filter at scale 1, in source samples
+static const double g_Radius[SCALE_FILTER_COUNT] = { 1.0, 2.0, 3.0 };
+
+const char *ScaleFilterName(ScaleFilter filter)
+{
+	if (filter < 0 || filter >= SCALE_FILTER_COUNT)
+		return "unknown";
+	return g_FilterNames[filter];
+}
+
+bool ScaleFilterFromName(const char *pszName, ScaleFilter *pFilter)
+{
+	for (int i = 0; i < SCALE_FILTER_COUNT; i++)
+	{
+		if (strcmp(pszName, g_FilterNames[i]) == 0)
+		{
+			*pFilter = (ScaleFilter)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static double FilterWeight(ScaleFilter filter, double x)
+{
+	x = fabs(x);
+	switch (filter)
+	{
+	case SCALE_BICUBIC:
+		// Catmull-Rom, a = -0.5
+		if (x < 1)
+			return (1.5 * x - 2.5) * x * x + 1;
+		if (x < 2)
+			return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+		return 0;
+	case SCALE_LANCZOS:
+		if (x < 1e-9)
+			return 1;
+		if (x >= 3)
+			return 0;
+		return 3 * sin(PI * x) * sin(PI * x / 3) / (PI * PI * x * x);
+	case SCALE_BILINEAR:
+	default:
+		return x < 1 ? 1 - x : 0;
+	}
+}
+
+//
+// Horizontal pass: 8-bit samples to 16-bit ones with 6 fraction bits. The
+// weights of a sample are contiguous, so SSE2 takes them four or eight at a
+// time and sums four output samples with one transpose.
+//
+// Fixed tap counts unroll the inner loop; TAPS 0 takes the count from nTaps
+template <int TAPS>
+static void ScaleHorizontalN(const unsigned char *pIn, const int *pStart, const short *pCoef,
+	int nTaps, short *pOut, int nOut)
+{
+	if (TAPS != 0)
+		nTaps = TAPS;
+	int x = 0;
+#ifdef FRAME_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 4 <= nOut; x += 4)
+	{
+		__m128i sum[4];
+		for (int j = 0; j < 4; j++)
+		{
+			const unsigned char *p = pIn + pStart[x + j];
+			const short *c = pCoef + (x + j) * nTaps;
+			__m128i acc = zero;
+			int k = 0;
+			for (; k + 8 <= nTaps; k += 8)
+			{
+				__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + k)), zero);
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_loadu_si128((const __m128i *)(c + k))));
+			}
+			if (k < nTaps)
+			{
+				int n4;
+				memcpy(&n4, p + k, 4);
+				__m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128(n4), zero);
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_loadl_epi64((const __m128i *)(c + k))));
+			}
+			sum[j] = acc;
+		}
+		// Four partial sums per sample to one sum per sample
+		__m128i s01 = _mm_add_epi32(_mm_unpacklo_epi32(sum[0], sum[1]), _mm_unpackhi_epi32(sum[0], sum[1]));
+		__m128i s23 = _mm_add_epi32(_mm_unpacklo_epi32(sum[2], sum[3]), _mm_unpackhi_epi32(sum[2], sum[3]));
+		__m128i s = _mm_add_epi32(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+		s = _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(128)), 8);
+		_mm_storel_epi64((__m128i *)(pOut + x), _mm_packs_epi32(s, s));
+	}
+#endif
+	for (; x < nOut; x++)
+	{
+		const unsigned char *p = pIn + pStart[x];
+		const short *c = pCoef + x * nTaps;
+		int sum = 0;
+		for (int k = 0; k < nTaps; k++)
+			sum += p[k] * c[k];
+		pOut[x] = (short)((sum + 128) >> 8);
+	}
+}
+
+static void ScaleHorizontal(const unsigned char *pIn, const int *pStart, const short *pCoef,
+	int nTaps, short *pOut, int nOut)
+{
+	switch (nTaps)
+	{
+	case 4:  ScaleHorizontalN<4>(pIn, pStart, pCoef, nTaps, pOut, nOut); break;
+	case 8:  ScaleHorizontalN<8>(pIn, pStart, pCoef, nTaps, pOut, nOut); break;
+	case 12: ScaleHorizontalN<12>(pIn, pStart, pCoef, nTaps, pOut, nOut); break;
+	case 16: ScaleHorizontalN<16>(pIn, pStart, pCoef, nTaps, pOut, nOut); break;
+	default: ScaleHorizontalN<0>(pIn, pStart, pCoef, nTaps, pOut, nOut); break;
+	}
+}
+
+//
+// Vertical pass: nTaps 16-bit rows back to 8-bit samples. SSE2 pairs the
+// rows so that one multiply-add covers two taps of eight samples.
+//
+static void ScaleVertical(const short *const *ppRows, const short *pCoef, int nTaps,
+	unsigned char *pOut, int nOut)
+{
+	int x = 0;
+#ifdef FRAME_SSE2
+	const __m128i round = _mm_set1_epi32(1 << 19);
+	for (; x + 8 <= nOut; x += 8)
+	{
+		__m128i lo = round, hi = round;
+		int k = 0;
+		for (; k + 2 <= nTaps; k += 2)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(ppRows[k] + x));
+			__m128i b = _mm_loadu_si128((const __m128i *)(ppRows[k + 1] + x));
+			__m128i c = _mm_set1_epi32((int)((unsigned short)pCoef[k] | ((unsigned int)(unsigned short)pCoef[k + 1] << 16)));
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+		}
+		if (k < nTaps)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(ppRows[k] + x));
+			__m128i c = _mm_set1_epi32((unsigned short)pCoef[k]);
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, _mm_setzero_si128()), c));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, _mm_setzero_si128()), c));
+		}
+		__m128i w = _mm_packs_epi32(_mm_srai_epi32(lo, 20), _mm_srai_epi32(hi, 20));
+		_mm_storel_epi64((__m128i *)(pOut + x), _mm_packus_epi16(w, w));
+	}
+#endif
+	for (; x < nOut; x++)
+	{
+		int sum = 1 << 19;
+		for (int k = 0; k < nTaps; k++)
+			sum += ppRows[k][x] * pCoef[k];
+		sum >>= 20;
+		pOut[x] = (unsigned char)(sum < 0 ? 0 : (sum > 255 ? 255 : sum));
+	}
+}
+
+CFrameScaler::CFrameScaler()
+	: m_Filter(SCALE_BICUBIC), m_bValid(false), m_Format(FRAME_FORMAT_YUY2),
+	  m_nSrcWidth(0), m_nSrcHeight(0), m_nDstWidth(0), m_nDstHeight(0),
+	  m_nPlanes(0), m_nGroups(0), m_nOutRows(1), m_lOutStride(0), m_lOutStrideUV(0)
+{
+}
+
+void CFrameScaler::SetFilter(ScaleFilter filter)
+{
+	if (filter != m_Filter)
+	{
+		m_Filter = filter;
+		m_bValid = false;
+	}
+}
+
+void CFrameScaler::BuildTaps(Taps *pTaps, int nIn, int nOut, int nAlign)
+{
+	// Shrinking stretches the filter over more source samples
+	const double dScale = (double)nIn / nOut;
+	const double dStretch = dScale > 1 ? dScale : 1;
+	const double dSupport = g_Radius[m_Filter] * dStretch;
+
+	int nTaps = 1;
+	for (int i = 0; i < nOut; i++)
+	{
+		double c = (i + 0.5) * dScale - 0.5;
+		int n = (int)floor(c + dSupport) - ((int)floor(c - dSupport) + 1) + 1;
+		if (n > nTaps)
+			nTaps = n;
+	}
+	nTaps = (nTaps + nAlign - 1) / nAlign * nAlign;
+
+	pTaps->nTaps = nTaps;
+	pTaps->Start.resize(nOut);
+	pTaps->Coef.assign((size_t)nOut * nTaps, 0);
+	std::vector<double> w(nTaps);
+	for (int i = 0; i < nOut; i++)
+	{
+		double c = (i + 0.5) * dScale - 0.5;
+		int nFirst = (int)floor(c - dSupport) + 1;
+		double dSum = 0;
+		for (int k = 0; k < nTaps; k++)
+		{
+			w[k] = FilterWeight(m_Filter, (nFirst + k - c) / dStretch);
+			dSum += w[k];
+		}
+
+		// Quantize and give the rounding error to the largest weight, so
+		// that a flat area stays exactly flat
+		short *pCoef = &pTaps->Coef[(size_t)i * nTaps];
+		int nSum = 0, nBig = 0;
+		for (int k = 0; k < nTaps; k++)
+		{
+			pCoef[k] = (short)floor(w[k] / dSum * (1 << 14) + 0.5);
+			nSum += pCoef[k];
+			if (pCoef[k] > pCoef[nBig])
+				nBig = k;
+		}
+		pCoef[nBig] = (short)(pCoef[nBig] + (1 << 14) - nSum);
+		pTaps->Start[i] = nFirst;
+	}
+}
+
+void CFrameScaler::Prepare(const FrameDesc &src, const FrameDesc &dst, int nBands)
+{
+	if (!m_bValid || src.format != m_Format ||
+		src.nWidth != m_nSrcWidth || src.nHeight != m_nSrcHeight ||
+		dst.nWidth != m_nDstWidth || dst.nHeight != m_nDstHeight)
+	{
+		m_Format = src.format;
+		m_nSrcWidth = src.nWidth;
+		m_nSrcHeight = src.nHeight;
+		m_nDstWidth = dst.nWidth;
+		m_nDstHeight = dst.nHeight;
+
+		int sx = 1, sy = 0;
+		if (FramePlanar(m_Format))
+			FrameChromaShift(m_Format, &sx, &sy);
+		m_nPlanes = 3;
+		m_nGroups = FramePlanar(m_Format) ? 2 : 1;
+		m_nOutRows = 1 << sy;
+		for (int p = 0; p < 3; p++)
+		{
+			Plane &plane = m_Planes[p];
+			int s = p == 0 ? 0 : sx;
+			plane.nSrcWidth = (m_nSrcWidth + s) >> s;
+			plane.nDstWidth = (m_nDstWidth + s) >> s;
+			plane.nGroup = p == 0 ? 0 : m_nGroups - 1;
+			BuildTaps(&plane.h, plane.nSrcWidth, plane.nDstWidth, 4);
+
+			// Room for the taps that hang over either edge of the row
+			int nLeft = 0, nRight = plane.nSrcWidth;
+			for (int x = 0; x < plane.nDstWidth; x++)
+			{
+				if (-plane.h.Start[x] > nLeft)
+					nLeft = -plane.h.Start[x];
+				if (plane.h.Start[x] + plane.h.nTaps > nRight)
+					nRight = plane.h.Start[x] + plane.h.nTaps;
+			}
+			for (int x = 0; x < plane.nDstWidth; x++)
+				plane.h.Start[x] += nLeft;
+			plane.nPadLeft = nLeft;
+			plane.nRowBytes = nLeft + nRight;
+		}
+		for (int g = 0; g < m_nGroups; g++)
+		{
+			Group &group = m_Groups[g];
+			int s = g == 0 ? 0 : sy;
+			group.nSrcHeight = (m_nSrcHeight + s) >> s;
+			group.nDstHeight = (m_nDstHeight + s) >> s;
+			BuildTaps(&group.v, group.nSrcHeight, group.nDstHeight, 1);
+		}
+
+		// Packed formats scale into the three planes and interleave behind
+		// them; planar ones scale straight into rows of the frame format
+		if (FramePlanar(m_Format))
+		{
+			m_lOutStride = m_Planes[0].nDstWidth;
+			m_lOutStrideUV = m_Planes[1].nDstWidth;
+		}
+		else
+		{
+			m_lOutStride = (ptrdiff_t)((m_nDstWidth + 1) / 2) * 4;
+			m_lOutStrideUV = 0;
+		}
+
+		m_Scratch.clear();
+		m_bValid = true;
+	}
+
+	size_t nOld = m_Scratch.size();
+	if (nOld < (size_t)nBands)
+		m_Scratch.resize(nBands);
+	for (size_t i = nOld; i < m_Scratch.size(); i++)
+	{
+		Scratch &s = m_Scratch[i];
+		for (int p = 0; p < m_nPlanes; p++)
+		{
+			const Plane &plane = m_Planes[p];
+			s.In[p].resize(plane.nRowBytes + 8);
+			s.Ring[p].resize((size_t)plane.nDstWidth * m_Groups[plane.nGroup].v.nTaps);
+		}
+		int nMaxTaps = 0;
+		for (int g = 0; g < m_nGroups; g++)
+		{
+			s.Tags[g].resize(m_Groups[g].v.nTaps);
+			if (m_Groups[g].v.nTaps > nMaxTaps)
+				nMaxTaps = m_Groups[g].v.nTaps;
+		}
+		s.Rows.resize(nMaxTaps);
+		size_t cbOut = FramePlanar(m_Format)
+			? (size_t)m_lOutStride * m_nOutRows + 2 * (size_t)m_lOutStrideUV
+			: (size_t)m_lOutStride + (size_t)m_Planes[0].nDstWidth + 1 + 2 * (size_t)m_Planes[1].nDstWidth;
+		s.Out.resize(cbOut);
+	}
+
+	// The rings hold rows of the previous frame. Within a frame they stay
+	// valid from one call to the next, so the tiles of a band that follow
+	// each other down the frame share the rows under both.
+	for (size_t i = 0; i < m_Scratch.size(); i++)
+	{
+		for (int g = 0; g < m_nGroups; g++)
+			m_Scratch[i].Tags[g].assign(m_Scratch[i].Tags[g].size(), INT_MIN);
+	}
+}
+
+//
+// Read source row nRow of a group, clamped to the frame, and scale its
+// planes horizontally into ring slot nSlot
+//
+void CFrameScaler::Fetch(Scratch &s, const FrameDesc &src, int nGroup, int nRow, int nSlot)
+{
+	const Group &group = m_Groups[nGroup];
+	if (nRow < 0)
+		nRow = 0;
+	if (nRow >= group.nSrcHeight)
+		nRow = group.nSrcHeight - 1;
+
+	if (!FramePlanar(m_Format))
+	{
+		const unsigned char *p = src.pbTop + src.lStride * nRow;
+		const int y0 = m_Format == FRAME_FORMAT_UYVY ? 1 : 0;
+		const int u = 1 - y0, y1 = 2 + y0, v = 3 - y0;
+		unsigned char *pY = &s.In[0][m_Planes[0].nPadLeft];
+		unsigned char *pU = &s.In[1][m_Planes[1].nPadLeft];
+		unsigned char *pV = &s.In[2][m_Planes[2].nPadLeft];
+		const int nPairs = m_nSrcWidth / 2;
+		int i = 0;
+#ifdef FRAME_SSE2
+		// Sixteen pixels at a time: luma from one byte of every pair, U and V
+		// alternating in the other
+		const __m128i low = _mm_set1_epi16(0x00ff);
+		for (; i + 8 <= nPairs; i += 8, p += 32)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)p);
+			__m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+			__m128i luma, chroma;
+			if (y0 == 0)
+			{
+				luma = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+				chroma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+			}
+			else
+			{
+				luma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+				chroma = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+			}
+			__m128i cu = _mm_and_si128(chroma, low);
+			__m128i cv = _mm_srli_epi16(chroma, 8);
+			_mm_storeu_si128((__m128i *)(pY + 2 * i), luma);
+			_mm_storel_epi64((__m128i *)(pU + i), _mm_packus_epi16(cu, cu));
+			_mm_storel_epi64((__m128i *)(pV + i), _mm_packus_epi16(cv, cv));
+		}
+#endif
+		for (; i < nPairs; i++, p += 4)
+		{
+			pY[2 * i] = p[y0];
+			pY[2 * i + 1] = p[y1];
+			pU[i] = p[u];
+			pV[i] = p[v];
+		}
+		if (m_nSrcWidth & 1)
+		{
+			pY[2 * nPairs] = p[y0];
+			pU[nPairs] = p[u];
+			pV[nPairs] = p[v];
+		}
+	}
+	else if (nGroup == 0)
+	{
+		memcpy(&s.In[0][m_Planes[0].nPadLeft], src.pbTop + src.lStride * nRow, m_nSrcWidth);
+	}
+	else
+	{
+		memcpy(&s.In[1][m_Planes[1].nPadLeft], src.pbU + src.lStrideUV * nRow, m_Planes[1].nSrcWidth);
+		memcpy(&s.In[2][m_Planes[2].nPadLeft], src.pbV + src.lStrideUV * nRow, m_Planes[2].nSrcWidth);
+	}
+
+	for (int p = 0; p < m_nPlanes; p++)
+	{
+		const Plane &plane = m_Planes[p];
+		if (plane.nGroup != nGroup)
+			continue;
+		unsigned char *pIn = &s.In[p][0];
+		int nLeft = plane.nPadLeft, nWidth = plane.nSrcWidth;
+		memset(pIn, pIn[nLeft], nLeft);
+		memset(pIn + nLeft + nWidth, pIn[nLeft + nWidth - 1], s.In[p].size() - nLeft - nWidth);
+		ScaleHorizontal(pIn, &plane.h.Start[0], &plane.h.Coef[0], plane.h.nTaps,
+			&s.Ring[p][(size_t)nSlot * plane.nDstWidth], plane.nDstWidth);
+	}
+}
+
+//
+// Produce target row nRow of every plane in a group
+//
+void CFrameScaler::ScaleRow(Scratch &s, const FrameDesc &src, int nGroup, int nRow, unsigned char **ppOut)
+{
+	const Taps &v = m_Groups[nGroup].v;
+	const int nTaps = v.nTaps;
+	const int nStart = v.Start[nRow];
+	std::vector<int> &tags = s.Tags[nGroup];
+
+	// The windows of consecutive rows only move down, so a ring of nTaps
+	// rows never drops a row that is still under the window
+	int nSlot0 = ((nStart % nTaps) + nTaps) % nTaps;
+	for (int k = 0; k < nTaps; k++)
+	{
+		int nSlot = (nSlot0 + k) % nTaps;
+		if (tags[nSlot] != nStart + k)
+		{
+			Fetch(s, src, nGroup, nStart + k, nSlot);
+			tags[nSlot] = nStart + k;
+		}
+	}
+
+	for (int p = 0; p < m_nPlanes; p++)
+	{
+		const Plane &plane = m_Planes[p];
+		if (plane.nGroup != nGroup)
+			continue;
+		for (int k = 0; k < nTaps; k++)
+			s.Rows[k] = &s.Ring[p][(size_t)((nSlot0 + k) % nTaps) * plane.nDstWidth];
+		ScaleVertical(&s.Rows[0], &v.Coef[(size_t)nRow * nTaps], nTaps, ppOut[p], plane.nDstWidth);
+	}
+}
+
+void CFrameScaler::InputRows(int nFirstRow, int nLastRow, int *pFirst, int *pLast) const
+{
+	// Every group reads the rows under the vertical taps of its own rows;
+	// planar chroma rows count as the luma rows they cover
+	int nFirst = m_nSrcHeight, nLast = 0;
+	for (int g = 0; g < m_nGroups; g++)
+	{
+		const Group &group = m_Groups[g];
+		const int s = g == 0 ? 0 : m_nOutRows >> 1;
+		int a = group.v.Start[nFirstRow >> s];
+		int b = group.v.Start[(nLastRow - 1) >> s] + group.v.nTaps;
+		a = a < 0 ? 0 : (a >= group.nSrcHeight ? group.nSrcHeight - 1 : a);
+		b = b > group.nSrcHeight ? group.nSrcHeight : (b < 1 ? 1 : b);
+		a <<= s;
+		b = (b << s) < m_nSrcHeight ? b << s : m_nSrcHeight;
+		if (a < nFirst)
+			nFirst = a;
+		if (b > nLast)
+			nLast = b;
+	}
+	*pFirst = nFirst;
+	*pLast = nLast;
+}
+
+void CFrameScaler::ProcessRows(CFrameSink *pSink, const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, int nBand)
+{
+	Scratch &s = m_Scratch[nBand];
+
+	// The scaled rows, described as a small frame of the target format
+	const bool bPlanar = FramePlanar(m_Format);
+	unsigned char *pbOut = &s.Out[0];
+	FrameDesc rows;
+	rows.pbTop = pbOut;
+	rows.lStride = m_lOutStride;
+	rows.nWidth = m_nDstWidth;
+	rows.format = m_Format;
+	unsigned char *ppOut[3];
+	if (bPlanar)
+	{
+		rows.pbU = pbOut + m_lOutStride * m_nOutRows;
+		rows.pbV = rows.pbU + m_lOutStrideUV;
+		rows.lStrideUV = m_lOutStrideUV;
+		ppOut[1] = rows.pbU;
+		ppOut[2] = rows.pbV;
+	}
+	else
+	{
+		rows.pbU = NULL;
+		rows.pbV = NULL;
+		rows.lStrideUV = 0;
+		ppOut[0] = pbOut + m_lOutStride;
+		ppOut[1] = ppOut[0] + m_Planes[0].nDstWidth + 1;
+		ppOut[2] = ppOut[1] + m_Planes[1].nDstWidth;
+	}
+
+	const int y0 = m_Format == FRAME_FORMAT_UYVY ? 1 : 0;
+	const int u = 1 - y0, y1 = 2 + y0, v = 3 - y0;
+
+	for (int y = nFirstRow; y < nLastRow; y += m_nOutRows)
+	{
+		int n = nLastRow - y < m_nOutRows ? nLastRow - y : m_nOutRows;
+		if (bPlanar)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				ppOut[0] = pbOut + m_lOutStride * i;
+				ScaleRow(s, src, 0, y + i, ppOut);
+			}
+			ScaleRow(s, src, 1, y / m_nOutRows, ppOut);
+		}
+		else
+		{
+			ScaleRow(s, src, 0, y, ppOut);
+			const unsigned char *pY = ppOut[0], *pU = ppOut[1], *pV = ppOut[2];
+			unsigned char *p = pbOut;
+			const int nPairs = (m_nDstWidth + 1) / 2;
+			ppOut[0][m_nDstWidth] = ppOut[0][m_nDstWidth - 1];
+			for (int i = 0; i < nPairs; i++, p += 4)
+			{
+				p[y0] = pY[2 * i];
+				p[y1] = pY[2 * i + 1];
+				p[u] = pU[i];
+				p[v] = pV[i];
+			}
+		}
+
+		rows.nHeight = n;
+		pSink->ProcessRowGroup(rows, dst, y, kernel, pStats);
+	}
+}
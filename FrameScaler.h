@@ -0,0 +1,112 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+
+//
+// Resampling filters, from cheapest to sharpest
+//
+enum ScaleFilter
+{
+	SCALE_BILINEAR = 0,   // Triangle, 2 taps when enlarging
+	SCALE_BICUBIC,        // Catmull-Rom, 4 taps
+	SCALE_LANCZOS,        // Lanczos-3, 6 taps
+	SCALE_FILTER_COUNT
+};
+
+const char *ScaleFilterName(ScaleFilter filter);
+bool ScaleFilterFromName(const char *pszName, ScaleFilter *pFilter);
+
+//
+// CFrameScaler
+//
+// Separable resize of a frame of any FrameFormat, run as a CFrameStage by
+// CColorEngine::ProcessScaled(). Every source row is read once: its planes
+// are filtered horizontally into a small ring of 16-bit rows, and each
+// target row is filtered vertically out of that ring. The scaled row then
+// goes straight through the engine's kernels while it is still in the L1
+// cache, so the colour transform costs no extra pass over memory.
+//
+// The taps are 14-bit fixed point and are widened by the scale factor
+// when shrinking, so downscales filter rather than skip pixels. Packed
+// formats are split into Y, U and V planes on the way in and interleaved
+// again on the way out.
+//
+class CFrameScaler : public CFrameStage
+{
+public:
+	CFrameScaler();
+
+	void SetFilter(ScaleFilter filter);
+	ScaleFilter GetFilter() const { return m_Filter; }
+
+	// Rebuild the taps when the format, the sizes or the filter changed and
+	// make room for nBands concurrent bands. Called by the engine.
+	virtual void Prepare(const FrameDesc &src, const FrameDesc &dst, int nBands);
+
+	virtual void InputRows(int nFirstRow, int nLastRow, int *pFirst, int *pLast) const;
+
+	// Scale target rows [nFirstRow, nLastRow) of dst from src and hand them
+	// to pSink. nBand selects the scratch rows of the calling worker.
+	// pStats, when given, receives the histograms of the sampled rows.
+	virtual void ProcessRows(CFrameSink *pSink, const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, int nBand);
+
+private:
+	// Filter positions and weights along one axis
+	struct Taps
+	{
+		int nTaps;                  // Per output sample, padded with zero weights
+		std::vector<int> Start;     // First input sample of each output sample
+		std::vector<short> Coef;    // nTaps weights per output sample, summing to 1 << 14
+	};
+
+	// One plane: horizontal taps and the place of its rows in a Scratch
+	struct Plane
+	{
+		int nSrcWidth;
+		int nDstWidth;
+		int nPadLeft;               // Replicated edge samples in front of a source row
+		int nRowBytes;              // Padded source row
+		int nGroup;                 // Planes of a group share the source rows and vertical taps
+		Taps h;
+	};
+
+	struct Group
+	{
+		int nSrcHeight;
+		int nDstHeight;
+		Taps v;                     // Unpadded; the ring holds v.nTaps rows
+	};
+
+	// Rows of one band
+	struct Scratch
+	{
+		std::vector<unsigned char> In[3];    // Padded source rows
+		std::vector<short> Ring[3];          // Horizontally scaled rows
+		std::vector<int> Tags[2];            // Source row in each ring slot
+		std::vector<unsigned char> Out;      // Scaled rows in the frame format
+		std::vector<const short *> Rows;     // Ring rows under the vertical taps
+	};
+
+	void BuildTaps(Taps *pTaps, int nIn, int nOut, int nAlign);
+	void Fetch(Scratch &s, const FrameDesc &src, int nGroup, int nRow, int nSlot);
+	void ScaleRow(Scratch &s, const FrameDesc &src, int nGroup, int nRow, unsigned char **ppOut);
+
+	ScaleFilter m_Filter;
+	bool m_bValid;
+	FrameFormat m_Format;
+	int m_nSrcWidth;
+	int m_nSrcHeight;
+	int m_nDstWidth;
+	int m_nDstHeight;
+
+	int m_nPlanes;
+	int m_nGroups;
+	Plane m_Planes[3];
+	Group m_Groups[2];
+	int m_nOutRows;              // Target rows scaled before each engine call
+	ptrdiff_t m_lOutStride;
+	ptrdiff_t m_lOutStrideUV;
+	std::vector<Scratch> m_Scratch;
+};
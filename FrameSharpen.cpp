@@ -0,0 +1,360 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include "FrameSharpen.h"
+
+//
+// Luma of a packed row: every other byte, starting at y0
+//
+static void ExtractLuma(const unsigned char *pIn, int y0, unsigned char *pOut, int n)
+{
+	int x = 0;
+#ifdef FRAME_SSE2
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	for (; x + 16 <= n; x += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(pIn + 2 * x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(pIn + 2 * x + 16));
+		if (y0 == 0)
+		{
+			a = _mm_and_si128(a, mask);
+			b = _mm_and_si128(b, mask);
+		}
+		else
+		{
+			a = _mm_srli_epi16(a, 8);
+			b = _mm_srli_epi16(b, 8);
+		}
+		_mm_storeu_si128((__m128i *)(pOut + x), _mm_packus_epi16(a, b));
+	}
+#endif
+	for (; x < n; x++)
+		pOut[x] = pIn[2 * x + y0];
+}
+
+//
+// A packed row with its luma replaced: the chroma of pIn and nWidth luma
+// samples of pLuma. The second luma of an odd last pair stays as it was.
+//
+static void MergeLuma(const unsigned char *pIn, const unsigned char *pLuma, int y0,
+	unsigned char *pOut, int nWidth)
+{
+	int x = 0;
+#ifdef FRAME_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i chroma = y0 == 0 ? _mm_set1_epi16((short)0xFF00) : _mm_set1_epi16(0x00FF);
+	for (; x + 8 <= nWidth; x += 8)
+	{
+		__m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pIn + 2 * x)), chroma);
+		__m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pLuma + x)), zero);
+		if (y0 != 0)
+			y = _mm_slli_epi16(y, 8);
+		_mm_storeu_si128((__m128i *)(pOut + 2 * x), _mm_or_si128(c, y));
+	}
+#endif
+	for (; x < nWidth; x++)
+	{
+		pOut[2 * x + 1 - y0] = pIn[2 * x + 1 - y0];
+		pOut[2 * x + y0] = pLuma[x];
+	}
+	if (nWidth & 1)
+	{
+		pOut[2 * x] = pIn[2 * x];
+		pOut[2 * x + 1] = pIn[2 * x + 1];
+	}
+}
+
+//
+// Horizontal pass: 8-bit luma to 16-bit samples with 6 fraction bits.
+// pIn holds radius samples of padding on either side of the nOut centres.
+// The weights are symmetric, so the two samples that share one are added
+// first and the radius + 1 sums go through the multiply-adds two at a
+// time, the centre last. The vertical pass does the same.
+//
+static void BlurHorizontal(const unsigned char *pIn, const short *pCoef, int nRadius,
+	short *pOut, int nOut)
+{
+	const int nTaps = 2 * nRadius + 1;
+	int x = 0;
+#ifdef FRAME_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(128);
+#define LOAD8(i) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pIn + x + (i))), zero)
+	for (; x + 8 <= nOut; x += 8)
+	{
+		__m128i lo = round, hi = round;
+		int k = 0;
+		for (; k + 1 < nRadius; k += 2)
+		{
+			__m128i a = _mm_add_epi16(LOAD8(k), LOAD8(nTaps - 1 - k));
+			__m128i b = _mm_add_epi16(LOAD8(k + 1), LOAD8(nTaps - 2 - k));
+			__m128i c = _mm_set1_epi32((unsigned short)pCoef[k] | (pCoef[k + 1] << 16));
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+		}
+		__m128i a = k < nRadius ? _mm_add_epi16(LOAD8(k), LOAD8(nTaps - 1 - k)) : zero;
+		__m128i b = LOAD8(nRadius);
+		__m128i c = _mm_set1_epi32((k < nRadius ? (unsigned short)pCoef[k] : 0) | (pCoef[nRadius] << 16));
+		lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+		hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+		_mm_storeu_si128((__m128i *)(pOut + x),
+			_mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8)));
+	}
+#undef LOAD8
+#endif
+	for (; x < nOut; x++)
+	{
+		int sum = 128 + pIn[x + nRadius] * pCoef[nRadius];
+		for (int k = 0; k < nRadius; k++)
+			sum += (pIn[x + k] + pIn[x + nTaps - 1 - k]) * pCoef[k];
+		pOut[x] = (short)(sum >> 8);
+	}
+}
+
+//
+// Vertical pass and the mask: the blur G of the ring rows, then
+// Y + amount * (Y - G) with the amount in 8 fraction bits. Both terms are
+// summed with one multiply-add against (amount, 256), scaled so that Y
+// itself lands in 14 fraction bits. Two ring samples stay below 32768.
+//
+static void SharpenVertical(const short *const *ppRows, const short *pCoef, int nRadius,
+	const unsigned char *pY, int nAmount, unsigned char *pOut, int nOut)
+{
+	const int nTaps = 2 * nRadius + 1;
+	int x = 0;
+#ifdef FRAME_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << 13);
+	const __m128i amount = _mm_set1_epi32((unsigned short)nAmount | (256 << 16));
+#define LOAD16(i) _mm_loadu_si128((const __m128i *)(ppRows[i] + x))
+	for (; x + 8 <= nOut; x += 8)
+	{
+		__m128i lo = round, hi = round;
+		int k = 0;
+		for (; k + 1 < nRadius; k += 2)
+		{
+			__m128i a = _mm_add_epi16(LOAD16(k), LOAD16(nTaps - 1 - k));
+			__m128i b = _mm_add_epi16(LOAD16(k + 1), LOAD16(nTaps - 2 - k));
+			__m128i c = _mm_set1_epi32((unsigned short)pCoef[k] | (pCoef[k + 1] << 16));
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+		}
+		__m128i a = k < nRadius ? _mm_add_epi16(LOAD16(k), LOAD16(nTaps - 1 - k)) : zero;
+		__m128i b = LOAD16(nRadius);
+		__m128i c = _mm_set1_epi32((k < nRadius ? (unsigned short)pCoef[k] : 0) | (pCoef[nRadius] << 16));
+		lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+		hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+
+		__m128i blur = _mm_packs_epi32(_mm_srai_epi32(lo, 14), _mm_srai_epi32(hi, 14));
+		__m128i y = _mm_slli_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pY + x)), zero), 6);
+		__m128i diff = _mm_sub_epi16(y, blur);
+		lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(diff, y), amount), round);
+		hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(diff, y), amount), round);
+		__m128i out = _mm_packs_epi32(_mm_srai_epi32(lo, 14), _mm_srai_epi32(hi, 14));
+		_mm_storel_epi64((__m128i *)(pOut + x), _mm_packus_epi16(out, zero));
+	}
+#undef LOAD16
+#endif
+	for (; x < nOut; x++)
+	{
+		int sum = (1 << 13) + ppRows[nRadius][x] * pCoef[nRadius];
+		for (int k = 0; k < nRadius; k++)
+			sum += (ppRows[k][x] + ppRows[nTaps - 1 - k][x]) * pCoef[k];
+		int y = pY[x] << 6;
+		int v = (nAmount * (y - (sum >> 14)) + (y << 8) + (1 << 13)) >> 14;
+		pOut[x] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+	}
+}
+
+CFrameSharpen::CFrameSharpen()
+	: m_nRadius(0), m_nAmount(0), m_nHeight(0), m_nTileWidth(0), m_nLumaBytes(0)
+{
+	SetParameters(1, 0);
+}
+
+void CFrameSharpen::SetParameters(int nRadius, double dAmount)
+{
+	if (nRadius < 1)
+		nRadius = 1;
+	if (nRadius > MAX_RADIUS)
+		nRadius = MAX_RADIUS;
+	if (dAmount < -1)
+		dAmount = -1;
+	if (dAmount > 4)
+		dAmount = 4;
+	m_nAmount = (int)floor(dAmount * 256 + 0.5);
+	if (nRadius == m_nRadius)
+		return;
+
+	// Gaussian over [-radius, radius]; the rounding error goes to the
+	// centre so that a flat area stays exactly flat
+	m_nRadius = nRadius;
+	const int nTaps = 2 * nRadius + 1;
+	const double dSigma = nRadius / 2.0;
+	std::vector<double> w(nTaps);
+	double dSum = 0;
+	for (int k = 0; k < nTaps; k++)
+	{
+		double x = k - nRadius;
+		w[k] = exp(-x * x / (2 * dSigma * dSigma));
+		dSum += w[k];
+	}
+	m_Coef.resize(nTaps);
+	int nSum = 0;
+	for (int k = 0; k < nTaps; k++)
+	{
+		m_Coef[k] = (short)floor(w[k] / dSum * (1 << 14) + 0.5);
+		nSum += m_Coef[k];
+	}
+	m_Coef[nRadius] = (short)(m_Coef[nRadius] + (1 << 14) - nSum);
+}
+
+void CFrameSharpen::Prepare(const FrameDesc &src, const FrameDesc &, int nBands)
+{
+	// Tiles a multiple of 64 pixels wide, which keeps them on whole chroma
+	// samples, with the 16-bit ring and the luma rows inside the budget
+	const int nRing = 2 * m_nRadius + 1;
+	int nTile = (int)(g_FrameTileBytes / ((size_t)nRing * 3)) & ~63;
+	if (nTile < 64)
+		nTile = 64;
+	m_nTileWidth = nTile < src.nWidth ? nTile : src.nWidth;
+	m_nHeight = src.nHeight;
+	m_nLumaBytes = m_nTileWidth + 2 * m_nRadius;
+
+	int sx = 0, sy = 0;
+	if (FramePlanar(src.format))
+		FrameChromaShift(src.format, &sx, &sy);
+	const size_t cbOut = FramePlanar(src.format)
+		? ((size_t)m_nTileWidth << sy)
+		: (size_t)(m_nTileWidth + 1) / 2 * 4 + m_nTileWidth;
+
+	if (m_Scratch.size() < (size_t)nBands)
+		m_Scratch.resize(nBands);
+	for (size_t i = 0; i < m_Scratch.size(); i++)
+	{
+		Scratch &s = m_Scratch[i];
+		s.Luma.resize((size_t)nRing * m_nLumaBytes);
+		s.Ring.resize((size_t)nRing * m_nTileWidth);
+		s.Tags.resize(nRing);
+		s.Rows.resize(nRing);
+		s.Out.resize(cbOut);
+		s.Tags.assign(nRing, INT_MIN);
+	}
+}
+
+void CFrameSharpen::InputRows(int nFirstRow, int nLastRow, int *pFirst, int *pLast) const
+{
+	*pFirst = nFirstRow - m_nRadius < 0 ? 0 : nFirstRow - m_nRadius;
+	*pLast = nLastRow + m_nRadius > m_nHeight ? m_nHeight : nLastRow + m_nRadius;
+}
+
+//
+// Read the luma of source row nRow, clamped to the frame, for the tile at
+// x0 and its padding, and blur it horizontally into the ring
+//
+void CFrameSharpen::Fetch(Scratch &s, const FrameDesc &src, int x0, int nWidth, int nRow)
+{
+	const int nRing = 2 * m_nRadius + 1;
+	const int nSlot = (nRow % nRing + nRing) % nRing;
+	s.Tags[nSlot] = nRow;
+	if (nRow < 0)
+		nRow = 0;
+	if (nRow >= src.nHeight)
+		nRow = src.nHeight - 1;
+
+	// Columns [x0 - r, x0 + nWidth + r), the part outside the frame
+	// replicated from its edges
+	const int r = m_nRadius;
+	unsigned char *pLuma = &s.Luma[(size_t)nSlot * m_nLumaBytes];
+	int nFirst = x0 - r < 0 ? 0 : x0 - r;
+	int nLast = x0 + nWidth + r > src.nWidth ? src.nWidth : x0 + nWidth + r;
+	const unsigned char *pRow = src.pbTop + src.lStride * nRow;
+	unsigned char *pMid = pLuma + (nFirst - (x0 - r));
+	if (FramePlanar(src.format))
+		memcpy(pMid, pRow + nFirst, nLast - nFirst);
+	else
+		ExtractLuma(pRow + 2 * nFirst, src.format == FRAME_FORMAT_UYVY ? 1 : 0, pMid, nLast - nFirst);
+	memset(pLuma, pMid[0], pMid - pLuma);
+	memset(pMid + (nLast - nFirst), pMid[nLast - nFirst - 1], (pLuma + nWidth + 2 * r) - (pMid + (nLast - nFirst)));
+
+	BlurHorizontal(pLuma, &m_Coef[0], m_nRadius, &s.Ring[(size_t)nSlot * m_nTileWidth], nWidth);
+}
+
+void CFrameSharpen::SharpenRow(Scratch &s, const FrameDesc &src, int x0, int nWidth, int nRow,
+	unsigned char *pOut)
+{
+	const int nRing = 2 * m_nRadius + 1;
+	for (int k = 0; k < nRing; k++)
+	{
+		int nSrc = nRow - m_nRadius + k;
+		int nSlot = (nSrc % nRing + nRing) % nRing;
+		if (s.Tags[nSlot] != nSrc)
+			Fetch(s, src, x0, nWidth, nSrc);
+		s.Rows[k] = &s.Ring[(size_t)nSlot * m_nTileWidth];
+	}
+	const int nSlot = (nRow % nRing + nRing) % nRing;
+	const unsigned char *pY = &s.Luma[(size_t)nSlot * m_nLumaBytes + m_nRadius];
+	SharpenVertical(&s.Rows[0], &m_Coef[0], m_nRadius, pY, m_nAmount, pOut, nWidth);
+}
+
+void CFrameSharpen::ProcessRows(CFrameSink *pSink, const FrameDesc &src, const FrameDesc &dst,
+	int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, int nBand)
+{
+	Scratch &s = m_Scratch[nBand];
+	const bool bPlanar = FramePlanar(src.format);
+	int sx = 0, sy = 0;
+	if (bPlanar)
+		FrameChromaShift(src.format, &sx, &sy);
+	const int nOutRows = 1 << sy;
+	const int y0 = src.format == FRAME_FORMAT_UYVY ? 1 : 0;
+	unsigned char *pbOut = &s.Out[0];
+
+	for (int x0 = 0; x0 < src.nWidth; x0 += m_nTileWidth)
+	{
+		const int nWidth = src.nWidth - x0 < m_nTileWidth ? src.nWidth - x0 : m_nTileWidth;
+		// The ring carries over from the previous call of the band only
+		// when the whole width is one tile
+		if (m_nTileWidth < src.nWidth)
+			s.Tags.assign(s.Tags.size(), INT_MIN);
+
+		// The sharpened rows of the tile, described as a small frame, and
+		// the tile's columns of the target
+		FrameDesc rows = src;
+		rows.pbTop = pbOut;
+		rows.nWidth = nWidth;
+		FrameDesc target = dst;
+		target.nWidth = nWidth;
+		if (bPlanar)
+		{
+			rows.lStride = m_nTileWidth;
+			target.pbTop = dst.pbTop + x0;
+			target.pbU = dst.pbU + (x0 >> sx);
+			target.pbV = dst.pbV + (x0 >> sx);
+		}
+		else
+		{
+			rows.lStride = (ptrdiff_t)(m_nTileWidth + 1) / 2 * 4;
+			target.pbTop = dst.pbTop + 2 * x0;
+		}
+
+		for (int y = nFirstRow; y < nLastRow; y += nOutRows)
+		{
+			const int n = nLastRow - y < nOutRows ? nLastRow - y : nOutRows;
+			if (bPlanar)
+			{
+				for (int i = 0; i < n; i++)
+					SharpenRow(s, src, x0, nWidth, y + i, pbOut + rows.lStride * i);
+				rows.pbU = src.pbU + src.lStrideUV * (y >> sy) + (x0 >> sx);
+				rows.pbV = src.pbV + src.lStrideUV * (y >> sy) + (x0 >> sx);
+			}
+			else
+			{
+				unsigned char *pLuma = pbOut + rows.lStride;
+				SharpenRow(s, src, x0, nWidth, y, pLuma);
+				MergeLuma(src.pbTop + src.lStride * y + 2 * x0, pLuma, y0, pbOut, nWidth);
+			}
+			rows.nHeight = n;
+			pSink->ProcessRowGroup(rows, target, y, kernel, pStats);
+		}
+	}
+}
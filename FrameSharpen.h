@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include "FramePlatform.h"
+#include "ColorEngine.h"
+
+//
+// CFrameSharpen
+//
+// Unsharp mask on luma, run as a CFrameStage in front of the colour
+// kernels: Y + amount * (Y - G(Y)), where G is a separable Gaussian reaching
+// radius pixels (sigma = radius / 2). An amount of -1 leaves the plain blur.
+// Chroma passes through.
+//
+// A band is worked in column tiles sized so that the ring of horizontally
+// blurred rows (2 * radius + 1 of them, 16-bit) fits g_FrameTileBytes.
+// Every source row of a tile is blurred horizontally once, every target row
+// is blurred vertically out of the ring, and the sharpened row goes
+// straight through the engine's kernels for that tile.
+//
+// The stage reads rows of the neighbouring bands, so the source and the
+// target must be separate frames.
+//
+class CFrameSharpen : public CFrameStage
+{
+public:
+	enum { MAX_RADIUS = 16 };
+
+	CFrameSharpen();
+
+	// nRadius 1..MAX_RADIUS; dAmount -1..4, 0 turns the stage off
+	void SetParameters(int nRadius, double dAmount);
+	int GetRadius() const { return m_nRadius; }
+	double GetAmount() const { return m_nAmount / 256.0; }
+	bool Enabled() const { return m_nAmount != 0; }
+
+	virtual void Prepare(const FrameDesc &src, const FrameDesc &dst, int nBands);
+	virtual void InputRows(int nFirstRow, int nLastRow, int *pFirst, int *pLast) const;
+	virtual void ProcessRows(CFrameSink *pSink, const FrameDesc &src, const FrameDesc &dst,
+		int nFirstRow, int nLastRow, ColorKernel kernel, FrameStats *pStats, int nBand);
+
+private:
+	// Rows of one band
+	struct Scratch
+	{
+		std::vector<unsigned char> Luma;     // Padded source luma, one row per ring slot
+		std::vector<short> Ring;             // Horizontally blurred rows
+		std::vector<int> Tags;               // Source row in each ring slot
+		std::vector<const short *> Rows;     // Ring rows under the vertical taps
+		std::vector<unsigned char> Out;      // Sharpened rows of one tile in the frame format
+	};
+
+	void Fetch(Scratch &s, const FrameDesc &src, int x0, int nWidth, int nRow);
+	void SharpenRow(Scratch &s, const FrameDesc &src, int x0, int nWidth, int nRow, unsigned char *pOut);
+
+	int m_nRadius;
+	int m_nAmount;               // 8 fraction bits
+	std::vector<short> m_Coef;   // 2 * radius + 1 weights summing to 1 << 14
+	int m_nHeight;
+	int m_nTileWidth;
+	int m_nLumaBytes;            // Padded luma row of a tile
+	std::vector<Scratch> m_Scratch;
+};
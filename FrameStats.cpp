@@ -0,0 +1,118 @@
+#include <math.h>
+#include <string.h>
+#include "FrameStats.h"
+
+void FrameStats::Clear()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+void FrameStats::Add(const FrameStats &other)
+{
+	for (int i = 0; i < 256; i++)
+	{
+		LumaIn[i] += other.LumaIn[i];
+		Luma[i] += other.Luma[i];
+		ChromaU[i] += other.ChromaU[i];
+		ChromaV[i] += other.ChromaV[i];
+		for (int k = 0; k < LANES; k++)
+		{
+			LumaIn[i] += other.LumaInLanes[k][i];
+			Luma[i] += other.LumaLanes[k][i];
+			ChromaU[i] += other.ChromaULanes[k][i];
+			ChromaV[i] += other.ChromaVLanes[k][i];
+		}
+	}
+}
+
+void FrameStats::Fold()
+{
+	for (int i = 0; i < 256; i++)
+	{
+		for (int k = 0; k < LANES; k++)
+		{
+			LumaIn[i] += LumaInLanes[k][i];
+			Luma[i] += LumaLanes[k][i];
+			ChromaU[i] += ChromaULanes[k][i];
+			ChromaV[i] += ChromaVLanes[k][i];
+		}
+	}
+	memset(LumaInLanes, 0, sizeof(LumaInLanes));
+	memset(LumaLanes, 0, sizeof(LumaLanes));
+	memset(ChromaULanes, 0, sizeof(ChromaULanes));
+	memset(ChromaVLanes, 0, sizeof(ChromaVLanes));
+}
+
+//
+// Mean, standard deviation and range of one histogram
+//
+static unsigned long long Summarize(const unsigned int *pHist, double *pMean, double *pSpread,
+	int *pMin, int *pMax)
+{
+	unsigned long long n = 0;
+	double sum = 0, sum2 = 0;
+	int nMin = 255, nMax = 0;
+	for (int i = 0; i < 256; i++)
+	{
+		if (pHist[i] == 0)
+			continue;
+		n += pHist[i];
+		sum += (double)i * pHist[i];
+		sum2 += (double)i * i * pHist[i];
+		if (i < nMin) nMin = i;
+		if (i > nMax) nMax = i;
+	}
+	if (n == 0)
+	{
+		*pMean = 0;
+		if (pSpread) *pSpread = 0;
+		if (pMin) *pMin = 0;
+		if (pMax) *pMax = 0;
+		return 0;
+	}
+	*pMean = sum / n;
+	if (pSpread)
+	{
+		double var = sum2 / n - *pMean * *pMean;
+		*pSpread = var > 0 ? sqrt(var) : 0;
+	}
+	if (pMin) *pMin = nMin;
+	if (pMax) *pMax = nMax;
+	return n;
+}
+
+//
+// Scale a histogram of nCounted samples to nFrame samples, rounding every
+// bin; the sum may then be off by a few samples
+//
+static void Scale(unsigned int *pHist, unsigned long long nCounted, unsigned long long nFrame)
+{
+	const double dScale = (double)nFrame / nCounted;
+	for (int i = 0; i < 256; i++)
+		pHist[i] = (unsigned int)(pHist[i] * dScale + 0.5);
+}
+
+void FrameStats::Finish(unsigned long long nLumaFrame, unsigned long long nChromaFrame)
+{
+	Fold();
+	unsigned long long nLumaCounted = 0, nChromaCounted = 0;
+	for (int i = 0; i < 256; i++)
+	{
+		nLumaCounted += LumaIn[i];
+		nChromaCounted += ChromaU[i];
+	}
+	if (nLumaCounted > 0 && nLumaCounted < nLumaFrame)
+	{
+		Scale(LumaIn, nLumaCounted, nLumaFrame);
+		Scale(Luma, nLumaCounted, nLumaFrame);
+	}
+	if (nChromaCounted > 0 && nChromaCounted < nChromaFrame)
+	{
+		Scale(ChromaU, nChromaCounted, nChromaFrame);
+		Scale(ChromaV, nChromaCounted, nChromaFrame);
+	}
+	nLuma = Summarize(Luma, &dLumaMean, NULL, &nLumaMin, &nLumaMax);
+	Summarize(LumaIn, &dLumaInMean, NULL, &nLumaInMin, &nLumaInMax);
+	nChroma = Summarize(ChromaU, &dUMean, &dUSpread, NULL, NULL);
+	Summarize(ChromaV, &dVMean, &dVSpread, NULL, NULL);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+//
+// FrameStats
+//
+// Per-frame statistics gathered by the colour engine while it transforms
+// the pixels. The kernels only fill the histograms; Finish() derives the
+// summary values from them.
+//
+// Neighbouring pixels mostly have the same value, and one increment of a
+// bin has to wait for the store of the one before it. The kernels therefore
+// count consecutive samples into four lanes in turn; Add() and Finish()
+// fold the lanes into the histograms.
+//
+// When the kernels only counted some of the rows, Finish() scales the
+// histograms up to the samples of the whole frame, so that they read the
+// same whatever the row step.
+//
+struct FrameStats
+{
+	enum { LANES = 4 };
+
+	// Histograms
+	unsigned int LumaIn[256];     // Source luma
+	unsigned int Luma[256];       // Processed luma
+	unsigned int ChromaU[256];    // Processed U
+	unsigned int ChromaV[256];    // Processed V
+
+	// Lanes of the same, filled by the kernels
+	unsigned int LumaInLanes[LANES][256];
+	unsigned int LumaLanes[LANES][256];
+	unsigned int ChromaULanes[LANES][256];
+	unsigned int ChromaVLanes[LANES][256];
+
+	// Derived by Finish()
+	unsigned long long nLuma;     // Luma samples of the frame
+	unsigned long long nChroma;   // Samples per chroma plane
+	double dLumaMean;             // Processed luma
+	int nLumaMin;
+	int nLumaMax;
+	double dLumaInMean;           // Source luma
+	int nLumaInMin;
+	int nLumaInMax;
+	double dUMean;                // Processed chroma, around 128
+	double dVMean;
+	double dUSpread;              // Standard deviation of U and V
+	double dVSpread;
+
+	void Clear();
+
+	// Add the histograms and lanes of another partial result
+	void Add(const FrameStats &other);
+
+	// Add the lanes into the histograms and clear them
+	void Fold();
+
+	// Fold, scale the histograms to a frame of nLumaFrame luma samples and
+	// nChromaFrame samples per chroma plane, then compute the summary
+	// values from them
+	void Finish(unsigned long long nLumaFrame, unsigned long long nChromaFrame);
+};
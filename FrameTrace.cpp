@@ -0,0 +1,116 @@
+#include <string.h>
+#include <vector>
+#include "FrameTrace.h"
+
+static const char *const g_EventNames[TRACE_EVENT_COUNT] =
+{
+	"?", "frame-in", "frame-out", "band-start", "band-end", "lut-start", "lut-end",
+	"parameter", "queue-depth", "alloc-start", "alloc-end", "anomaly"
+};
+
+static const char *const g_TableNames[TRACE_TABLE_COUNT] =
+{
+	"luma", "chroma", "cube", "spaces", "curve"
+};
+
+static const char *const g_ParameterNames[TRACE_PARAM_COUNT] =
+{
+	"brightness", "contrast", "hue", "saturation", "gamma", "color-space", "cube"
+};
+
+const char *FrameTraceEventName(int nEvent)
+{
+	return nEvent > 0 && nEvent < TRACE_EVENT_COUNT ? g_EventNames[nEvent] : "?";
+}
+
+const char *FrameTraceTableName(int nTable)
+{
+	return nTable >= 0 && nTable < TRACE_TABLE_COUNT ? g_TableNames[nTable] : "?";
+}
+
+const char *FrameTraceParameterName(int nParameter)
+{
+	return nParameter >= 0 && nParameter < TRACE_PARAM_COUNT ? g_ParameterNames[nParameter] : "?";
+}
+
+CFrameTrace::CFrameTrace()
+	: m_pSlots(NULL), m_nMask(0), m_lNext(0), m_bEnabled(false)
+{
+	SetCapacity(g_FrameTraceRecords);
+}
+
+CFrameTrace::~CFrameTrace()
+{
+	delete [] m_pSlots;
+}
+
+bool CFrameTrace::SetCapacity(unsigned int nRecords)
+{
+	if (nRecords == 0 || nRecords > (1u << 24))
+		return false;
+	unsigned int nSize = 16;
+	while (nSize < nRecords)
+		nSize <<= 1;
+	Slot *pSlots = new Slot[nSize];
+	memset(pSlots, 0, sizeof(Slot) * nSize);
+	delete [] m_pSlots;
+	m_pSlots = pSlots;
+	m_nMask = nSize - 1;
+	m_lNext = 0;
+	return true;
+}
+
+//
+// The slot is cleared before it is written and numbered after, both with
+// a full barrier, so a reader that sees the same number before and after
+// its copy has a whole event. The time is taken once the slot is ours;
+// the order of the slots is only nearly the order of the times.
+//
+void CFrameTrace::Write(FrameTraceEvent event, unsigned int nArg)
+{
+	unsigned int i = (unsigned int)FrameInterlockedIncrement(&m_lNext) - 1;
+	Slot &slot = m_pSlots[i & m_nMask];
+	FrameInterlockedExchange(&slot.lSequence, 0);
+	slot.rec.nTicks = FrameTicks();
+	slot.rec.nArg = nArg;
+	slot.rec.nEvent = (unsigned short)event;
+	slot.rec.nThread = (unsigned short)FrameThreadId();
+	FrameInterlockedExchange(&slot.lSequence, (long)(i + 1));
+}
+
+unsigned long long CFrameTrace::Snapshot(FrameTraceRecord *pRecords, unsigned int *pCount) const
+{
+	unsigned int nNext = (unsigned int)m_lNext;
+	unsigned int nCount = nNext < m_nMask + 1 ? nNext : m_nMask + 1;
+	unsigned int nFirst = nNext - nCount;
+	unsigned int n = 0;
+	for (unsigned int i = nFirst; i != nNext; i++)
+	{
+		const Slot &slot = m_pSlots[i & m_nMask];
+		long lBefore = slot.lSequence;
+		FrameMemoryBarrier();
+		FrameTraceRecord rec = slot.rec;
+		FrameMemoryBarrier();
+		if (lBefore == (long)(i + 1) && slot.lSequence == lBefore)
+			pRecords[n++] = rec;
+	}
+	*pCount = n;
+	return nFirst;
+}
+
+bool CFrameTrace::Save(FILE *pFile) const
+{
+	std::vector<FrameTraceRecord> records(m_nMask + 1);
+	FrameTraceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, "FPTR", 4);
+	header.nVersion = g_FrameTraceVersion;
+	header.nTickFrequency = FrameTickFrequency();
+	header.nFirst = Snapshot(&records[0], &header.nRecords);
+	if (fwrite(&header, sizeof(header), 1, pFile) != 1)
+		return false;
+	if (header.nRecords > 0 &&
+		fwrite(&records[0], sizeof(FrameTraceRecord), header.nRecords, pFile) != header.nRecords)
+		return false;
+	return fflush(pFile) == 0;
+}
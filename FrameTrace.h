@@ -0,0 +1,138 @@
+#pragma once
+#include <stdio.h>
+#include "FramePlatform.h"
+
+//
+// Events of the hot path. The argument of each one is given with it.
+//
+enum FrameTraceEvent
+{
+	TRACE_FRAME_IN = 1,    // A frame arrives; frame number
+	TRACE_FRAME_OUT,       // It leaves; frame number
+	TRACE_BAND_START,      // A worker starts a band of a frame or a slice; band number
+	TRACE_BAND_END,        // And finishes it; band number
+	TRACE_LUT_START,       // Tables are rebuilt; FrameTraceTable
+	TRACE_LUT_END,         // FrameTraceTable
+	TRACE_PARAMETER,       // A parameter changes; FrameTraceParameter << 16 | new value
+	TRACE_QUEUE_DEPTH,     // Samples waiting in an output queue
+	TRACE_ALLOC_START,     // Waiting for an output buffer from the allocator
+	TRACE_ALLOC_END,       // 0, or 1 when there was none
+	TRACE_ANOMALY,         // A frame took too long; microseconds
+	TRACE_EVENT_COUNT
+};
+
+enum FrameTraceTable
+{
+	TRACE_TABLE_LUMA = 0,
+	TRACE_TABLE_CHROMA,
+	TRACE_TABLE_CUBE,
+	TRACE_TABLE_SPACES,
+	TRACE_TABLE_CURVE,     // A new luma curve taken up at the start of a frame
+	TRACE_TABLE_COUNT
+};
+
+// Parameters of TRACE_PARAMETER. The colour spaces give 0 for the input
+// and 1 for the output; the cube 1 when one is loaded and 0 when cleared.
+enum FrameTraceParameter
+{
+	TRACE_PARAM_BRIGHTNESS = 0,
+	TRACE_PARAM_CONTRAST,
+	TRACE_PARAM_HUE,
+	TRACE_PARAM_SATURATION,
+	TRACE_PARAM_GAMMA,
+	TRACE_PARAM_COLOR_SPACE,
+	TRACE_PARAM_CUBE,
+	TRACE_PARAM_COUNT
+};
+
+const char *FrameTraceEventName(int nEvent);
+const char *FrameTraceTableName(int nTable);
+const char *FrameTraceParameterName(int nParameter);
+
+//
+// One event, in memory and in the file
+//
+struct FrameTraceRecord
+{
+	long long nTicks;        // FrameTicks() when it happened
+	unsigned int nArg;
+	unsigned short nEvent;   // FrameTraceEvent
+	unsigned short nThread;  // Low 16 bits of FrameThreadId()
+};
+
+//
+// Header of a trace file, followed by nRecords FrameTraceRecords, oldest
+// first, in the byte order of the machine that wrote it
+//
+struct FrameTraceHeader
+{
+	char Magic[4];                  // "FPTR"
+	unsigned int nVersion;          // g_FrameTraceVersion
+	long long nTickFrequency;       // Ticks per second
+	unsigned long long nFirst;      // Events recorded before the first one in the file
+	unsigned int nRecords;
+	unsigned int nReserved;
+};
+
+const unsigned int g_FrameTraceVersion = 1;
+
+// Slots of a new ring: 1.5 MB, about a minute of 60 frames a second on
+// eight workers
+const unsigned int g_FrameTraceRecords = 65536;
+
+//
+// CFrameTrace
+//
+// A fixed ring of the last events of one filter or engine, for finding
+// out afterwards what a glitch in a stream coincided with. Record() is
+// lock-free and may be called on any thread: it takes a slot with one
+// interlocked increment and marks it complete with a sequence number, so
+// that Save() can run while events are still coming in and leaves out
+// the slots that are being written. When the ring is full the oldest
+// events are overwritten. A record costs a clock read and two interlocked
+// operations; disabled, one test of a flag.
+//
+class CFrameTrace
+{
+public:
+	CFrameTrace();
+	~CFrameTrace();
+
+	// Slots in the ring, rounded up to a power of two; drops the events
+	// recorded so far. Not while events are recorded.
+	bool SetCapacity(unsigned int nRecords);
+	unsigned int Capacity() const { return m_nMask + 1; }
+
+	void SetEnabled(bool bEnabled) { m_bEnabled = bEnabled; }
+	bool Enabled() const { return m_bEnabled; }
+
+	void Record(FrameTraceEvent event, unsigned int nArg)
+	{
+		if (m_bEnabled)
+			Write(event, nArg);
+	}
+
+	// Write the events in the ring as a trace file; false on a write error
+	bool Save(FILE *pFile) const;
+
+	// The events in the ring, oldest first; returns how many were recorded
+	// before the first one
+	unsigned long long Snapshot(FrameTraceRecord *pRecords, unsigned int *pCount) const;
+
+private:
+	struct Slot
+	{
+		FrameTraceRecord rec;
+		volatile long lSequence;   // Index of the event + 1 once written, 0 while writing
+	};
+
+	void Write(FrameTraceEvent event, unsigned int nArg);
+
+	Slot *m_pSlots;
+	unsigned int m_nMask;
+	volatile long m_lNext;         // Index of the next event
+	volatile bool m_bEnabled;
+
+	CFrameTrace(const CFrameTrace &);
+	CFrameTrace &operator=(const CFrameTrace &);
+};
@@ -0,0 +1,130 @@
+#include "FrameWorkers.h"
+
+CFrameWorkers::CFrameWorkers()
+	: m_nThreads(1),
+	  m_bExit(false),
+	  m_Generation(0),
+	  m_pfn(NULL),
+	  m_pContext(NULL),
+	  m_nBands(0),
+	  m_nActive(0),
+	  m_NextBand(0),
+	  m_BandsDone(0)
+{
+}
+
+CFrameWorkers::~CFrameWorkers()
+{
+	Stop();
+}
+
+void CFrameWorkers::Stop()
+{
+	{
+		CFrameAutoLock lock(&m_Lock);
+		m_bExit = true;
+		m_WakeUp.Broadcast();
+	}
+	for (int i = 1; i < m_nThreads; i++)
+		m_Threads[i].Join();
+	m_bExit = false;
+	m_nThreads = 1;
+}
+
+void CFrameWorkers::SetThreadCount(int nThreads)
+{
+	if (nThreads < 1) nThreads = 1;
+	if (nThreads > MAX_THREADS) nThreads = MAX_THREADS;
+	if (nThreads == m_nThreads)
+		return;
+
+	Stop();
+	for (int i = 1; i < nThreads; i++)
+	{
+		if (!m_Threads[i].Start(WorkerProc, this))
+			break;
+		m_nThreads = i + 1;
+	}
+}
+
+void CFrameWorkers::WorkerProc(void *pv)
+{
+	((CFrameWorkers *)pv)->Work();
+}
+
+void CFrameWorkers::Work()
+{
+	unsigned int seen = 0;
+	for (;;)
+	{
+		{
+			CFrameAutoLock lock(&m_Lock);
+			while (!m_bExit && m_Generation == seen)
+				m_WakeUp.Wait(&m_Lock);
+			if (m_bExit)
+				return;
+			seen = m_Generation;
+			m_nActive++;
+		}
+		DoBands();
+		{
+			CFrameAutoLock lock(&m_Lock);
+			if (--m_nActive == 0)
+				m_Done.Broadcast();
+		}
+	}
+}
+
+void CFrameWorkers::DoBands()
+{
+	for (;;)
+	{
+		long band = FrameInterlockedExchangeAdd(&m_NextBand, 1);
+		if (band >= m_nBands)
+			return;
+
+		m_pfn(m_pContext, (int)band, m_nBands);
+
+		if (FrameInterlockedIncrement(&m_BandsDone) == m_nBands)
+		{
+			CFrameAutoLock lock(&m_Lock);
+			m_Done.Broadcast();
+		}
+	}
+}
+
+void CFrameWorkers::Run(FRAMEBANDPROC pfn, void *pContext, int nBands)
+{
+	if (nBands <= 0)
+		return;
+
+	if (m_nThreads == 1 || nBands == 1)
+	{
+		for (int i = 0; i < nBands; i++)
+			pfn(pContext, i, nBands);
+		return;
+	}
+
+	{
+		// A helper which woke up late for the previous job may still be on
+		// its way out of DoBands(); let it leave before the counters reset.
+		CFrameAutoLock lock(&m_Lock);
+		while (m_nActive > 0)
+			m_Done.Wait(&m_Lock);
+
+		m_pfn = pfn;
+		m_pContext = pContext;
+		m_nBands = nBands;
+		m_NextBand = 0;
+		m_BandsDone = 0;
+		m_Generation++;
+		m_WakeUp.Broadcast();
+	}
+
+	DoBands();
+
+	// Wait for the last band and for the helpers to go idle again.
+	CFrameAutoLock lock(&m_Lock);
+	while (m_BandsDone < m_nBands || m_nActive > 0)
+		m_Done.Wait(&m_Lock);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "FramePlatform.h"
+
+//
+// CFrameWorkers
+//
+// A small pool of persistent threads which split one job into bands.
+// Run() blocks until every band has been processed; the calling thread
+// takes part in the work, so a pool of N threads keeps N-1 helpers.
+//
+typedef void (*FRAMEBANDPROC)(void *pContext, int nBand, int nBands);
+
+class CFrameWorkers
+{
+public:
+	CFrameWorkers();
+	~CFrameWorkers();
+
+	// Number of threads (including the caller) used by Run()
+	void SetThreadCount(int nThreads);
+	int GetThreadCount() const { return m_nThreads; }
+
+	void Run(FRAMEBANDPROC pfn, void *pContext, int nBands);
+
+private:
+	static void WorkerProc(void *pv);
+	void Work();
+	void DoBands();
+	void Stop();
+
+	enum { MAX_THREADS = 64 };
+
+	int m_nThreads;
+	CFrameThread m_Threads[MAX_THREADS];
+
+	CFrameCritSec m_Lock;
+	CFrameCondition m_WakeUp;     // Signalled when a new job is posted
+	CFrameCondition m_Done;       // Signalled when the last band finishes
+	bool m_bExit;
+	unsigned int m_Generation;    // Incremented for every posted job
+
+	FRAMEBANDPROC m_pfn;
+	void *m_pContext;
+	int m_nBands;
+	int m_nActive;                // Helpers currently inside DoBands()
+	volatile long m_NextBand;
+	volatile long m_BandsDone;
+};
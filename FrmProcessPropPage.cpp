@@ -21,7 +21,8 @@ CUnknown * WINAPI CFrmProcessorProps::CreateInstance(LPUNKNOWN lpunk, HRESULT *p
 
 CFrmProcessorProps::CFrmProcessorProps(LPUNKNOWN pUnk, HRESULT *phr) :
     CBasePropertyPage((TCHAR *)g_PPName, pUnk, IDD_FRMPROCESSPP, IDS_TITLE),
-    m_pProps(NULL)
+    m_pProps(NULL),
+    m_pAutoLevels(NULL)
 {
     InitCommonControls();
 
@@ -30,6 +31,7 @@ CFrmProcessorProps::CFrmProcessorProps(LPUNKNOWN pUnk, HRESULT *phr) :
 	m_HueLevel = g_DefaultHueLevel;
 	m_SaturationLevel = g_DefaultSaturationLevel;
 	m_GammaLevel = g_DefaultGammaLevel;
+	m_bAutoLevels = FALSE;
 } 
 
 void CFrmProcessorProps::SetDirty()
@@ -49,6 +51,9 @@ INT_PTR CFrmProcessorProps::OnReceiveMessage(HWND hwnd,UINT uMsg,
         case WM_INITDIALOG:
         {
             CreateSliders(hwnd);
+            CheckDlgButton(hwnd, IDC_AUTOLEVELS, m_bAutoLevels ? BST_CHECKED : BST_UNCHECKED);
+            EnableWindow(GetDlgItem(hwnd, IDC_AUTOLEVELS), m_pAutoLevels != NULL);
+            EnableManualLevels(hwnd, !m_bAutoLevels);
             return (LRESULT) 1;
         }
         case WM_VSCROLL:
@@ -87,6 +92,13 @@ INT_PTR CFrmProcessorProps::OnReceiveMessage(HWND hwnd,UINT uMsg,
 				GetProps()->put_GammaCorrectionLevel(g_DefaultGammaLevel);
                 SendMessage(m_Sliders[4], TBM_SETPOS, TRUE, g_DefaultGammaLevel);
                 SetDirty();
+            }
+			else if(LOWORD(wParam) == IDC_AUTOLEVELS && m_pAutoLevels)
+            {
+				m_bAutoLevels = IsDlgButtonChecked(hwnd, IDC_AUTOLEVELS) == BST_CHECKED;
+				m_pAutoLevels->put_AutoLevels(m_bAutoLevels);
+				EnableManualLevels(hwnd, !m_bAutoLevels);
+                SetDirty();
             }
             return (LRESULT) 1;
         }
@@ -127,6 +139,13 @@ HRESULT CFrmProcessorProps::OnConnect(IUnknown *pUnknown)
 	m_pProps->get_GammaCorrectionLevel(&m_GammaLevel);
 	m_GammaLevel = g_MaxGammaLevel - m_GammaLevel;
 
+	// Optional: automatic levels
+	m_bAutoLevels = FALSE;
+	if (SUCCEEDED(pUnknown->QueryInterface(IID_IFrameAutoLevels, (void **) &m_pAutoLevels)))
+		m_pAutoLevels->get_AutoLevels(&m_bAutoLevels);
+	else
+		m_pAutoLevels = NULL;
+
     return NOERROR;
 } 
 
@@ -138,6 +157,11 @@ HRESULT CFrmProcessorProps::OnDisconnect()
 
     m_pProps->Release();
     m_pProps = NULL;
+    if (m_pAutoLevels)
+    {
+        m_pAutoLevels->Release();
+        m_pAutoLevels = NULL;
+    }
     return NOERROR;
 
 } 
@@ -185,6 +209,15 @@ void CFrmProcessorProps::CreateSliders(HWND parent)
 		, g_MinGammaLevel, g_MaxGammaLevel));
 } 
 
+// Brightness and contrast come from the automatic levels while they are on
+void CFrmProcessorProps::EnableManualLevels(HWND hwnd, BOOL bEnable)
+{
+	EnableWindow(m_Sliders[0], bEnable);
+	EnableWindow(m_Sliders[1], bEnable);
+	EnableWindow(GetDlgItem(hwnd, IDB_BRIGHTNESS_DEF), bEnable);
+	EnableWindow(GetDlgItem(hwnd, IDB_CONTRAST_DEF), bEnable);
+}
+
 void CFrmProcessorProps::DestroySliders()
 {
 	vector<HWND>::iterator it;
@@ -25,6 +25,7 @@ private:
 
     void OnSliderNotification(WPARAM wParam, LPARAM lParam);
 	void UpdateValues(LPARAM lParam);
+	void EnableManualLevels(HWND hwnd, BOOL bEnable);
 	vector<HWND> m_Sliders;
 
     CFrmProcessorProps(LPUNKNOWN lpunk, HRESULT *phr);
@@ -36,8 +37,10 @@ private:
 	unsigned char m_HueLevel;
 	unsigned char m_SaturationLevel;
 	unsigned char m_GammaLevel;
+	BOOL m_bAutoLevels;
 
     IFrameProcessor *m_pProps;
+    IFrameAutoLevels *m_pAutoLevels;   // NULL if the filter has no automatic levels
 
     IFrameProcessor *GetProps() 
 	{
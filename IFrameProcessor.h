@@ -70,6 +70,575 @@ extern "C" {
 
     };
 
+
+	// {FDA66BD3-CDAB-4475-A435-B545BB2C9965}
+	DEFINE_GUID(IID_IFrameStatistics, 
+	0xfda66bd3, 0xcdab, 0x4475, 0xa4, 0x35, 0xb5, 0x45, 0xbb, 0x2c, 0x99, 0x65);
+
+	//
+	// Statistics of the last processed frame, gathered while the filter
+	// transforms the pixels. With a row step above 1 the histograms only
+	// count every RowStep-th row and are then scaled up to the samples of
+	// the whole frame, so they read the same at any step.
+	//
+	// The default step of 32 keeps the statistics (and the automatic
+	// levels, which read them) within 5% of the pass, but misses detail
+	// narrower than the step and rounds every bin to about a multiple of
+	// it. A step of 1 counts every pixel exactly; the counts then cost about
+	// as much as the transform of a packed frame itself, so the pass takes
+	// roughly twice as long.
+	//
+	typedef struct _FRAMESTATS
+	{
+		DWORD FrameNumber;            // Frames processed since the stream started
+		DWORD RowStep;
+		DWORD LumaInHistogram[256];   // Source luma
+		DWORD LumaHistogram[256];     // Processed luma
+		DWORD ChromaUHistogram[256];  // Processed U
+		DWORD ChromaVHistogram[256];  // Processed V
+		double LumaMean;
+		DWORD LumaMin;
+		DWORD LumaMax;
+		double LumaInMean;
+		DWORD LumaInMin;
+		DWORD LumaInMax;
+		double ChromaUMean;
+		double ChromaVMean;
+		double ChromaUSpread;         // Standard deviation
+		double ChromaVSpread;
+		DWORD QualityLevel;           // FRAMEQOS the frame was processed at
+	} FRAMESTATS;
+
+    DECLARE_INTERFACE_(IFrameStatistics, IUnknown)
+    {
+        STDMETHOD(get_StatisticsEnabled) (THIS_
+            BOOL *Enabled      // Whether statistics are gathered
+        ) PURE;
+
+        STDMETHOD(put_StatisticsEnabled) (THIS_
+            BOOL Enabled      // Turn the statistics on or off
+        ) PURE;
+
+        STDMETHOD(get_StatisticsRowStep) (THIS_
+            DWORD *RowStep      // Every how many rows are sampled
+        ) PURE;
+
+        STDMETHOD(put_StatisticsRowStep) (THIS_
+            DWORD RowStep      // 1 counts every pixel; 32 by default
+        ) PURE;
+
+        STDMETHOD(GetFrameStatistics) (THIS_
+            FRAMESTATS *Stats      // Receives the last frame; S_FALSE if there is none yet
+        ) PURE;
+    };
+
+
+	// {6245D5BC-0D02-4FF9-A39B-B99008295541}
+	DEFINE_GUID(IID_IFrameAutoLevels, 
+	0x6245d5bc, 0x0d02, 0x4ff9, 0xa3, 0x9b, 0xb9, 0x90, 0x08, 0x29, 0x55, 0x41);
+
+    DECLARE_INTERFACE_(IFrameAutoLevels, IUnknown)
+    {
+		//
+		// Automatic levels: while enabled the luma curve follows the histograms
+		// of the previous frames and the brightness and contrast levels are not
+		// used. Gamma still applies.
+		//
+        STDMETHOD(get_AutoLevels) (THIS_
+            BOOL *Enabled      // Whether automatic levels are on
+        ) PURE;
+
+        STDMETHOD(put_AutoLevels) (THIS_
+            BOOL Enabled      // Turn automatic levels on or off
+        ) PURE;
+
+        STDMETHOD(get_AutoLevelsSmoothing) (THIS_
+            DWORD *Frames      // Frames the levels take to follow a change
+        ) PURE;
+
+        STDMETHOD(put_AutoLevelsSmoothing) (THIS_
+            DWORD Frames      // Larger is steadier, smaller reacts faster
+        ) PURE;
+    };
+
+
+	// {0F5AD58E-2BE4-4DA1-84A7-2A863D92255A}
+	DEFINE_GUID(IID_IFrameColorCube,
+	0x0f5ad58e, 0x2be4, 0x4da1, 0x84, 0xa7, 0x2a, 0x86, 0x3d, 0x92, 0x25, 0x5a);
+
+    DECLARE_INTERFACE_(IFrameColorCube, IUnknown)
+    {
+		//
+		// Grading through a 3D LUT in the .cube format. While a cube is
+		// loaded it replaces the five levels, unless the levels are baked in
+		// front of it. Automatic levels do not apply to a cube.
+		//
+        STDMETHOD(LoadCube) (THIS_
+            const WCHAR *Path      // .cube file; E_FAIL if it cannot be read
+        ) PURE;
+
+        STDMETHOD(ClearCube) (THIS) PURE;
+
+        STDMETHOD(get_CubeLoaded) (THIS_
+            BOOL *Loaded      // Whether a cube is in use
+        ) PURE;
+
+        STDMETHOD(get_CubeBakeLevels) (THIS_
+            BOOL *Bake      // Whether the levels are applied before the cube
+        ) PURE;
+
+        STDMETHOD(put_CubeBakeLevels) (THIS_
+            BOOL Bake      // Apply the five levels in front of the cube
+        ) PURE;
+    };
+
+
+	// {FF4D1E9A-E837-4736-9A21-AFF2F0F0F5DC}
+	DEFINE_GUID(IID_IFrameColorSpace,
+	0xff4d1e9a, 0xe837, 0x4736, 0x9a, 0x21, 0xaf, 0xf2, 0xf0, 0xf0, 0xf5, 0xdc);
+
+	typedef enum _FRAMEMATRIX
+	{
+		FRAMEMATRIX_AUTO = 0,     // Input: from the media type; output: same as the input
+		FRAMEMATRIX_BT601,
+		FRAMEMATRIX_BT709,
+		FRAMEMATRIX_BT2020
+	} FRAMEMATRIX;
+
+    DECLARE_INTERFACE_(IFrameColorSpace, IUnknown)
+    {
+		//
+		// YUV encoding of the input and the output. The input is read from the
+		// extended format of a VIDEOINFOHEADER2 media type when it carries
+		// one, otherwise it is BT.709 from 720 lines up and BT.601 below, in
+		// limited range. When the output differs the frames are converted in
+		// the same pass as the levels.
+		//
+        STDMETHOD(get_InputColorSpace) (THIS_
+            DWORD *Matrix,      // FRAMEMATRIX in effect
+            BOOL *FullRange     // TRUE for 0..255 codes
+        ) PURE;
+
+        STDMETHOD(put_InputColorSpace) (THIS_
+            DWORD Matrix,       // FRAMEMATRIX_AUTO follows the media type
+            BOOL FullRange      // Ignored with FRAMEMATRIX_AUTO
+        ) PURE;
+
+        STDMETHOD(get_OutputColorSpace) (THIS_
+            DWORD *Matrix,      // FRAMEMATRIX in effect
+            BOOL *FullRange
+        ) PURE;
+
+        STDMETHOD(put_OutputColorSpace) (THIS_
+            DWORD Matrix,       // FRAMEMATRIX_AUTO turns the conversion off
+            BOOL FullRange      // Ignored with FRAMEMATRIX_AUTO
+        ) PURE;
+    };
+
+	// {3BD4A1B6-A3D9-4B90-8E1F-C94EC927B739}
+	DEFINE_GUID(IID_IFrameScaling,
+	0x3bd4a1b6, 0xa3d9, 0x4b90, 0x8e, 0x1f, 0xc9, 0x4e, 0xc9, 0x27, 0xb7, 0x39);
+
+	typedef enum _FRAMESCALEFILTER
+	{
+		FRAMESCALE_BILINEAR = 0,
+		FRAMESCALE_BICUBIC,       // Catmull-Rom
+		FRAMESCALE_LANCZOS        // Lanczos-3
+	} FRAMESCALEFILTER;
+
+    DECLARE_INTERFACE_(IFrameScaling, IUnknown)
+    {
+		//
+		// When the output media type has another frame size than the input,
+		// the frames are resized in the same pass as the levels. The filter
+		// picks the resampling kernel.
+		//
+        STDMETHOD(get_ScaleFilter) (THIS_
+            DWORD *Filter      // FRAMESCALEFILTER in use
+        ) PURE;
+
+        STDMETHOD(put_ScaleFilter) (THIS_
+            DWORD Filter       // FRAMESCALEFILTER for the following frames
+        ) PURE;
+    };
+
+	// {402C3AC2-9124-4F67-8401-E60121795782}
+	DEFINE_GUID(IID_IFrameSharpen,
+	0x402c3ac2, 0x9124, 0x4f67, 0x84, 0x01, 0xe6, 0x01, 0x21, 0x79, 0x57, 0x82);
+
+    DECLARE_INTERFACE_(IFrameSharpen, IUnknown)
+    {
+		//
+		// Unsharp mask on luma in the same pass as the levels: the detail
+		// above a Gaussian blur of the given radius is added again, scaled by
+		// the amount. Negative amounts soften, -100 leaves the plain blur.
+		// Scaled frames are sharpened at the output size.
+		//
+        STDMETHOD(get_SharpenRadius) (THIS_
+            DWORD *Radius      // Reach of the blur in pixels
+        ) PURE;
+
+        STDMETHOD(put_SharpenRadius) (THIS_
+            DWORD Radius       // 1..16
+        ) PURE;
+
+        STDMETHOD(get_SharpenAmount) (THIS_
+            LONG *Amount       // Percent; 0 when the stage is off
+        ) PURE;
+
+        STDMETHOD(put_SharpenAmount) (THIS_
+            LONG Amount        // -100..400, 0 turns it off
+        ) PURE;
+    };
+
+	// {D66B4FE6-DDD4-4F33-B50E-3D4BA0223F75}
+	DEFINE_GUID(IID_IFrameQuality,
+	0xd66b4fe6, 0xddd4, 0x4f33, 0xb5, 0x0e, 0x3d, 0x4b, 0xa0, 0x22, 0x3f, 0x75);
+
+	typedef enum _FRAMEQOS
+	{
+		FRAMEQOS_FULL = 0,         // Everything
+		FRAMEQOS_NO_OPTIONAL,      // Without the unsharp mask and the blend
+		FRAMEQOS_NO_CHROMA,        // Chroma passes through as well
+		FRAMEQOS_PASSTHROUGH       // Copied; only resized when the size changes
+	} FRAMEQOS;
+
+	//
+	// What the quality control has seen and decided since the stream
+	// started. Times are in 100 ns units like the quality messages.
+	//
+	typedef struct _FRAMEQUALITY
+	{
+		DWORD Level;                  // FRAMEQOS in effect
+		DWORD Frames;
+		DWORD Messages;               // Quality messages from downstream
+		DWORD Sheds;                  // Steps to a higher level
+		DWORD Recoveries;             // Steps back
+		DWORD FramesAtLevel[4];       // By FRAMEQOS
+		DWORD LastDecisionFrame;      // Frame of the last step, 0 before the first
+		LONGLONG LastDecisionLate;    // Lateness that step was taken on
+		LONGLONG Late;                // Last message, negative when early
+		LONG Proportion;              // Last message, 1000 keeps the rate
+	} FRAMEQUALITY;
+
+    DECLARE_INTERFACE_(IFrameQuality, IUnknown)
+    {
+		//
+		// Quality control: when the renderer reports late frames the filter
+		// gives up work a level at a time and takes it back once the frames
+		// have been early for a while. At FRAMEQOS_PASSTHROUGH further
+		// messages go upstream. Off, every message goes upstream.
+		//
+        STDMETHOD(get_QualityControl) (THIS_
+            BOOL *Enabled      // Whether the filter sheds work
+        ) PURE;
+
+        STDMETHOD(put_QualityControl) (THIS_
+            BOOL Enabled       // Off also goes back to FRAMEQOS_FULL
+        ) PURE;
+
+        STDMETHOD(get_QualityLevel) (THIS_
+            DWORD *Level       // FRAMEQOS in effect
+        ) PURE;
+
+        STDMETHOD(GetQualityStatistics) (THIS_
+            FRAMEQUALITY *Quality      // Receives the decisions so far
+        ) PURE;
+    };
+
+	// {FF7C84FC-E94B-4722-ACD1-9F004A2B739C}
+	DEFINE_GUID(IID_IFrameSliceCallback,
+	0xff7c84fc, 0xe94b, 0x4722, 0xac, 0xd1, 0x9f, 0x00, 0x4a, 0x2b, 0x73, 0x9c);
+
+    DECLARE_INTERFACE_(IFrameSliceCallback, IUnknown)
+    {
+		//
+		// Implemented by whoever wants the rows of a frame before the whole
+		// frame is done: an application through IFrameSlices, or the
+		// downstream filter, whose input pin or filter object the frame
+		// processor asks for this interface when it connects. Called on the
+		// streaming thread before the sample is delivered; return quickly
+		// and do not keep the sample.
+		//
+        STDMETHOD(SliceReady) (THIS_
+            IMediaSample *Sample,   // Output sample the rows are in
+            DWORD FirstRow,         // Rows [FirstRow, LastRow) from the top are final
+            DWORD LastRow,
+            DWORD Height            // Rows in the frame
+        ) PURE;
+    };
+
+	// {B5BE56C8-49AF-46E4-B5BF-57051830A5D2}
+	DEFINE_GUID(IID_IFrameSlices,
+	0xb5be56c8, 0x49af, 0x46e4, 0xb5, 0xbf, 0x57, 0x05, 0x18, 0x30, 0xa5, 0xd2);
+
+    DECLARE_INTERFACE_(IFrameSlices, IUnknown)
+    {
+		//
+		// Slice mode for low latency: while anyone listens, the frames are
+		// processed in slices of rows from the top and every finished slice
+		// is signalled through IFrameSliceCallback, so that display or
+		// encoding can start before the frame is done.
+		//
+        STDMETHOD(get_SliceRows) (THIS_
+            DWORD *Rows      // Rows per slice; 0 when slice mode is off
+        ) PURE;
+
+        STDMETHOD(put_SliceRows) (THIS_
+            DWORD Rows       // 0 turns slice mode off
+        ) PURE;
+
+        STDMETHOD(SetSliceCallback) (THIS_
+            IFrameSliceCallback *Callback      // In-process consumer, NULL for none
+        ) PURE;
+
+        STDMETHOD(get_DownstreamSlices) (THIS_
+            BOOL *Supported  // Whether the downstream filter takes slices
+        ) PURE;
+    };
+
+	// {274EC432-4C8A-4CF8-A957-B8FD20FF1E82}
+	DEFINE_GUID(IID_IFrameRowReuse,
+	0x274ec432, 0x4c8a, 0x4cf8, 0xa9, 0x57, 0xb8, 0xfd, 0x20, 0xff, 0x1e, 0x82);
+
+	//
+	// What row reuse has saved since the stream started
+	//
+	typedef struct _FRAMEREUSE
+	{
+		DWORD Frames;                 // Frames processed with reuse on
+		DWORD FullFrames;             // Of them processed in full: the first, or after a change
+		ULONGLONG Rows;
+		ULONGLONG RowsReused;         // Rows copied from the previous output
+		double ReuseRatio;            // RowsReused / Rows
+	} FRAMEREUSE;
+
+    DECLARE_INTERFACE_(IFrameRowReuse, IUnknown)
+    {
+		//
+		// Row reuse for mostly static content such as screen capture: the
+		// rows whose source is the same as in the previous frame are copied
+		// from the previous output instead of being processed again. Only
+		// frames without statistics, automatic levels, resizing or the
+		// unsharp mask are compared; the others are processed in full.
+		//
+        STDMETHOD(get_RowReuse) (THIS_
+            BOOL *Enabled      // Whether unchanged rows are reused
+        ) PURE;
+
+        STDMETHOD(put_RowReuse) (THIS_
+            BOOL Enabled
+        ) PURE;
+
+        STDMETHOD(GetReuseStatistics) (THIS_
+            FRAMEREUSE *Reuse  // Receives the counters so far
+        ) PURE;
+    };
+
+	// {A681B4B9-87DD-468B-84CC-DB7212B7DE44}
+	DEFINE_GUID(IID_IFrameMotion,
+	0xa681b4b9, 0x87dd, 0x468b, 0x84, 0xcc, 0xdb, 0x72, 0x12, 0xb7, 0xde, 0x44);
+
+	//
+	// Motion between the last frame and the one before it
+	//
+	typedef struct _FRAMEMOTION
+	{
+		DWORD Frame;                  // Frames measured since the stream started
+		REFERENCE_TIME StartTime;     // Of the output sample, -1 without a time stamp
+		double Sad;                   // Mean luma difference of 8x8 blocks, 0..255
+		DWORD MovingPercent;          // Blocks that moved noticeably
+		BOOL SceneChange;             // A cut: the first frame, or a jump well above the recent motion
+		DWORD FramesSinceSceneChange;
+		DWORD SceneChanges;
+	} FRAMEMOTION;
+
+    DECLARE_INTERFACE_(IFrameMotion, IUnknown)
+    {
+		//
+		// Scene change and motion detection: every frame is compared with
+		// the previous one on a thumbnail of block means, sampled from the
+		// source rows while they are processed. A cut also lets the
+		// automatic levels jump to the new scene instead of fading to it.
+		//
+        STDMETHOD(get_MotionDetection) (THIS_
+            BOOL *Enabled      // Whether the frames are measured
+        ) PURE;
+
+        STDMETHOD(put_MotionDetection) (THIS_
+            BOOL Enabled
+        ) PURE;
+
+        STDMETHOD(GetFrameMotion) (THIS_
+            FRAMEMOTION *Motion      // Receives the last frame's result
+        ) PURE;
+    };
+
+	// {16CADA36-6172-4AA8-AC4B-9187C5941A6B}
+	DEFINE_GUID(IID_IFrameOverlay,
+	0x16cada36, 0x6172, 0x4aa8, 0xac, 0x4b, 0x91, 0x87, 0xc5, 0x94, 0x1a, 0x6b);
+
+    DECLARE_INTERFACE_(IFrameOverlay, IUnknown)
+    {
+		//
+		// Graphics over the output: up to 8 layers of BGRA with per-pixel
+		// alpha, such as a channel bug or a lower third, composited in the
+		// same pass as the colour transform. A layer is converted once
+		// when it is set; each frame then only costs its visible area.
+		//
+        STDMETHOD(SetOverlay) (THIS_
+            DWORD Layer,            // 0..7, higher layers drawn on top
+            const BYTE *Bgra,       // 32-bit BGRA, straight alpha, top row first
+            LONG Stride,            // Bytes from one row to the next
+            DWORD Width,
+            DWORD Height,
+            LONG X,                 // Output pixel of the top left corner;
+            LONG Y                  // the layer may reach past the edges
+        ) PURE;
+
+        STDMETHOD(ClearOverlay) (THIS_
+            DWORD Layer             // 0..7
+        ) PURE;
+    };
+
+	// {8DFBA60B-5099-476D-9A8E-AF21D0E1FBF2}
+	DEFINE_GUID(IID_IFrameChromaKey,
+	0x8dfba60b, 0x5099, 0x476d, 0x9a, 0x8e, 0xaf, 0x21, 0xd0, 0xe1, 0xfb, 0xf2);
+
+	typedef struct _FRAMECHROMAKEY
+	{
+		BOOL Enabled;
+		BYTE Red;                     // Key colour
+		BYTE Green;
+		BYTE Blue;
+		DWORD Tolerance;              // Chroma distance keyed out fully, 0..362
+		DWORD Softness;               // Distance beyond it to full opacity, 1..362
+		BOOL Matte;                   // Output the alpha as a grey picture instead
+	} FRAMECHROMAKEY;
+
+    DECLARE_INTERFACE_(IFrameChromaKey, IUnknown)
+    {
+		//
+		// Green and blue screen keying in the same pass as the colour
+		// transform. The alpha of a pixel follows the distance of its
+		// chroma from the key colour's, after the adjustments; keyed out
+		// pixels show the background image, or black without one.
+		//
+        STDMETHOD(GetChromaKey) (THIS_
+            FRAMECHROMAKEY *Key
+        ) PURE;
+
+        STDMETHOD(SetChromaKey) (THIS_
+            const FRAMECHROMAKEY *Key
+        ) PURE;
+
+        STDMETHOD(SetChromaKeyBackground) (THIS_
+            const BYTE *Bgra,       // 32-bit BGRA, top row first, stretched to the output; NULL for black
+            LONG Stride,            // Bytes from one row to the next
+            DWORD Width,
+            DWORD Height
+        ) PURE;
+    };
+
+	// {6C4C5A3B-2AB0-4BF6-B36C-2B3B4BCFCFB8}
+	DEFINE_GUID(IID_IFramePreview,
+	0x6c4c5a3b, 0x2ab0, 0x4bf6, 0xb3, 0x6c, 0x2b, 0x3b, 0x4b, 0xcf, 0xcf, 0xb8);
+
+    DECLARE_INTERFACE_(IFramePreview, IUnknown)
+    {
+		//
+		// A thumbnail of every output frame on the second output pin,
+		// "Preview": YUY2 at 1/2, 1/4 or 1/8 the output size, each pixel
+		// the average of the output pixels under it. It is made in the
+		// same pass as the output frame while the pin is connected, and
+		// skipped for a frame when the preview renderer has no buffer free.
+		//
+        STDMETHOD(get_PreviewFactor) (THIS_
+            DWORD *Factor
+        ) PURE;
+
+        STDMETHOD(put_PreviewFactor) (THIS_
+            DWORD Factor            // 2, 4 or 8; not while the preview pin is connected
+        ) PURE;
+    };
+
+	// {6BE16476-D173-4CF9-97A2-778220F08F20}
+	DEFINE_GUID(IID_IFrameFingerprint,
+	0x6be16476, 0xd173, 0x4cf9, 0x97, 0xa2, 0x77, 0x82, 0x20, 0xf0, 0x8f, 0x20);
+
+	typedef struct _FRAMEFINGERPRINT
+	{
+		DWORD Frame;                  // Frames fingerprinted since the stream started
+		REFERENCE_TIME StartTime;     // Of the output sample, -1 without a time stamp
+		ULONGLONG Hash;               // Of every output pixel: equal for equal frames
+		ULONGLONG PerceptualHash;     // Of a 9x8 grid of luma means: close for similar frames
+		DWORD PerceptualDistance;     // Bits that differ from the previous frame's, 64 for the first
+		DWORD FrozenFrames;           // Frames since the output last changed
+		BOOL Frozen;                  // FrozenFrames has reached the alarm threshold
+	} FRAMEFINGERPRINT;
+
+    DECLARE_INTERFACE_(IFrameFingerprint, IUnknown)
+    {
+		//
+		// A fingerprint of every output frame, taken while the frame is
+		// written instead of in another pass downstream: a hash of the
+		// pixels for deduplication, a perceptual hash that survives small
+		// changes, and an alarm when the output has not changed for a
+		// number of frames, as from a frozen feed.
+		//
+        STDMETHOD(get_Fingerprint) (THIS_
+            BOOL *Enabled      // Whether the frames are fingerprinted
+        ) PURE;
+
+        STDMETHOD(put_Fingerprint) (THIS_
+            BOOL Enabled
+        ) PURE;
+
+        STDMETHOD(get_FrozenThreshold) (THIS_
+            DWORD *Frames
+        ) PURE;
+
+        STDMETHOD(put_FrozenThreshold) (THIS_
+            DWORD Frames       // Unchanged frames that raise the alarm; 0 never does
+        ) PURE;
+
+        STDMETHOD(GetFrameFingerprint) (THIS_
+            FRAMEFINGERPRINT *Fingerprint      // Receives the last frame's result
+        ) PURE;
+    };
+
+	// {6A095E03-7609-4C7D-9695-1E3EB4EE46F5}
+	DEFINE_GUID(IID_IFrameTrace,
+	0x6a095e03, 0x7609, 0x4c7d, 0x96, 0x95, 0x1e, 0x3e, 0xb4, 0xee, 0x46, 0xf5);
+
+    DECLARE_INTERFACE_(IFrameTrace, IUnknown)
+    {
+		//
+		// A ring of the last events of the filter, time stamped: frames in
+		// and out of Transform, the bands of the workers, table rebuilds,
+		// parameter changes, waits for output buffers and the depth of the
+		// preview queue. It is saved as a binary file on demand, or by
+		// itself when a frame takes too long; tools/fptrace decodes it.
+		// Tracing costs well under 1% of the frame time.
+		//
+        STDMETHOD(get_Tracing) (THIS_
+            BOOL *Enabled
+        ) PURE;
+
+        STDMETHOD(put_Tracing) (THIS_
+            BOOL Enabled
+        ) PURE;
+
+        STDMETHOD(SaveTrace) (THIS_
+            const WCHAR *Path       // File to write; E_FAIL if it cannot be written
+        ) PURE;
+
+        STDMETHOD(SetTraceAnomaly) (THIS_
+            DWORD Microseconds,     // A Transform call at least this long is an anomaly; 0 for none
+            const WCHAR *Path       // File the trace is saved to on one, at most every 10 seconds; or NULL
+        ) PURE;
+    };
+
 #ifdef __IFRAMEPROCESSOR__
 }
 #endif
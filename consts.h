@@ -28,4 +28,56 @@ const int g_MaxSaturationLevel = 255;
 
 const int g_MinGammaLevel = 0;
 const int g_DefaultGammaLevel = 127;
-const int g_MaxGammaLevel = 255;
\ No newline at end of file
+const int g_MaxGammaLevel = 255;
+// Frame statistics sample every 32nd row by default, which keeps their cost
+// within 5% of the pass; a step of 1 counts every pixel at about twice the
+// cost of the pass
+const int g_DefaultStatsRowStep = 32;
+
+// Frames the automatic levels take to follow a change of the picture
+const int g_DefaultAutoLevelsSmoothing = 15;
+
+// Resampling kernel used when the output frame size differs from the input
+const int g_DefaultScaleFilter = 1;   // FRAMESCALE_BICUBIC
+
+// Unsharp mask on luma; an amount of 0 percent leaves it off
+const int g_DefaultSharpenRadius = 2;
+const int g_DefaultSharpenAmount = 0;
+
+// Shed work when the renderer reports late frames
+const int g_DefaultQualityControl = 1;
+
+// Rows per slice while a consumer takes the frames slice by slice
+const int g_DefaultSliceRows = 64;
+
+// Copy the rows of a frame that did not change from the previous output
+const int g_DefaultRowReuse = 0;
+
+// Measure the motion between frames and detect cuts
+const int g_DefaultMotionDetection = 0;
+
+// Chroma key, off until set: pure green, keyed out up to this distance in
+// chroma codes and fully opaque past the softness beyond it
+const int g_DefaultKeyTolerance = 40;
+const int g_DefaultKeySoftness = 30;
+
+// Preview pin: the output frames at a quarter of their width and height
+const int g_DefaultPreviewFactor = 4;
+static const WCHAR g_PreviewPinName[] = L"Preview";
+
+// Fingerprint the output frames, and call the feed frozen after two
+// seconds of PAL without a change
+const int g_DefaultFingerprint = 0;
+const int g_DefaultFrozenThreshold = 50;
+
+// Trace ring of the hot path, off until enabled; a trace is saved on an
+// anomaly at most this often
+const int g_DefaultTracing = 0;
+const int g_TraceSaveInterval = 10;
+
+// Largest frame accepted on either pin; 8K and DCI 8K fit with room to spare
+const int g_MaxFrameWidth = 16384;
+const int g_MaxFrameHeight = 16384;
+
+// Output frame the later ones are blended with
+const DWORD g_GhostFrame = 500;
@@ -1159,6 +1159,7 @@
 #define IDB_SATURATION_DEF              1004
 #define IDB_DEFAULT5                    1005
 #define IDB_GAMMA_DEF                   1005
+#define IDC_AUTOLEVELS                  1006
 #define CF_GDIOBJLAST                   0x03FF
 #define _WIN32_WINNT_NT4                0x0400
 #define _WIN32_IE_IE40                  0x0400
@@ -1505,7 +1506,7 @@
 #define _APS_3D_CONTROLS                     1
 #define _APS_NEXT_RESOURCE_VALUE        102
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1002
+#define _APS_NEXT_CONTROL_VALUE         1007
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
@@ -0,0 +1,56 @@
+#pragma once
+//
+// CFrameQueue
+//
+// Blocking FIFO of frame buffers between two pipeline stages. The queues
+// only pass pointers around; the buffers themselves come from a fixed pool,
+// so the memory of a pipeline does not depend on the length of the stream.
+//
+#include <deque>
+#include "../FramePlatform.h"
+
+struct PipelineFrame
+{
+	unsigned char *pb;
+	long long nIndex;
+};
+
+class CFrameQueue
+{
+public:
+	CFrameQueue() : m_bClosed(false) {}
+
+	void Push(PipelineFrame *pFrame)
+	{
+		CFrameAutoLock lock(&m_Lock);
+		m_Items.push_back(pFrame);
+		m_Changed.Signal();
+	}
+
+	// Returns NULL once the queue is closed and empty
+	PipelineFrame *Pop()
+	{
+		CFrameAutoLock lock(&m_Lock);
+		while (m_Items.empty() && !m_bClosed)
+			m_Changed.Wait(&m_Lock);
+		if (m_Items.empty())
+			return NULL;
+		PipelineFrame *pFrame = m_Items.front();
+		m_Items.pop_front();
+		return pFrame;
+	}
+
+	// No more frames will be pushed
+	void Close()
+	{
+		CFrameAutoLock lock(&m_Lock);
+		m_bClosed = true;
+		m_Changed.Broadcast();
+	}
+
+private:
+	std::deque<PipelineFrame *> m_Items;
+	bool m_bClosed;
+	CFrameCritSec m_Lock;
+	CFrameCondition m_Changed;
+};
@@ -0,0 +1,276 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // O_DIRECT
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "RawVideoIO.h"
+
+//
+// CMappedFile
+//
+CMappedFile::CMappedFile()
+	: m_fd(-1), m_pbData(NULL), m_cbSize(0), m_bWritable(false)
+{
+}
+
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
+
+bool CMappedFile::OpenRead(const char *pszPath)
+{
+	Close();
+	m_fd = open(pszPath, O_RDONLY);
+	if (m_fd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", pszPath, strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || st.st_size == 0)
+	{
+		fprintf(stderr, "%s: empty or unreadable\n", pszPath);
+		Close();
+		return false;
+	}
+	m_cbSize = (size_t)st.st_size;
+	void *pv = mmap(NULL, m_cbSize, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (pv == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: mmap: %s\n", pszPath, strerror(errno));
+		Close();
+		return false;
+	}
+	m_pbData = (unsigned char *)pv;
+	madvise(m_pbData, m_cbSize, MADV_SEQUENTIAL);
+	return true;
+}
+
+bool CMappedFile::Create(const char *pszPath, size_t cbSize)
+{
+	Close();
+	m_fd = open(pszPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_fd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", pszPath, strerror(errno));
+		return false;
+	}
+	if (ftruncate(m_fd, (off_t)cbSize) != 0)
+	{
+		fprintf(stderr, "%s: ftruncate: %s\n", pszPath, strerror(errno));
+		Close();
+		return false;
+	}
+	m_cbSize = cbSize;
+	m_bWritable = true;
+	if (cbSize == 0)
+		return true;
+	void *pv = mmap(NULL, m_cbSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (pv == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: mmap: %s\n", pszPath, strerror(errno));
+		Close();
+		return false;
+	}
+	m_pbData = (unsigned char *)pv;
+	madvise(m_pbData, m_cbSize, MADV_SEQUENTIAL);
+	return true;
+}
+
+void CMappedFile::Release(size_t cbOffset, size_t cb)
+{
+	// madvise wants a page aligned start; round inwards
+	long page = sysconf(_SC_PAGESIZE);
+	size_t start = (cbOffset + page - 1) & ~(size_t)(page - 1);
+	size_t end = (cbOffset + cb) & ~(size_t)(page - 1);
+	if (m_pbData == NULL || end <= start)
+		return;
+	if (m_bWritable)
+		msync(m_pbData + start, end - start, MS_ASYNC);
+	else
+		madvise(m_pbData + start, end - start, MADV_DONTNEED);
+}
+
+void CMappedFile::Close()
+{
+	if (m_pbData != NULL)
+		munmap(m_pbData, m_cbSize);
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+	m_pbData = NULL;
+	m_cbSize = 0;
+	m_bWritable = false;
+}
+
+//
+// CDirectWriter
+//
+CDirectWriter::CDirectWriter()
+	: m_fd(-1), m_bDirect(false), m_cbBuffer(0), m_iCurrent(0), m_cbFill(0),
+	  m_FileOffset(0), m_cbTotal(0), m_bExit(false), m_bError(false)
+{
+	for (int i = 0; i < BUFFERS; i++)
+	{
+		m_pBuffers[i] = NULL;
+		m_cbPending[i] = 0;
+		m_Offset[i] = 0;
+	}
+}
+
+CDirectWriter::~CDirectWriter()
+{
+	if (m_fd >= 0)
+		Close();
+	for (int i = 0; i < BUFFERS; i++)
+		free(m_pBuffers[i]);
+}
+
+bool CDirectWriter::Open(const char *pszPath, size_t cbChunk)
+{
+	m_fd = open(pszPath, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	m_bDirect = m_fd >= 0;
+	if (m_fd < 0 && errno == EINVAL)
+	{
+		// tmpfs and some network file systems do not support O_DIRECT
+		m_fd = open(pszPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (m_fd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", pszPath, strerror(errno));
+		return false;
+	}
+
+	// At least 8 MB per buffer, and room for one chunk plus a carried tail
+	m_cbBuffer = 8 << 20;
+	if (m_cbBuffer < cbChunk + BLOCK)
+		m_cbBuffer = (cbChunk + 2 * BLOCK - 1) & ~(size_t)(BLOCK - 1);
+	for (int i = 0; i < BUFFERS; i++)
+	{
+		// O_DIRECT needs block aligned memory, not just cache line aligned
+		void *pv = NULL;
+		if (posix_memalign(&pv, BLOCK, m_cbBuffer) != 0)
+			return false;
+		m_pBuffers[i] = (unsigned char *)pv;
+	}
+	return m_Thread.Start(WriterProc, this);
+}
+
+unsigned char *CDirectWriter::Reserve(size_t cb)
+{
+	if (m_cbFill + cb > m_cbBuffer)
+		Submit(m_cbFill & ~(size_t)(BLOCK - 1));
+	return m_pBuffers[m_iCurrent] + m_cbFill;
+}
+
+void CDirectWriter::Commit(size_t cb)
+{
+	m_cbFill += cb;
+	m_cbTotal += cb;
+}
+
+//
+// Queue the first cbAligned bytes of the current buffer and move the tail
+// that did not fill a whole block to the start of the next buffer.
+//
+void CDirectWriter::Submit(size_t cbAligned)
+{
+	int iNext = (m_iCurrent + 1) % BUFFERS;
+	size_t cbTail = m_cbFill - cbAligned;
+
+	CFrameAutoLock lock(&m_Lock);
+	while (m_cbPending[iNext] != 0)
+		m_Changed.Wait(&m_Lock);
+
+	memcpy(m_pBuffers[iNext], m_pBuffers[m_iCurrent] + cbAligned, cbTail);
+	if (cbAligned != 0)
+	{
+		m_cbPending[m_iCurrent] = cbAligned;
+		m_Offset[m_iCurrent] = m_FileOffset;
+		m_Changed.Broadcast();
+	}
+
+	m_FileOffset += cbAligned;
+	m_iCurrent = iNext;
+	m_cbFill = cbTail;
+}
+
+void CDirectWriter::WriterProc(void *pv)
+{
+	((CDirectWriter *)pv)->Writer();
+}
+
+void CDirectWriter::Writer()
+{
+	int iNext = 0;
+	for (;;)
+	{
+		size_t cb;
+		long long offset;
+		{
+			CFrameAutoLock lock(&m_Lock);
+			while (m_cbPending[iNext] == 0 && !m_bExit)
+				m_Changed.Wait(&m_Lock);
+			if (m_cbPending[iNext] == 0)
+				return;
+			cb = m_cbPending[iNext];
+			offset = m_Offset[iNext];
+		}
+
+		size_t done = 0;
+		while (done < cb)
+		{
+			ssize_t n = pwrite(m_fd, m_pBuffers[iNext] + done, cb - done, (off_t)(offset + done));
+			if (n <= 0)
+			{
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n < 0 && errno == EINVAL && m_bDirect)
+				{
+					// Opened fine but the file system rejects direct writes
+					fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+					m_bDirect = false;
+					continue;
+				}
+				fprintf(stderr, "write: %s\n", n < 0 ? strerror(errno) : "short write");
+				m_bError = true;
+				break;
+			}
+			done += (size_t)n;
+		}
+
+		CFrameAutoLock lock(&m_Lock);
+		m_cbPending[iNext] = 0;
+		m_Changed.Broadcast();
+		iNext = (iNext + 1) % BUFFERS;
+	}
+}
+
+bool CDirectWriter::Close()
+{
+	// Pad the last partial block with zeros; the file is trimmed afterwards
+	size_t cbPadded = (m_cbFill + BLOCK - 1) & ~(size_t)(BLOCK - 1);
+	memset(m_pBuffers[m_iCurrent] + m_cbFill, 0, cbPadded - m_cbFill);
+	m_cbFill = cbPadded;
+	Submit(cbPadded);
+
+	{
+		CFrameAutoLock lock(&m_Lock);
+		m_bExit = true;
+		m_Changed.Broadcast();
+	}
+	m_Thread.Join();
+
+	if (ftruncate(m_fd, (off_t)m_cbTotal) != 0)
+		m_bError = true;
+	close(m_fd);
+	m_fd = -1;
+	return !m_bError;
+}
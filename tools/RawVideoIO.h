@@ -0,0 +1,83 @@
+#pragma once
+//
+// File helpers for the Linux command line tools: read-only and writable
+// memory mappings, and a double-buffered O_DIRECT writer.
+//
+#include <stddef.h>
+#include "../FramePlatform.h"
+
+//
+// CMappedFile
+//
+// Maps a whole file into memory. OpenRead() maps an existing file for
+// reading; Create() sizes a new file and maps it for writing.
+//
+class CMappedFile
+{
+public:
+	CMappedFile();
+	~CMappedFile();
+
+	bool OpenRead(const char *pszPath);
+	bool Create(const char *pszPath, size_t cbSize);
+	void Close();
+
+	unsigned char *Data() const { return m_pbData; }
+	size_t Size() const { return m_cbSize; }
+
+	// Tell the kernel that [cbOffset, cbOffset + cb) is not needed any more
+	void Release(size_t cbOffset, size_t cb);
+
+private:
+	int m_fd;
+	unsigned char *m_pbData;
+	size_t m_cbSize;
+	bool m_bWritable;
+};
+
+//
+// CDirectWriter
+//
+// Writes a stream of bytes with O_DIRECT, bypassing the page cache. The
+// caller fills one aligned buffer through Reserve()/Commit() while a
+// background thread writes the previous one. Close() pads the final block,
+// writes it and trims the file to the exact length.
+//
+class CDirectWriter
+{
+public:
+	CDirectWriter();
+	~CDirectWriter();
+
+	// cbChunk is the largest single Reserve() the caller will make
+	bool Open(const char *pszPath, size_t cbChunk);
+	unsigned char *Reserve(size_t cb);
+	void Commit(size_t cb);
+	bool Close();
+
+	bool DirectIO() const { return m_bDirect; }
+
+private:
+	enum { BLOCK = 4096, BUFFERS = 2 };
+
+	static void WriterProc(void *pv);
+	void Writer();
+	void Submit(size_t cbAligned);
+
+	int m_fd;
+	bool m_bDirect;             // False if the file system refused O_DIRECT
+	size_t m_cbBuffer;
+	unsigned char *m_pBuffers[BUFFERS];
+	size_t m_cbPending[BUFFERS];  // Bytes queued for writing, 0 = free
+	long long m_Offset[BUFFERS];  // File offset of each queued buffer
+	int m_iCurrent;
+	size_t m_cbFill;
+	long long m_FileOffset;       // Offset of the current buffer in the file
+	long long m_cbTotal;          // Bytes committed so far
+
+	CFrameThread m_Thread;
+	CFrameCritSec m_Lock;
+	CFrameCondition m_Changed;
+	bool m_bExit;
+	bool m_bError;
+};
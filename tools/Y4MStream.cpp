@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+#include "Y4MStream.h"
+
+using namespace std;
+
+static const char g_Signature[] = "YUV4MPEG2";
+
+// Large stdio buffers keep the system call count low for big frames
+static const size_t g_cbStdioBuffer = 1 << 20;
+
+//
+// CY4MReader
+//
+CY4MReader::CY4MReader()
+	: m_fp(NULL), m_cbFrame(0), m_bError(false)
+{
+	m_Header.nWidth = 0;
+	m_Header.nHeight = 0;
+	m_Header.format = FRAME_FORMAT_I420;
+}
+
+CY4MReader::~CY4MReader()
+{
+	if (m_fp != NULL)
+		fclose(m_fp);
+}
+
+bool CY4MReader::ReadLine(string *pLine)
+{
+	pLine->clear();
+	int c;
+	while ((c = getc(m_fp)) != EOF)
+	{
+		if (c == '\n')
+			return true;
+		*pLine += (char)c;
+		if (pLine->size() > 4096)
+			return false;
+	}
+	return false;
+}
+
+bool CY4MReader::Open(const char *pszPath)
+{
+	m_fp = fopen(pszPath, "rb");
+	if (m_fp == NULL)
+	{
+		fprintf(stderr, "%s: cannot open\n", pszPath);
+		return false;
+	}
+	setvbuf(m_fp, NULL, _IOFBF, g_cbStdioBuffer);
+
+	string line;
+	if (!ReadLine(&line) || line.compare(0, sizeof(g_Signature) - 1, g_Signature) != 0)
+	{
+		fprintf(stderr, "%s: not a YUV4MPEG2 stream\n", pszPath);
+		return false;
+	}
+	m_Header.params = line.substr(sizeof(g_Signature) - 1);
+
+	// Tokens are separated by single spaces and start with a tag letter
+	string colorspace = "420jpeg";
+	size_t pos = 0;
+	while (pos < m_Header.params.size())
+	{
+		size_t end = m_Header.params.find(' ', pos);
+		if (end == string::npos)
+			end = m_Header.params.size();
+		string token = m_Header.params.substr(pos, end - pos);
+		pos = end + 1;
+		if (token.empty())
+			continue;
+		switch (token[0])
+		{
+		case 'W': m_Header.nWidth = atoi(token.c_str() + 1); break;
+		case 'H': m_Header.nHeight = atoi(token.c_str() + 1); break;
+		case 'C': colorspace = token.substr(1); break;
+		default: break;
+		}
+	}
+
+	if (colorspace.compare(0, 3, "420") == 0)
+		m_Header.format = FRAME_FORMAT_I420;
+	else if (colorspace == "422")
+		m_Header.format = FRAME_FORMAT_I422;
+	else if (colorspace == "444")
+		m_Header.format = FRAME_FORMAT_I444;
+	else
+	{
+		fprintf(stderr, "%s: colour space C%s is not supported\n", pszPath, colorspace.c_str());
+		return false;
+	}
+	if (m_Header.nWidth <= 0 || m_Header.nHeight <= 0)
+	{
+		fprintf(stderr, "%s: missing frame size\n", pszPath);
+		return false;
+	}
+	if (m_Header.nWidth > g_FrameMaxSize || m_Header.nHeight > g_FrameMaxSize)
+	{
+		fprintf(stderr, "%s: frame size %dx%d is too large\n", pszPath, m_Header.nWidth, m_Header.nHeight);
+		return false;
+	}
+	m_cbFrame = ::FrameBytes(m_Header.format, m_Header.nWidth, m_Header.nHeight);
+	return true;
+}
+
+bool CY4MReader::ReadFrame(unsigned char *pb)
+{
+	string line;
+	if (!ReadLine(&line))
+	{
+		// A clean end of file lands exactly on a frame boundary
+		m_bError = !line.empty();
+		return false;
+	}
+	if (line.compare(0, 5, "FRAME") != 0)
+	{
+		fprintf(stderr, "y4m: bad frame marker\n");
+		m_bError = true;
+		return false;
+	}
+	if (fread(pb, 1, m_cbFrame, m_fp) != m_cbFrame)
+	{
+		fprintf(stderr, "y4m: truncated frame\n");
+		m_bError = true;
+		return false;
+	}
+	return true;
+}
+
+//
+// CY4MWriter
+//
+CY4MWriter::CY4MWriter()
+	: m_fp(NULL), m_cbFrame(0), m_bError(false)
+{
+}
+
+CY4MWriter::~CY4MWriter()
+{
+	if (m_fp != NULL)
+		fclose(m_fp);
+}
+
+bool CY4MWriter::Open(const char *pszPath, const Y4MHeader &header)
+{
+	m_fp = fopen(pszPath, "wb");
+	if (m_fp == NULL)
+	{
+		fprintf(stderr, "%s: cannot create\n", pszPath);
+		return false;
+	}
+	setvbuf(m_fp, NULL, _IOFBF, g_cbStdioBuffer);
+	m_cbFrame = ::FrameBytes(header.format, header.nWidth, header.nHeight);
+
+	// Copy the parameters, with the frame size of this header
+	string params;
+	size_t pos = 0;
+	while (pos < header.params.size())
+	{
+		size_t end = header.params.find(' ', pos);
+		if (end == string::npos)
+			end = header.params.size();
+		string token = header.params.substr(pos, end - pos);
+		pos = end + 1;
+		if (token.empty())
+			continue;
+		char sz[16];
+		if (token[0] == 'W')
+		{
+			sprintf(sz, "W%d", header.nWidth);
+			token = sz;
+		}
+		else if (token[0] == 'H')
+		{
+			sprintf(sz, "H%d", header.nHeight);
+			token = sz;
+		}
+		params += " " + token;
+	}
+	m_bError = fprintf(m_fp, "%s%s\n", g_Signature, params.c_str()) < 0;
+	return !m_bError;
+}
+
+bool CY4MWriter::WriteFrame(const unsigned char *pb)
+{
+	if (fwrite("FRAME\n", 1, 6, m_fp) != 6 || fwrite(pb, 1, m_cbFrame, m_fp) != m_cbFrame)
+		m_bError = true;
+	return !m_bError;
+}
+
+bool CY4MWriter::Close()
+{
+	if (m_fp != NULL && fclose(m_fp) != 0)
+		m_bError = true;
+	m_fp = NULL;
+	return !m_bError;
+}
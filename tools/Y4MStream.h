@@ -0,0 +1,56 @@
+#pragma once
+//
+// YUV4MPEG2 (.y4m) demuxer and muxer. Only the planar 8-bit colour spaces
+// the engine understands are accepted: 4:2:0 (all chroma sitings), 4:2:2
+// and 4:4:4.
+//
+#include <stdio.h>
+#include <string>
+#include "../ColorEngine.h"
+
+struct Y4MHeader
+{
+	int nWidth;
+	int nHeight;
+	FrameFormat format;
+	std::string params;     // Everything after the signature, copied to the output with W and H updated
+};
+
+class CY4MReader
+{
+public:
+	CY4MReader();
+	~CY4MReader();
+
+	bool Open(const char *pszPath);
+	const Y4MHeader &Header() const { return m_Header; }
+	size_t FrameBytes() const { return m_cbFrame; }
+
+	// Read the next frame into pb; false at the end of the stream
+	bool ReadFrame(unsigned char *pb);
+	bool Failed() const { return m_bError; }
+
+private:
+	bool ReadLine(std::string *pLine);
+
+	FILE *m_fp;
+	Y4MHeader m_Header;
+	size_t m_cbFrame;
+	bool m_bError;
+};
+
+class CY4MWriter
+{
+public:
+	CY4MWriter();
+	~CY4MWriter();
+
+	bool Open(const char *pszPath, const Y4MHeader &header);
+	bool WriteFrame(const unsigned char *pb);
+	bool Close();
+
+private:
+	FILE *m_fp;
+	size_t m_cbFrame;
+	bool m_bError;
+};
@@ -0,0 +1,744 @@
+//
+// fpaccuracy - numerical accuracy of the colour kernels
+//
+// Sweeps the brightness/contrast/hue/saturation/gamma space and compares
+// every kernel with the double-precision model in ColorReference.h over
+// the complete 8-bit input domain (all 256 Y values and all 65536 U/V
+// pairs). The frame kernels run on every FrameFormat with every
+// instruction set. Reports the maximum error and PSNR per kernel and exits
+// with a non-zero status when a gated kernel drifts past its bound.
+//
+// The engine also converts between YUV encodings, and the reference applies
+// the exact conversion after the adjustments. A fixed set of pairs is run
+// unless --in or --out names one.
+//
+// The cube kernels grade through an identity 33^3 .cube, once on its own
+// and once with the levels baked in front of it; their reference runs the
+// cube itself in double precision.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "../ColorEngine.h"
+#include "../ChainTables.h"
+#include "../ColorReference.h"
+#include "../ColorCube.h"
+
+using namespace std;
+
+//
+// Every kernel fills one output frame laid out by BuildDomainFrame(): the
+// macropixel k holds Y0 = k & 255, U = k & 255, Y1 = 255 - (k & 255) and
+// V = k >> 8, so one 512x256 YUY2 frame covers the whole input domain.
+//
+static const int g_DomainWidth = 512;
+static const int g_DomainHeight = 256;
+static const int g_DomainBytes = g_DomainWidth * 2 * g_DomainHeight;
+
+static void BuildDomainFrame(unsigned char *pb)
+{
+	for (int k = 0; k < 65536; k++)
+	{
+		pb[k * 4 + 0] = (unsigned char)(k & 255);
+		pb[k * 4 + 1] = (unsigned char)(k & 255);
+		pb[k * 4 + 2] = (unsigned char)(255 - (k & 255));
+		pb[k * 4 + 3] = (unsigned char)(k >> 8);
+	}
+}
+
+//
+// The frame kernels run on the domain in every FrameFormat. UYVY swaps the
+// bytes of each macropixel and the planar formats split it into planes:
+// I444 gives both pixels the chroma of their macropixel, and I420 repeats
+// every row, so that each chroma block holds one macropixel twice. The
+// output goes back into the domain layout once per copy of a row.
+//
+static int DomainCopies(FrameFormat format)
+{
+	return format == FRAME_FORMAT_I420 ? 2 : 1;
+}
+
+static void PackDomain(const unsigned char *pbDomain, const FrameDesc &d)
+{
+	int sx = 1, sy = 0;
+	if (FramePlanar(d.format))
+		FrameChromaShift(d.format, &sx, &sy);
+	const int iY = d.format == FRAME_FORMAT_UYVY ? 1 : 0;
+	for (int r = 0; r < d.nHeight; r++)
+	{
+		unsigned char *pRow = d.pbTop + d.lStride * r;
+		const unsigned char *s = pbDomain + (size_t)(r / DomainCopies(d.format)) * g_DomainWidth * 2;
+		for (int m = 0; m < g_DomainWidth / 2; m++, s += 4)
+		{
+			if (!FramePlanar(d.format))
+			{
+				pRow[m * 4 + iY] = s[0];
+				pRow[m * 4 + 1 - iY] = s[1];
+				pRow[m * 4 + iY + 2] = s[2];
+				pRow[m * 4 + 3 - iY] = s[3];
+				continue;
+			}
+			pRow[m * 2] = s[0];
+			pRow[m * 2 + 1] = s[2];
+			for (int x = (m * 2) >> sx; x <= (m * 2 + 1) >> sx; x++)
+			{
+				d.pbU[d.lStrideUV * (r >> sy) + x] = s[1];
+				d.pbV[d.lStrideUV * (r >> sy) + x] = s[3];
+			}
+		}
+	}
+}
+
+// The chroma of the two pixels of an I444 macropixel, which a cube grades
+// apart, is averaged as the packed kernels do
+static void UnpackDomain(const FrameDesc &d, int nCopy, unsigned char *pbOut)
+{
+	int sx = 1, sy = 0;
+	if (FramePlanar(d.format))
+		FrameChromaShift(d.format, &sx, &sy);
+	const int iY = d.format == FRAME_FORMAT_UYVY ? 1 : 0;
+	for (int dr = 0; dr < g_DomainHeight; dr++)
+	{
+		const int r = dr * DomainCopies(d.format) + nCopy;
+		const unsigned char *pRow = d.pbTop + d.lStride * r;
+		unsigned char *o = pbOut + (size_t)dr * g_DomainWidth * 2;
+		for (int m = 0; m < g_DomainWidth / 2; m++, o += 4)
+		{
+			if (!FramePlanar(d.format))
+			{
+				o[0] = pRow[m * 4 + iY];
+				o[1] = pRow[m * 4 + 1 - iY];
+				o[2] = pRow[m * 4 + iY + 2];
+				o[3] = pRow[m * 4 + 3 - iY];
+				continue;
+			}
+			const unsigned char *pu = d.pbU + d.lStrideUV * (r >> sy);
+			const unsigned char *pv = d.pbV + d.lStrideUV * (r >> sy);
+			const int x0 = (m * 2) >> sx, x1 = (m * 2 + 1) >> sx;
+			o[0] = pRow[m * 2];
+			o[1] = (unsigned char)((pu[x0] + pu[x1] + 1) >> 1);
+			o[2] = pRow[m * 2 + 1];
+			o[3] = (unsigned char)((pv[x0] + pv[x1] + 1) >> 1);
+		}
+	}
+}
+
+struct KernelContext
+{
+	CColorEngine *pEngine;             // The five controls
+	CColorEngine *pCubeEngine;         // The cube alone
+	CColorEngine *pBakedEngine;        // The cube with the levels baked in
+	const CChainTables *pChain;
+	const unsigned char *pbDomain;     // YUY2
+	FrameFormat format;                // Of the frame kernels
+	FrameIsa isa;
+	const unsigned char *pbFrame;      // The domain in that format
+	unsigned char *pbScratch;          // Source of a frame kernel
+	unsigned char *pbTarget;
+};
+
+typedef void (*KERNELPROC)(const KernelContext &ctx, const ColorParams &params, unsigned char *pbOut);
+
+static void RunChain(const KernelContext &ctx, const ColorParams &p, unsigned char *pbOut)
+{
+	for (int k = 0; k < 65536; k++)
+	{
+		const unsigned char *s = ctx.pbDomain + k * 4;
+		unsigned char *d = pbOut + k * 4;
+		d[0] = ctx.pChain->ProcessLuma(s[0], p.Brightness, p.Contrast, p.Gamma);
+		d[2] = ctx.pChain->ProcessLuma(s[2], p.Brightness, p.Contrast, p.Gamma);
+		ctx.pChain->ProcessChroma(s[1], s[3], p.Hue, p.Saturation, &d[1], &d[3]);
+	}
+}
+
+static void RunLut(const KernelContext &ctx, const ColorParams &, unsigned char *pbOut)
+{
+	for (int k = 0; k < 65536; k++)
+	{
+		const unsigned char *s = ctx.pbDomain + k * 4;
+		unsigned char *d = pbOut + k * 4;
+		ctx.pEngine->Apply(s[0], s[1], s[3], &d[0], &d[1], &d[3]);
+		ctx.pEngine->Apply(s[2], s[1], s[3], &d[2], &d[1], &d[3]);
+	}
+}
+
+// Fills one domain in pbOut for every copy of a row
+static void RunKernel(const KernelContext &ctx, CColorEngine *pEngine, ColorKernel kernel,
+	unsigned char *pbOut)
+{
+	// The in-place kernel writes into its source, so always work on a copy
+	const int nHeight = g_DomainHeight * DomainCopies(ctx.format);
+	memcpy(ctx.pbScratch, ctx.pbFrame, FrameBytes(ctx.format, g_DomainWidth, nHeight));
+	FrameDesc src = FrameLayout(ctx.pbScratch, ctx.format, g_DomainWidth, nHeight);
+	FrameDesc dst = FrameLayout(ctx.pbTarget, ctx.format, g_DomainWidth, nHeight);
+	pEngine->SetIsa(ctx.isa);
+	pEngine->Process(src, dst, kernel);
+	for (int c = 0; c < DomainCopies(ctx.format); c++)
+		UnpackDomain(dst, c, pbOut + (size_t)c * g_DomainBytes);
+}
+
+static void RunInplace(const KernelContext &ctx, const ColorParams &, unsigned char *pbOut)
+{
+	RunKernel(ctx, ctx.pEngine, KERNEL_INPLACE, pbOut);
+}
+
+static void RunDirect(const KernelContext &ctx, const ColorParams &, unsigned char *pbOut)
+{
+	RunKernel(ctx, ctx.pEngine, KERNEL_DIRECT, pbOut);
+}
+
+static void RunUnrolled(const KernelContext &ctx, const ColorParams &, unsigned char *pbOut)
+{
+	RunKernel(ctx, ctx.pEngine, KERNEL_UNROLLED, pbOut);
+}
+
+static void RunCube(const KernelContext &ctx, const ColorParams &, unsigned char *pbOut)
+{
+	RunKernel(ctx, ctx.pCubeEngine, KERNEL_DIRECT, pbOut);
+}
+
+static void RunBaked(const KernelContext &ctx, const ColorParams &, unsigned char *pbOut)
+{
+	RunKernel(ctx, ctx.pBakedEngine, KERNEL_DIRECT, pbOut);
+}
+
+//
+// Kernels under test and their bounds. A kernel with bGated == false is
+// measured and printed but never fails the run. The table kernels truncate
+// and quantize saturation to Saturation/4, which costs up to ~5.1 levels of
+// chroma; a new fast path must not be any worse than that. The cube
+// kernels interpolate between grid nodes 8 codes apart, which is exact
+// only where the graded colour is a linear function of the codes; the
+// clip to the RGB gamut costs up to 2 levels, a full range output
+// stretches that, and the baked tables add their own error on top.
+//
+enum CubeUse
+{
+	CUBE_NONE,      // The five controls
+	CUBE_ALONE,     // The cube on the input codes
+	CUBE_BAKED      // The five controls, then the cube
+};
+
+enum KernelFrames
+{
+	FRAMES_NONE,    // Works on samples, in no format and instruction set
+	FRAMES_PACKED,  // YUY2 and UYVY
+	FRAMES_ALL
+};
+
+struct KernelEntry
+{
+	const char *pszName;
+	KERNELPROC pfn;
+	double dMaxError;   // Largest allowed |out - reference| on any sample
+	double dMinPsnr;    // Smallest allowed PSNR (dB) over the sweep
+	bool bGated;
+	CubeUse cube;
+	KernelFrames frames;
+};
+
+static const KernelEntry g_Kernels[] =
+{
+	{ "chain",    RunChain,    255.0,  0.0, false, CUBE_NONE,  FRAMES_NONE },
+	{ "lut",      RunLut,        5.5, 42.0, true,  CUBE_NONE,  FRAMES_NONE },
+	{ "inplace",  RunInplace,    5.5, 42.0, true,  CUBE_NONE,  FRAMES_PACKED },
+	{ "direct",   RunDirect,     5.5, 42.0, true,  CUBE_NONE,  FRAMES_ALL },
+	{ "unrolled", RunUnrolled,   5.5, 42.0, true,  CUBE_NONE,  FRAMES_PACKED },
+	{ "cube",     RunCube,       3.0, 55.0, true,  CUBE_ALONE, FRAMES_ALL },
+	{ "baked",    RunBaked,      6.5, 46.0, true,  CUBE_BAKED, FRAMES_ALL },
+};
+static const int g_nKernels = sizeof(g_Kernels) / sizeof(g_Kernels[0]);
+
+//
+// Accumulated error of one kernel over the whole sweep
+//
+struct ErrorStats
+{
+	double dLumaMax;
+	double dChromaMax;
+	double dLumaSq;
+	double dChromaSq;
+	double nLuma;
+	double nChroma;
+	ColorParams worstLuma;
+	ColorParams worstChroma;
+	unsigned long nMismatch;   // Samples that differ from the "lut" tables
+
+	ErrorStats()
+		: dLumaMax(0), dChromaMax(0), dLumaSq(0), dChromaSq(0),
+		  nLuma(0), nChroma(0), nMismatch(0)
+	{
+		memset(&worstLuma, 0, sizeof(worstLuma));
+		memset(&worstChroma, 0, sizeof(worstChroma));
+	}
+
+	static double Psnr(double dSq, double n)
+	{
+		if (dSq <= 0) return 99.0;
+		return 10.0 * log10(255.0 * 255.0 / (dSq / n));
+	}
+	double LumaPsnr() const { return Psnr(dLumaSq, nLuma); }
+	double ChromaPsnr() const { return Psnr(dChromaSq, nChroma); }
+};
+
+//
+// One kernel on one format and instruction set
+//
+struct KernelRun
+{
+	int nKernel;
+	FrameFormat format;
+	FrameIsa isa;
+	ErrorStats stats;
+};
+
+// Encodings every run without --in and --out converts between: none, both
+// ways between two matrices, and into and out of full range
+static const char *const g_SpacePairs[][2] =
+{
+	{ "601", "601" },
+	{ "601", "709" },
+	{ "709", "601" },
+	{ "709", "709:full" },
+	{ "2020:full", "601" },
+};
+static const int g_nSpacePairs = sizeof(g_SpacePairs) / sizeof(g_SpacePairs[0]);
+
+//
+// Reference output for one parameter set, in the domain frame layout
+//
+static double Clamp255(double x)
+{
+	return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+static void BuildReference(const ColorParams &params, const ColorSpace &in, const ColorSpace &out,
+	double *pdRef)
+{
+	CColorReference ref(params);
+	double luma[256];
+	for (int y = 0; y < 256; y++)
+		luma[y] = ref.Luma((unsigned char)y);
+	bool bConvert = !ColorSpaceEqual(in, out);
+	for (int k = 0; k < 65536; k++)
+	{
+		double *d = pdRef + k * 4;
+		d[0] = luma[k & 255];
+		d[2] = luma[255 - (k & 255)];
+		ref.Chroma((unsigned char)(k & 255), (unsigned char)(k >> 8), &d[1], &d[3]);
+		if (bConvert)
+		{
+			double u, v;
+			ColorSpaceConvert(in, out, d[0], d[1], d[3], &d[0], &u, &v);
+			ColorSpaceConvert(in, out, d[2], d[1], d[3], &d[2], &u, &v);
+			d[0] = Clamp255(d[0]);
+			d[2] = Clamp255(d[2]);
+			d[1] = Clamp255(u);
+			d[3] = Clamp255(v);
+		}
+	}
+}
+
+//
+// Reference output of the cube for one parameter set. Baked controls and
+// the conversion to the output space come first; the cube grades in the
+// output space. The packed kernels grade both pixels of a macropixel and
+// average their chroma. The subsampled planar ones grade the chroma once,
+// at the mean luma of the block rounded as they round it.
+//
+static double Clamp01(double x)
+{
+	return x < 0 ? 0 : (x > 1 ? 1 : x);
+}
+
+static void GradeSample(const CColorReference *pRef, const CColorCube &cube,
+	const ColorSpace &in, const ColorSpace &out, unsigned char y, unsigned char u, unsigned char v,
+	double *pY, double *pU, double *pV)
+{
+	double Y = y, U = u, V = v;
+	const ColorSpace *pSpace = &in;
+	if (pRef != NULL)
+	{
+		Y = pRef->Luma(y);
+		pRef->Chroma(u, v, &U, &V);
+		ColorSpaceConvert(in, out, Y, U, V, &Y, &U, &V);
+		Y = Clamp255(Y);
+		U = Clamp255(U);
+		V = Clamp255(V);
+		pSpace = &out;
+	}
+	double r, g, b;
+	ColorSpaceToRGB(*pSpace, Y, U, V, &r, &g, &b);
+	cube.Sample(Clamp01(r), Clamp01(g), Clamp01(b), &r, &g, &b);
+	ColorSpaceFromRGB(out, r, g, b, &Y, &U, &V);
+	*pY = Clamp255(Y);
+	*pU = Clamp255(U);
+	*pV = Clamp255(V);
+}
+
+static void BuildCubeReference(const ColorParams &params, bool bBaked, bool bBlockMean,
+	const CColorCube &cube, const ColorSpace &in, const ColorSpace &out, double *pdRef)
+{
+	CColorReference ref(params);
+	const CColorReference *pRef = bBaked ? &ref : NULL;
+	for (int k = 0; k < 65536; k++)
+	{
+		double *d = pdRef + k * 4;
+		const unsigned char y0 = (unsigned char)(k & 255), y1 = (unsigned char)(255 - (k & 255));
+		const unsigned char u = (unsigned char)(k & 255), v = (unsigned char)(k >> 8);
+		double u0, v0, u1, v1;
+		GradeSample(pRef, cube, in, out, y0, u, v, &d[0], &u0, &v0);
+		GradeSample(pRef, cube, in, out, y1, u, v, &d[2], &u1, &v1);
+		if (bBlockMean)
+		{
+			double y;
+			GradeSample(pRef, cube, in, out, (unsigned char)((y0 + y1 + 1) / 2), u, v, &y, &d[1], &d[3]);
+		}
+		else
+		{
+			d[1] = (u0 + u1) / 2;
+			d[3] = (v0 + v1) / 2;
+		}
+	}
+}
+
+static void Accumulate(ErrorStats *pStats, const ColorParams &params,
+	const unsigned char *pbOut, const double *pdRef, const unsigned char *pbLut)
+{
+	for (int i = 0; i < g_DomainBytes; i++)
+	{
+		double e = fabs((double)pbOut[i] - pdRef[i]);
+		if (pbLut != NULL && pbOut[i] != pbLut[i])
+			pStats->nMismatch++;
+		if ((i & 1) == 0)
+		{
+			// The first 256 macropixels already hold every Y value (once
+			// as Y0, once as Y1), so only they go into the luma PSNR.
+			if (i < 256 * 4)
+			{
+				pStats->dLumaSq += e * e;
+				pStats->nLuma++;
+			}
+			if (e > pStats->dLumaMax)
+			{
+				pStats->dLumaMax = e;
+				pStats->worstLuma = params;
+			}
+		}
+		else
+		{
+			pStats->dChromaSq += e * e;
+			pStats->nChroma++;
+			if (e > pStats->dChromaMax)
+			{
+				pStats->dChromaMax = e;
+				pStats->worstChroma = params;
+			}
+		}
+	}
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: fpaccuracy [options]\n"
+		"  -q, --quick          sweep every 15th level instead of every level\n"
+		"  -r, --random N       number of random parameter combinations (default: 256)\n"
+		"  -k, --kernels LIST   kernels to measure (default: all)\n"
+		"  -e, --max-error X    override the maximum error bound of gated kernels\n"
+		"  -p, --min-psnr DB    override the PSNR bound of gated kernels\n"
+		"      --in SPACE       input encoding: 601, 709 or 2020[:full|:limited]\n"
+		"      --out SPACE      output encoding (default: same as --in; without either,\n"
+		"                       a fixed set of conversions)\n"
+		"  -v, --verbose        print every parameter set\n");
+}
+
+int main(int argc, char **argv)
+{
+	int nStep = 1;
+	int nRandom = 256;
+	double dMaxError = -1;
+	double dMinPsnr = -1;
+	bool bVerbose = false;
+	vector<bool> selected(g_nKernels, true);
+	ColorSpace in = MakeColorSpace(COLOR_MATRIX_BT601, false);
+	ColorSpace out = in;
+	bool bIn = false;
+	bool bOut = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool bHasValue = i + 1 < argc;
+		if (arg == "-q" || arg == "--quick")
+		{
+			nStep = 15;
+		}
+		else if ((arg == "-r" || arg == "--random") && bHasValue)
+		{
+			nRandom = atoi(argv[++i]);
+		}
+		else if ((arg == "-k" || arg == "--kernels") && bHasValue)
+		{
+			string list = string(",") + argv[++i] + ",";
+			for (int k = 0; k < g_nKernels; k++)
+				selected[k] = list.find(string(",") + g_Kernels[k].pszName + ",") != string::npos;
+		}
+		else if ((arg == "-e" || arg == "--max-error") && bHasValue)
+		{
+			dMaxError = atof(argv[++i]);
+		}
+		else if ((arg == "-p" || arg == "--min-psnr") && bHasValue)
+		{
+			dMinPsnr = atof(argv[++i]);
+		}
+		else if (arg == "-v" || arg == "--verbose")
+		{
+			bVerbose = true;
+		}
+		else if (arg == "--in" && bHasValue && ColorSpaceFromName(argv[i + 1], &in))
+		{
+			i++;
+			bIn = true;
+		}
+		else if (arg == "--out" && bHasValue && ColorSpaceFromName(argv[i + 1], &out))
+		{
+			i++;
+			bOut = true;
+		}
+		else
+		{
+			Usage();
+			return arg == "-h" || arg == "--help" ? 0 : 2;
+		}
+	}
+
+	// Parameter sets: each control swept on its own around the defaults,
+	// then random combinations from a fixed seed so that runs repeat.
+	vector<ColorParams> sweep;
+	for (int c = 0; c < 5; c++)
+	{
+		for (int level = 0; level < 256; level += nStep)
+		{
+			ColorParams p = { 127, 127, 127, 127, 127 };
+			unsigned char *pControl[5] = { &p.Brightness, &p.Contrast, &p.Hue, &p.Saturation, &p.Gamma };
+			*pControl[c] = (unsigned char)level;
+			sweep.push_back(p);
+		}
+	}
+	unsigned int seed = 20261019;
+	for (int i = 0; i < nRandom; i++)
+	{
+		unsigned char v[5];
+		for (int c = 0; c < 5; c++)
+		{
+			seed = seed * 1103515245 + 12345;
+			v[c] = (unsigned char)(seed >> 16);
+		}
+		ColorParams p = { v[0], v[1], v[2], v[3], v[4] };
+		sweep.push_back(p);
+	}
+
+	vector<ColorSpace> ins, outs;
+	if (bIn || bOut)
+	{
+		ins.push_back(in);
+		outs.push_back(bOut ? out : in);
+	}
+	for (int i = 0; i < g_nSpacePairs && !bIn && !bOut; i++)
+	{
+		ColorSpaceFromName(g_SpacePairs[i][0], &in);
+		ColorSpaceFromName(g_SpacePairs[i][1], &out);
+		ins.push_back(in);
+		outs.push_back(out);
+	}
+
+	// Every frame kernel on every format it takes and every instruction set
+	vector<KernelRun> runs;
+	for (int k = 0; k < g_nKernels; k++)
+	{
+		if (!selected[k])
+			continue;
+		KernelRun run;
+		run.nKernel = k;
+		run.format = FRAME_FORMAT_YUY2;
+		run.isa = FrameIsaBest();
+		if (g_Kernels[k].frames == FRAMES_NONE)
+		{
+			runs.push_back(run);
+			continue;
+		}
+		for (int f = 0; f < FRAME_FORMAT_COUNT; f++)
+		{
+			if (g_Kernels[k].frames == FRAMES_PACKED && FramePlanar((FrameFormat)f))
+				continue;
+			for (int isa = FRAME_ISA_SCALAR; isa <= FrameIsaBest(); isa++)
+			{
+				run.format = (FrameFormat)f;
+				run.isa = (FrameIsa)isa;
+				runs.push_back(run);
+			}
+		}
+	}
+
+	CColorEngine *pEngine = new CColorEngine;
+	CChainTables *pChain = new CChainTables;
+	unsigned char *pbDomain = new unsigned char[g_DomainBytes];
+	unsigned char *pbLut = new unsigned char[g_DomainBytes];
+	unsigned char *pbOut = new unsigned char[g_DomainBytes * 2];
+	double *pdRef = new double[g_DomainBytes];
+	// Per pixel chroma for the packed and 4:4:4 frames, block mean luma
+	// chroma for the subsampled planar ones
+	double *pdCubeRef[2] = { new double[g_DomainBytes], new double[g_DomainBytes] };
+	double *pdBakedRef[2] = { new double[g_DomainBytes], new double[g_DomainBytes] };
+	BuildDomainFrame(pbDomain);
+
+	vector<unsigned char> frames[FRAME_FORMAT_COUNT];
+	size_t cbFrame = 0;
+	for (int f = 0; f < FRAME_FORMAT_COUNT; f++)
+	{
+		int nHeight = g_DomainHeight * DomainCopies((FrameFormat)f);
+		frames[f].resize(FrameBytes((FrameFormat)f, g_DomainWidth, nHeight));
+		PackDomain(pbDomain, FrameLayout(&frames[f][0], (FrameFormat)f, g_DomainWidth, nHeight));
+		if (frames[f].size() > cbFrame)
+			cbFrame = frames[f].size();
+	}
+	vector<unsigned char> scratch(cbFrame), target(cbFrame);
+
+	CColorCube cube;
+	cube.Identity(33);
+	ColorParams neutral = { 127, 127, 127, 127, 127 };
+	CColorEngine *pCubeEngine = new CColorEngine;
+	CColorEngine *pBakedEngine = new CColorEngine;
+	KernelContext ctx = { pEngine, pCubeEngine, pBakedEngine, pChain, pbDomain, FRAME_FORMAT_YUY2,
+		FrameIsaBest(), NULL, &scratch[0], &target[0] };
+
+	printf("%u parameter sets, %d luma and 65536 chroma inputs each\n", (unsigned)sweep.size(), 256);
+	bool bFailed = false;
+	for (size_t c = 0; c < ins.size(); c++)
+	{
+		const ColorSpace &in = ins[c];
+		const ColorSpace &out = outs[c];
+		pEngine->SetColorSpaces(in, out);
+		pCubeEngine->SetColorSpaces(in, out);
+		pCubeEngine->SetCube(cube, false);
+		pBakedEngine->SetColorSpaces(in, out);
+		pBakedEngine->SetCube(cube, true);
+		for (size_t r = 0; r < runs.size(); r++)
+			runs[r].stats = ErrorStats();
+		bool bCubeRef[2] = { false, false };
+
+		for (size_t s = 0; s < sweep.size(); s++)
+		{
+			const ColorParams &p = sweep[s];
+			pEngine->UpdateLuma(p.Brightness, p.Contrast, p.Gamma);
+			pEngine->UpdateChroma(p.Hue, p.Saturation);
+			BuildReference(p, in, out, pdRef);
+			RunLut(ctx, p, pbLut);
+			pBakedEngine->UpdateLuma(p.Brightness, p.Contrast, p.Gamma);
+			pBakedEngine->UpdateChroma(p.Hue, p.Saturation);
+			bool bBakedRef[2] = { false, false };
+
+			for (size_t r = 0; r < runs.size(); r++)
+			{
+				KernelRun &run = runs[r];
+				const KernelEntry &entry = g_Kernels[run.nKernel];
+				const double *pdKernelRef = pdRef;
+				const unsigned char *pbKernelLut = pbLut;
+				const int nMean = run.format == FRAME_FORMAT_I420 || run.format == FRAME_FORMAT_I422;
+				if (entry.cube == CUBE_ALONE)
+				{
+					// The cube alone ignores the controls, so one parameter
+					// set covers it
+					if (s > 0)
+						continue;
+					if (!bCubeRef[nMean])
+						BuildCubeReference(neutral, false, nMean != 0, cube, in, out, pdCubeRef[nMean]);
+					bCubeRef[nMean] = true;
+					pdKernelRef = pdCubeRef[nMean];
+					pbKernelLut = NULL;
+				}
+				else if (entry.cube == CUBE_BAKED)
+				{
+					if (!bBakedRef[nMean])
+						BuildCubeReference(p, true, nMean != 0, cube, in, out, pdBakedRef[nMean]);
+					bBakedRef[nMean] = true;
+					pdKernelRef = pdBakedRef[nMean];
+					pbKernelLut = NULL;
+				}
+				ctx.format = run.format;
+				ctx.isa = run.isa;
+				ctx.pbFrame = &frames[run.format][0];
+				entry.pfn(ctx, p, pbOut);
+
+				ErrorStats one;
+				const int nCopies = entry.frames == FRAMES_NONE ? 1 : DomainCopies(run.format);
+				for (int n = 0; n < nCopies; n++)
+				{
+					Accumulate(&one, p, pbOut + (size_t)n * g_DomainBytes, pdKernelRef, pbKernelLut);
+					Accumulate(&run.stats, p, pbOut + (size_t)n * g_DomainBytes, pdKernelRef, pbKernelLut);
+				}
+				if (bVerbose)
+				{
+					printf("B=%3d C=%3d H=%3d S=%3d G=%3d  %-9s %-5s %-7s  Y max %6.2f psnr %6.2f  UV max %6.2f psnr %6.2f\n",
+						p.Brightness, p.Contrast, p.Hue, p.Saturation, p.Gamma, entry.pszName,
+						entry.frames == FRAMES_NONE ? "-" : FrameFormatName(run.format),
+						entry.frames == FRAMES_NONE ? "-" : FrameIsaName(run.isa),
+						one.dLumaMax, one.LumaPsnr(), one.dChromaMax, one.ChromaPsnr());
+				}
+			}
+		}
+
+		printf("\nBT.%s %s", ColorMatrixName(in.matrix), in.bFullRange ? "full" : "limited");
+		if (!ColorSpaceEqual(in, out))
+			printf(" to BT.%s %s", ColorMatrixName(out.matrix), out.bFullRange ? "full" : "limited");
+		printf("\n\n");
+		printf("%-9s %-5s %-7s %8s %8s %8s %8s %10s  %-24s %-24s %s\n", "kernel", "frame", "isa",
+			"Y max", "Y psnr", "UV max", "UV psnr", "!= lut", "worst Y (B,C,H,S,G)", "worst UV (B,C,H,S,G)", "status");
+
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			const KernelRun &run = runs[r];
+			const KernelEntry &entry = g_Kernels[run.nKernel];
+			const ErrorStats &st = run.stats;
+			double dBoundError = dMaxError >= 0 ? dMaxError : entry.dMaxError;
+			double dBoundPsnr = dMinPsnr >= 0 ? dMinPsnr : entry.dMinPsnr;
+
+			bool bPass = st.dLumaMax <= dBoundError && st.dChromaMax <= dBoundError &&
+				st.LumaPsnr() >= dBoundPsnr && st.ChromaPsnr() >= dBoundPsnr;
+			const char *pszStatus = !entry.bGated ? "info" : (bPass ? "ok" : "FAIL");
+			if (entry.bGated && !bPass)
+				bFailed = true;
+
+			char worstY[32], worstUV[32];
+			sprintf(worstY, "%d,%d,%d,%d,%d", st.worstLuma.Brightness, st.worstLuma.Contrast,
+				st.worstLuma.Hue, st.worstLuma.Saturation, st.worstLuma.Gamma);
+			sprintf(worstUV, "%d,%d,%d,%d,%d", st.worstChroma.Brightness, st.worstChroma.Contrast,
+				st.worstChroma.Hue, st.worstChroma.Saturation, st.worstChroma.Gamma);
+			printf("%-9s %-5s %-7s %8.3f %8.2f %8.3f %8.2f %10lu  %-24s %-24s %s\n",
+				entry.pszName, entry.frames == FRAMES_NONE ? "-" : FrameFormatName(run.format),
+				entry.frames == FRAMES_NONE ? "-" : FrameIsaName(run.isa),
+				st.dLumaMax, st.LumaPsnr(), st.dChromaMax, st.ChromaPsnr(),
+				st.nMismatch, worstY, worstUV, pszStatus);
+		}
+	}
+
+	delete pEngine;
+	delete pCubeEngine;
+	delete pBakedEngine;
+	delete pChain;
+	delete [] pbDomain;
+	delete [] pbLut;
+	delete [] pbOut;
+	delete [] pdRef;
+	for (int n = 0; n < 2; n++)
+	{
+		delete [] pdCubeRef[n];
+		delete [] pdBakedRef[n];
+	}
+
+	return bFailed ? 1 : 0;
+}
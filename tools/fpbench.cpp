@@ -0,0 +1,837 @@
+//
+// fpbench - throughput benchmark for the colour engine
+//
+// Runs every kernel variant of CColorEngine over synthetic or file-backed
+// YUY2 frames at a set of standard resolutions and thread counts, and
+// reports ns/pixel, GB/s and frames/s as a table or as JSON. With --stats
+// every run is repeated with the in-pass histograms enabled so that their
+// cost can be read off side by side. --cube times the 3D LUT path instead
+// of the table kernels, --in and --out a colour space conversion.
+// --scale-to resizes every source size to one target size in the same
+// pass, so that the cost of the scaler can be read off against the plain
+// transform; ns/pixel then counts source pixels. --sharpen and --blur
+// time the unsharp mask stage in front of the kernels. With both a resize
+// and a mask the two run as a tiled pipeline; --tile-rows sets its tile
+// height, so that a frame-sized value shows what the tiling saves.
+// --levels picks the adjustments, and with them the kernel the engine
+// dispatches to: neutral hue and saturation leave the chroma tables out,
+// for instance. --blend averages every frame with a second one in the same
+// pass, and --isa runs the kernels built for a narrower instruction set.
+// --slices processes the frames in slices of rows; the "first ms" column
+// is the time until the first rows of a frame are final, which slices cut
+// to a fraction of the frame time. --stream forces the non-temporal
+// stores that large targets get on or off, and --prefetch sets how far
+// ahead the source is prefetched meanwhile. --reuse P keeps the output of
+// the rows whose source has not changed (FrameReuse.h) and runs one
+// source frame of which P percent of the rows change from frame to frame;
+// with --kept the rows unchanged since the target was last written are
+// left in it as well. --motion measures the motion between the frames
+// while they are processed (FrameMotion.h). --overlay WxH composites a
+// layer of that size with varying alpha into the bottom right corner of
+// every target frame (FrameOverlay.h). --key composite keys every frame
+// against green and composites it over a second frame, --key matte puts
+// out the alpha instead (FrameKey.h). --preview N makes a box-filtered
+// preview of 1/N the size of every target frame (FramePreview.h).
+// --fingerprint hashes every target frame while it is processed
+// (FrameFingerprint.h). --trace FILE records the frames, the bands and
+// the table rebuilds of the timed runs and saves the last of them for
+// fptrace (FrameTrace.h).
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../ColorEngine.h"
+#include "../FrameScaler.h"
+#include "../FrameSharpen.h"
+#include "../FramePipeline.h"
+#include "../FrameReuse.h"
+#include "../FrameMotion.h"
+#include "../FrameOverlay.h"
+#include "../FrameKey.h"
+#include "../FramePreview.h"
+#include "../FrameFingerprint.h"
+#include "../FrameTrace.h"
+
+using namespace std;
+
+struct BenchSize
+{
+	const char *pszName;
+	int nWidth;
+	int nHeight;
+};
+
+static const BenchSize g_Sizes[] =
+{
+	{ "480p",   720,  480 },
+	{ "720p",  1280,  720 },
+	{ "1080p", 1920, 1080 },
+	{ "4k",    3840, 2160 },
+	{ "8k",    7680, 4320 },
+};
+static const int g_nSizes = sizeof(g_Sizes) / sizeof(g_Sizes[0]);
+
+struct BenchResult
+{
+	string size;
+	int nWidth;
+	int nHeight;
+	string kernel;
+	string filter;        // Stages in front of the kernels, empty without any
+	bool bStats;
+	int nThreads;
+	int nFrames;
+	double dSeconds;
+	double dNsPerPixel;
+	double dGBps;
+	double dFps;
+	double dFirstMs;      // Until the first rows of a frame are final
+};
+
+//
+// Times the first slice of every frame
+//
+class CSliceClock : public CFrameSliceSink
+{
+public:
+	CSliceClock() : m_dStart(0), m_dFirst(0), m_dTotal(0), m_nFrames(0) {}
+
+	void StartFrame() { m_dStart = FrameSeconds(); m_dFirst = -1; }
+	void EndFrame()
+	{
+		if (m_dFirst >= 0)
+		{
+			m_dTotal += m_dFirst;
+			m_nFrames++;
+		}
+	}
+	void Reset() { m_dTotal = 0; m_nFrames = 0; }
+	double AverageMs() const { return m_nFrames > 0 ? m_dTotal * 1000 / m_nFrames : 0; }
+
+	virtual void SliceDone(const FrameDesc &dst, int nFirstRow, int nLastRow)
+	{
+		if (m_dFirst < 0)
+			m_dFirst = FrameSeconds() - m_dStart;
+	}
+
+private:
+	double m_dStart;
+	double m_dFirst;
+	double m_dTotal;
+	int m_nFrames;
+};
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: fpbench [options]\n"
+		"  -s, --sizes LIST     480p,720p,1080p,4k,8k or WxH (default: all)\n"
+		"  -k, --kernels LIST   inplace,direct,unrolled (default: all)\n"
+		"  -t, --threads LIST   thread counts (default: 1 and every power of two up to the CPU count)\n"
+		"  -m, --min-time SEC   minimum measuring time per run (default: 0.5)\n"
+		"  -i, --input FILE     raw YUY2 file to take frames from (needs a single WxH size)\n"
+		"  -S, --stats          also measure every run with frame statistics enabled\n"
+		"      --stats-step N   gather the statistics from every Nth row (default: 32, as the filter does)\n"
+		"  -c, --cube SIZE|FILE grade through a 3D LUT: an identity cube of SIZE^3 or a .cube file\n"
+		"      --in SPACE       convert from 601, 709 or 2020[:full|:limited] (default: 601)\n"
+		"      --out SPACE      convert to this encoding (default: same as --in)\n"
+		"  -z, --scale-to SIZE  resize every size to SIZE in the same pass\n"
+		"      --filter NAME    bilinear, bicubic or lanczos (default: bicubic)\n"
+		"      --sharpen R[:A]  unsharp mask of radius R and amount A (default: 1) on luma\n"
+		"      --blur R         Gaussian blur of radius R on luma\n"
+		"      --tile-rows N    rows per pipeline tile (default: sized for the L2 cache)\n"
+		"      --levels B,C,G,H,S brightness, contrast, gamma, hue, saturation (default: 140,150,120,150,160)\n"
+		"      --blend          average every frame with a second one\n"
+		"      --isa NAME       scalar or sse2 (default: the widest one built)\n"
+		"      --slices N       process in slices of N rows and time the first one\n"
+		"      --stream MODE    non-temporal target stores: auto, on or off (default: auto)\n"
+		"      --prefetch N     rows of source prefetched ahead while streaming (default: 0)\n"
+		"      --reuse P        copy unchanged rows from the previous output; P percent of the rows change\n"
+		"      --kept           with --reuse, leave unchanged rows in the target instead\n"
+		"      --motion         detect motion and scene changes while processing\n"
+		"      --overlay WxH    composite a layer of this size into every frame\n"
+		"      --key MODE       chroma key against green: composite over a second frame, or matte\n"
+		"      --preview N      make a preview of 1/N the size, N 2, 4 or 8\n"
+		"      --fingerprint    hash every frame while processing\n"
+		"      --trace FILE     record the timed frames into FILE for fptrace\n"
+		"  -j, --json           print JSON instead of a table\n");
+}
+
+static vector<string> Split(const char *psz)
+{
+	vector<string> items;
+	string cur;
+	for (; *psz; psz++)
+	{
+		if (*psz == ',')
+		{
+			if (!cur.empty()) items.push_back(cur);
+			cur.clear();
+		}
+		else
+		{
+			cur += *psz;
+		}
+	}
+	if (!cur.empty()) items.push_back(cur);
+	return items;
+}
+
+static bool ParseSize(const string &s, BenchSize *pSize)
+{
+	for (int i = 0; i < g_nSizes; i++)
+	{
+		if (s == g_Sizes[i].pszName)
+		{
+			*pSize = g_Sizes[i];
+			return true;
+		}
+	}
+	int w, h;
+	if (sscanf(s.c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0 && w <= g_FrameMaxSize && h <= g_FrameMaxSize)
+	{
+		pSize->pszName = NULL;
+		pSize->nWidth = w;
+		pSize->nHeight = h;
+		return true;
+	}
+	return false;
+}
+
+static bool ParseKernel(const string &s, ColorKernel *pKernel)
+{
+	for (int k = 0; k < KERNEL_COUNT; k++)
+	{
+		if (s == CColorEngine::KernelName((ColorKernel)k))
+		{
+			*pKernel = (ColorKernel)k;
+			return true;
+		}
+	}
+	return false;
+}
+
+//
+// A set of source frames, either synthetic or read from a raw file
+//
+class CFrameSet
+{
+public:
+	CFrameSet() : m_cbFrame(0), m_lStride(0) {}
+	~CFrameSet()
+	{
+		for (size_t i = 0; i < m_Frames.size(); i++)
+			FrameFree(m_Frames[i]);
+	}
+
+	bool Create(int nWidth, int nHeight, const char *pszFile)
+	{
+		m_lStride = ((ptrdiff_t)nWidth * 2 + 3) & ~3;
+		m_cbFrame = (size_t)m_lStride * nHeight;
+
+		if (pszFile == NULL)
+		{
+			// Two frames are enough to defeat any "same input" shortcut
+			for (int f = 0; f < 2; f++)
+			{
+				unsigned char *pb = Alloc();
+				if (pb == NULL) return false;
+				unsigned int seed = 12345 + f;
+				for (int y = 0; y < nHeight; y++)
+				{
+					unsigned char *row = pb + m_lStride * y;
+					for (int x = 0; x < nWidth * 2; x += 2)
+					{
+						seed = seed * 1103515245 + 12345;
+						row[x] = (unsigned char)(16 + ((x / 2 + y + f * 7) % 220));
+						row[x + 1] = (unsigned char)(seed >> 16);
+					}
+				}
+			}
+			return true;
+		}
+
+		FILE *fp = fopen(pszFile, "rb");
+		if (fp == NULL)
+		{
+			fprintf(stderr, "fpbench: cannot open %s\n", pszFile);
+			return false;
+		}
+		// Keep at most 8 frames resident; the rest of the file is not needed
+		size_t cbPacked = (size_t)nWidth * 2;
+		for (int f = 0; f < 8; f++)
+		{
+			unsigned char *pb = Alloc();
+			if (pb == NULL) break;
+			bool bOk = true;
+			for (int y = 0; y < nHeight && bOk; y++)
+				bOk = fread(pb + m_lStride * y, 1, cbPacked, fp) == cbPacked;
+			if (!bOk)
+			{
+				FrameFree(pb);
+				m_Frames.pop_back();
+				break;
+			}
+		}
+		fclose(fp);
+		if (m_Frames.empty())
+		{
+			fprintf(stderr, "fpbench: %s holds no complete %dx%d frame\n", pszFile, nWidth, nHeight);
+			return false;
+		}
+		return true;
+	}
+
+	size_t Count() const { return m_Frames.size(); }
+	unsigned char *Frame(size_t i) const { return m_Frames[i % m_Frames.size()]; }
+	ptrdiff_t Stride() const { return m_lStride; }
+	size_t FrameBytes() const { return m_cbFrame; }
+
+private:
+	unsigned char *Alloc()
+	{
+		unsigned char *pb = (unsigned char *)FrameAlloc(m_cbFrame);
+		if (pb != NULL)
+		{
+			memset(pb, 0x80, m_cbFrame);
+			m_Frames.push_back(pb);
+		}
+		return pb;
+	}
+
+	vector<unsigned char *> m_Frames;
+	size_t m_cbFrame;
+	ptrdiff_t m_lStride;
+};
+
+static string SizeName(const BenchSize &size)
+{
+	if (size.pszName != NULL)
+		return size.pszName;
+	char name[32];
+	sprintf(name, "%dx%d", size.nWidth, size.nHeight);
+	return name;
+}
+
+static BenchResult RunOne(CColorEngine *pEngine, CFrameWorkers *pWorkers, const CFrameSet &frames,
+	unsigned char *pbTarget, const BenchSize &size, const BenchSize &target, CFrameScaler *pScaler,
+	CFrameSharpen *pSharpen, CFramePipeline *pPipeline, ColorKernel kernel, bool bStats, double dMinTime,
+	CSliceClock *pClock, int nChangePercent, bool bKept, CFrameTrace *pTrace)
+{
+	bool bScaled = target.nWidth != size.nWidth || target.nHeight != size.nHeight;
+	pPipeline->Clear();
+	if (bScaled)
+		pPipeline->Add(pScaler);
+	if (pSharpen->Enabled())
+		pPipeline->Add(pSharpen);
+	CFrameStage *pStage = pPipeline->StageCount() > 0 ? pPipeline : NULL;
+
+	FrameStats stats;
+	FrameStats *pStats = bStats ? &stats : NULL;
+	ptrdiff_t lStrideOut = ((ptrdiff_t)target.nWidth * 2 + 3) & ~3;
+	FrameDesc dst = FrameLayout(pbTarget, FRAME_FORMAT_YUY2, target.nWidth, target.nHeight);
+	dst.lStride = lStrideOut;
+
+	// Warm up the tables, the page mappings and the worker threads
+	for (size_t i = 0; i < frames.Count(); i++)
+	{
+		FrameDesc src = FrameLayout(frames.Frame(i), FRAME_FORMAT_YUY2, size.nWidth, size.nHeight);
+		src.lStride = frames.Stride();
+		pEngine->ProcessStage(src, dst, pStage, kernel, pWorkers, pStats);
+	}
+
+	int nFrames = 0;
+	pClock->Reset();
+	double dStart = FrameSeconds();
+	double dElapsed = 0;
+	while (dElapsed < dMinTime || nFrames < 3)
+	{
+		// With reuse one frame, of which a band of rows moving down changes
+		unsigned char *pbSource = frames.Frame(nChangePercent >= 0 ? 0 : nFrames);
+		if (nChangePercent > 0)
+		{
+			int nRows = (int)((long long)size.nHeight * nChangePercent / 100);
+			for (int i = 0; i < nRows; i++)
+				pbSource[frames.Stride() * (((long long)nFrames * nRows + i) % size.nHeight)] ^= 1;
+		}
+		FrameDesc src = FrameLayout(pbSource, FRAME_FORMAT_YUY2, size.nWidth, size.nHeight);
+		src.lStride = frames.Stride();
+		pClock->StartFrame();
+		pTrace->Record(TRACE_FRAME_IN, nFrames);
+		pEngine->ProcessStage(src, dst, pStage, kernel, pWorkers, pStats);
+		pTrace->Record(TRACE_FRAME_OUT, nFrames);
+		pClock->EndFrame();
+		nFrames++;
+		dElapsed = FrameSeconds() - dStart;
+	}
+
+	// Source pixels; the bytes are the source read and the target written
+	double dPixels = (double)size.nWidth * size.nHeight * nFrames;
+	double dBytes = ((double)size.nWidth * size.nHeight + (double)target.nWidth * target.nHeight) * 2 * nFrames;
+
+	BenchResult r;
+	r.size = bScaled ? SizeName(size) + ">" + SizeName(target) : SizeName(size);
+	r.nWidth = size.nWidth;
+	r.nHeight = size.nHeight;
+	r.kernel = pEngine->HasCube() ? "cube" : CColorEngine::KernelName(kernel);
+	if (pEngine->Streaming(dst))
+		r.kernel += "+nt";
+	if (nChangePercent >= 0 && pStage == NULL && !bStats)
+		r.kernel += bKept ? "+kept" : "+reuse";
+	r.filter = bScaled ? ScaleFilterName(pScaler->GetFilter()) : "";
+	if (pSharpen->Enabled())
+	{
+		char name[32];
+		sprintf(name, "%s%s%d:%.2g", bScaled ? "+" : "", pSharpen->GetAmount() < 0 ? "blur" : "sharpen",
+			pSharpen->GetRadius(), pSharpen->GetAmount());
+		r.filter += name;
+	}
+	r.bStats = bStats;
+	r.nThreads = pWorkers->GetThreadCount();
+	r.nFrames = nFrames;
+	r.dSeconds = dElapsed;
+	r.dNsPerPixel = dElapsed * 1e9 / dPixels;
+	r.dGBps = dBytes / dElapsed / 1e9;
+	r.dFps = nFrames / dElapsed;
+	// Without slices the first rows are final with the whole frame
+	r.dFirstMs = pClock->AverageMs() > 0 ? pClock->AverageMs() : dElapsed * 1000 / nFrames;
+	return r;
+}
+
+static void PrintTable(const vector<BenchResult> &results)
+{
+	printf("%-14s %-14s %-9s %5s %7s %8s %10s %9s %10s %9s\n",
+		"size", "kernel", "filter", "stats", "threads", "frames", "ns/pixel", "GB/s", "frames/s", "first ms");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult &r = results[i];
+		printf("%-14s %-14s %-9s %5s %7d %8d %10.3f %9.2f %10.1f %9.3f\n",
+			r.size.c_str(), r.kernel.c_str(), r.filter.empty() ? "-" : r.filter.c_str(),
+			r.bStats ? "on" : "off", r.nThreads, r.nFrames,
+			r.dNsPerPixel, r.dGBps, r.dFps, r.dFirstMs);
+	}
+}
+
+static void PrintJson(const vector<BenchResult> &results, const char *pszInput)
+{
+	printf("{\n  \"tool\": \"fpbench\",\n  \"format\": \"YUY2\",\n");
+	printf("  \"source\": \"%s\",\n", pszInput ? pszInput : "synthetic");
+	printf("  \"cpus\": %d,\n  \"results\": [\n", FrameCpuCount());
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult &r = results[i];
+		printf("    { \"size\": \"%s\", \"width\": %d, \"height\": %d, \"kernel\": \"%s\", \"filter\": \"%s\", "
+			"\"stats\": %s, \"threads\": %d, \"frames\": %d, \"seconds\": %.6f, "
+			"\"ns_per_pixel\": %.4f, \"gb_per_s\": %.4f, \"fps\": %.3f, \"first_ms\": %.4f }%s\n",
+			r.size.c_str(), r.nWidth, r.nHeight, r.kernel.c_str(), r.filter.c_str(),
+			r.bStats ? "true" : "false", r.nThreads, r.nFrames,
+			r.dSeconds, r.dNsPerPixel, r.dGBps, r.dFps, r.dFirstMs,
+			i + 1 < results.size() ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	vector<BenchSize> sizes(g_Sizes, g_Sizes + g_nSizes);
+	vector<ColorKernel> kernels;
+	vector<int> threads;
+	double dMinTime = 0.5;
+	const char *pszInput = NULL;
+	bool bJson = false;
+	bool bStats = false;
+	int nStatsStep = 32;
+	const char *pszCube = NULL;
+	ColorSpace in = MakeColorSpace(COLOR_MATRIX_BT601, false);
+	ColorSpace out = in;
+	bool bOut = false;
+	BenchSize target = { NULL, 0, 0 };
+	CFrameScaler scaler;
+	CFrameSharpen sharpen;
+	CFramePipeline pipeline;
+	int levels[5] = { 140, 150, 120, 150, 160 };
+	bool bBlend = false;
+	FrameIsa isa = FrameIsaBest();
+	int nSliceRows = 0;
+	StreamMode stream = STREAM_AUTO;
+	int nPrefetchRows = 0;
+	int nChangePercent = -1;
+	bool bKept = false;
+	bool bMotion = false;
+	BenchSize overlaySize = { NULL, 0, 0 };
+	int nKeyOutput = -1;
+	CFramePreview preview;
+	bool bPreview = false;
+	bool bFingerprint = false;
+	const char *pszTrace = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool bHasValue = i + 1 < argc;
+		if ((arg == "-s" || arg == "--sizes") && bHasValue)
+		{
+			sizes.clear();
+			vector<string> items = Split(argv[++i]);
+			for (size_t k = 0; k < items.size(); k++)
+			{
+				BenchSize size;
+				if (!ParseSize(items[k], &size))
+				{
+					fprintf(stderr, "fpbench: unknown size '%s'\n", items[k].c_str());
+					return 2;
+				}
+				sizes.push_back(size);
+			}
+		}
+		else if ((arg == "-k" || arg == "--kernels") && bHasValue)
+		{
+			vector<string> items = Split(argv[++i]);
+			for (size_t k = 0; k < items.size(); k++)
+			{
+				ColorKernel kernel;
+				if (!ParseKernel(items[k], &kernel))
+				{
+					fprintf(stderr, "fpbench: unknown kernel '%s'\n", items[k].c_str());
+					return 2;
+				}
+				kernels.push_back(kernel);
+			}
+		}
+		else if ((arg == "-t" || arg == "--threads") && bHasValue)
+		{
+			vector<string> items = Split(argv[++i]);
+			for (size_t k = 0; k < items.size(); k++)
+				threads.push_back(atoi(items[k].c_str()));
+		}
+		else if ((arg == "-m" || arg == "--min-time") && bHasValue)
+		{
+			dMinTime = atof(argv[++i]);
+		}
+		else if ((arg == "-i" || arg == "--input") && bHasValue)
+		{
+			pszInput = argv[++i];
+		}
+		else if (arg == "-S" || arg == "--stats")
+		{
+			bStats = true;
+		}
+		else if (arg == "--stats-step" && bHasValue)
+		{
+			nStatsStep = atoi(argv[++i]);
+		}
+		else if ((arg == "-c" || arg == "--cube") && bHasValue)
+		{
+			pszCube = argv[++i];
+		}
+		else if (arg == "--in" && bHasValue && ColorSpaceFromName(argv[i + 1], &in))
+		{
+			i++;
+		}
+		else if (arg == "--out" && bHasValue && ColorSpaceFromName(argv[i + 1], &out))
+		{
+			i++;
+			bOut = true;
+		}
+		else if ((arg == "-z" || arg == "--scale-to") && bHasValue && ParseSize(argv[i + 1], &target))
+		{
+			i++;
+		}
+		else if (arg == "--filter" && bHasValue)
+		{
+			ScaleFilter filter;
+			if (!ScaleFilterFromName(argv[++i], &filter))
+			{
+				fprintf(stderr, "fpbench: unknown filter '%s'\n", argv[i]);
+				return 2;
+			}
+			scaler.SetFilter(filter);
+		}
+		else if (arg == "--sharpen" && bHasValue)
+		{
+			const char *psz = argv[++i];
+			const char *pszAmount = strchr(psz, ':');
+			sharpen.SetParameters(atoi(psz), pszAmount ? atof(pszAmount + 1) : 1.0);
+		}
+		else if (arg == "--blur" && bHasValue)
+		{
+			sharpen.SetParameters(atoi(argv[++i]), -1.0);
+		}
+		else if (arg == "--tile-rows" && bHasValue)
+		{
+			pipeline.SetTileRows(atoi(argv[++i]));
+		}
+		else if (arg == "--levels" && bHasValue)
+		{
+			vector<string> items = Split(argv[++i]);
+			if (items.size() != 5)
+			{
+				fprintf(stderr, "fpbench: --levels needs five values\n");
+				return 2;
+			}
+			for (int k = 0; k < 5; k++)
+				levels[k] = atoi(items[k].c_str()) & 255;
+		}
+		else if (arg == "--blend")
+		{
+			bBlend = true;
+		}
+		else if (arg == "--isa" && bHasValue)
+		{
+			string name = argv[++i];
+			if (name == FrameIsaName(FRAME_ISA_SCALAR))
+				isa = FRAME_ISA_SCALAR;
+			else if (name == FrameIsaName(FRAME_ISA_SSE2) && FrameIsaBest() >= FRAME_ISA_SSE2)
+				isa = FRAME_ISA_SSE2;
+			else
+			{
+				fprintf(stderr, "fpbench: instruction set '%s' is not built\n", name.c_str());
+				return 2;
+			}
+		}
+		else if (arg == "--slices" && bHasValue)
+		{
+			nSliceRows = atoi(argv[++i]);
+		}
+		else if (arg == "--stream" && bHasValue)
+		{
+			string mode = argv[++i];
+			if (mode == "on")
+				stream = STREAM_ON;
+			else if (mode == "off")
+				stream = STREAM_OFF;
+			else if (mode == "auto")
+				stream = STREAM_AUTO;
+			else
+			{
+				fprintf(stderr, "fpbench: --stream takes auto, on or off\n");
+				return 2;
+			}
+		}
+		else if (arg == "--prefetch" && bHasValue)
+		{
+			nPrefetchRows = atoi(argv[++i]);
+		}
+		else if (arg == "--reuse" && bHasValue)
+		{
+			nChangePercent = atoi(argv[++i]);
+			if (nChangePercent < 0 || nChangePercent > 100)
+			{
+				fprintf(stderr, "fpbench: --reuse takes a percentage\n");
+				return 2;
+			}
+		}
+		else if (arg == "--kept")
+		{
+			bKept = true;
+		}
+		else if (arg == "--motion")
+		{
+			bMotion = true;
+		}
+		else if (arg == "--overlay" && bHasValue && ParseSize(argv[i + 1], &overlaySize))
+		{
+			i++;
+		}
+		else if (arg == "--key" && bHasValue)
+		{
+			string mode = argv[++i];
+			if (mode == "composite")
+				nKeyOutput = KEY_COMPOSITE;
+			else if (mode == "matte")
+				nKeyOutput = KEY_MATTE;
+			else
+			{
+				fprintf(stderr, "fpbench: --key takes composite or matte\n");
+				return 2;
+			}
+		}
+		else if (arg == "--preview" && bHasValue)
+		{
+			if (!preview.SetFactor(atoi(argv[++i])))
+			{
+				fprintf(stderr, "fpbench: --preview takes 2, 4 or 8\n");
+				return 2;
+			}
+			bPreview = true;
+		}
+		else if (arg == "--fingerprint")
+		{
+			bFingerprint = true;
+		}
+		else if (arg == "--trace" && bHasValue)
+		{
+			pszTrace = argv[++i];
+		}
+		else if (arg == "-j" || arg == "--json")
+		{
+			bJson = true;
+		}
+		else
+		{
+			Usage();
+			return arg == "-h" || arg == "--help" ? 0 : 2;
+		}
+	}
+
+	if (pszInput != NULL && sizes.size() != 1)
+	{
+		fprintf(stderr, "fpbench: --input needs exactly one --sizes entry\n");
+		return 2;
+	}
+	if (kernels.empty())
+	{
+		for (int k = 0; k < KERNEL_COUNT; k++)
+			kernels.push_back((ColorKernel)k);
+	}
+	if (threads.empty())
+	{
+		int nCpus = FrameCpuCount();
+		for (int n = 1; n < nCpus; n *= 2)
+			threads.push_back(n);
+		threads.push_back(nCpus);
+	}
+
+	CColorEngine engine;
+	engine.SetColorSpaces(in, bOut ? out : in);
+	engine.UpdateLuma((unsigned char)levels[0], (unsigned char)levels[1], (unsigned char)levels[2]);
+	engine.UpdateChroma((unsigned char)levels[3], (unsigned char)levels[4]);
+	engine.SetStatsRowStep(nStatsStep);
+	engine.SetIsa(isa);
+	CSliceClock clock;
+	engine.SetSlices(nSliceRows, &clock);
+	engine.SetStreaming(stream, nPrefetchRows);
+	CFrameReuse reuse;
+	reuse.SetTargetsKept(bKept);
+	engine.SetReuse(nChangePercent >= 0 ? &reuse : NULL);
+	CFrameMotion motion;
+	engine.SetMotion(bMotion ? &motion : NULL);
+	CFrameOverlay overlay;
+	engine.SetOverlay(overlaySize.nWidth > 0 ? &overlay : NULL);
+	CFrameKey key;
+	key.SetKey(0, 255, 0, 40, 30);
+	key.SetEnabled(nKeyOutput >= 0);
+	key.SetOutput(nKeyOutput == KEY_MATTE ? KEY_MATTE : KEY_COMPOSITE);
+	engine.SetKey(nKeyOutput >= 0 ? &key : NULL);
+	engine.SetPreview(bPreview ? &preview : NULL);
+	CFrameFingerprint fingerprint;
+	engine.SetFingerprint(bFingerprint ? &fingerprint : NULL);
+	CFrameTrace trace;
+	trace.SetEnabled(pszTrace != NULL);
+	engine.SetTrace(&trace);
+	if (pszCube != NULL)
+	{
+		CColorCube cube;
+		int nSize = atoi(pszCube);
+		if (nSize >= 2)
+			cube.Identity(nSize);
+		else if (!cube.Load(pszCube))
+		{
+			fprintf(stderr, "fpbench: %s: %s\n", pszCube, cube.Error());
+			return 1;
+		}
+		engine.SetCube(cube, true);
+		// Every kernel takes the cube path, so one of them is enough
+		kernels.assign(1, KERNEL_DIRECT);
+	}
+	CFrameWorkers workers;
+
+	vector<BenchResult> results;
+	for (size_t s = 0; s < sizes.size(); s++)
+	{
+		CFrameSet frames;
+		if (!frames.Create(sizes[s].nWidth, sizes[s].nHeight, pszInput))
+			return 1;
+		BenchSize out = target.nWidth > 0 ? target : sizes[s];
+		ptrdiff_t lStrideOut = ((ptrdiff_t)out.nWidth * 2 + 3) & ~3;
+		unsigned char *pbTarget = (unsigned char *)FrameAlloc((size_t)lStrideOut * out.nHeight);
+		unsigned char *pbBlend = bBlend ? (unsigned char *)FrameAlloc((size_t)lStrideOut * out.nHeight) : NULL;
+		bool bBackground = nKeyOutput == KEY_COMPOSITE;
+		unsigned char *pbBackground = bBackground ? (unsigned char *)FrameAlloc((size_t)lStrideOut * out.nHeight) : NULL;
+		if (pbTarget == NULL || (bBlend && pbBlend == NULL) || (bBackground && pbBackground == NULL))
+		{
+			fprintf(stderr, "fpbench: out of memory\n");
+			return 1;
+		}
+		if (bBlend)
+		{
+			memset(pbBlend, 0x60, (size_t)lStrideOut * out.nHeight);
+			FrameDesc blend = FrameLayout(pbBlend, FRAME_FORMAT_YUY2, out.nWidth, out.nHeight);
+			blend.lStride = lStrideOut;
+			engine.SetBlend(&blend);
+		}
+		if (bBackground)
+		{
+			memset(pbBackground, 0x70, (size_t)lStrideOut * out.nHeight);
+			FrameDesc background = FrameLayout(pbBackground, FRAME_FORMAT_YUY2, out.nWidth, out.nHeight);
+			background.lStride = lStrideOut;
+			key.SetBackgroundFrame(&background);
+		}
+		if (overlaySize.nWidth > 0)
+		{
+			// Opaque in the middle, fading out towards the edges
+			vector<unsigned char> bgra((size_t)overlaySize.nWidth * overlaySize.nHeight * 4);
+			for (int y = 0; y < overlaySize.nHeight; y++)
+			{
+				for (int x = 0; x < overlaySize.nWidth; x++)
+				{
+					unsigned char *pb = &bgra[((size_t)overlaySize.nWidth * y + x) * 4];
+					int nEdge = min(min(x, overlaySize.nWidth - 1 - x), min(y, overlaySize.nHeight - 1 - y));
+					pb[0] = (unsigned char)x;
+					pb[1] = (unsigned char)y;
+					pb[2] = 200;
+					pb[3] = (unsigned char)min(255, nEdge * 16);
+				}
+			}
+			overlay.SetLayer(0, &bgra[0], overlaySize.nWidth * 4, overlaySize.nWidth, overlaySize.nHeight,
+				out.nWidth - overlaySize.nWidth, out.nHeight - overlaySize.nHeight);
+		}
+
+		for (size_t t = 0; t < threads.size(); t++)
+		{
+			workers.SetThreadCount(threads[t]);
+			for (size_t k = 0; k < kernels.size(); k++)
+			{
+				for (int st = 0; st <= (bStats ? 1 : 0); st++)
+				{
+					results.push_back(RunOne(&engine, &workers, frames, pbTarget,
+						sizes[s], out, &scaler, &sharpen, &pipeline, kernels[k], st != 0, dMinTime, &clock, nChangePercent, bKept, &trace));
+					if (!bJson)
+					{
+						fprintf(stderr, "\r%u/%u", (unsigned)results.size(),
+							(unsigned)(sizes.size() * threads.size() * kernels.size() * (bStats ? 2 : 1)));
+					}
+				}
+			}
+		}
+		engine.SetBlend(NULL);
+		key.SetBackgroundFrame(NULL);
+		FrameFree(pbBackground);
+		FrameFree(pbBlend);
+		FrameFree(pbTarget);
+	}
+	if (!bJson)
+		fprintf(stderr, "\r");
+
+	if (bJson)
+		PrintJson(results, pszInput);
+	else
+		PrintTable(results);
+
+	if (pszTrace != NULL)
+	{
+		FILE *pFile = fopen(pszTrace, "wb");
+		bool bSaved = pFile != NULL && trace.Save(pFile);
+		if (pFile != NULL)
+			fclose(pFile);
+		if (!bSaved)
+		{
+			fprintf(stderr, "fpbench: cannot write %s\n", pszTrace);
+			return 1;
+		}
+	}
+	return 0;
+}
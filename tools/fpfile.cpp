@@ -0,0 +1,469 @@
+//
+// fpfile - offline file-to-file processing of raw video and .y4m clips
+//
+// Raw files: memory-maps a YUY2, UYVY or planar file, runs the colour
+// engine straight from the mapped pages and writes the result either into
+// a mapped output file or through an O_DIRECT writer.
+//
+// .y4m clips: a reader thread, the processing stage and a writer thread
+// overlap, handing frames to each other through queues backed by a fixed
+// pool of buffers (--queue), so memory use does not grow with the clip.
+//
+// Every frame is split into row bands across the worker threads.
+//
+// With --auto-levels the luma histogram of each frame drives the levels of
+// the next one, as in the filter. The analysis runs inline here so that the
+// output does not depend on thread timing.
+//
+// With --cube the frames are graded through a .cube 3D LUT instead of the
+// levels, or after them with --bake.
+//
+// With --scale the frames are resized in the same pass as the colour
+// transform. A .y4m pipeline buffer then holds the source frame followed
+// by the scaled one.
+//
+// --sharpen and --blur run an unsharp mask over luma in the same pass. It
+// reads rows around the one it writes, so .y4m frames get a separate
+// output there too. A resize and a mask run together as a tiled pipeline.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "../ColorEngine.h"
+#include "../AutoLevels.h"
+#include "../FrameScaler.h"
+#include "../FrameSharpen.h"
+#include "../FramePipeline.h"
+#include "RawVideoIO.h"
+#include "Y4MStream.h"
+#include "FrameQueue.h"
+
+using namespace std;
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: fpfile -i INPUT -o OUTPUT -s WxH [options]\n"
+		"       fpfile -i INPUT.y4m -o OUTPUT.y4m [options]\n"
+		"  -f, --format FMT     yuy2, uyvy, i420, i422 or i444 (default: yuy2)\n"
+		"  -b, --brightness N   0..255 (default: 127)\n"
+		"  -c, --contrast N     0..255 (default: 127)\n"
+		"  -u, --hue N          0..255 (default: 127)\n"
+		"  -a, --saturation N   0..255 (default: 127)\n"
+		"  -g, --gamma N        0..255 (default: 127)\n"
+		"  -A, --auto-levels    derive the levels from the previous frames (ignores -b and -c)\n"
+		"      --smoothing N    frames the auto levels take to settle (default: 15)\n"
+		"      --cube FILE      grade through a .cube 3D LUT instead of the levels\n"
+		"      --bake           apply the levels in front of the cube\n"
+		"      --in SPACE       input encoding: 601, 709 or 2020[:full|:limited] (default: 601)\n"
+		"      --out SPACE      convert to this encoding (default: same as --in)\n"
+		"      --scale WxH      resize the frames to WxH\n"
+		"      --filter NAME    bilinear, bicubic or lanczos (default: bicubic)\n"
+		"      --sharpen R[:A]  unsharp mask of radius R and amount A (default: 1) on luma\n"
+		"      --blur R         Gaussian blur of radius R on luma\n"
+		"  -t, --threads N      worker threads (default: CPU count)\n"
+		"  -n, --frames N       stop after N frames\n"
+		"  -d, --direct         write with O_DIRECT instead of a mapped output file\n"
+		"      --queue N        frame buffers in flight for .y4m (default: 4)\n"
+		"  -q, --quiet          no summary\n");
+}
+
+static bool IsY4M(const char *pszPath)
+{
+	size_t cch = strlen(pszPath);
+	return cch > 4 && strcmp(pszPath + cch - 4, ".y4m") == 0;
+}
+
+//
+// Y4M pipeline
+//
+struct Y4MPipeline
+{
+	CY4MReader *pReader;
+	CY4MWriter *pWriter;
+	CFrameQueue free;       // Empty buffers, for the reader
+	CFrameQueue filled;     // Read, waiting for processing
+	CFrameQueue processed;  // Processed, waiting for the writer
+	size_t cbOutput;        // Offset of the processed frame in each buffer
+	long long nMaxFrames;
+	bool bWriteError;
+};
+
+static void Y4MReaderProc(void *pv)
+{
+	Y4MPipeline *pPipe = (Y4MPipeline *)pv;
+	for (long long n = 0; pPipe->nMaxFrames < 0 || n < pPipe->nMaxFrames; n++)
+	{
+		PipelineFrame *pFrame = pPipe->free.Pop();
+		if (pFrame == NULL)
+			break;
+		if (!pPipe->pReader->ReadFrame(pFrame->pb))
+		{
+			pPipe->free.Push(pFrame);
+			break;
+		}
+		pFrame->nIndex = n;
+		pPipe->filled.Push(pFrame);
+	}
+	pPipe->filled.Close();
+}
+
+static void Y4MWriterProc(void *pv)
+{
+	Y4MPipeline *pPipe = (Y4MPipeline *)pv;
+	PipelineFrame *pFrame;
+	while ((pFrame = pPipe->processed.Pop()) != NULL)
+	{
+		// After an error keep draining so that the other stages finish
+		if (!pPipe->bWriteError && !pPipe->pWriter->WriteFrame(pFrame->pb + pPipe->cbOutput))
+		{
+			fprintf(stderr, "fpfile: write failed at frame %lld\n", pFrame->nIndex);
+			pPipe->bWriteError = true;
+		}
+		pPipe->free.Push(pFrame);
+	}
+}
+
+// The stages in front of the colour kernels, or NULL when there are none
+static CFrameStage *BuildStages(CFramePipeline *pPipeline, CFrameScaler *pScaler, CFrameSharpen *pSharpen,
+	bool bScaled)
+{
+	pPipeline->Clear();
+	if (bScaled)
+		pPipeline->Add(pScaler);
+	if (pSharpen->Enabled())
+		pPipeline->Add(pSharpen);
+	return pPipeline->StageCount() > 0 ? pPipeline : NULL;
+}
+
+static void ProcessFrame(CColorEngine *pEngine, CFrameWorkers *pWorkers, CAutoLevels *pAuto,
+	CFrameStage *pStage, const FrameDesc &src, const FrameDesc &dst)
+{
+	FrameStats stats;
+	FrameStats *pStats = pAuto != NULL ? &stats : NULL;
+	pEngine->ProcessStage(src, dst, pStage, KERNEL_DIRECT, pWorkers, pStats);
+	if (pAuto != NULL)
+		pAuto->Analyse(stats.LumaIn);
+}
+
+static int RunY4M(const char *pszInput, const char *pszOutput, CColorEngine *pEngine,
+	CFrameWorkers *pWorkers, CAutoLevels *pAuto, CFramePipeline *pPipeline, CFrameScaler *pScaler,
+	CFrameSharpen *pSharpen, int nScaleWidth, int nScaleHeight, int nBuffers, long long nMaxFrames, bool bQuiet)
+{
+	CY4MReader reader;
+	if (!reader.Open(pszInput))
+		return 1;
+	const Y4MHeader &header = reader.Header();
+	Y4MHeader outHeader = header;
+	if (nScaleWidth > 0)
+	{
+		outHeader.nWidth = nScaleWidth;
+		outHeader.nHeight = nScaleHeight;
+	}
+	bool bScaled = outHeader.nWidth != header.nWidth || outHeader.nHeight != header.nHeight;
+	CFrameStage *pStage = BuildStages(pPipeline, pScaler, pSharpen, bScaled);
+	bool bSeparate = pStage != NULL;
+	CY4MWriter writer;
+	if (!writer.Open(pszOutput, outHeader))
+		return 1;
+
+	if (nBuffers < 3)
+		nBuffers = 3;
+	size_t cbFrame = reader.FrameBytes();
+	size_t cbOutFrame = FrameBytes(header.format, outHeader.nWidth, outHeader.nHeight);
+	size_t cbBuffer = bSeparate ? cbFrame + cbOutFrame : cbFrame;
+	PipelineFrame *pFrames = new PipelineFrame[nBuffers];
+	Y4MPipeline pipe;
+	pipe.pReader = &reader;
+	pipe.pWriter = &writer;
+	pipe.cbOutput = bSeparate ? cbFrame : 0;
+	pipe.nMaxFrames = nMaxFrames;
+	pipe.bWriteError = false;
+	for (int i = 0; i < nBuffers; i++)
+	{
+		pFrames[i].pb = (unsigned char *)FrameAlloc(cbBuffer);
+		pFrames[i].nIndex = -1;
+		if (pFrames[i].pb == NULL)
+		{
+			fprintf(stderr, "fpfile: out of memory\n");
+			return 1;
+		}
+		pipe.free.Push(&pFrames[i]);
+	}
+
+	double dStart = FrameSeconds();
+	CFrameThread readerThread, writerThread;
+	readerThread.Start(Y4MReaderProc, &pipe);
+	writerThread.Start(Y4MWriterProc, &pipe);
+
+	// The processing stage runs on this thread and its worker pool. The
+	// kernels read each sample before they write it, so frames are
+	// transformed in place unless they are scaled or sharpened.
+	long long nFrames = 0;
+	PipelineFrame *pFrame;
+	while ((pFrame = pipe.filled.Pop()) != NULL)
+	{
+		FrameDesc frame = FrameLayout(pFrame->pb, header.format, header.nWidth, header.nHeight);
+		FrameDesc target = FrameLayout(pFrame->pb + pipe.cbOutput, header.format, outHeader.nWidth, outHeader.nHeight);
+		ProcessFrame(pEngine, pWorkers, pAuto, pStage, frame, target);
+		pipe.processed.Push(pFrame);
+		nFrames++;
+	}
+	pipe.processed.Close();
+	readerThread.Join();
+	writerThread.Join();
+	pipe.free.Close();
+
+	bool bOk = writer.Close() && !pipe.bWriteError && !reader.Failed();
+	double dElapsed = FrameSeconds() - dStart;
+
+	for (int i = 0; i < nBuffers; i++)
+		FrameFree(pFrames[i].pb);
+	delete [] pFrames;
+
+	if (!bQuiet)
+	{
+		double dBytes = (double)nFrames * (cbFrame + cbOutFrame);
+		printf("%lld frames %dx%d %s (y4m), %d threads, %d buffers (%.1f MB): %.3f s, %.1f frames/s, %.2f GB/s\n",
+			nFrames, header.nWidth, header.nHeight, FrameFormatName(header.format),
+			pWorkers->GetThreadCount(), nBuffers, nBuffers * (double)cbBuffer / (1 << 20), dElapsed,
+			dElapsed > 0 ? nFrames / dElapsed : 0.0,
+			dElapsed > 0 ? dBytes / dElapsed / 1e9 : 0.0);
+	}
+	return bOk ? 0 : 1;
+}
+
+static bool ParseLevel(const char *psz, unsigned char *pLevel)
+{
+	int n = atoi(psz);
+	if (n < 0 || n > 255)
+		return false;
+	*pLevel = (unsigned char)n;
+	return true;
+}
+
+static bool ParseSize(const char *psz, int *pWidth, int *pHeight)
+{
+	return sscanf(psz, "%dx%d", pWidth, pHeight) == 2 &&
+		*pWidth > 0 && *pWidth <= g_FrameMaxSize && *pHeight > 0 && *pHeight <= g_FrameMaxSize;
+}
+
+int main(int argc, char **argv)
+{
+	const char *pszInput = NULL;
+	const char *pszOutput = NULL;
+	int nWidth = 0, nHeight = 0;
+	FrameFormat format = FRAME_FORMAT_YUY2;
+	unsigned char Brightness = 127, Contrast = 127, Hue = 127, Saturation = 127, Gamma = 127;
+	int nThreads = FrameCpuCount();
+	long long nMaxFrames = -1;
+	bool bDirect = false;
+	bool bQuiet = false;
+	int nBuffers = 4;
+	bool bAutoLevels = false;
+	int nSmoothing = 15;
+	const char *pszCube = NULL;
+	bool bBake = false;
+	ColorSpace in = MakeColorSpace(COLOR_MATRIX_BT601, false);
+	ColorSpace out = in;
+	bool bOut = false;
+	int nScaleWidth = 0, nScaleHeight = 0;
+	CFrameScaler scaler;
+	CFrameSharpen sharpen;
+	CFramePipeline pipeline;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool bHasValue = i + 1 < argc;
+		bool bOk = true;
+		if ((arg == "-i" || arg == "--input") && bHasValue)
+			pszInput = argv[++i];
+		else if ((arg == "-o" || arg == "--output") && bHasValue)
+			pszOutput = argv[++i];
+		else if ((arg == "-s" || arg == "--size") && bHasValue)
+			bOk = ParseSize(argv[++i], &nWidth, &nHeight);
+		else if ((arg == "-f" || arg == "--format") && bHasValue)
+			bOk = FrameFormatFromName(argv[++i], &format);
+		else if ((arg == "-b" || arg == "--brightness") && bHasValue)
+			bOk = ParseLevel(argv[++i], &Brightness);
+		else if ((arg == "-c" || arg == "--contrast") && bHasValue)
+			bOk = ParseLevel(argv[++i], &Contrast);
+		else if ((arg == "-u" || arg == "--hue") && bHasValue)
+			bOk = ParseLevel(argv[++i], &Hue);
+		else if ((arg == "-a" || arg == "--saturation") && bHasValue)
+			bOk = ParseLevel(argv[++i], &Saturation);
+		else if ((arg == "-g" || arg == "--gamma") && bHasValue)
+			bOk = ParseLevel(argv[++i], &Gamma);
+		else if (arg == "-A" || arg == "--auto-levels")
+			bAutoLevels = true;
+		else if (arg == "--smoothing" && bHasValue)
+			bOk = (nSmoothing = atoi(argv[++i])) > 0;
+		else if (arg == "--cube" && bHasValue)
+			pszCube = argv[++i];
+		else if (arg == "--bake")
+			bBake = true;
+		else if (arg == "--in" && bHasValue)
+			bOk = ColorSpaceFromName(argv[++i], &in);
+		else if (arg == "--out" && bHasValue)
+			bOk = bOut = ColorSpaceFromName(argv[++i], &out);
+		else if (arg == "--scale" && bHasValue)
+			bOk = ParseSize(argv[++i], &nScaleWidth, &nScaleHeight);
+		else if (arg == "--filter" && bHasValue)
+		{
+			ScaleFilter filter;
+			bOk = ScaleFilterFromName(argv[++i], &filter);
+			scaler.SetFilter(filter);
+		}
+		else if (arg == "--sharpen" && bHasValue)
+		{
+			const char *psz = argv[++i];
+			const char *pszAmount = strchr(psz, ':');
+			sharpen.SetParameters(atoi(psz), pszAmount ? atof(pszAmount + 1) : 1.0);
+			bOk = atoi(psz) > 0;
+		}
+		else if (arg == "--blur" && bHasValue)
+		{
+			sharpen.SetParameters(atoi(argv[++i]), -1.0);
+			bOk = atoi(argv[i]) > 0;
+		}
+		else if ((arg == "-t" || arg == "--threads") && bHasValue)
+			nThreads = atoi(argv[++i]);
+		else if ((arg == "-n" || arg == "--frames") && bHasValue)
+			nMaxFrames = atoll(argv[++i]);
+		else if (arg == "-d" || arg == "--direct")
+			bDirect = true;
+		else if (arg == "-q" || arg == "--quiet")
+			bQuiet = true;
+		else if (arg == "--queue" && bHasValue)
+			nBuffers = atoi(argv[++i]);
+		else
+			bOk = false;
+
+		if (!bOk)
+		{
+			fprintf(stderr, "fpfile: bad argument '%s'\n", argv[i]);
+			Usage();
+			return 2;
+		}
+	}
+	if (pszInput == NULL || pszOutput == NULL)
+	{
+		Usage();
+		return 2;
+	}
+
+	CColorEngine engine;
+	engine.SetColorSpaces(in, bOut ? out : in);
+	engine.UpdateLuma(Brightness, Contrast, Gamma);
+	engine.UpdateChroma(Hue, Saturation);
+	if (pszCube != NULL)
+	{
+		CColorCube cube;
+		if (!cube.Load(pszCube))
+		{
+			fprintf(stderr, "fpfile: %s: %s\n", pszCube, cube.Error());
+			return 1;
+		}
+		engine.SetCube(cube, bBake);
+	}
+	CFrameWorkers workers;
+	workers.SetThreadCount(nThreads);
+
+	CAutoLevels autoLevels;
+	CAutoLevels *pAuto = NULL;
+	if (bAutoLevels)
+	{
+		autoLevels.SetGamma(Gamma);
+		autoLevels.SetSmoothing(nSmoothing);
+		engine.SetLumaCurve(autoLevels.Curve());
+		pAuto = &autoLevels;
+	}
+
+	if (IsY4M(pszInput))
+	{
+		if (!IsY4M(pszOutput))
+		{
+			fprintf(stderr, "fpfile: a .y4m input needs a .y4m output\n");
+			return 2;
+		}
+		return RunY4M(pszInput, pszOutput, &engine, &workers, pAuto, &pipeline, &scaler, &sharpen, nScaleWidth, nScaleHeight,
+			nBuffers, nMaxFrames, bQuiet);
+	}
+	if (nWidth == 0)
+	{
+		Usage();
+		return 2;
+	}
+
+	CMappedFile input;
+	if (!input.OpenRead(pszInput))
+		return 1;
+
+	size_t cbFrame = FrameBytes(format, nWidth, nHeight);
+	int nOutWidth = nScaleWidth > 0 ? nScaleWidth : nWidth;
+	int nOutHeight = nScaleWidth > 0 ? nScaleHeight : nHeight;
+	size_t cbOutFrame = FrameBytes(format, nOutWidth, nOutHeight);
+	CFrameStage *pStage = BuildStages(&pipeline, &scaler, &sharpen, nOutWidth != nWidth || nOutHeight != nHeight);
+	long long nFrames = (long long)(input.Size() / cbFrame);
+	if (nMaxFrames >= 0 && nMaxFrames < nFrames)
+		nFrames = nMaxFrames;
+	if (input.Size() % cbFrame != 0 && nMaxFrames < 0)
+	{
+		fprintf(stderr, "fpfile: warning: %s ends with a partial frame, ignored\n", pszInput);
+	}
+
+	double dStart = FrameSeconds();
+	bool bOk = true;
+
+	if (bDirect)
+	{
+		CDirectWriter writer;
+		if (!writer.Open(pszOutput, cbOutFrame))
+			return 1;
+		if (!writer.DirectIO() && !bQuiet)
+			fprintf(stderr, "fpfile: O_DIRECT not supported for %s, using buffered writes\n", pszOutput);
+
+		for (long long f = 0; f < nFrames; f++)
+		{
+			size_t cbOffset = (size_t)f * cbFrame;
+			FrameDesc src = FrameLayout(input.Data() + cbOffset, format, nWidth, nHeight);
+			FrameDesc dst = FrameLayout(writer.Reserve(cbOutFrame), format, nOutWidth, nOutHeight);
+			ProcessFrame(&engine, &workers, pAuto, pStage, src, dst);
+			writer.Commit(cbOutFrame);
+			input.Release(cbOffset, cbFrame);
+		}
+		bOk = writer.Close();
+	}
+	else
+	{
+		CMappedFile output;
+		if (!output.Create(pszOutput, (size_t)nFrames * cbOutFrame))
+			return 1;
+
+		for (long long f = 0; f < nFrames; f++)
+		{
+			size_t cbOffset = (size_t)f * cbFrame;
+			size_t cbOutOffset = (size_t)f * cbOutFrame;
+			FrameDesc src = FrameLayout(input.Data() + cbOffset, format, nWidth, nHeight);
+			FrameDesc dst = FrameLayout(output.Data() + cbOutOffset, format, nOutWidth, nOutHeight);
+			ProcessFrame(&engine, &workers, pAuto, pStage, src, dst);
+			input.Release(cbOffset, cbFrame);
+			output.Release(cbOutOffset, cbOutFrame);
+		}
+		output.Close();
+	}
+
+	double dElapsed = FrameSeconds() - dStart;
+	if (!bQuiet)
+	{
+		double dBytes = (double)nFrames * (cbFrame + cbOutFrame);
+		printf("%lld frames %dx%d %s, %d threads, %s: %.3f s, %.1f frames/s, %.2f GB/s\n",
+			nFrames, nWidth, nHeight, FrameFormatName(format), workers.GetThreadCount(),
+			bDirect ? "O_DIRECT" : "mmap", dElapsed,
+			dElapsed > 0 ? nFrames / dElapsed : 0.0,
+			dElapsed > 0 ? dBytes / dElapsed / 1e9 : 0.0);
+	}
+	return bOk ? 0 : 1;
+}
@@ -0,0 +1,1703 @@
+//
+// fphost - the filter's transform path without a DirectShow runtime
+//
+// Builds CFrameProcessFilter against the headless base classes in
+// tools/headless and plays the rest of the graph around it: a source with
+// an allocator of its own upstream, a renderer downstream and, when asked
+// for, a second renderer on the preview pin. A script connects the pins,
+// changes formats and parameters and pushes frames through
+// IMemInputPin::Receive() as a graph would, so that Receive(),
+// InitializeOutputSample(), Transform(), DecideBufferSize() and
+// SetMediaType() of the filter run as they do in a graph. Every call of an
+// entry point is timed, and every run of frames reports per frame
+//
+//   buffers  output samples the filter took from the renderers' allocators
+//   allocs   heap allocations (new and CoTaskMemAlloc) while receiving it
+//   copies   bytes the filter moved with CopyMemory, in output frames
+//
+// Along the way it checks that every frame arrives with the length of the
+// renderer's type, that the filter takes up each format change, gives back
+// every buffer and every reference it took, and, after "check copy", that
+// the output frames are the input frames, up to the frame g_GhostFrame the
+// filter starts blending with. The exit status is non-zero when a check
+// failed.
+//
+// Script, one command per line; # starts a comment:
+//
+//   input WxH [vih2] [stride N]   (re)connect the source with this type,
+//                                 N pixels from one row to the next
+//   output [WxH] [stride N] [slices]
+//                                 (re)connect the renderer, with the filter's
+//                                 type or this one; "slices" makes its pin
+//                                 take IFrameSliceCallback
+//   preview on|off                connect or disconnect the preview renderer
+//   run, stop                     start and stop streaming
+//   frames N                      push N frames
+//   set NAME VALUE                change a parameter (fphost -h lists them)
+//   hold NAME VALUE               the renderer holds the next frame in
+//                                 Receive, as a paused one does, while
+//                                 another thread changes the parameter;
+//                                 the setter must not wait for the frame
+//   format in WxH                 the source's next sample brings this type
+//   format out WxH [stride N]     the renderer's next buffer brings this type
+//   quality MS                    the renderer reports frames MS late
+//   flush, eos                    a flush, the end of the stream
+//   check copy|off                compare the output frames with the input
+//
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../FrameProcessFilter.h"
+
+using namespace std;
+
+//
+// Heap allocations of the process, counted while frames are received
+//
+static volatile long long g_nHeapAllocs = 0;
+
+void *operator new(size_t cb)
+{
+	__sync_fetch_and_add(&g_nHeapAllocs, 1);
+	void *pv = malloc(cb != 0 ? cb : 1);
+	if (pv == NULL)
+		throw std::bad_alloc();
+	return pv;
+}
+
+void *operator new[](size_t cb)
+{
+	return operator new(cb);
+}
+
+void operator delete(void *pv) throw()
+{
+	free(pv);
+}
+
+void operator delete[](void *pv) throw()
+{
+	free(pv);
+}
+
+static long long g_nHostAllocs = 0;   // The ones the harness made for itself
+
+static long long Allocations()
+{
+	return g_nHeapAllocs + g_Headless.nTaskAllocs - g_nHostAllocs;
+}
+
+//
+// Failures of the checks
+//
+static int g_nFailures = 0;
+static string g_Where;        // Script line being run
+
+static void Fail(const char *pszFormat, ...) __attribute__((format(printf, 1, 2)));
+static void Fail(const char *pszFormat, ...)
+{
+	g_nFailures++;
+	fprintf(stderr, "FAILED: %s: ", g_Where.c_str());
+	va_list args;
+	va_start(args, pszFormat);
+	vfprintf(stderr, pszFormat, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+}
+
+static bool Check(HRESULT hr, const char *pszCall)
+{
+	if (SUCCEEDED(hr))
+		return true;
+	Fail("%s returned 0x%08x", pszCall, (unsigned int)hr);
+	return false;
+}
+
+//
+// Call times of the entry points
+//
+class CHostTimings
+{
+public:
+	void Add(const char *pszName, double dMicroseconds)
+	{
+		long long nStart = g_nHeapAllocs;
+		string name = pszName;
+		if (m_Calls.find(name) == m_Calls.end())
+			m_Order.push_back(name);
+		m_Calls[name].push_back(dMicroseconds);
+		g_nHostAllocs += g_nHeapAllocs - nStart;
+	}
+
+	void Print() const
+	{
+		printf("%-24s %7s %10s %10s %10s  (us)\n", "entry point", "calls", "median", "p99", "max");
+		for (size_t i = 0; i < m_Order.size(); i++)
+		{
+			vector<double> v = m_Calls.find(m_Order[i])->second;
+			sort(v.begin(), v.end());
+			printf("%-24s %7d %10.1f %10.1f %10.1f\n", m_Order[i].c_str(), (int)v.size(),
+				Percentile(v, 50), Percentile(v, 99), v.back());
+		}
+	}
+
+	// Of sorted values, nearest rank
+	static double Percentile(const vector<double> &v, int nPercent)
+	{
+		if (v.empty())
+			return 0;
+		size_t i = (v.size() * nPercent + 99) / 100;
+		return v[i > 0 ? i - 1 : 0];
+	}
+
+private:
+	map<string, vector<double> > m_Calls;
+	vector<string> m_Order;
+};
+
+static CHostTimings g_Timings;
+
+//
+// Times one call into the filter
+//
+class CHostTimer
+{
+public:
+	CHostTimer(const char *pszName) : m_pszName(pszName), m_nStart(FrameTicks()) {}
+	~CHostTimer() { g_Timings.Add(m_pszName, Elapsed()); }
+	double Elapsed() const { return (FrameTicks() - m_nStart) * 1e6 / FrameTickFrequency(); }
+private:
+	const char *m_pszName;
+	long long m_nStart;
+};
+
+//
+// The filter, with its entry points timed
+//
+class CHostFilter : public CFrameProcessFilter
+{
+public:
+	CHostFilter(HRESULT *phr) : CFrameProcessFilter(NULL, phr) {}
+
+	HRESULT Transform(IMediaSample *pIn, IMediaSample *pOut)
+	{
+		CHostTimer timer("Transform");
+		return CFrameProcessFilter::Transform(pIn, pOut);
+	}
+	HRESULT InitializeOutputSample(IMediaSample *pSample, IMediaSample **ppOutSample)
+	{
+		CHostTimer timer("InitializeOutputSample");
+		return CFrameProcessFilter::InitializeOutputSample(pSample, ppOutSample);
+	}
+	HRESULT DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp)
+	{
+		CHostTimer timer("DecideBufferSize");
+		return CFrameProcessFilter::DecideBufferSize(pAlloc, pProp);
+	}
+	HRESULT SetMediaType(PIN_DIRECTION direction, const CMediaType *pmt)
+	{
+		CHostTimer timer(direction == PINDIR_INPUT ? "SetMediaType in" : "SetMediaType out");
+		return CFrameProcessFilter::SetMediaType(direction, pmt);
+	}
+	HRESULT CheckTransform(const CMediaType *mtIn, const CMediaType *mtOut)
+	{
+		CHostTimer timer("CheckTransform");
+		return CFrameProcessFilter::CheckTransform(mtIn, mtOut);
+	}
+	HRESULT StartStreaming()
+	{
+		CHostTimer timer("StartStreaming");
+		return CFrameProcessFilter::StartStreaming();
+	}
+	HRESULT AlterQuality(Quality q)
+	{
+		CHostTimer timer("AlterQuality");
+		return CFrameProcessFilter::AlterQuality(q);
+	}
+
+	CBasePin *Input() { return GetPin(0); }
+	CBasePin *Output() { return GetPin(1); }
+	CBasePin *Preview() { return GetPin(2); }
+};
+
+//
+// Media types
+//
+struct HostFormat
+{
+	int nWidth;
+	int nHeight;
+	int nStride;       // Pixels from one row to the next, at least nWidth
+	bool bVih2;
+};
+
+static void MakeType(const HostFormat &format, CMediaType *pmt)
+{
+	pmt->InitMediaType();
+	pmt->SetType(&MEDIATYPE_Video);
+	pmt->SetSubtype(&MEDIASUBTYPE_YUY2);
+	pmt->SetFormatType(format.bVih2 ? &FORMAT_VideoInfo2 : &FORMAT_VideoInfo);
+	pmt->SetTemporalCompression(FALSE);
+
+	ULONG cbFormat = format.bVih2 ? sizeof(VIDEOINFOHEADER2) : sizeof(VIDEOINFOHEADER);
+	BYTE *pbFormat = pmt->AllocFormatBuffer(cbFormat);
+	ZeroMemory(pbFormat, cbFormat);
+	RECT rc = { 0, 0, 0, 0 };
+	if (format.nStride != format.nWidth)
+		SetRect(&rc, 0, 0, format.nWidth, format.nHeight);
+	BITMAPINFOHEADER *pBmi;
+	if (format.bVih2)
+	{
+		VIDEOINFOHEADER2 *pVih2 = (VIDEOINFOHEADER2 *)pbFormat;
+		pVih2->rcSource = pVih2->rcTarget = rc;
+		pVih2->AvgTimePerFrame = 400000;
+		pVih2->dwPictAspectRatioX = format.nWidth;
+		pVih2->dwPictAspectRatioY = format.nHeight;
+		pBmi = &pVih2->bmiHeader;
+	}
+	else
+	{
+		VIDEOINFOHEADER *pVih = (VIDEOINFOHEADER *)pbFormat;
+		pVih->rcSource = pVih->rcTarget = rc;
+		pVih->AvgTimePerFrame = 400000;
+		pBmi = &pVih->bmiHeader;
+	}
+	pBmi->biSize = sizeof(BITMAPINFOHEADER);
+	pBmi->biWidth = format.nStride;
+	pBmi->biHeight = format.nHeight;
+	pBmi->biPlanes = 1;
+	pBmi->biBitCount = 16;
+	pBmi->biCompression = FCC('YUY2');
+	pBmi->biSizeImage = DIBSIZE(*pBmi);
+	pmt->SetSampleSize(pBmi->biSizeImage);
+}
+
+static const BITMAPINFOHEADER *TypeHeader(const AM_MEDIA_TYPE &mt)
+{
+	if (mt.formattype == FORMAT_VideoInfo2)
+		return &((const VIDEOINFOHEADER2 *)mt.pbFormat)->bmiHeader;
+	return &((const VIDEOINFOHEADER *)mt.pbFormat)->bmiHeader;
+}
+
+// The frame of a type: its top left pixel, size and stride in bytes
+static void TypeFrame(const AM_MEDIA_TYPE &mt, int *pX, int *pY, int *pWidth, int *pHeight, int *pStride)
+{
+	const BITMAPINFOHEADER *pBmi = TypeHeader(mt);
+	const RECT &rc = mt.formattype == FORMAT_VideoInfo2 ?
+		((const VIDEOINFOHEADER2 *)mt.pbFormat)->rcTarget : ((const VIDEOINFOHEADER *)mt.pbFormat)->rcTarget;
+	*pStride = (pBmi->biWidth * 2 + 3) & ~3;
+	*pX = *pY = 0;
+	*pWidth = pBmi->biWidth;
+	*pHeight = abs(pBmi->biHeight);
+	if (!IsRectEmpty(&rc))
+	{
+		*pX = rc.left;
+		*pY = rc.top;
+		*pWidth = rc.right - rc.left;
+		*pHeight = rc.bottom - rc.top;
+	}
+}
+
+static string TypeName(const AM_MEDIA_TYPE &mt)
+{
+	int x, y, nWidth, nHeight, nStride;
+	TypeFrame(mt, &x, &y, &nWidth, &nHeight, &nStride);
+	char sz[64];
+	snprintf(sz, sizeof(sz), "%dx%d", nWidth, nHeight);
+	return sz;
+}
+
+//
+// CHostUnknown
+//
+// Reference count of an object of the harness, which lives as long as the
+// harness; a count above one at the end is a reference the filter kept
+//
+class CHostUnknown
+{
+public:
+	CHostUnknown() : m_cRef(1) {}
+	ULONG HostAddRef() { return (ULONG)__sync_add_and_fetch(&m_cRef, 1); }
+	ULONG HostRelease() { return (ULONG)__sync_sub_and_fetch(&m_cRef, 1); }
+	long References() const { return m_cRef; }
+protected:
+	volatile long m_cRef;
+};
+
+class CHostAllocator;
+
+//
+// CHostSample
+//
+class CHostSample : public IMediaSample
+{
+public:
+	CHostSample(CHostAllocator *pAllocator, long cbBuffer);
+	virtual ~CHostSample();
+
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv)
+	{
+		if (riid != IID_IUnknown && riid != IID_IMediaSample)
+			return E_NOINTERFACE;
+		*ppv = (IMediaSample *)this;
+		AddRef();
+		return S_OK;
+	}
+	STDMETHODIMP_(ULONG) AddRef() { return (ULONG)__sync_add_and_fetch(&m_cRef, 1); }
+	STDMETHODIMP_(ULONG) Release();
+
+	STDMETHODIMP GetPointer(BYTE **ppBuffer) { *ppBuffer = m_pBuffer; return S_OK; }
+	STDMETHODIMP_(long) GetSize() { return m_cbBuffer; }
+	STDMETHODIMP GetTime(REFERENCE_TIME *pTimeStart, REFERENCE_TIME *pTimeEnd)
+	{
+		if (!m_bTime)
+			return VFW_E_SAMPLE_TIME_NOT_SET;
+		*pTimeStart = m_tStart;
+		if (!m_bStop)
+		{
+			*pTimeEnd = m_tStart + 1;
+			return VFW_S_NO_STOP_TIME;
+		}
+		*pTimeEnd = m_tStop;
+		return S_OK;
+	}
+	STDMETHODIMP SetTime(REFERENCE_TIME *pTimeStart, REFERENCE_TIME *pTimeEnd)
+	{
+		m_bTime = pTimeStart != NULL;
+		m_bStop = m_bTime && pTimeEnd != NULL;
+		if (m_bTime)
+			m_tStart = *pTimeStart;
+		if (m_bStop)
+			m_tStop = *pTimeEnd;
+		return S_OK;
+	}
+	STDMETHODIMP IsSyncPoint() { return m_bSyncPoint ? S_OK : S_FALSE; }
+	STDMETHODIMP SetSyncPoint(BOOL bIsSyncPoint) { m_bSyncPoint = bIsSyncPoint != FALSE; return S_OK; }
+	STDMETHODIMP IsPreroll() { return m_bPreroll ? S_OK : S_FALSE; }
+	STDMETHODIMP SetPreroll(BOOL bIsPreroll) { m_bPreroll = bIsPreroll != FALSE; return S_OK; }
+	STDMETHODIMP_(long) GetActualDataLength() { return m_lActual; }
+	STDMETHODIMP SetActualDataLength(long lLen)
+	{
+		if (lLen < 0 || lLen > m_cbBuffer)
+			return VFW_E_BUFFER_OVERFLOW;
+		m_lActual = lLen;
+		return S_OK;
+	}
+	STDMETHODIMP GetMediaType(AM_MEDIA_TYPE **ppMediaType)
+	{
+		*ppMediaType = NULL;
+		if (m_pmt == NULL)
+			return S_FALSE;
+		*ppMediaType = CreateMediaType(m_pmt);
+		return *ppMediaType != NULL ? S_OK : E_OUTOFMEMORY;
+	}
+	STDMETHODIMP SetMediaType(AM_MEDIA_TYPE *pMediaType)
+	{
+		DeleteMediaType(m_pmt);
+		m_pmt = pMediaType != NULL ? CreateMediaType(pMediaType) : NULL;
+		return S_OK;
+	}
+	STDMETHODIMP IsDiscontinuity() { return m_bDiscontinuity ? S_OK : S_FALSE; }
+	STDMETHODIMP SetDiscontinuity(BOOL bDiscontinuity) { m_bDiscontinuity = bDiscontinuity != FALSE; return S_OK; }
+	STDMETHODIMP GetMediaTime(LONGLONG *pTimeStart, LONGLONG *pTimeEnd) { return VFW_E_MEDIA_TIME_NOT_SET; }
+	STDMETHODIMP SetMediaTime(LONGLONG *pTimeStart, LONGLONG *pTimeEnd) { return S_OK; }
+
+	// Back from the allocator: no times, flags or type, and room for cb bytes
+	void Reset(long cbBuffer);
+
+private:
+	CHostAllocator *m_pAllocator;
+	volatile long m_cRef;
+	BYTE *m_pBuffer;
+	long m_cbBuffer;
+	long m_lActual;
+	REFERENCE_TIME m_tStart;
+	REFERENCE_TIME m_tStop;
+	bool m_bTime;
+	bool m_bStop;
+	bool m_bSyncPoint;
+	bool m_bPreroll;
+	bool m_bDiscontinuity;
+	AM_MEDIA_TYPE *m_pmt;
+};
+
+//
+// CHostAllocator
+//
+// A fixed pool of samples, as CMemAllocator has. GetBuffer() never waits:
+// the harness runs on one thread, so a pool that is empty stays empty.
+// SetNextType() hands the next buffer out with a new media type, as a
+// video renderer does when it changes the format of its surface.
+//
+class CHostAllocator : public IMemAllocator, public CHostUnknown
+{
+public:
+	CHostAllocator();
+	~CHostAllocator();
+
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv)
+	{
+		if (riid != IID_IUnknown && riid != IID_IMemAllocator)
+			return E_NOINTERFACE;
+		*ppv = (IMemAllocator *)this;
+		AddRef();
+		return S_OK;
+	}
+	STDMETHODIMP_(ULONG) AddRef() { return HostAddRef(); }
+	STDMETHODIMP_(ULONG) Release() { return HostRelease(); }
+
+	STDMETHODIMP SetProperties(ALLOCATOR_PROPERTIES *pRequest, ALLOCATOR_PROPERTIES *pActual);
+	STDMETHODIMP GetProperties(ALLOCATOR_PROPERTIES *pProps) { *pProps = m_Props; return S_OK; }
+	STDMETHODIMP Commit();
+	STDMETHODIMP Decommit() { m_bCommitted = false; return S_OK; }
+	STDMETHODIMP GetBuffer(IMediaSample **ppBuffer, REFERENCE_TIME *pStartTime,
+		REFERENCE_TIME *pEndTime, DWORD dwFlags);
+	STDMETHODIMP ReleaseBuffer(IMediaSample *pBuffer);
+
+	void SetNextType(const CMediaType &mt);
+	int Outstanding() const { return (int)(m_Samples.size() - m_Free.size()); }
+	long long Buffers() const { return m_nBuffers; }
+	long long Empty() const { return m_nEmpty; }
+
+private:
+	ALLOCATOR_PROPERTIES m_Props;
+	bool m_bCommitted;
+	vector<CHostSample *> m_Samples;
+	vector<CHostSample *> m_Free;
+	CMediaType m_NextType;
+	long long m_nBuffers;      // GetBuffer() calls that returned one
+	long long m_nEmpty;        // And the ones that found the pool empty
+	CCritSec m_cs;
+	void FreeSamples();
+};
+
+CHostSample::CHostSample(CHostAllocator *pAllocator, long cbBuffer)
+	: m_pAllocator(pAllocator), m_cRef(0), m_pBuffer(NULL), m_cbBuffer(0), m_pmt(NULL)
+{
+	Reset(cbBuffer);
+}
+
+CHostSample::~CHostSample()
+{
+	DeleteMediaType(m_pmt);
+	FrameFree(m_pBuffer);
+}
+
+STDMETHODIMP_(ULONG) CHostSample::Release()
+{
+	long cRef = __sync_sub_and_fetch(&m_cRef, 1);
+	if (cRef == 0)
+		m_pAllocator->ReleaseBuffer(this);
+	return (ULONG)cRef;
+}
+
+void CHostSample::Reset(long cbBuffer)
+{
+	if (cbBuffer != m_cbBuffer)
+	{
+		// FrameAlloc, so that the pool does not count as an allocation of the filter
+		FrameFree(m_pBuffer);
+		m_pBuffer = (BYTE *)FrameAlloc(cbBuffer);
+		m_cbBuffer = cbBuffer;
+	}
+	m_lActual = 0;
+	m_tStart = m_tStop = 0;
+	m_bTime = m_bStop = false;
+	m_bSyncPoint = m_bPreroll = m_bDiscontinuity = false;
+	DeleteMediaType(m_pmt);
+	m_pmt = NULL;
+}
+
+CHostAllocator::CHostAllocator()
+	: m_bCommitted(false), m_nBuffers(0), m_nEmpty(0)
+{
+	ZeroMemory(&m_Props, sizeof(m_Props));
+}
+
+CHostAllocator::~CHostAllocator()
+{
+	FreeSamples();
+}
+
+void CHostAllocator::FreeSamples()
+{
+	for (size_t i = 0; i < m_Samples.size(); i++)
+		delete m_Samples[i];
+	m_Samples.clear();
+	m_Free.clear();
+}
+
+STDMETHODIMP CHostAllocator::SetProperties(ALLOCATOR_PROPERTIES *pRequest, ALLOCATOR_PROPERTIES *pActual)
+{
+	CAutoLock lock(&m_cs);
+	if (m_bCommitted || Outstanding() > 0)
+		return VFW_E_ALREADY_COMMITTED;
+	if (pRequest->cbBuffer <= 0)
+		return VFW_E_SIZENOTSET;
+	m_Props = *pRequest;
+	m_Props.cBuffers = max(m_Props.cBuffers, 1);
+	m_Props.cbAlign = max(m_Props.cbAlign, 1);
+	*pActual = m_Props;
+	FreeSamples();
+	return S_OK;
+}
+
+STDMETHODIMP CHostAllocator::Commit()
+{
+	CAutoLock lock(&m_cs);
+	if (m_Props.cbBuffer <= 0)
+		return VFW_E_SIZENOTSET;
+	while ((int)m_Samples.size() < m_Props.cBuffers)
+	{
+		m_Samples.push_back(new CHostSample(this, m_Props.cbBuffer));
+		m_Free.push_back(m_Samples.back());
+	}
+	m_bCommitted = true;
+	return S_OK;
+}
+
+STDMETHODIMP CHostAllocator::GetBuffer(IMediaSample **ppBuffer, REFERENCE_TIME *pStartTime,
+	REFERENCE_TIME *pEndTime, DWORD dwFlags)
+{
+	CAutoLock lock(&m_cs);
+	*ppBuffer = NULL;
+	if (!m_bCommitted)
+		return VFW_E_NOT_COMMITTED;
+	if (m_Free.empty())
+	{
+		m_nEmpty++;
+		return VFW_E_TIMEOUT;
+	}
+	CHostSample *pSample = m_Free.back();
+	m_Free.pop_back();
+	pSample->Reset(m_Props.cbBuffer);
+	if (m_NextType.IsValid())
+	{
+		pSample->SetMediaType(&m_NextType);
+		FreeMediaType(m_NextType);
+		m_NextType.InitMediaType();
+	}
+	pSample->AddRef();
+	*ppBuffer = pSample;
+	m_nBuffers++;
+	return S_OK;
+}
+
+STDMETHODIMP CHostAllocator::ReleaseBuffer(IMediaSample *pBuffer)
+{
+	CAutoLock lock(&m_cs);
+	m_Free.push_back((CHostSample *)pBuffer);
+	return S_OK;
+}
+
+void CHostAllocator::SetNextType(const CMediaType &mt)
+{
+	CAutoLock lock(&m_cs);
+	m_NextType = mt;
+	// A larger surface: the samples grow as they are handed out
+	m_Props.cbBuffer = max(m_Props.cbBuffer, (LONG)TypeHeader(mt)->biSizeImage);
+}
+
+//
+// CHostPin
+//
+// The pins of the harness: the source's output pin, and the renderers'
+// input pins, which take the samples and check them
+//
+class CHostPin : public IPin, public IMemInputPin, public IQualityControl,
+	public IFrameSliceCallback, public CHostUnknown
+{
+public:
+	CHostPin(const char *pszName, PIN_DIRECTION dir)
+		: m_Name(pszName), m_bSlices(false), m_bCheckCopy(false), m_pExpected(NULL),
+		  m_nExpectedStride(0), m_pfnHold(NULL), m_pvHold(NULL),
+		  m_dir(dir), m_pConnected(NULL), m_pInputPin(NULL)
+	{
+		ResetCounts();
+	}
+
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef() { return HostAddRef(); }
+	STDMETHODIMP_(ULONG) Release() { return HostRelease(); }
+
+	// IPin
+	STDMETHODIMP Connect(IPin *pReceivePin, const AM_MEDIA_TYPE *pmt) { return E_NOTIMPL; }
+	STDMETHODIMP ReceiveConnection(IPin *pConnector, const AM_MEDIA_TYPE *pmt);
+	STDMETHODIMP Disconnect();
+	STDMETHODIMP ConnectedTo(IPin **ppPin)
+	{
+		*ppPin = m_pConnected;
+		if (m_pConnected == NULL)
+			return VFW_E_NOT_CONNECTED;
+		m_pConnected->AddRef();
+		return S_OK;
+	}
+	STDMETHODIMP ConnectionMediaType(AM_MEDIA_TYPE *pmt) { return CopyMediaType(pmt, &m_mt); }
+	STDMETHODIMP QueryPinInfo(PIN_INFO *pInfo)
+	{
+		pInfo->pFilter = NULL;
+		pInfo->dir = m_dir;
+		mbstowcs(pInfo->achName, m_Name.c_str(), 128);
+		return S_OK;
+	}
+	STDMETHODIMP QueryDirection(PIN_DIRECTION *pPinDir) { *pPinDir = m_dir; return S_OK; }
+	STDMETHODIMP QueryAccept(const AM_MEDIA_TYPE *pmt) { return S_OK; }
+	STDMETHODIMP EndOfStream() { m_nEndOfStream++; return S_OK; }
+	STDMETHODIMP BeginFlush() { m_nFlushes++; return S_OK; }
+	STDMETHODIMP EndFlush() { return S_OK; }
+	STDMETHODIMP NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate) { return S_OK; }
+
+	// IMemInputPin
+	STDMETHODIMP GetAllocator(IMemAllocator **ppAllocator)
+	{
+		*ppAllocator = &m_Allocator;
+		m_Allocator.AddRef();
+		return S_OK;
+	}
+	STDMETHODIMP NotifyAllocator(IMemAllocator *pAllocator, BOOL bReadOnly)
+	{
+		return pAllocator == &m_Allocator ? S_OK : E_FAIL;
+	}
+	STDMETHODIMP GetAllocatorRequirements(ALLOCATOR_PROPERTIES *pProps) { return E_NOTIMPL; }
+	STDMETHODIMP Receive(IMediaSample *pSample);
+	STDMETHODIMP ReceiveCanBlock() { return S_FALSE; }
+
+	// IQualityControl, for the messages the filter passes upstream
+	STDMETHODIMP Notify(IBaseFilter *pSelf, Quality q) { m_nQuality++; return S_OK; }
+	STDMETHODIMP SetSink(IQualityControl *piqc) { return S_OK; }
+
+	// IFrameSliceCallback, while the pin takes slices
+	STDMETHODIMP SliceReady(IMediaSample *Sample, DWORD FirstRow, DWORD LastRow, DWORD Height);
+
+	// The source side of a connection
+	HRESULT ConnectTo(IPin *pPin, const CMediaType &mt);
+
+	void ResetCounts()
+	{
+		m_nReceived = m_nEndOfStream = m_nFlushes = m_nQuality = m_nSlices = 0;
+		m_nBadLength = m_nBadCopy = 0;
+	}
+	bool IsConnected() const { return m_pConnected != NULL; }
+	const CMediaType &Type() const { return m_mt; }
+	void SetType(const CMediaType &mt) { m_mt = mt; }
+
+	const string m_Name;
+	CHostAllocator m_Allocator;
+	bool m_bSlices;            // Takes IFrameSliceCallback
+	bool m_bCheckCopy;         // Compares the samples with m_pExpected
+	const BYTE *m_pExpected;   // The input frame of the sample to come
+	int m_nExpectedStride;
+	void (*m_pfnHold)(void *pv);   // Called once by the next Receive()
+	void *m_pvHold;
+	int m_nReceived;
+	int m_nEndOfStream;
+	int m_nFlushes;
+	int m_nQuality;
+	int m_nSlices;
+	int m_nBadLength;
+	int m_nBadCopy;
+
+private:
+	PIN_DIRECTION m_dir;
+	IPin *m_pConnected;
+	IMemInputPin *m_pInputPin;
+	CMediaType m_mt;
+};
+
+STDMETHODIMP CHostPin::QueryInterface(REFIID riid, void **ppv)
+{
+	if (riid == IID_IUnknown || riid == IID_IPin)
+		*ppv = (IPin *)this;
+	else if (riid == IID_IMemInputPin && m_dir == PINDIR_INPUT)
+		*ppv = (IMemInputPin *)this;
+	else if (riid == IID_IQualityControl && m_dir == PINDIR_OUTPUT)
+		*ppv = (IQualityControl *)this;
+	else if (riid == IID_IFrameSliceCallback && m_bSlices)
+		*ppv = (IFrameSliceCallback *)this;
+	else
+	{
+		*ppv = NULL;
+		return E_NOINTERFACE;
+	}
+	AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP CHostPin::ReceiveConnection(IPin *pConnector, const AM_MEDIA_TYPE *pmt)
+{
+	if (m_pConnected != NULL)
+		return VFW_E_ALREADY_CONNECTED;
+	if (pmt->majortype != MEDIATYPE_Video || pmt->subtype != MEDIASUBTYPE_YUY2 || pmt->pbFormat == NULL)
+		return VFW_E_TYPE_NOT_ACCEPTED;
+	m_pConnected = pConnector;
+	m_pConnected->AddRef();
+	m_mt = *pmt;
+	return S_OK;
+}
+
+STDMETHODIMP CHostPin::Disconnect()
+{
+	if (m_pConnected == NULL)
+		return S_FALSE;
+	if (m_pInputPin != NULL)
+	{
+		m_pInputPin->Release();
+		m_pInputPin = NULL;
+	}
+	m_pConnected->Release();
+	m_pConnected = NULL;
+	return S_OK;
+}
+
+//
+// The source connects to the filter's input pin with mt and lends it an
+// allocator of three buffers of the type's size
+//
+HRESULT CHostPin::ConnectTo(IPin *pPin, const CMediaType &mt)
+{
+	HRESULT hr = pPin->ReceiveConnection(this, &mt);
+	if (FAILED(hr))
+		return hr;
+	m_pConnected = pPin;
+	m_pConnected->AddRef();
+	m_mt = mt;
+	hr = pPin->QueryInterface(IID_IMemInputPin, (void **)&m_pInputPin);
+	if (SUCCEEDED(hr))
+	{
+		ALLOCATOR_PROPERTIES request = { 3, (LONG)TypeHeader(mt)->biSizeImage, 1, 0 }, actual;
+		hr = m_Allocator.SetProperties(&request, &actual);
+	}
+	if (SUCCEEDED(hr))
+		hr = m_pInputPin->NotifyAllocator(&m_Allocator, FALSE);
+	if (FAILED(hr))
+	{
+		pPin->Disconnect();
+		Disconnect();
+	}
+	return hr;
+}
+
+//
+// A sample for a renderer: it takes up a new type that comes with it, and
+// checks the length and, when asked to, the pixels
+//
+STDMETHODIMP CHostPin::Receive(IMediaSample *pSample)
+{
+	m_nReceived++;
+	if (m_pfnHold != NULL)
+	{
+		void (*pfnHold)(void *) = m_pfnHold;
+		m_pfnHold = NULL;
+		pfnHold(m_pvHold);
+	}
+	AM_MEDIA_TYPE *pmt = NULL;
+	if (pSample->GetMediaType(&pmt) == S_OK)
+	{
+		m_mt = *pmt;
+		DeleteMediaType(pmt);
+	}
+	if (pSample->GetActualDataLength() != (long)TypeHeader(m_mt)->biSizeImage)
+		m_nBadLength++;
+
+	if (m_bCheckCopy && m_pExpected != NULL)
+	{
+		BYTE *pBuffer;
+		pSample->GetPointer(&pBuffer);
+		int x, y, nWidth, nHeight, nStride;
+		TypeFrame(m_mt, &x, &y, &nWidth, &nHeight, &nStride);
+		const BYTE *pbTop = pBuffer + (ptrdiff_t)nStride * y + x * 2;
+		for (int i = 0; i < nHeight; i++)
+		{
+			if (memcmp(pbTop + (ptrdiff_t)nStride * i, m_pExpected + (ptrdiff_t)m_nExpectedStride * i, nWidth * 2) != 0)
+			{
+				m_nBadCopy++;
+				break;
+			}
+		}
+	}
+	return S_OK;
+}
+
+STDMETHODIMP CHostPin::SliceReady(IMediaSample *Sample, DWORD FirstRow, DWORD LastRow, DWORD Height)
+{
+	m_nSlices++;
+	return S_OK;
+}
+
+//
+// Frames of the source: a few frames of a moving pattern, made once per
+// format and copied into the samples
+//
+class CHostFrames
+{
+public:
+	void Make(int nWidth, int nHeight)
+	{
+		if (nWidth == m_nWidth && nHeight == m_nHeight)
+			return;
+		m_nWidth = nWidth;
+		m_nHeight = nHeight;
+		m_Frames.assign(g_nFrames, vector<BYTE>((size_t)nWidth * 2 * nHeight));
+		for (int f = 0; f < g_nFrames; f++)
+		{
+			BYTE *pb = &m_Frames[f][0];
+			int nBoxX = (nWidth / 2 - nWidth / 8) * f / g_nFrames;
+			int nBoxY = nHeight / 3;
+			for (int y = 0; y < nHeight; y++)
+			{
+				for (int x = 0; x < nWidth; x += 2)
+				{
+					bool bBox = x >= nBoxX && x < nBoxX + nWidth / 8 && y >= nBoxY && y < nBoxY + nHeight / 4;
+					BYTE *p = pb + ((size_t)y * nWidth + x) * 2;
+					p[0] = bBox ? 220 : (BYTE)(16 + (x + y + 3 * f) % 220);
+					p[1] = (BYTE)(64 + (x * 128 / nWidth));
+					p[2] = bBox ? 220 : (BYTE)(16 + (x + 1 + y + 3 * f) % 220);
+					p[3] = (BYTE)(64 + (y * 128 / nHeight));
+				}
+			}
+		}
+	}
+	const BYTE *Frame(int n) const { return &m_Frames[n % g_nFrames][0]; }
+	int Stride() const { return m_nWidth * 2; }
+
+	CHostFrames() : m_nWidth(0), m_nHeight(0) {}
+
+private:
+	static const int g_nFrames = 8;
+	int m_nWidth;
+	int m_nHeight;
+	vector<vector<BYTE> > m_Frames;
+};
+
+//
+// CHost
+//
+// The graph around the filter, driven by the script
+//
+class CHost
+{
+public:
+	CHost(bool bVerbose);
+	~CHost();
+
+	bool Create();
+	bool Destroy();
+	bool Run(const string &script);
+
+private:
+	bool Command(istringstream &line, const string &command);
+	bool ParseFormat(istringstream &line, HostFormat *pFormat, bool bNeedSize);
+	void ConnectInput(const HostFormat &format);
+	void ConnectOutput(const HostFormat *pFormat, bool bSlices);
+	void ConnectPreview(bool bOn);
+	void Disconnect(CBasePin *pFilterPin, CHostPin *pPin);
+	void Start();
+	void Stop();
+	void Frames(int nFrames);
+	void SetParameter(const string &name, long lValue);
+	void PutParameter(const string &name, long lValue);
+	void HoldParameter(const string &name, long lValue);
+	static void HoldProc(void *pv);
+	static void HoldThreadProc(void *pv);
+	void FormatIn(const HostFormat &format);
+	void FormatOut(const HostFormat &format);
+	void CheckBuffers();
+
+	bool m_bVerbose;
+	CHostFilter *m_pFilter;
+	CHostPin m_Source;
+	CHostPin m_Renderer;
+	CHostPin m_PreviewRenderer;
+	CHostFrames m_Frames;
+	bool m_bRunning;
+	bool m_bCheckCopy;
+	REFERENCE_TIME m_tNext;    // Start time of the next sample
+	int m_nFrame;              // Frames sent since the start
+	CMediaType m_NextInput;    // Type the next sample of the source brings
+
+	// "hold": the parameter a second thread sets while the renderer holds
+	// a frame, and whether the setter has returned
+	string m_HoldName;
+	long m_lHoldValue;
+	CFrameThread m_HoldThread;
+	volatile long m_lHoldDone;
+};
+
+CHost::CHost(bool bVerbose)
+	: m_bVerbose(bVerbose), m_pFilter(NULL),
+	  m_Source("source", PINDIR_OUTPUT),
+	  m_Renderer("renderer", PINDIR_INPUT),
+	  m_PreviewRenderer("preview renderer", PINDIR_INPUT),
+	  m_bRunning(false), m_bCheckCopy(false), m_tNext(0), m_nFrame(0),
+	  m_lHoldValue(0), m_lHoldDone(0)
+{
+}
+
+CHost::~CHost()
+{
+}
+
+bool CHost::Create()
+{
+	g_Where = "create";
+	HRESULT hr = S_OK;
+	m_pFilter = new CHostFilter(&hr);
+	m_pFilter->AddRef();
+	if (!Check(hr, "CFrameProcessFilter()"))
+		return false;
+
+	// Every interface the filter reveals, and its references
+	static const IID *iids[] =
+	{
+		&IID_IBaseFilter, &IID_IFrameProcessor, &IID_IFrameStatistics, &IID_IFrameAutoLevels,
+		&IID_IFrameColorCube, &IID_IFrameColorSpace, &IID_IFrameScaling, &IID_IFrameSharpen,
+		&IID_IFrameQuality, &IID_IFrameSlices, &IID_IFrameRowReuse, &IID_IFrameMotion,
+		&IID_IFrameOverlay, &IID_IFrameChromaKey, &IID_IFramePreview, &IID_IFrameFingerprint,
+		&IID_IFrameTrace, &IID_ISpecifyPropertyPages
+	};
+	for (size_t i = 0; i < sizeof(iids) / sizeof(iids[0]); i++)
+	{
+		IUnknown *pUnk = NULL;
+		if (!Check(m_pFilter->QueryInterface(*iids[i], (void **)&pUnk), "QueryInterface"))
+			continue;
+		if (pUnk->Release() != 1)
+			Fail("interface %d: the reference was not released", (int)i);
+	}
+	if (m_pFilter->GetPinCount() != 3 || m_pFilter->Preview() == NULL)
+		Fail("the filter has no preview pin");
+	return g_nFailures == 0;
+}
+
+bool CHost::Destroy()
+{
+	g_Where = "destroy";
+	if (m_bRunning)
+		Stop();
+	Disconnect(m_pFilter->Preview(), &m_PreviewRenderer);
+	Disconnect(m_pFilter->Output(), &m_Renderer);
+	Disconnect(m_pFilter->Input(), &m_Source);
+	ULONG cRef = m_pFilter->Release();
+	if (cRef != 0)
+		Fail("%u references to the filter are left", (unsigned int)cRef);
+	CHostPin *pins[] = { &m_Source, &m_Renderer, &m_PreviewRenderer };
+	for (int i = 0; i < 3; i++)
+	{
+		if (pins[i]->References() != 1)
+			Fail("the %s has %ld references", pins[i]->m_Name.c_str(), pins[i]->References() - 1);
+		if (pins[i]->m_Allocator.References() != 1)
+			Fail("the allocator of the %s has %ld references", pins[i]->m_Name.c_str(),
+				pins[i]->m_Allocator.References() - 1);
+	}
+	return g_nFailures == 0;
+}
+
+void CHost::Disconnect(CBasePin *pFilterPin, CHostPin *pPin)
+{
+	if (!pPin->IsConnected())
+		return;
+	Check(pFilterPin->Disconnect(), "Disconnect");
+	pPin->Disconnect();
+}
+
+void CHost::ConnectInput(const HostFormat &format)
+{
+	Disconnect(m_pFilter->Preview(), &m_PreviewRenderer);
+	Disconnect(m_pFilter->Output(), &m_Renderer);
+	Disconnect(m_pFilter->Input(), &m_Source);
+	CMediaType mt;
+	MakeType(format, &mt);
+	CHostTimer timer("Connect in");
+	Check(m_Source.ConnectTo(m_pFilter->Input(), mt), "ReceiveConnection");
+	m_Frames.Make(format.nWidth, format.nHeight);
+}
+
+void CHost::ConnectOutput(const HostFormat *pFormat, bool bSlices)
+{
+	Disconnect(m_pFilter->Preview(), &m_PreviewRenderer);
+	Disconnect(m_pFilter->Output(), &m_Renderer);
+	m_Renderer.m_bSlices = bSlices;
+	CMediaType mt;
+	if (pFormat != NULL)
+		MakeType(*pFormat, &mt);
+	CHostTimer timer("Connect out");
+	Check(m_pFilter->Output()->Connect(&m_Renderer, pFormat != NULL ? &mt : NULL), "Connect");
+}
+
+void CHost::ConnectPreview(bool bOn)
+{
+	Disconnect(m_pFilter->Preview(), &m_PreviewRenderer);
+	if (!bOn)
+		return;
+	CHostTimer timer("Connect preview");
+	Check(m_pFilter->Preview()->Connect(&m_PreviewRenderer, NULL), "Connect");
+}
+
+void CHost::Start()
+{
+	m_Source.m_Allocator.Commit();
+	{
+		CHostTimer timer("Run");
+		if (!Check(m_pFilter->Run(0), "Run"))
+			return;
+	}
+	m_bRunning = true;
+	m_tNext = 0;
+	m_nFrame = 0;
+}
+
+void CHost::Stop()
+{
+	{
+		CHostTimer timer("Stop");
+		Check(m_pFilter->Stop(), "Stop");
+	}
+	m_Source.m_Allocator.Decommit();
+	m_bRunning = false;
+	CheckBuffers();
+}
+
+// Every sample the filter took has to be back with its allocator
+void CHost::CheckBuffers()
+{
+	CHostPin *pins[] = { &m_Source, &m_Renderer, &m_PreviewRenderer };
+	for (int i = 0; i < 3; i++)
+	{
+		int nOutstanding = pins[i]->m_Allocator.Outstanding();
+		if (nOutstanding != 0)
+			Fail("%d samples of the %s were not released", nOutstanding, pins[i]->m_Name.c_str());
+	}
+}
+
+//
+// Send nFrames samples and report the time they took and what was copied
+// and allocated for them
+//
+void CHost::Frames(int nFrames)
+{
+	int nX, nY, nWidth, nHeight, nStride;
+	TypeFrame(m_Source.Type(), &nX, &nY, &nWidth, &nHeight, &nStride);
+	bool bCheck = m_bCheckCopy && m_Renderer.IsConnected();
+	if (bCheck)
+	{
+		int nOutX, nOutY, nOutWidth, nOutHeight, nOutStride;
+		TypeFrame(m_Renderer.Type(), &nOutX, &nOutY, &nOutWidth, &nOutHeight, &nOutStride);
+		bCheck = nOutWidth == nWidth && nOutHeight == nHeight;
+	}
+	m_Renderer.m_bCheckCopy = bCheck;
+	m_Renderer.ResetCounts();
+	m_PreviewRenderer.ResetCounts();
+
+	IMemInputPin *pInput = NULL;
+	if (!Check(m_pFilter->Input()->QueryInterface(IID_IMemInputPin, (void **)&pInput), "QueryInterface"))
+		return;
+
+	long long nBuffers = m_Renderer.m_Allocator.Buffers() + m_PreviewRenderer.m_Allocator.Buffers();
+	long long nCopyBytes = 0;
+	long long nAllocs = 0;
+	vector<double> receive;
+	receive.reserve(nFrames);
+	int nFailed = 0;
+	for (int i = 0; i < nFrames; i++)
+	{
+		IMediaSample *pSample = NULL;
+		if (!Check(m_Source.m_Allocator.GetBuffer(&pSample, NULL, NULL, 0), "GetBuffer"))
+			break;
+
+		// The source's new type comes with this sample
+		if (m_NextInput.IsValid())
+		{
+			pSample->SetMediaType(&m_NextInput);
+			TypeFrame(m_NextInput, &nX, &nY, &nWidth, &nHeight, &nStride);
+			m_Source.SetType(m_NextInput);
+			FreeMediaType(m_NextInput);
+			m_NextInput.InitMediaType();
+		}
+		BYTE *pBuffer;
+		pSample->GetPointer(&pBuffer);
+		m_Frames.Make(nWidth, nHeight);
+		const BYTE *pFrame = m_Frames.Frame(m_nFrame);
+		for (int y = 0; y < nHeight; y++)
+			memcpy(pBuffer + (ptrdiff_t)nStride * (nY + y) + nX * 2, pFrame + (ptrdiff_t)m_Frames.Stride() * y, nWidth * 2);
+		REFERENCE_TIME tStart = m_tNext, tStop = m_tNext + 400000;
+		pSample->SetTime(&tStart, &tStop);
+		pSample->SetSyncPoint(TRUE);
+		pSample->SetDiscontinuity(m_nFrame == 0);
+		pSample->SetActualDataLength((long)TypeHeader(m_Source.Type())->biSizeImage);
+		// From frame g_GhostFrame on the filter blends the frames with that one
+		m_Renderer.m_pExpected = m_nFrame < (int)g_GhostFrame ? pFrame : NULL;
+		m_Renderer.m_nExpectedStride = m_Frames.Stride();
+
+		long long nCopyStart = g_Headless.nCopyBytes;
+		long long nAllocStart = Allocations();
+		HRESULT hr;
+		{
+			CHostTimer timer("Receive");
+			hr = pInput->Receive(pSample);
+			receive.push_back(timer.Elapsed());
+		}
+		nAllocs += Allocations() - nAllocStart;
+		nCopyBytes += g_Headless.nCopyBytes - nCopyStart;
+		pSample->Release();
+		if (hr != S_OK && nFailed++ == 0)
+			Fail("frame %d: Receive returned 0x%08x", m_nFrame, (unsigned int)hr);
+		m_tNext = tStop;
+		m_nFrame++;
+	}
+	pInput->Release();
+	CheckBuffers();
+
+	// What the renderers got
+	if (m_Renderer.m_nReceived != nFrames)
+		Fail("the renderer received %d of %d frames", m_Renderer.m_nReceived, nFrames);
+	if (m_Renderer.m_nBadLength > 0)
+		Fail("%d frames had the wrong length for %s", m_Renderer.m_nBadLength, TypeName(m_Renderer.Type()).c_str());
+	if (m_Renderer.m_nBadCopy > 0)
+		Fail("%d frames are not the input", m_Renderer.m_nBadCopy);
+	if (m_PreviewRenderer.IsConnected() && m_PreviewRenderer.m_nReceived == 0)
+		Fail("the preview renderer received nothing");
+	if (m_PreviewRenderer.m_nBadLength > 0)
+		Fail("%d previews had the wrong length", m_PreviewRenderer.m_nBadLength);
+	if (m_Renderer.m_bSlices && m_Renderer.m_nSlices < m_Renderer.m_nReceived)
+		Fail("%d slices for %d frames", m_Renderer.m_nSlices, m_Renderer.m_nReceived);
+
+	// The filter's types have to be what the source and the renderer use
+	CMediaType mtIn, mtOut;
+	m_pFilter->Input()->ConnectionMediaType(&mtIn);
+	m_pFilter->Output()->ConnectionMediaType(&mtOut);
+	if (mtIn != m_Source.Type())
+		Fail("the input type is %s, the source's %s", TypeName(mtIn).c_str(), TypeName(m_Source.Type()).c_str());
+	if (mtOut != m_Renderer.Type())
+		Fail("the output type is %s, the renderer's %s", TypeName(mtOut).c_str(), TypeName(m_Renderer.Type()).c_str());
+
+	sort(receive.begin(), receive.end());
+	const BITMAPINFOHEADER *pOut = TypeHeader(m_Renderer.Type());
+	double dFrame = (double)pOut->biSizeImage * nFrames;
+	long long nTaken = m_Renderer.m_Allocator.Buffers() + m_PreviewRenderer.m_Allocator.Buffers() - nBuffers;
+	printf("frames %5d  %9s -> %-9s  receive %8.3f ms  p99 %8.3f ms  buffers %.2f  allocs %.2f  copies %.2f",
+		nFrames, TypeName(m_Source.Type()).c_str(), TypeName(m_Renderer.Type()).c_str(),
+		CHostTimings::Percentile(receive, 50) / 1000, CHostTimings::Percentile(receive, 99) / 1000,
+		(double)nTaken / nFrames, (double)nAllocs / nFrames, nCopyBytes / dFrame);
+	if (m_PreviewRenderer.IsConnected())
+		printf("  preview %d", m_PreviewRenderer.m_nReceived);
+	if (m_Renderer.m_bSlices)
+		printf("  slices %.1f", (double)m_Renderer.m_nSlices / nFrames);
+	if (bCheck)
+		printf("  copy checked");
+	printf("\n");
+}
+
+//
+// Parameters of "set", each through the interface the filter reveals it in
+//
+static const char *g_Parameters[] =
+{
+	"brightness", "contrast", "hue", "saturation", "gamma", "stats", "autolevels", "quality",
+	"slicerows", "reuse", "motion", "fingerprint", "sharpen", "scale", "previewfactor",
+	"tracing", "inmatrix", "outmatrix"
+};
+
+void CHost::SetParameter(const string &name, long lValue)
+{
+	CHostTimer timer("parameter");
+	PutParameter(name, lValue);
+}
+
+void CHost::PutParameter(const string &name, long lValue)
+{
+	CHostFilter *f = m_pFilter;
+	HRESULT hr;
+	if (name == "brightness")
+		hr = f->put_BrightnessLevel((unsigned char)lValue);
+	else if (name == "contrast")
+		hr = f->put_ContrastLevel((unsigned char)lValue);
+	else if (name == "hue")
+		hr = f->put_HueLevel((unsigned char)lValue);
+	else if (name == "saturation")
+		hr = f->put_SaturationLevel((unsigned char)lValue);
+	else if (name == "gamma")
+		hr = f->put_GammaCorrectionLevel((unsigned char)lValue);
+	else if (name == "stats")
+		hr = f->put_StatisticsEnabled(lValue != 0);
+	else if (name == "autolevels")
+		hr = f->put_AutoLevels(lValue != 0);
+	else if (name == "quality")
+		hr = f->put_QualityControl(lValue != 0);
+	else if (name == "slicerows")
+		hr = f->put_SliceRows((DWORD)lValue);
+	else if (name == "reuse")
+		hr = f->put_RowReuse(lValue != 0);
+	else if (name == "motion")
+		hr = f->put_MotionDetection(lValue != 0);
+	else if (name == "fingerprint")
+		hr = f->put_Fingerprint(lValue != 0);
+	else if (name == "sharpen")
+		hr = f->put_SharpenAmount((LONG)lValue);
+	else if (name == "scale")
+		hr = f->put_ScaleFilter((DWORD)lValue);
+	else if (name == "previewfactor")
+		hr = f->put_PreviewFactor((DWORD)lValue);
+	else if (name == "tracing")
+		hr = f->put_Tracing(lValue != 0);
+	else if (name == "inmatrix")
+		hr = f->put_InputColorSpace((DWORD)lValue, FALSE);
+	else
+		hr = f->put_OutputColorSpace((DWORD)lValue, FALSE);
+	Check(hr, ("put " + name).c_str());
+}
+
+//
+// A paused renderer blocks in Receive() with the filter's streaming lock
+// held, and the property page changes parameters meanwhile on its own
+// thread. The renderer holds the next frame until the setter has returned;
+// a setter that waits for the frame fails the check instead of hanging.
+//
+void CHost::HoldParameter(const string &name, long lValue)
+{
+	m_HoldName = name;
+	m_lHoldValue = lValue;
+	FrameInterlockedExchange(&m_lHoldDone, 0);
+	m_Renderer.m_pfnHold = HoldProc;
+	m_Renderer.m_pvHold = this;
+	Frames(1);
+	m_HoldThread.Join();
+	if (m_Renderer.m_pfnHold != NULL)
+	{
+		m_Renderer.m_pfnHold = NULL;
+		Fail("the renderer got no frame to hold");
+	}
+}
+
+void CHost::HoldProc(void *pv)
+{
+	CHost *pHost = (CHost *)pv;
+	if (!pHost->m_HoldThread.Start(HoldThreadProc, pHost))
+	{
+		Fail("cannot start the thread of the setter");
+		return;
+	}
+	double dStart = FrameSeconds();
+	while (FrameInterlockedExchangeAdd(&pHost->m_lHoldDone, 0) == 0)
+	{
+		if (FrameSeconds() - dStart > 2)
+		{
+			Fail("set %s waited for the frame in the renderer", pHost->m_HoldName.c_str());
+			return;
+		}
+		usleep(1000);
+	}
+}
+
+void CHost::HoldThreadProc(void *pv)
+{
+	CHost *pHost = (CHost *)pv;
+	pHost->PutParameter(pHost->m_HoldName, pHost->m_lHoldValue);
+	FrameInterlockedExchange(&pHost->m_lHoldDone, 1);
+}
+
+//
+// The source changes its type with the next sample, once the filter's
+// input pin accepts it; its buffers grow with it
+//
+void CHost::FormatIn(const HostFormat &format)
+{
+	CMediaType mt;
+	MakeType(format, &mt);
+	HRESULT hr;
+	{
+		CHostTimer timer("QueryAccept in");
+		hr = m_pFilter->Input()->QueryAccept(&mt);
+	}
+	if (hr != S_OK)
+	{
+		Fail("the input pin refused %s", TypeName(mt).c_str());
+		return;
+	}
+	ALLOCATOR_PROPERTIES props, actual;
+	m_Source.m_Allocator.GetProperties(&props);
+	if (props.cbBuffer < (LONG)TypeHeader(mt)->biSizeImage)
+	{
+		props.cbBuffer = TypeHeader(mt)->biSizeImage;
+		m_Source.m_Allocator.Decommit();
+		m_Source.m_Allocator.SetProperties(&props, &actual);
+		m_Source.m_Allocator.Commit();
+	}
+	m_NextInput = mt;
+}
+
+//
+// The renderer changes its surface: the filter's output pin has to accept
+// the type, which then comes with the next buffer
+//
+void CHost::FormatOut(const HostFormat &format)
+{
+	CMediaType mt;
+	MakeType(format, &mt);
+	HRESULT hr;
+	{
+		CHostTimer timer("QueryAccept out");
+		hr = m_pFilter->Output()->QueryAccept(&mt);
+	}
+	if (hr != S_OK)
+	{
+		Fail("the output pin refused %s", TypeName(mt).c_str());
+		return;
+	}
+	m_Renderer.m_Allocator.SetNextType(mt);
+}
+
+bool CHost::ParseFormat(istringstream &line, HostFormat *pFormat, bool bNeedSize)
+{
+	string word;
+	pFormat->nWidth = pFormat->nHeight = pFormat->nStride = 0;
+	pFormat->bVih2 = false;
+	bool bSize = false;
+	while (line >> word)
+	{
+		if (word == "vih2")
+			pFormat->bVih2 = true;
+		else if (word == "stride" && line >> pFormat->nStride)
+			continue;
+		else if (word == "slices")
+			continue;
+		else if (sscanf(word.c_str(), "%dx%d", &pFormat->nWidth, &pFormat->nHeight) == 2)
+			bSize = true;
+		else
+			return false;
+	}
+	if (!bSize)
+		return !bNeedSize;
+	if (pFormat->nWidth < 2 || pFormat->nHeight < 1 || (pFormat->nWidth & 1) != 0)
+		return false;
+	pFormat->nStride = max(pFormat->nStride, pFormat->nWidth);
+	return true;
+}
+
+bool CHost::Command(istringstream &line, const string &command)
+{
+	string arg;
+	HostFormat format;
+	if (command == "input")
+	{
+		if (m_bRunning || !ParseFormat(line, &format, true))
+			return false;
+		ConnectInput(format);
+	}
+	else if (command == "output")
+	{
+		bool bSlices = line.str().find("slices") != string::npos;
+		if (m_bRunning || !ParseFormat(line, &format, false))
+			return false;
+		ConnectOutput(format.nWidth > 0 ? &format : NULL, bSlices);
+	}
+	else if (command == "preview")
+	{
+		if (m_bRunning || !(line >> arg) || (arg != "on" && arg != "off"))
+			return false;
+		ConnectPreview(arg == "on");
+	}
+	else if (command == "run")
+	{
+		if (m_bRunning)
+			return false;
+		Start();
+	}
+	else if (command == "stop")
+	{
+		if (!m_bRunning)
+			return false;
+		Stop();
+	}
+	else if (command == "frames")
+	{
+		int nFrames = 0;
+		if (!(line >> nFrames) || nFrames < 1)
+			return false;
+		Frames(nFrames);
+	}
+	else if (command == "set")
+	{
+		long lValue;
+		if (!(line >> arg >> lValue))
+			return false;
+		const char **pEnd = g_Parameters + sizeof(g_Parameters) / sizeof(g_Parameters[0]);
+		if (find(g_Parameters, pEnd, arg) == pEnd)
+			return false;
+		SetParameter(arg, lValue);
+	}
+	else if (command == "hold")
+	{
+		long lValue;
+		if (!m_bRunning || !(line >> arg >> lValue))
+			return false;
+		const char **pEnd = g_Parameters + sizeof(g_Parameters) / sizeof(g_Parameters[0]);
+		if (find(g_Parameters, pEnd, arg) == pEnd)
+			return false;
+		HoldParameter(arg, lValue);
+	}
+	else if (command == "format")
+	{
+		if (!(line >> arg) || (arg != "in" && arg != "out") || !ParseFormat(line, &format, true))
+			return false;
+		if (arg == "in")
+			FormatIn(format);
+		else
+			FormatOut(format);
+	}
+	else if (command == "quality")
+	{
+		double dLate;
+		if (!(line >> dLate))
+			return false;
+		Quality q;
+		q.Type = dLate > 0 ? Famine : Flood;
+		q.Proportion = dLate > 0 ? 500 : 1000;
+		q.Late = (REFERENCE_TIME)(dLate * 10000);
+		q.TimeStamp = m_tNext;
+		CHostTimer timer("Notify");
+		Check(static_cast<CTransformOutputPin *>(m_pFilter->Output())->Notify(NULL, q), "Notify");
+	}
+	else if (command == "flush")
+	{
+		int nFlushes = m_Renderer.m_nFlushes;
+		IPin *pInput = m_pFilter->Input();
+		CHostTimer timer("flush");
+		if (Check(pInput->BeginFlush(), "BeginFlush") && Check(pInput->EndFlush(), "EndFlush") &&
+			m_Renderer.m_nFlushes != nFlushes + 1)
+			Fail("the renderer was not flushed");
+	}
+	else if (command == "eos")
+	{
+		int nEndOfStream = m_PreviewRenderer.m_nEndOfStream;
+		if (Check(m_pFilter->Input()->EndOfStream(), "EndOfStream") && m_Renderer.m_nEndOfStream == 0)
+			Fail("the renderer got no end of stream");
+		if (m_PreviewRenderer.IsConnected() && m_PreviewRenderer.m_nEndOfStream == nEndOfStream)
+			Fail("the preview renderer got no end of stream");
+	}
+	else if (command == "check")
+	{
+		if (!(line >> arg) || (arg != "copy" && arg != "off"))
+			return false;
+		m_bCheckCopy = arg == "copy";
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+bool CHost::Run(const string &script)
+{
+	istringstream lines(script);
+	string text;
+	for (int nLine = 1; getline(lines, text); nLine++)
+	{
+		size_t nComment = text.find('#');
+		if (nComment != string::npos)
+			text.erase(nComment);
+		istringstream line(text);
+		string command;
+		if (!(line >> command))
+			continue;
+		size_t nFirst = text.find_first_not_of(" \t");
+		size_t nLast = text.find_last_not_of(" \t\r");
+		g_Where = text.substr(nFirst, nLast - nFirst + 1);
+		if (m_bVerbose)
+			printf("> %s\n", g_Where.c_str());
+		if (!Command(line, command))
+		{
+			fprintf(stderr, "fphost: line %d: cannot run \"%s\"\n", nLine, g_Where.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+//
+// The script fphost runs without one: format changes on both sides,
+// parameter changes and the features of the streaming thread, a resize with
+// slices and the preview, a flush and the end of the stream, and neutral
+// levels that have to give the input back
+//
+static string DefaultScript(int nWidth, int nHeight, int nFrames)
+{
+	int nHalfWidth = (nWidth / 2 + 1) & ~1, nHalfHeight = max(nHeight / 2, 1);
+	int nBigWidth = nWidth * 3 / 2 & ~1, nBigHeight = nHeight * 3 / 2;
+	char sz[2048];
+	snprintf(sz, sizeof(sz),
+		"input %1$dx%2$d\n"
+		"output\n"
+		"run\n"
+		"frames %7$d\n"
+		"set brightness 150\n"
+		"set contrast 140\n"
+		"set saturation 150\n"
+		"frames %7$d\n"
+		"set stats 1\n"
+		"set autolevels 1\n"
+		"set motion 1\n"
+		"set fingerprint 1\n"
+		"frames %7$d\n"
+		"# The property page while the renderer is paused\n"
+		"hold brightness 160\n"
+		"hold autolevels 0\n"
+		"hold outmatrix 2\n"
+		"hold outmatrix 0\n"
+		"frames %7$d\n"
+		"# The renderer moves to a surface with wider rows\n"
+		"format out %1$dx%2$d stride %8$d\n"
+		"frames %7$d\n"
+		"quality 60\n"
+		"frames %7$d\n"
+		"quality 0\n"
+		"stop\n"
+		"# Downscaled, slice by slice, with a preview\n"
+		"output %3$dx%4$d slices\n"
+		"preview on\n"
+		"run\n"
+		"frames %7$d\n"
+		"set sharpen 80\n"
+		"frames %7$d\n"
+		"flush\n"
+		"frames %7$d\n"
+		"eos\n"
+		"stop\n"
+		"# The source changes the frame size on the way\n"
+		"input %1$dx%2$d vih2\n"
+		"output\n"
+		"run\n"
+		"frames %7$d\n"
+		"format in %5$dx%6$d\n"
+		"frames %7$d\n"
+		"stop\n"
+		"# Neutral levels give the input back\n"
+		"input %1$dx%2$d\n"
+		"output\n"
+		"set brightness 127\n"
+		"set contrast 127\n"
+		"set gamma 128\n"
+		"set hue 128\n"
+		"set saturation 128\n"
+		"set autolevels 0\n"
+		"set sharpen 0\n"
+		"check copy\n"
+		"run\n"
+		"frames %7$d\n"
+		"stop\n",
+		nWidth, nHeight, nHalfWidth, nHalfHeight, nBigWidth, nBigHeight, nFrames, nWidth + 64);
+	return sz;
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: fphost [options] [SCRIPT]\n"
+		"  SCRIPT               commands to run, - for standard input (default: the built-in script)\n"
+		"  -s, --size WxH       frame size of the built-in script (default: 640x360)\n"
+		"  -n, --frames N       frames per step of the built-in script (default: 60)\n"
+		"  -p, --print          print the built-in script and exit\n"
+		"  -v, --verbose        print every command as it runs\n"
+		"parameters of set:");
+	for (size_t i = 0; i < sizeof(g_Parameters) / sizeof(g_Parameters[0]); i++)
+		fprintf(stderr, " %s", g_Parameters[i]);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	int nWidth = 640, nHeight = 360;
+	int nFrames = 60;
+	bool bPrint = false;
+	bool bVerbose = false;
+	const char *pszScript = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool bHasValue = i + 1 < argc;
+		if ((arg == "-s" || arg == "--size") && bHasValue)
+		{
+			if (sscanf(argv[++i], "%dx%d", &nWidth, &nHeight) != 2 || nWidth < 4 || nHeight < 2 ||
+				(nWidth & 1) != 0)
+			{
+				Usage();
+				return 2;
+			}
+		}
+		else if ((arg == "-n" || arg == "--frames") && bHasValue)
+		{
+			nFrames = atoi(argv[++i]);
+			if (nFrames < 1)
+			{
+				Usage();
+				return 2;
+			}
+		}
+		else if (arg == "-p" || arg == "--print")
+		{
+			bPrint = true;
+		}
+		else if (arg == "-v" || arg == "--verbose")
+		{
+			bVerbose = true;
+		}
+		else if ((arg == "-" || arg[0] != '-') && pszScript == NULL)
+		{
+			pszScript = argv[i];
+		}
+		else
+		{
+			Usage();
+			return arg == "-h" || arg == "--help" ? 0 : 2;
+		}
+	}
+
+	string script = DefaultScript(nWidth, nHeight, nFrames);
+	if (bPrint)
+	{
+		fputs(script.c_str(), stdout);
+		return 0;
+	}
+	if (pszScript != NULL)
+	{
+		FILE *pFile = strcmp(pszScript, "-") == 0 ? stdin : fopen(pszScript, "r");
+		if (pFile == NULL)
+		{
+			fprintf(stderr, "fphost: cannot open %s\n", pszScript);
+			return 2;
+		}
+		script.clear();
+		char buffer[4096];
+		size_t cb;
+		while ((cb = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+			script.append(buffer, cb);
+		if (pFile != stdin)
+			fclose(pFile);
+	}
+
+	CHost host(bVerbose);
+	if (!host.Create())
+		return 1;
+	if (!host.Run(script))
+	{
+		host.Destroy();
+		return 2;
+	}
+	host.Destroy();
+
+	printf("\n");
+	g_Timings.Print();
+	if (g_nFailures > 0)
+	{
+		printf("\n%d checks failed\n", g_nFailures);
+		return 1;
+	}
+	return 0;
+}
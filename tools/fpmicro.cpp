@@ -0,0 +1,641 @@
+//
+// fpmicro - microbenchmarks of the single kernels, with a regression gate
+//
+// Times the table builds (luma, chroma, 3D LUT lattice) and one pass of
+// every kind of row kernel (copy, luma, chroma, both, blend, cube) over
+// YUY2 and I420 frames small enough to stay in the L2 cache, once per
+// instruction set. fpbench measures whole frames under realistic memory
+// traffic; fpmicro keeps everything else still so that a change in one
+// kernel shows up as a change in one line.
+//
+// The thread is pinned to one CPU and every benchmark is warmed up before
+// it is timed. The time of a benchmark is the median of --rounds rounds,
+// with the median absolute deviation as its spread. Every round follows a
+// short round of a fixed calibration loop in registers, and a benchmark is compared by
+// the median of its rounds over their calibration rounds: whatever slows
+// the machine down for a while, or makes another machine of the same kind
+// faster, changes both alike. --save writes the times with the
+// calibration as a baseline; --baseline compares with one and exits 1
+// when a benchmark is more than --threshold percent slower than it. One
+// that fails is measured again after all the others, twice at most, and
+// keeps its best result, so that a burst of noise does not fail the run.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "../ColorEngine.h"
+
+using namespace std;
+
+//
+// What one benchmark does
+//
+enum MicroKind
+{
+	MICRO_LUT_LUMA = 0,   // UpdateLuma()
+	MICRO_LUT_CHROMA,     // UpdateChroma()
+	MICRO_LUT_CUBE,       // SetCube() of an identity cube, baked
+	MICRO_PASS            // One frame through the kernels
+};
+
+enum MicroOps
+{
+	OPS_COPY = 0,
+	OPS_LUMA,
+	OPS_CHROMA,
+	OPS_FULL,
+	OPS_BLEND,
+	OPS_CUBE,
+	OPS_COPY_NT           // Copy with non-temporal stores
+};
+
+static const char *const g_OpsNames[] = { "copy", "luma", "chroma", "full", "blend", "cube", "copy+nt" };
+
+struct MicroCase
+{
+	string name;
+	MicroKind kind;
+	MicroOps ops;
+	FrameFormat format;
+	ColorKernel kernel;
+	FrameIsa isa;
+	int nCube;            // Edge of the cube of MICRO_LUT_CUBE and OPS_CUBE
+};
+
+struct MicroResult
+{
+	double dTime;         // Median of the rounds: ns per pixel of a pass, us per table build
+	double dMad;          // Median absolute deviation of the rounds
+	double dCalibration;  // Median of the calibration rounds next to them, ns per step
+	double dRelative;     // Median of the round times over their calibration times
+};
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: fpmicro [options]\n"
+		"  -s, --size WxH       frame size of the passes (default: 320x180)\n"
+		"  -f, --filter TEXT    only the benchmarks whose name contains TEXT\n"
+		"  -r, --rounds N       timed rounds per benchmark (default: 15)\n"
+		"  -m, --round-ms MS    minimum time of a round (default: 5)\n"
+		"  -c, --cpu N          pin to CPU N (default: the one it starts on)\n"
+		"  -b, --baseline FILE  compare with FILE and exit 1 on a regression\n"
+		"  -t, --threshold PCT  slowdown that counts as a regression (default: 20)\n"
+		"      --no-scale       compare the times as they are, without the calibration\n"
+		"      --save FILE      write the times to FILE as a baseline\n"
+		"  -l, --list           list the benchmarks and exit\n");
+}
+
+static vector<MicroCase> AllCases(int nCube)
+{
+	vector<MicroCase> cases;
+	MicroCase c;
+	c.ops = OPS_COPY;
+	c.format = FRAME_FORMAT_YUY2;
+	c.kernel = KERNEL_DIRECT;
+	c.isa = FRAME_ISA_SCALAR;
+	c.nCube = nCube;
+
+	// The tables are built in scalar code whatever the instruction set
+	c.kind = MICRO_LUT_LUMA;
+	c.name = "lut/luma";
+	cases.push_back(c);
+	c.kind = MICRO_LUT_CHROMA;
+	c.name = "lut/chroma";
+	cases.push_back(c);
+	c.kind = MICRO_LUT_CUBE;
+	char name[64];
+	sprintf(name, "lut/cube%d", nCube);
+	c.name = name;
+	cases.push_back(c);
+
+	c.kind = MICRO_PASS;
+	for (int i = 0; i <= (int)FrameIsaBest(); i++)
+	{
+		c.isa = (FrameIsa)i;
+		for (int f = 0; f < 2; f++)
+		{
+			c.format = f == 0 ? FRAME_FORMAT_YUY2 : FRAME_FORMAT_I420;
+			for (int o = OPS_COPY; o <= OPS_COPY_NT; o++)
+			{
+				c.ops = (MicroOps)o;
+				if (c.ops == OPS_COPY_NT && c.isa < FRAME_ISA_SSE2)
+					continue;
+				// The memory walks of the packed kernels only differ with work to do
+				int nKernels = c.format == FRAME_FORMAT_YUY2 && c.ops == OPS_FULL ? KERNEL_COUNT : 1;
+				for (int k = 0; k < nKernels; k++)
+				{
+					c.kernel = nKernels > 1 ? (ColorKernel)k : KERNEL_DIRECT;
+					sprintf(name, "%s/%s/%s/%s", g_OpsNames[o], FrameFormatName(c.format),
+						FramePlanar(c.format) ? "planar" : CColorEngine::KernelName(c.kernel),
+						FrameIsaName(c.isa));
+					c.name = name;
+					cases.push_back(c);
+				}
+			}
+		}
+	}
+	return cases;
+}
+
+//
+// Source, second and target frame of one format, filled with a pattern
+// that every kernel has to work through
+//
+class CMicroFrames
+{
+public:
+	CMicroFrames() { memset(m_pb, 0, sizeof(m_pb)); }
+	~CMicroFrames()
+	{
+		for (int i = 0; i < 3; i++)
+			FrameFree(m_pb[i]);
+	}
+
+	bool Create(FrameFormat format, int nWidth, int nHeight)
+	{
+		size_t cb = FrameBytes(format, nWidth, nHeight);
+		for (int i = 0; i < 3; i++)
+		{
+			m_pb[i] = (unsigned char *)FrameAlloc(cb);
+			if (m_pb[i] == NULL)
+				return false;
+			unsigned int seed = 12345 + i;
+			for (size_t b = 0; b < cb; b++)
+			{
+				seed = seed * 1103515245 + 12345;
+				m_pb[i][b] = (unsigned char)(16 + (seed >> 16) % 220);
+			}
+			m_Desc[i] = FrameLayout(m_pb[i], format, nWidth, nHeight);
+		}
+		return true;
+	}
+
+	const FrameDesc &Source() const { return m_Desc[0]; }
+	const FrameDesc &Second() const { return m_Desc[1]; }
+	const FrameDesc &Target() const { return m_Desc[2]; }
+
+private:
+	unsigned char *m_pb[3];
+	FrameDesc m_Desc[3];
+};
+
+//
+// Pin the calling thread to one CPU, so that it is not moved to a cold
+// cache between rounds
+//
+static bool PinThread(int nCpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(nCpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+//
+// A fixed chain of multiplies in registers, with no engine code and no
+// memory in it. A short round of it is timed in front of every round of a
+// benchmark, and the benchmark is judged by its time relative to that: a
+// faster machine, a lower clock or a while without the CPU changes both
+// alike. A loop over memory would be a worse yardstick, since its time
+// depends as much on where its pages happen to fall in the cache.
+//
+class CCalibration
+{
+public:
+	CCalibration() : m_nPerRound(1), m_nState(1) {}
+
+	void Run()
+	{
+		unsigned long long x = m_nState;
+		for (int i = 0; i < STEPS; i++)
+		{
+			x ^= x >> 13;
+			x *= 0x9E3779B97F4A7C15ULL;
+		}
+		m_nState = x;
+	}
+
+	// Warm up, and size a round to dMs
+	void Prepare(double dMs)
+	{
+		long long nStart = FrameTicks();
+		for (int i = 0; i < 64; i++)
+			Run();
+		double dNs = (double)(FrameTicks() - nStart) * 1e9 / FrameTickFrequency();
+		m_nPerRound = (int)(dMs * 1e6 / (dNs / 64)) + 1;
+	}
+
+	// Time one round; ns per step
+	double Round()
+	{
+		long long nStart = FrameTicks();
+		for (int i = 0; i < m_nPerRound; i++)
+			Run();
+		return (double)(FrameTicks() - nStart) * 1e9 / FrameTickFrequency() / ((double)m_nPerRound * STEPS);
+	}
+
+	enum { STEPS = 4096 };
+
+private:
+	int m_nPerRound;
+	volatile unsigned long long m_nState;   // Keeps the chain from being dropped
+};
+
+//
+// One benchmark, set up on its own engine
+//
+class CMicroRunner
+{
+public:
+	CMicroRunner(const MicroCase &c, const CMicroFrames &frames, const CColorCube &cube)
+		: m_Case(c), m_Frames(frames), m_Cube(cube), m_nCall(0)
+	{
+		m_Engine.SetIsa(c.isa);
+		m_Engine.SetStreaming(c.ops == OPS_COPY_NT ? STREAM_ON : STREAM_OFF);
+		bool bLuma = c.ops == OPS_LUMA || c.ops == OPS_FULL;
+		bool bChroma = c.ops == OPS_CHROMA || c.ops == OPS_FULL;
+		m_Engine.UpdateLuma(bLuma ? 140 : 127, bLuma ? 150 : 127, bLuma ? 120 : 128);
+		m_Engine.UpdateChroma(bChroma ? 150 : 128, bChroma ? 160 : 128);
+		if (c.kind == MICRO_PASS && c.ops == OPS_BLEND)
+			m_Engine.SetBlend(&frames.Second());
+		if (c.kind == MICRO_PASS && c.ops == OPS_CUBE)
+			m_Engine.SetCube(cube, false);
+	}
+
+	// Units of work of one call: pixels of a pass, or a thousandth of a
+	// table build, so that builds come out in microseconds
+	double Units() const
+	{
+		return m_Case.kind == MICRO_PASS ? (double)m_Frames.Source().nWidth * m_Frames.Source().nHeight : 1000;
+	}
+
+	void Run()
+	{
+		// The builds alternate between two settings, so that none is a no-op
+		int n = m_nCall++ & 1;
+		switch (m_Case.kind)
+		{
+		case MICRO_LUT_LUMA:
+			m_Engine.UpdateLuma(n ? 140 : 120, 150, n ? 120 : 130);
+			break;
+		case MICRO_LUT_CHROMA:
+			m_Engine.UpdateChroma(n ? 150 : 110, 160);
+			break;
+		case MICRO_LUT_CUBE:
+			m_Engine.SetCube(m_Cube, true);
+			break;
+		case MICRO_PASS:
+		default:
+			m_Engine.Process(m_Frames.Source(), m_Frames.Target(), m_Case.kernel);
+			break;
+		}
+	}
+
+private:
+	const MicroCase &m_Case;
+	const CMicroFrames &m_Frames;
+	const CColorCube &m_Cube;
+	CColorEngine m_Engine;
+	int m_nCall;
+};
+
+static bool RelativeLess(const MicroResult &a, const MicroResult &b)
+{
+	return a.dRelative < b.dRelative;
+}
+
+// The value below which a fraction dAt of v lies, interpolated
+static double Quantile(vector<double> v, double dAt)
+{
+	sort(v.begin(), v.end());
+	double dIndex = dAt * (v.size() - 1);
+	size_t i = (size_t)dIndex;
+	return i + 1 < v.size() ? v[i] + (v[i + 1] - v[i]) * (dIndex - i) : v[i];
+}
+
+//
+// Warm up, size the rounds to dRoundMs, then time nRounds of them, each
+// right after a round of pCal; pRun is called as pRun->Run() and does
+// dUnits of work each time
+//
+template <class T>
+static MicroResult Measure(T *pRun, double dUnits, CCalibration *pCal, int nRounds, double dRoundMs)
+{
+	const double dTicksPerNs = (double)FrameTickFrequency() / 1e9;
+
+	// Warm up the caches and the branch predictors for at least 50 ms,
+	// and count the calls that fill a round meanwhile
+	long long nCalls = 0;
+	long long nStart = FrameTicks();
+	double dNs = 0;
+	while (dNs < 50e6 || nCalls < 3)
+	{
+		pRun->Run();
+		nCalls++;
+		dNs = (FrameTicks() - nStart) / dTicksPerNs;
+	}
+	long long nPerRound = (long long)(dRoundMs * 1e6 / (dNs / nCalls)) + 1;
+
+	vector<double> rounds, calibration, relative;
+	for (int r = 0; r < nRounds; r++)
+	{
+		calibration.push_back(pCal->Round());
+		long long t = FrameTicks();
+		for (long long i = 0; i < nPerRound; i++)
+			pRun->Run();
+		rounds.push_back((FrameTicks() - t) / dTicksPerNs / ((double)nPerRound * dUnits));
+		relative.push_back(rounds.back() / calibration.back());
+	}
+
+	MicroResult result;
+	result.dTime = Quantile(rounds, 0.5);
+	vector<double> deviations;
+	for (size_t i = 0; i < rounds.size(); i++)
+		deviations.push_back(rounds[i] > result.dTime ? rounds[i] - result.dTime : result.dTime - rounds[i]);
+	result.dMad = Quantile(deviations, 0.5);
+	result.dCalibration = Quantile(calibration, 0.5);
+	result.dRelative = Quantile(relative, 0.5);
+	return result;
+}
+
+//
+// A baseline: a "<name> <time> <calibration ns per step>" line for every
+// benchmark; # starts a comment, the first one with the frame size
+//
+struct MicroBaseline
+{
+	double dTime;
+	double dCalibration;
+};
+
+static bool LoadBaseline(const char *pszFile, map<string, MicroBaseline> *pBaseline,
+	int *pWidth, int *pHeight)
+{
+	FILE *fp = fopen(pszFile, "r");
+	if (fp == NULL)
+		return false;
+	char line[256];
+	*pWidth = *pHeight = 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char name[128];
+		MicroBaseline b;
+		if (*pWidth == 0)
+			sscanf(line, "# fpmicro baseline of %dx%d", pWidth, pHeight);
+		if (line[0] != '#' && sscanf(line, "%127s %lf %lf", name, &b.dTime, &b.dCalibration) == 3 &&
+			b.dTime > 0 && b.dCalibration > 0)
+			(*pBaseline)[name] = b;
+	}
+	fclose(fp);
+	return true;
+}
+
+// The model of the CPU, for the baseline to say where it was taken
+static string CpuModel()
+{
+	string model = "unknown CPU";
+	FILE *fp = fopen("/proc/cpuinfo", "r");
+	if (fp == NULL)
+		return model;
+	char line[256];
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		const char *pColon = strchr(line, ':');
+		if (strncmp(line, "model name", 10) == 0 && pColon != NULL)
+		{
+			model = pColon + 1 + strspn(pColon + 1, " \t");
+			model.erase(model.find_last_not_of(" \t\r\n") + 1);
+			break;
+		}
+	}
+	fclose(fp);
+	return model;
+}
+
+static bool SaveBaseline(const char *pszFile, const vector<MicroCase> &cases,
+	const vector<MicroResult> &results, int nWidth, int nHeight)
+{
+	FILE *fp = fopen(pszFile, "w");
+	if (fp == NULL)
+		return false;
+	fprintf(fp, "# fpmicro baseline of %dx%d passes: benchmark, median ns per pixel of a pass\n"
+		"# or us per table build at the median calibration ns per step next to it\n"
+		"# taken on %s\n", nWidth, nHeight, CpuModel().c_str());
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		// The time at the median calibration, so that the relative time is
+		// the measured one
+		fprintf(fp, "%s %.4f %.4f\n", cases[i].name.c_str(), results[i].dRelative * results[i].dCalibration,
+			results[i].dCalibration);
+	}
+	return fclose(fp) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	int nWidth = 320, nHeight = 180;
+	const char *pszFilter = NULL;
+	int nRounds = 15;
+	double dRoundMs = 5;
+	int nCpu = -1;
+	const char *pszBaseline = NULL;
+	double dThreshold = 20;
+	bool bScale = true;
+	const char *pszSave = NULL;
+	bool bList = false;
+	const int nCube = 17;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool bHasValue = i + 1 < argc;
+		if ((arg == "-s" || arg == "--size") && bHasValue)
+		{
+			if (sscanf(argv[++i], "%dx%d", &nWidth, &nHeight) != 2 || nWidth < 2 || nHeight < 2 ||
+				nWidth > g_FrameMaxSize || nHeight > g_FrameMaxSize)
+			{
+				fprintf(stderr, "fpmicro: bad size '%s'\n", argv[i]);
+				return 2;
+			}
+		}
+		else if ((arg == "-f" || arg == "--filter") && bHasValue)
+		{
+			pszFilter = argv[++i];
+		}
+		else if ((arg == "-r" || arg == "--rounds") && bHasValue)
+		{
+			nRounds = atoi(argv[++i]);
+			if (nRounds < 1)
+				nRounds = 1;
+		}
+		else if ((arg == "-m" || arg == "--round-ms") && bHasValue)
+		{
+			dRoundMs = atof(argv[++i]);
+		}
+		else if ((arg == "-c" || arg == "--cpu") && bHasValue)
+		{
+			nCpu = atoi(argv[++i]);
+		}
+		else if ((arg == "-b" || arg == "--baseline") && bHasValue)
+		{
+			pszBaseline = argv[++i];
+		}
+		else if ((arg == "-t" || arg == "--threshold") && bHasValue)
+		{
+			dThreshold = atof(argv[++i]);
+		}
+		else if (arg == "--no-scale")
+		{
+			bScale = false;
+		}
+		else if (arg == "--save" && bHasValue)
+		{
+			pszSave = argv[++i];
+		}
+		else if (arg == "-l" || arg == "--list")
+		{
+			bList = true;
+		}
+		else
+		{
+			Usage();
+			return 2;
+		}
+	}
+
+	vector<MicroCase> cases;
+	vector<MicroCase> all = AllCases(nCube);
+	for (size_t i = 0; i < all.size(); i++)
+	{
+		if (pszFilter == NULL || all[i].name.find(pszFilter) != string::npos)
+			cases.push_back(all[i]);
+	}
+	if (bList)
+	{
+		for (size_t i = 0; i < cases.size(); i++)
+			printf("%s\n", cases[i].name.c_str());
+		return 0;
+	}
+	if (cases.empty())
+	{
+		fprintf(stderr, "fpmicro: no benchmark matches '%s'\n", pszFilter);
+		return 2;
+	}
+
+	map<string, MicroBaseline> baseline;
+	int nBaseWidth, nBaseHeight;
+	if (pszBaseline != NULL && !LoadBaseline(pszBaseline, &baseline, &nBaseWidth, &nBaseHeight))
+	{
+		fprintf(stderr, "fpmicro: cannot read %s\n", pszBaseline);
+		return 2;
+	}
+	if (pszBaseline != NULL && (nBaseWidth != nWidth || nBaseHeight != nHeight))
+	{
+		fprintf(stderr, "fpmicro: %s is of %dx%d passes, not %dx%d\n", pszBaseline,
+			nBaseWidth, nBaseHeight, nWidth, nHeight);
+		return 2;
+	}
+
+	if (nCpu < 0)
+		nCpu = sched_getcpu() >= 0 ? sched_getcpu() : 0;
+	if (!PinThread(nCpu))
+		fprintf(stderr, "fpmicro: cannot pin to CPU %d, timing unpinned\n", nCpu);
+
+	CMicroFrames yuy2, i420;
+	if (!yuy2.Create(FRAME_FORMAT_YUY2, nWidth, nHeight) || !i420.Create(FRAME_FORMAT_I420, nWidth, nHeight))
+	{
+		fprintf(stderr, "fpmicro: out of memory\n");
+		return 1;
+	}
+	CColorCube cube;
+	cube.Identity(nCube);
+
+	CCalibration calibration;
+	calibration.Prepare(dRoundMs / 4);
+
+	printf("%dx%d, CPU %d, %d rounds of %g ms\n\n%-30s %10s %7s %10s %8s\n", nWidth, nHeight, nCpu,
+		nRounds, dRoundMs, "benchmark", "time", "mad", "baseline", "change");
+
+	// Every benchmark once, then up to two more passes over the ones that
+	// are too slow, so that the retries come at other times than the first
+	// measurement and a noisy stretch of the machine passes. A baseline
+	// to save takes all three passes of every benchmark and keeps the
+	// middle one, so that it is not set by a lucky pass.
+	vector<MicroResult> results(cases.size());
+	vector<double> change(cases.size(), 0);
+	vector<vector<MicroResult> > passes(cases.size());
+	for (int nPass = 0; nPass < 3; nPass++)
+	{
+		for (size_t i = 0; i < cases.size(); i++)
+		{
+			map<string, MicroBaseline>::const_iterator it = baseline.find(cases[i].name);
+			bool bRetry = it != baseline.end() && change[i] > dThreshold;
+			if (nPass > 0 && pszSave == NULL && !bRetry)
+				continue;
+			const MicroCase &c = cases[i];
+			CMicroRunner run(c, c.format == FRAME_FORMAT_YUY2 ? yuy2 : i420, cube);
+			MicroResult r = Measure(&run, run.Units(), &calibration, nRounds, dRoundMs);
+			passes[i].push_back(r);
+			if (it == baseline.end())
+			{
+				results[i] = r;
+				continue;
+			}
+			const MicroBaseline &b = it->second;
+			double dChange = bScale ? r.dRelative / (b.dTime / b.dCalibration) : r.dTime / b.dTime;
+			dChange = (dChange - 1) * 100;
+			if (nPass == 0 || dChange < change[i])
+			{
+				results[i] = r;
+				change[i] = dChange;
+			}
+		}
+	}
+
+	int nRegressed = 0;
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		const MicroResult &r = results[i];
+		const char *pszUnit = cases[i].kind == MICRO_PASS ? "ns/px" : "us";
+		printf("%-30s %10.4f %6.1f%% ", cases[i].name.c_str(), r.dTime, r.dTime > 0 ? r.dMad * 100 / r.dTime : 0);
+		map<string, MicroBaseline>::const_iterator it = baseline.find(cases[i].name);
+		if (it != baseline.end())
+		{
+			// The baseline time at the calibration of this run
+			const MicroBaseline &b = it->second;
+			double dExpected = bScale ? b.dTime * r.dCalibration / b.dCalibration : b.dTime;
+			bool bRegressed = change[i] > dThreshold;
+			printf("%10.4f %+7.1f%% %s%s\n", dExpected, change[i], pszUnit, bRegressed ? "  REGRESSED" : "");
+			if (bRegressed)
+				nRegressed++;
+		}
+		else
+		{
+			printf("%10s %8s %s\n", pszBaseline != NULL ? "new" : "-", "", pszUnit);
+		}
+	}
+
+	if (pszSave != NULL)
+	{
+		for (size_t i = 0; i < cases.size(); i++)
+		{
+			vector<MicroResult> &p = passes[i];
+			sort(p.begin(), p.end(), RelativeLess);
+			results[i] = p[p.size() / 2];
+		}
+	}
+	if (pszSave != NULL && !SaveBaseline(pszSave, cases, results, nWidth, nHeight))
+	{
+		fprintf(stderr, "fpmicro: cannot write %s\n", pszSave);
+		return 1;
+	}
+	if (pszBaseline != NULL)
+		printf("\n%d of %d benchmarks regressed by more than %g%%\n", nRegressed, (int)cases.size(), dThreshold);
+	return nRegressed > 0 ? 1 : 0;
+}
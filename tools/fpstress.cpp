@@ -0,0 +1,1042 @@
+//
+// fpstress - frame sizes and layouts the filter may be handed
+//
+// Runs every format through the engine paths the filter uses - the plain
+// transform with each kernel and instruction set, streaming stores,
+// slices, the blend, the bypass, row reuse, motion detection, overlays,
+// the chroma key, the preview, the fingerprint and the resize/unsharp
+// pipeline - on frames from 2x2 up to 7680x4320, with odd widths and
+// heights, row strides that are not a multiple of 4 and bottom-up frames
+// with negative strides.
+//
+// Every frame sits in a buffer with guard bytes around the planes and in
+// the row padding. The tool checks the transformed pixels against
+// CColorEngine::Apply(), a resized frame against the same frame processed
+// in a tightly packed layout on one thread, and that no byte outside the
+// pixels of the target, nor any byte of the source, has changed. The
+// motion measured in bands must be what one pass over the frame finds, and
+// an overlay, a key or a fingerprint made by the workers what one pass
+// makes. Apart from that, clear and opaque layers, screens at and far from
+// the key colour, the box average of the preview and the frozen count of
+// repeated frames are checked against what they have to give. A scripted
+// run of quality messages checks the level CFrameQos sheds to on every
+// frame and its counters.
+// The exit status is non-zero when anything failed.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../ColorEngine.h"
+#include "../ColorCube.h"
+#include "../FrameScaler.h"
+#include "../FrameSharpen.h"
+#include "../FramePipeline.h"
+#include "../FrameReuse.h"
+#include "../FrameMotion.h"
+#include "../FrameOverlay.h"
+#include "../FrameKey.h"
+#include "../FramePreview.h"
+#include "../FrameFingerprint.h"
+#include "../FrameQos.h"
+
+using namespace std;
+
+static const int g_Sizes[][2] =
+{
+	{ 2, 2 }, { 3, 3 }, { 4, 1 }, { 1, 4 }, { 5, 7 }, { 17, 9 }, { 33, 17 },
+	{ 127, 63 }, { 641, 479 }, { 1279, 719 }, { 1920, 1080 }, { 3841, 2161 },
+	{ 7680, 4320 }
+};
+static const int g_nSizes = sizeof(g_Sizes) / sizeof(g_Sizes[0]);
+
+// Frames larger than this only go through the plain transform and one
+// resize, which keeps a full run to a few minutes on one core
+static const size_t g_LargePixels = 1920 * 1088;
+
+// Bytes of guard in front of, between and after the planes
+static const size_t g_GuardBytes = 64;
+
+//
+// Row layouts: the padding added to every stride and whether the frame is
+// stored bottom-up
+//
+struct Layout
+{
+	const char *pszName;
+	int nPad;
+	bool bFlip;
+};
+
+static const Layout g_Layouts[] =
+{
+	{ "packed", 0, false },
+	{ "pad+3", 3, false },
+	{ "pad+6", 6, false },
+	{ "flip+1", 1, true },
+};
+static const int g_nLayouts = sizeof(g_Layouts) / sizeof(g_Layouts[0]);
+
+static unsigned char GuardByte(size_t i)
+{
+	return (unsigned char)((i * 151 + 89) ^ 0x5a);
+}
+
+//
+// CStressFrame
+//
+// A frame in a buffer of guard bytes; DamagedGuards() counts the bytes
+// outside the pixels that have changed
+//
+class CStressFrame
+{
+public:
+	CStressFrame(FrameFormat format, int nWidth, int nHeight, const Layout &layout)
+	{
+		int sx = 0, sy = 0;
+		if (FramePlanar(format))
+			FrameChromaShift(format, &sx, &sy);
+		m_cbRow = FramePlanar(format) ? (size_t)nWidth : (size_t)((nWidth + 1) / 2) * 4;
+		m_cbRowUV = FramePlanar(format) ? (size_t)((nWidth + sx) >> sx) : 0;
+		m_nRowsUV = FramePlanar(format) ? (nHeight + sy) >> sy : 0;
+		const size_t lStride = m_cbRow + layout.nPad;
+		const size_t lStrideUV = m_cbRowUV + layout.nPad;
+
+		size_t cbY = lStride * nHeight;
+		size_t cbUV = lStrideUV * m_nRowsUV;
+		m_Buffer.resize(cbY + 2 * cbUV + 4 * g_GuardBytes);
+		for (size_t i = 0; i < m_Buffer.size(); i++)
+			m_Buffer[i] = GuardByte(i);
+
+		unsigned char *pb = &m_Buffer[0] + g_GuardBytes;
+		m_Desc.format = format;
+		m_Desc.nWidth = nWidth;
+		m_Desc.nHeight = nHeight;
+		m_Desc.pbTop = Plane(pb, lStride, nHeight, layout.bFlip, &m_Desc.lStride);
+		m_Desc.pbU = NULL;
+		m_Desc.pbV = NULL;
+		m_Desc.lStrideUV = 0;
+		if (FramePlanar(format))
+		{
+			pb += cbY + g_GuardBytes;
+			m_Desc.pbU = Plane(pb, lStrideUV, m_nRowsUV, layout.bFlip, &m_Desc.lStrideUV);
+			pb += cbUV + g_GuardBytes;
+			m_Desc.pbV = Plane(pb, lStrideUV, m_nRowsUV, layout.bFlip, &m_Desc.lStrideUV);
+		}
+	}
+
+	const FrameDesc &Desc() const { return m_Desc; }
+	size_t RowBytes() const { return m_cbRow; }
+	size_t RowBytesUV() const { return m_cbRowUV; }
+	int RowsUV() const { return m_nRowsUV; }
+
+	unsigned char *Row(int y) const { return m_Desc.pbTop + m_Desc.lStride * y; }
+	unsigned char *RowU(int y) const { return m_Desc.pbU + m_Desc.lStrideUV * y; }
+	unsigned char *RowV(int y) const { return m_Desc.pbV + m_Desc.lStrideUV * y; }
+
+	// Pixels from a fixed seed, so that every layout of a size holds the
+	// same picture
+	void Fill(unsigned int nSeed)
+	{
+		for (int y = 0; y < m_Desc.nHeight; y++)
+			FillRow(Row(y), m_cbRow, &nSeed);
+		for (int y = 0; y < m_nRowsUV; y++)
+		{
+			FillRow(RowU(y), m_cbRowUV, &nSeed);
+			FillRow(RowV(y), m_cbRowUV, &nSeed);
+		}
+	}
+
+	// Bytes outside the pixels that differ from the guard
+	size_t DamagedGuards() const
+	{
+		vector<bool> mask(m_Buffer.size(), false);
+		Mark(&mask, m_Desc.pbTop, m_Desc.lStride, m_Desc.nHeight, m_cbRow);
+		if (FramePlanar(m_Desc.format))
+		{
+			Mark(&mask, m_Desc.pbU, m_Desc.lStrideUV, m_nRowsUV, m_cbRowUV);
+			Mark(&mask, m_Desc.pbV, m_Desc.lStrideUV, m_nRowsUV, m_cbRowUV);
+		}
+		size_t n = 0;
+		for (size_t i = 0; i < m_Buffer.size(); i++)
+		{
+			if (!mask[i] && m_Buffer[i] != GuardByte(i))
+				n++;
+		}
+		return n;
+	}
+
+	// Rows that differ from those of another frame of the same size
+	int DifferentRows(const CStressFrame &other) const
+	{
+		int n = 0;
+		for (int y = 0; y < m_Desc.nHeight; y++)
+			n += memcmp(Row(y), other.Row(y), m_cbRow) != 0;
+		for (int y = 0; y < m_nRowsUV; y++)
+		{
+			n += memcmp(RowU(y), other.RowU(y), m_cbRowUV) != 0;
+			n += memcmp(RowV(y), other.RowV(y), m_cbRowUV) != 0;
+		}
+		return n;
+	}
+
+	// Pixel data only, in a fixed order, for comparing the source before
+	// and after
+	void Snapshot(vector<unsigned char> *pPixels) const
+	{
+		pPixels->clear();
+		for (int y = 0; y < m_Desc.nHeight; y++)
+			pPixels->insert(pPixels->end(), Row(y), Row(y) + m_cbRow);
+		for (int y = 0; y < m_nRowsUV; y++)
+		{
+			pPixels->insert(pPixels->end(), RowU(y), RowU(y) + m_cbRowUV);
+			pPixels->insert(pPixels->end(), RowV(y), RowV(y) + m_cbRowUV);
+		}
+	}
+
+private:
+	static unsigned char *Plane(unsigned char *pb, size_t lStride, int nRows, bool bFlip, ptrdiff_t *plStride)
+	{
+		*plStride = bFlip ? -(ptrdiff_t)lStride : (ptrdiff_t)lStride;
+		return bFlip ? pb + lStride * (nRows - 1) : pb;
+	}
+
+	static void FillRow(unsigned char *pb, size_t cb, unsigned int *pSeed)
+	{
+		for (size_t i = 0; i < cb; i++)
+		{
+			*pSeed = *pSeed * 1103515245 + 12345;
+			pb[i] = (unsigned char)(*pSeed >> 16);
+		}
+	}
+
+	void Mark(vector<bool> *pMask, const unsigned char *pbTop, ptrdiff_t lStride, int nRows, size_t cbRow) const
+	{
+		for (int y = 0; y < nRows; y++)
+		{
+			size_t i = (pbTop + lStride * y) - &m_Buffer[0];
+			for (size_t x = 0; x < cbRow; x++)
+				(*pMask)[i + x] = true;
+		}
+	}
+
+	vector<unsigned char> m_Buffer;
+	FrameDesc m_Desc;
+	size_t m_cbRow;
+	size_t m_cbRowUV;
+	int m_nRowsUV;
+};
+
+//
+// What the kernels should have made of src, by CColorEngine::Apply() on
+// every pixel, with the target averaged with pBlend when given
+//
+static void Reference(const CColorEngine &engine, const CStressFrame &src, const CStressFrame *pBlend,
+	CStressFrame *pRef)
+{
+	const FrameDesc &s = src.Desc();
+	unsigned char y0, y1, u, v;
+	if (!FramePlanar(s.format))
+	{
+		// Y0 U Y1 V or U Y0 V Y1; an odd width still has whole macropixels
+		const int iY = s.format == FRAME_FORMAT_UYVY ? 1 : 0;
+		const int iC = 1 - iY;
+		for (int y = 0; y < s.nHeight; y++)
+		{
+			const unsigned char *ps = src.Row(y);
+			unsigned char *pd = pRef->Row(y);
+			for (size_t x = 0; x < src.RowBytes(); x += 4)
+			{
+				engine.Apply(ps[x + iY], ps[x + iC], ps[x + iC + 2], &y0, &u, &v);
+				engine.Apply(ps[x + iY + 2], ps[x + iC], ps[x + iC + 2], &y1, &u, &v);
+				pd[x + iY] = y0;
+				pd[x + iC] = u;
+				pd[x + iY + 2] = y1;
+				pd[x + iC + 2] = v;
+			}
+		}
+	}
+	else
+	{
+		int sx, sy;
+		FrameChromaShift(s.format, &sx, &sy);
+		for (int y = 0; y < s.nHeight; y++)
+		{
+			const unsigned char *ps = src.Row(y);
+			const unsigned char *psu = src.RowU(y >> sy);
+			const unsigned char *psv = src.RowV(y >> sy);
+			unsigned char *pd = pRef->Row(y);
+			for (int x = 0; x < s.nWidth; x++)
+				engine.Apply(ps[x], psu[x >> sx], psv[x >> sx], &pd[x], &u, &v);
+		}
+		for (int y = 0; y < src.RowsUV(); y++)
+		{
+			const unsigned char *psu = src.RowU(y);
+			const unsigned char *psv = src.RowV(y);
+			unsigned char *pdu = pRef->RowU(y);
+			unsigned char *pdv = pRef->RowV(y);
+			for (size_t x = 0; x < src.RowBytesUV(); x++)
+				engine.Apply(128, psu[x], psv[x], &y0, &pdu[x], &pdv[x]);
+		}
+	}
+
+	if (pBlend == NULL)
+		return;
+	for (int y = 0; y < s.nHeight; y++)
+	{
+		for (size_t x = 0; x < src.RowBytes(); x++)
+			pRef->Row(y)[x] = (unsigned char)((pRef->Row(y)[x] + pBlend->Row(y)[x]) >> 1);
+	}
+	for (int y = 0; y < src.RowsUV(); y++)
+	{
+		for (size_t x = 0; x < src.RowBytesUV(); x++)
+		{
+			pRef->RowU(y)[x] = (unsigned char)((pRef->RowU(y)[x] + pBlend->RowU(y)[x]) >> 1);
+			pRef->RowV(y)[x] = (unsigned char)((pRef->RowV(y)[x] + pBlend->RowV(y)[x]) >> 1);
+		}
+	}
+}
+
+//
+// Sample x of row y of a plane of a frame: 0 for luma, 1 and 2 for U and V
+//
+static unsigned char *Sample(const FrameDesc &d, int nPlane, int x, int y)
+{
+	if (FramePlanar(d.format))
+	{
+		if (nPlane == 0)
+			return d.pbTop + d.lStride * y + x;
+		return (nPlane == 1 ? d.pbU : d.pbV) + d.lStrideUV * y + x;
+	}
+	const int iY = d.format == FRAME_FORMAT_UYVY ? 1 : 0;
+	unsigned char *pbRow = d.pbTop + d.lStride * y;
+	return nPlane == 0 ? pbRow + x * 2 + iY : pbRow + x * 4 + (1 - iY) + (nPlane == 2 ? 2 : 0);
+}
+
+// Samples per row and rows of a plane; an odd packed width has whole
+// macropixels
+static void PlaneSize(const FrameDesc &d, int nPlane, int *pSamples, int *pRows)
+{
+	int sx = 1, sy = 0;
+	if (FramePlanar(d.format))
+		FrameChromaShift(d.format, &sx, &sy);
+	if (nPlane == 0)
+	{
+		*pSamples = FramePlanar(d.format) ? d.nWidth : (d.nWidth + 1) & ~1;
+		*pRows = d.nHeight;
+	}
+	else
+	{
+		*pSamples = (d.nWidth + sx) >> sx;
+		*pRows = (d.nHeight + sy) >> sy;
+	}
+}
+
+// The chroma sample of a luma sample
+static void ChromaOf(const FrameDesc &d, int x, int y, int *pX, int *pY)
+{
+	int sx = 1, sy = 0;
+	if (FramePlanar(d.format))
+		FrameChromaShift(d.format, &sx, &sy);
+	*pX = x >> sx;
+	*pY = y >> sy;
+}
+
+// Every sample of a frame to one value per plane
+static void Paint(const FrameDesc &d, const unsigned char *pValues)
+{
+	for (int p = 0; p < 3; p++)
+	{
+		int nSamples, nRows;
+		PlaneSize(d, p, &nSamples, &nRows);
+		for (int y = 0; y < nRows; y++)
+			for (int x = 0; x < nSamples; x++)
+				*Sample(d, p, x, y) = pValues[p];
+	}
+}
+
+// Samples of the preview that are not the rounded box average of the
+// nFactor x nFactor target samples under them, or -1 when the preview
+// does not have the size of whole chroma blocks in the target / nFactor
+static int PreviewErrors(const FrameDesc &target, const FrameDesc &preview, int nFactor)
+{
+	int sx = 1, sy = 0;
+	if (FramePlanar(target.format))
+		FrameChromaShift(target.format, &sx, &sy);
+	int nWidth = target.nWidth / nFactor >> sx << sx;
+	int nHeight = target.nHeight / nFactor >> sy << sy;
+	if (nWidth == 0 || nHeight == 0)
+		nWidth = nHeight = 0;
+	if (preview.nWidth != nWidth || preview.nHeight != nHeight)
+		return -1;
+	if (nWidth == 0)
+		return 0;
+
+	int nErrors = 0;
+	for (int p = 0; p < 3; p++)
+	{
+		int nSamples, nRows;
+		PlaneSize(preview, p, &nSamples, &nRows);
+		for (int y = 0; y < nRows; y++)
+		{
+			for (int x = 0; x < nSamples; x++)
+			{
+				int nSum = 0;
+				for (int j = 0; j < nFactor; j++)
+					for (int i = 0; i < nFactor; i++)
+						nSum += *Sample(target, p, x * nFactor + i, y * nFactor + j);
+				int nMean = (nSum + nFactor * nFactor / 2) / (nFactor * nFactor);
+				nErrors += *Sample(preview, p, x, y) != nMean;
+			}
+		}
+	}
+	return nErrors;
+}
+
+//
+// Checks that slices arrive in order from the top and cover the frame
+//
+class CSliceCheck : public CFrameSliceSink
+{
+public:
+	CSliceCheck() : m_nNext(0), m_bOrder(true) {}
+
+	virtual void SliceDone(const FrameDesc &dst, int nFirstRow, int nLastRow)
+	{
+		m_bOrder = m_bOrder && nFirstRow == m_nNext && nLastRow > nFirstRow && nLastRow <= dst.nHeight;
+		m_nNext = nLastRow;
+	}
+
+	bool Complete(int nHeight) const { return m_bOrder && m_nNext == nHeight; }
+
+private:
+	int m_nNext;
+	bool m_bOrder;
+};
+
+struct StressOptions
+{
+	int nMaxWidth;
+	int nMaxHeight;
+	bool bVerbose;
+};
+
+static int g_nCases = 0;
+static int g_nFailures = 0;
+
+static void Report(bool bOk, const char *pszPath, FrameFormat format, int nWidth, int nHeight,
+	const Layout &layout, const char *pszWhat, const StressOptions &opt)
+{
+	g_nCases++;
+	if (!bOk)
+		g_nFailures++;
+	if (!bOk || opt.bVerbose)
+	{
+		printf("%-4s %-18s %-5s %5dx%-5d %-7s %s\n", bOk ? "ok" : "FAIL", pszPath,
+			FrameFormatName(format), nWidth, nHeight, layout.pszName, pszWhat);
+	}
+}
+
+//
+// One run of the engine into a fresh target, checked against the reference
+// and the guards of both frames
+//
+static void CheckRun(const char *pszPath, CColorEngine *pEngine, CFrameStage *pStage, CFrameWorkers *pWorkers,
+	ColorKernel kernel, const CStressFrame &src, const vector<unsigned char> &srcPixels,
+	const CStressFrame &ref, const Layout &layout, const StressOptions &opt)
+{
+	const FrameDesc &s = src.Desc();
+	const FrameDesc &r = ref.Desc();
+	CStressFrame dst(s.format, r.nWidth, r.nHeight, layout);
+	pEngine->ProcessStage(s, dst.Desc(), pStage, kernel, pWorkers, NULL);
+
+	vector<unsigned char> after;
+	src.Snapshot(&after);
+	char what[96];
+	int nRows = dst.DifferentRows(ref);
+	size_t nDst = dst.DamagedGuards();
+	size_t nSrc = src.DamagedGuards();
+	sprintf(what, "%d rows differ, %lu + %lu guard bytes written", nRows, (unsigned long)nDst, (unsigned long)nSrc);
+	bool bOk = nRows == 0 && nDst == 0 && nSrc == 0 && after == srcPixels;
+	if (after != srcPixels)
+		strcat(what, ", source changed");
+	Report(bOk, pszPath, s.format, s.nWidth, s.nHeight, layout, what, opt);
+}
+
+static void StressSize(FrameFormat format, int nWidth, int nHeight, CFrameWorkers *pWorkers,
+	const StressOptions &opt)
+{
+	const bool bLarge = (size_t)nWidth * nHeight > g_LargePixels;
+	const ColorKernel kernels[] = { KERNEL_DIRECT, KERNEL_UNROLLED };
+
+	// A resize to a size that is odd in both directions, and an unsharp mask
+	// behind it, are checked against the packed layout on one thread
+	const int nScaleWidth = nWidth > 2 ? nWidth * 2 / 3 | 1 : 3;
+	const int nScaleHeight = nHeight > 2 ? nHeight * 3 / 4 | 1 : 5;
+	CFrameScaler scaler;
+	scaler.SetFilter(SCALE_BICUBIC);
+	CFrameSharpen sharpen;
+	sharpen.SetParameters(2, 0.8);
+	CFramePipeline pipeline;
+	pipeline.Add(&scaler);
+	pipeline.Add(&sharpen);
+
+	CColorEngine engine;
+	engine.UpdateLuma(150, 140, 110);
+	engine.UpdateChroma(100, 170);
+	CStressFrame packedSrc(format, nWidth, nHeight, g_Layouts[0]);
+	packedSrc.Fill(nWidth * 7919 + nHeight);
+	CStressFrame scaled(format, nScaleWidth, nScaleHeight, g_Layouts[0]);
+	engine.ProcessStage(packedSrc.Desc(), scaled.Desc(), &pipeline, KERNEL_DIRECT, NULL, NULL);
+
+	for (int l = 0; l < g_nLayouts; l++)
+	{
+		const Layout &layout = g_Layouts[l];
+		CStressFrame src(format, nWidth, nHeight, layout);
+		src.Fill(nWidth * 7919 + nHeight);
+		vector<unsigned char> pixels;
+		src.Snapshot(&pixels);
+
+		CStressFrame ref(format, nWidth, nHeight, g_Layouts[0]);
+		Reference(engine, src, NULL, &ref);
+
+		// The plain transform: every kernel on both instruction sets, on one
+		// thread and on all of them
+		for (int isa = FRAME_ISA_SCALAR; isa <= FrameIsaBest(); isa++)
+		{
+			engine.SetIsa((FrameIsa)isa);
+			for (int k = 0; k < (FramePlanar(format) ? 1 : 2); k++)
+			{
+				string path = string(CColorEngine::KernelName(kernels[k])) + "/" + FrameIsaName((FrameIsa)isa);
+				CheckRun(path.c_str(), &engine, NULL, NULL, kernels[k], src, pixels, ref, layout, opt);
+				if (!bLarge)
+				{
+					path += "/mt";
+					CheckRun(path.c_str(), &engine, NULL, pWorkers, kernels[k], src, pixels, ref, layout, opt);
+				}
+			}
+		}
+
+		// A cube with the controls baked in: the lookups on both
+		// instruction sets against one scalar pass on one thread
+		CColorCube cube;
+		cube.Identity(17);
+		engine.SetCube(cube, true);
+		engine.SetIsa(FRAME_ISA_SCALAR);
+		CStressFrame graded(format, nWidth, nHeight, g_Layouts[0]);
+		engine.Process(src.Desc(), graded.Desc(), KERNEL_DIRECT, NULL, NULL);
+		for (int isa = FRAME_ISA_SCALAR; isa <= FrameIsaBest(); isa++)
+		{
+			engine.SetIsa((FrameIsa)isa);
+			string path = string("cube/") + FrameIsaName((FrameIsa)isa);
+			CheckRun(path.c_str(), &engine, NULL, bLarge ? NULL : pWorkers, KERNEL_DIRECT,
+				src, pixels, graded, layout, opt);
+		}
+		engine.ClearCube();
+		engine.SetIsa(FrameIsaBest());
+
+		CheckRun("resize+sharpen/mt", &engine, &pipeline, pWorkers, KERNEL_DIRECT, src, pixels, scaled, layout, opt);
+		if (bLarge)
+			continue;
+
+		// Streaming stores, and slices of an odd number of rows
+		engine.SetStreaming(STREAM_ON);
+		CheckRun("stream", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, ref, layout, opt);
+		engine.SetStreaming(STREAM_AUTO);
+
+		CSliceCheck slices;
+		engine.SetSlices(7, &slices);
+		CheckRun("slices", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, ref, layout, opt);
+		engine.SetSlices(0, NULL);
+		Report(slices.Complete(nHeight), "slice order", format, nWidth, nHeight, layout, "", opt);
+
+		// The blend with a frame of the target size in the same layout
+		CStressFrame blend(format, nWidth, nHeight, layout);
+		blend.Fill(12345);
+		CStressFrame blended(format, nWidth, nHeight, g_Layouts[0]);
+		Reference(engine, src, &blend, &blended);
+		engine.SetBlend(&blend.Desc());
+		CheckRun("blend", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, blended, layout, opt);
+		engine.SetBlend(NULL);
+
+		// Passthrough is a copy
+		engine.SetBypass(true, true);
+		CheckRun("bypass", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, src, layout, opt);
+		engine.SetBypass(false, false);
+
+		// Reuse: a frame in full, then the same frame with a few rows
+		// changed and a new target each time
+		CFrameReuse reuse;
+		engine.SetReuse(&reuse);
+		CheckRun("reuse/full", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, ref, layout, opt);
+		for (int y = nHeight / 3; y < nHeight; y += 5)
+			src.Row(y)[src.RowBytes() - 1] ^= 0x40;
+		if (FramePlanar(format))
+			src.RowU(src.RowsUV() - 1)[0] ^= 0x40;
+		src.Snapshot(&pixels);
+		Reference(engine, src, NULL, &ref);
+		CheckRun("reuse/rows", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, ref, layout, opt);
+		FrameReuseStats rs;
+		reuse.GetStats(&rs);
+		Report(rs.nFrames == 2 && rs.nFullFrames == 1 && (nHeight < 6 || rs.nRowsReused > 0),
+			"reuse count", format, nWidth, nHeight, layout, "", opt);
+
+		// Kept targets: a frame into one target, and the next into the same
+		// target, which only gets the rows that changed in between
+		reuse.SetTargetsKept(true);
+		CStressFrame kept(format, nWidth, nHeight, layout);
+		engine.ProcessStage(src.Desc(), kept.Desc(), NULL, KERNEL_DIRECT, pWorkers, NULL);
+		for (int y = 0; y < nHeight; y += 7)
+			src.Row(y)[0] ^= 0x21;
+		Reference(engine, src, NULL, &ref);
+		engine.ProcessStage(src.Desc(), kept.Desc(), NULL, KERNEL_DIRECT, pWorkers, NULL);
+		char what[64];
+		int nRows = kept.DifferentRows(ref);
+		sprintf(what, "%d rows differ", nRows);
+		Report(nRows == 0 && kept.DamagedGuards() == 0, "reuse/kept", format, nWidth, nHeight, layout, what, opt);
+		engine.SetReuse(NULL);
+
+		// Motion: the same frame twice, then one with some rows changed,
+		// against a single pass over each frame
+		CFrameMotion motion, single;
+		engine.SetMotion(&motion);
+		FrameMotionInfo mi, si;
+		src.Snapshot(&pixels);
+		for (int i = 0; i < 3; i++)
+		{
+			if (i == 2)
+			{
+				for (int y = 0; y < nHeight; y += 3)
+					src.Row(y)[0] ^= 0xA5;
+				src.Snapshot(&pixels);
+				Reference(engine, src, NULL, &ref);
+			}
+			CheckRun("motion", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, ref, layout, opt);
+			single.BeginFrame(src.Desc());
+			single.SampleRows(src.Desc(), 0, nHeight);
+			single.EndFrame();
+			motion.GetInfo(&mi);
+			single.GetInfo(&si);
+			sprintf(what, "frame %d: sad %.3f, %.3f in one pass", i, mi.dSad, si.dSad);
+			Report(mi.dSad == si.dSad && mi.nMoving == si.nMoving && mi.bSceneChange == si.bSceneChange &&
+				(i != 1 || (mi.dSad == 0 && !mi.bSceneChange)), "motion count", format, nWidth, nHeight, layout, what, opt);
+		}
+		engine.SetMotion(NULL);
+
+		// Overlay: two layers reaching past the top left and the bottom
+		// right edges, against one scalar pass over the transformed frame
+		CFrameOverlay overlay;
+		vector<unsigned char> bgra(37 * 23 * 4);
+		unsigned int nSeed = 777;
+		for (size_t i = 0; i < bgra.size(); i++)
+		{
+			nSeed = nSeed * 1103515245 + 12345;
+			bgra[i] = (unsigned char)(nSeed >> 16);
+		}
+		overlay.SetLayer(0, &bgra[0], 37 * 4, 37, 23, -9, -5);
+		overlay.SetLayer(3, &bgra[0], 37 * 4, 37, 23, nWidth / 2 - 1, nHeight / 2 - 1);
+		overlay.Prepare(format, engine.OutputSpace());
+		CStressFrame overlaid(format, nWidth, nHeight, g_Layouts[0]);
+		Reference(engine, src, NULL, &overlaid);
+		overlay.CompositeRows(overlaid.Desc(), 0, nHeight, 0, FRAME_ISA_SCALAR);
+		engine.SetOverlay(&overlay);
+		CheckRun("overlay", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, overlaid, layout, opt);
+		engine.SetStreaming(STREAM_ON);
+		CheckRun("overlay/stream", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, overlaid, layout, opt);
+		engine.SetStreaming(STREAM_AUTO);
+
+		// Whatever the premultiplied conversion does, a layer over the
+		// whole frame that is transparent leaves the transformed frame as
+		// it is, and one that is opaque white makes it white
+		const int nCoverWidth = nWidth + 2, nCoverHeight = nHeight + 2;
+		vector<unsigned char> coverBgra((size_t)nCoverWidth * nCoverHeight * 4);
+		for (size_t i = 0; i < coverBgra.size(); i++)
+		{
+			nSeed = nSeed * 1103515245 + 12345;
+			coverBgra[i] = i % 4 == 3 ? 0 : (unsigned char)(nSeed >> 16);
+		}
+		CFrameOverlay cover;
+		cover.SetLayer(0, &coverBgra[0], nCoverWidth * 4, nCoverWidth, nCoverHeight, 0, 0);
+		engine.SetOverlay(&cover);
+		CheckRun("overlay/clear", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, ref, layout, opt);
+		memset(&coverBgra[0], 255, coverBgra.size());
+		cover.SetLayer(0, &coverBgra[0], nCoverWidth * 4, nCoverWidth, nCoverHeight, 0, 0);
+		const unsigned char white[3] = { (unsigned char)(engine.OutputSpace().bFullRange ? 255 : 235), 128, 128 };
+		CStressFrame painted(format, nWidth, nHeight, g_Layouts[0]);
+		Paint(painted.Desc(), white);
+		CheckRun("overlay/opaque", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, painted, layout, opt);
+		engine.SetOverlay(NULL);
+
+		// Key: over the blend frame as the background, and the matte,
+		// against one scalar pass over the transformed frame
+		CFrameKey key;
+		key.SetKey(40, 200, 60, 30, 40);
+		key.SetEnabled(true);
+		key.SetBackgroundFrame(&blend.Desc());
+		engine.SetKey(&key);
+		for (int m = KEY_COMPOSITE; m < KEY_OUTPUT_COUNT; m++)
+		{
+			key.SetOutput((KeyOutput)m);
+			CStressFrame keyed(format, nWidth, nHeight, g_Layouts[0]);
+			Reference(engine, src, NULL, &keyed);
+			key.Prepare(keyed.Desc(), engine.OutputSpace());
+			key.KeyRows(keyed.Desc(), 0, nHeight, 0, FRAME_ISA_SCALAR);
+			CheckRun(m == KEY_MATTE ? "key/matte" : "key", &engine, NULL, pWorkers, KERNEL_DIRECT,
+				src, pixels, keyed, layout, opt);
+		}
+		engine.SetKey(NULL);
+
+		// Whatever the alpha ramp does, through neutral levels a chroma
+		// block at exactly the key colour shows the background and one far
+		// from it keeps the foreground; the matte is black and white there.
+		// The left half of the screen is keyed, the right half is not.
+		CColorEngine plain;
+		plain.UpdateLuma(127, 127, 128);
+		plain.UpdateChroma(128, 128);
+		double dKeyY, dKeyU, dKeyV;
+		ColorSpaceFromRGB(plain.OutputSpace(), 40 / 255.0, 200 / 255.0, 60 / 255.0, &dKeyY, &dKeyU, &dKeyV);
+		const int nKey[3] = { 0, (int)(dKeyU + 0.5), (int)(dKeyV + 0.5) };
+		CStressFrame screen(format, nWidth, nHeight, layout);
+		screen.Fill(nWidth * 31 + nHeight);
+		const FrameDesc &sd = screen.Desc();
+		int nChromaSamples, nChromaRows;
+		PlaneSize(sd, 1, &nChromaSamples, &nChromaRows);
+		for (int p = 1; p < 3; p++)
+		{
+			for (int y = 0; y < nChromaRows; y++)
+			{
+				for (int x = 0; x < nChromaSamples; x++)
+				{
+					int lx, ly;
+					ChromaOf(sd, nWidth / 2, 0, &lx, &ly);
+					bool bKeyed = x < lx;
+					*Sample(sd, p, x, y) = (unsigned char)(bKeyed ? nKey[p] : (nKey[p] < 128 ? 240 : 16));
+				}
+			}
+		}
+		vector<unsigned char> screenPixels;
+		screen.Snapshot(&screenPixels);
+		CStressFrame composite(format, nWidth, nHeight, g_Layouts[0]);
+		CStressFrame matte(format, nWidth, nHeight, g_Layouts[0]);
+		const unsigned char nBlack = plain.OutputSpace().bFullRange ? 0 : 16;
+		const unsigned char nWhite = plain.OutputSpace().bFullRange ? 255 : 235;
+		for (int p = 0; p < 3; p++)
+		{
+			int nSamples, nRows;
+			PlaneSize(sd, p, &nSamples, &nRows);
+			for (int y = 0; y < nRows; y++)
+			{
+				for (int x = 0; x < nSamples; x++)
+				{
+					int cx = x, cy = y;
+					if (p == 0)
+						ChromaOf(sd, x, y, &cx, &cy);
+					bool bKeyed = *Sample(sd, 1, cx, cy) == nKey[1] && *Sample(sd, 2, cx, cy) == nKey[2];
+					*Sample(composite.Desc(), p, x, y) = bKeyed ? *Sample(blend.Desc(), p, x, y) : *Sample(sd, p, x, y);
+					*Sample(matte.Desc(), p, x, y) = p != 0 ? 128 : (bKeyed ? nBlack : nWhite);
+				}
+			}
+		}
+		key.SetOutput(KEY_COMPOSITE);
+		plain.SetKey(&key);
+		CheckRun("key/screen", &plain, NULL, pWorkers, KERNEL_DIRECT, screen, screenPixels, composite, layout, opt);
+		key.SetOutput(KEY_MATTE);
+		CheckRun("key/screen matte", &plain, NULL, pWorkers, KERNEL_DIRECT, screen, screenPixels, matte, layout, opt);
+
+		// Preview: every factor, on the workers and streamed, against the
+		// box average of the transformed frame
+		CFramePreview preview;
+		engine.SetPreview(&preview);
+		for (int f = 2; f <= 8; f *= 2)
+		{
+			preview.SetFactor(f);
+			const FrameDesc &p = preview.Frame();
+			for (int st = 0; st < 2; st++)
+			{
+				engine.SetStreaming(st != 0 ? STREAM_ON : STREAM_AUTO);
+				CheckRun(st != 0 ? "preview/stream" : "preview", &engine, NULL, pWorkers, KERNEL_DIRECT,
+					src, pixels, ref, layout, opt);
+				int nErrors = PreviewErrors(ref.Desc(), p, f);
+				sprintf(what, "factor %d: %dx%d, %d samples differ", f, p.nWidth, p.nHeight, nErrors);
+				Report(nErrors == 0, st != 0 ? "preview/stream pixels" : "preview pixels", format, nWidth, nHeight,
+					layout, what, opt);
+			}
+		}
+		engine.SetStreaming(STREAM_AUTO);
+		engine.SetPreview(NULL);
+
+		// Fingerprint: a frame that reuse alone could take from the last,
+		// the same frame three times more with its rows reused and
+		// streamed, then one with some rows changed. The banded hashes
+		// must be what one pass over each transformed frame makes; the
+		// repeated frames keep the hash and count up to the frozen alarm,
+		// and the changed one starts the count again.
+		CFrameFingerprint fingerprint, onePassPrint;
+		FrameFingerprintInfo fi, oi;
+		unsigned long long nFirstHash = 0;
+		fingerprint.SetFrozenFrames(2);
+		reuse.SetTargetsKept(false);
+		engine.SetReuse(&reuse);
+		CheckRun("fingerprint", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, ref, layout, opt);
+		engine.SetFingerprint(&fingerprint);
+		for (int i = 0; i < 5; i++)
+		{
+			bool bChanged = false;
+			if (i == 4)
+			{
+				vector<unsigned char> before;
+				ref.Snapshot(&before);
+				for (int y = nHeight / 2; y < nHeight; y += 4)
+					src.Row(y)[0] ^= 0x5A;
+				src.Snapshot(&pixels);
+				Reference(engine, src, NULL, &ref);
+				vector<unsigned char> after;
+				ref.Snapshot(&after);
+				bChanged = after != before;
+			}
+			engine.SetStreaming(i == 1 ? STREAM_ON : STREAM_AUTO);
+			CheckRun("fingerprint", &engine, NULL, pWorkers, KERNEL_DIRECT, src, pixels, ref, layout, opt);
+			onePassPrint.BeginFrame(ref.Desc());
+			onePassPrint.HashRows(ref.Desc(), 0, nHeight, 0);
+			onePassPrint.EndFrame();
+			fingerprint.GetInfo(&fi);
+			onePassPrint.GetInfo(&oi);
+			if (i == 0)
+				nFirstHash = fi.nHash;
+			sprintf(what, "frame %d: %016llx, %016llx in one pass", i, fi.nHash, oi.nHash);
+			Report(fi.nHash == oi.nHash && fi.nPerceptual == oi.nPerceptual && fi.nFrame == (unsigned long)i + 1,
+				"fingerprint hash", format, nWidth, nHeight, layout, what, opt);
+
+			const unsigned long nFrozen = i < 4 ? (unsigned long)i : 0;
+			bool bOk = fi.nFrozen == nFrozen && fi.bFrozen == (nFrozen >= 2);
+			if (i == 0)
+				bOk = bOk && fi.nDistance == 64;
+			else if (i < 4)
+				bOk = bOk && fi.nHash == nFirstHash && fi.nDistance == 0;
+			else if (bChanged)
+				bOk = bOk && fi.nHash != nFirstHash;
+			sprintf(what, "frame %d: %lu frozen%s, distance %d", i, fi.nFrozen, fi.bFrozen ? " (alarm)" : "", fi.nDistance);
+			Report(bOk, "fingerprint frozen", format, nWidth, nHeight, layout, what, opt);
+		}
+		engine.SetStreaming(STREAM_AUTO);
+		engine.SetReuse(NULL);
+		engine.SetFingerprint(NULL);
+	}
+}
+
+//
+// A step of the load shedding script: the quality message sent before the
+// first frame, if any, with its lateness in frames, then the frames and the
+// level every one of them must get
+//
+struct QosStep
+{
+	bool bMessage;
+	double dLate;
+	long lProportion;
+	int nFrames;
+	int nLevel;
+	const char *pszWhat;
+};
+
+static const QosStep g_QosScript[] =
+{
+	{ true,   0.6, 1000,    1, 1, "late by more than half a frame sheds" },
+	{ true,   0.6, 1000,    1, 1, "no second shed within the hold" },
+	{ false,  0,      0,    6, 1, "the old message is not acted on again" },
+	{ true,   0.5, 1000,    1, 1, "half a frame late does not shed" },
+	{ true,   0,    899,    1, 2, "a proportion below 900 sheds" },
+	{ false,  0,      0,    7, 2, "hold" },
+	{ true,   0,    900,    1, 2, "a proportion of 900 does not shed" },
+	{ true,  -0.3, 1000,   59, 2, "early, one frame short of the calm period" },
+	{ true,   0,   1000,    1, 2, "on time: the calm starts over" },
+	{ true,  -0.3,  999,   10, 2, "early below the full rate is not calm" },
+	{ true,  -0.3, 1000,   59, 2, "early again" },
+	{ false,  0,      0,    1, 1, "60 calm frames recover" },
+	{ false,  0,      0,    7, 1, "still early" },
+	{ true,   0.6, 1000,    1, 2, "a shed soon after the recovery" },
+	{ true,  -0.3, 1000,  119, 2, "early for less than the doubled calm period" },
+	{ false,  0,      0,    1, 1, "120 calm frames recover" },
+	{ false,  0,      0,    7, 1, "still early" },
+	{ true,   0.6, 1000,    1, 2, "a shed soon after the recovery" },
+	{ true,  -0.3, 1000,  239, 2, "early" },
+	{ false,  0,      0,    1, 1, "240 calm frames recover" },
+	{ false,  0,      0,    7, 1, "still early" },
+	{ true,   0.6, 1000,    1, 2, "a shed soon after the recovery" },
+	{ true,  -0.3, 1000,  479, 2, "early" },
+	{ false,  0,      0,    1, 1, "480 calm frames recover" },
+	{ false,  0,      0,    7, 1, "still early" },
+	{ true,   0.6, 1000,    1, 2, "a shed soon after the recovery" },
+	{ true,  -0.3, 1000,  959, 2, "early" },
+	{ false,  0,      0,    1, 1, "960 calm frames recover" },
+	{ false,  0,      0,    7, 1, "still early" },
+	{ true,   0.6, 1000,    1, 2, "a shed soon after the recovery" },
+	{ true,  -0.3, 1000,  959, 2, "early" },
+	{ false,  0,      0,    1, 1, "the calm period stays at 960" },
+	{ true,   0,   1000, 3839, 1, "on time" },
+	{ true,   0.6, 1000,    1, 2, "a shed long after the recovery" },
+	{ true,  -0.3, 1000,   59, 2, "early" },
+	{ false,  0,      0,    1, 1, "the calm period is back to 60" },
+	{ false,  0,      0,   59, 1, "early" },
+	{ false,  0,      0,    1, 0, "60 calm frames recover to full" },
+	{ false,  0,      0,   10, 0, "early at full" },
+	{ true,   0.6, 1000,    1, 1, "late" },
+	{ false,  0,      0,    7, 1, "hold" },
+	{ true,   0.6, 1000,    1, 2, "late" },
+	{ false,  0,      0,    7, 2, "hold" },
+	{ true,   0.6, 1000,    1, 3, "late" },
+	{ false,  0,      0,    7, 3, "hold" },
+	{ true,   0.6, 1000,    1, 3, "no shed beyond the pass-through" },
+};
+
+static void ReportQos(bool bOk, const char *pszWhat, const StressOptions &opt)
+{
+	g_nCases++;
+	if (!bOk)
+		g_nFailures++;
+	if (!bOk || opt.bVerbose)
+		printf("%-4s %-18s %s\n", bOk ? "ok" : "FAIL", "qos", pszWhat);
+}
+
+//
+// Runs the script through CFrameQos at 25 frames per second and checks the
+// level of every frame. The counters must be what the script adds up to:
+// the frames and messages it sends, a shed or a recovery for each change
+// of level and the frames spent at each level.
+//
+static void StressQos(const StressOptions &opt)
+{
+	const double dFrameTime = 0.04;
+	CFrameQos qos;
+	qos.SetFrameTime(dFrameTime);
+
+	FrameQosStats expect;
+	memset(&expect, 0, sizeof(expect));
+	expect.lProportion = 1000;
+	char what[256];
+	for (size_t i = 0; i < sizeof(g_QosScript) / sizeof(g_QosScript[0]); i++)
+	{
+		const QosStep &step = g_QosScript[i];
+		if (step.bMessage)
+		{
+			qos.Notify(step.dLate * dFrameTime, step.lProportion);
+			expect.nMessages++;
+			expect.dLate = step.dLate * dFrameTime;
+			expect.lProportion = step.lProportion;
+		}
+		int nWrong = 0, nGot = expect.nLevel;
+		for (int f = 0; f < step.nFrames; f++)
+		{
+			int nLevel = qos.NextFrame();
+			expect.nFrames++;
+			if (nLevel != step.nLevel)
+			{
+				nWrong++;
+				nGot = nLevel;
+			}
+			expect.nFramesAt[step.nLevel]++;
+		}
+		if (step.nLevel != expect.nLevel)
+		{
+			if (step.nLevel > expect.nLevel)
+				expect.nSheds++;
+			else
+				expect.nRecoveries++;
+			expect.nLevel = step.nLevel;
+			expect.nLastDecision = expect.nFrames;
+			expect.dLastDecisionLate = expect.dLate;
+		}
+
+		FrameQosStats stats;
+		qos.GetStats(&stats);
+		bool bCounters = stats.nLevel == expect.nLevel && stats.nFrames == expect.nFrames &&
+			stats.nMessages == expect.nMessages && stats.nSheds == expect.nSheds &&
+			stats.nRecoveries == expect.nRecoveries && stats.nLastDecision == expect.nLastDecision &&
+			stats.dLastDecisionLate == expect.dLastDecisionLate && stats.dLate == expect.dLate &&
+			stats.lProportion == expect.lProportion;
+		for (int l = 0; l < FRAME_QOS_LEVEL_COUNT; l++)
+			bCounters = bCounters && stats.nFramesAt[l] == expect.nFramesAt[l];
+		sprintf(what, "step %d: %s: %d frames at level %d, %d at level %d; frame %lu, %lu sheds, %lu recoveries",
+			(int)i + 1, step.pszWhat, step.nFrames - nWrong, step.nLevel, nWrong, nGot,
+			stats.nFrames, stats.nSheds, stats.nRecoveries);
+		ReportQos(nWrong == 0 && bCounters, what, opt);
+	}
+
+	// Reset() starts over at full with no counts
+	qos.Reset();
+	FrameQosStats stats;
+	qos.GetStats(&stats);
+	bool bOk = qos.Level() == FRAME_QOS_FULL && stats.nFrames == 0 && stats.nMessages == 0 &&
+		stats.nSheds == 0 && stats.nRecoveries == 0 && stats.nLastDecision == 0 && stats.lProportion == 1000;
+	for (int l = 0; l < FRAME_QOS_LEVEL_COUNT; l++)
+		bOk = bOk && stats.nFramesAt[l] == 0;
+	qos.Notify(0.6 * dFrameTime, 1000);
+	bOk = bOk && qos.NextFrame() == FRAME_QOS_NO_OPTIONAL;
+	ReportQos(bOk, "reset: level and counters cleared, the first late message sheds", opt);
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: fpstress [options]\n"
+		"  -q, --quick          frames up to 1920x1080 only\n"
+		"  -m, --max WxH        largest frame to run (default: 7680x4320)\n"
+		"  -t, --threads N      worker threads of the multi-threaded runs (default: CPU count, at least 2)\n"
+		"  -v, --verbose        print every case, not only the failures\n");
+}
+
+int main(int argc, char **argv)
+{
+	StressOptions opt;
+	opt.nMaxWidth = 7680;
+	opt.nMaxHeight = 4320;
+	opt.bVerbose = false;
+	int nThreads = FrameCpuCount() > 2 ? FrameCpuCount() : 2;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool bHasValue = i + 1 < argc;
+		if (arg == "-q" || arg == "--quick")
+		{
+			opt.nMaxWidth = 1920;
+			opt.nMaxHeight = 1080;
+		}
+		else if ((arg == "-m" || arg == "--max") && bHasValue &&
+			sscanf(argv[i + 1], "%dx%d", &opt.nMaxWidth, &opt.nMaxHeight) == 2)
+		{
+			i++;
+		}
+		else if ((arg == "-t" || arg == "--threads") && bHasValue && (nThreads = atoi(argv[i + 1])) > 0)
+		{
+			i++;
+		}
+		else if (arg == "-v" || arg == "--verbose")
+		{
+			opt.bVerbose = true;
+		}
+		else
+		{
+			Usage();
+			return arg == "-h" || arg == "--help" ? 0 : 2;
+		}
+	}
+
+	StressQos(opt);
+
+	CFrameWorkers workers;
+	workers.SetThreadCount(nThreads);
+	for (int i = 0; i < g_nSizes; i++)
+	{
+		int nWidth = g_Sizes[i][0], nHeight = g_Sizes[i][1];
+		if (nWidth > opt.nMaxWidth || nHeight > opt.nMaxHeight)
+			continue;
+		for (int f = 0; f < FRAME_FORMAT_COUNT; f++)
+			StressSize((FrameFormat)f, nWidth, nHeight, &workers, opt);
+		fflush(stdout);
+	}
+
+	printf("%d cases, %d failed\n", g_nCases, g_nFailures);
+	return g_nFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,342 @@
+//
+// fptrace - decode a trace file of the filter or of fpbench --trace
+//
+// Reads the events a CFrameTrace saved (FrameTrace.h), pairs the starts
+// with their ends on each thread and prints how long the frames, the
+// bands, the table rebuilds and the allocator waits took, the queue
+// depths, the parameter changes and the anomalies. With --timeline it
+// draws the last frames as one lane per thread:
+//
+//   F  inside a frame (Transform, or a frame of fpbench)
+//   B  a band on a worker
+//   L  a table rebuild
+//   A  waiting for an output buffer
+//   P  a parameter change, ! an anomaly, Q a queue depth
+//
+// --events lists every event with its time from the first one.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "../FrameTrace.h"
+
+using namespace std;
+
+// An interval between a start and its end on one thread
+struct Span
+{
+	char kind;               // F, B, L or A as on the timeline
+	int nLane;
+	long long nStart;
+	long long nEnd;
+	unsigned int nArg;       // Of the start
+};
+
+struct TraceFile
+{
+	FrameTraceHeader header;
+	vector<FrameTraceRecord> records;   // In time order
+	map<unsigned short, int> lanes;     // Thread to lane, in order of appearance
+	vector<Span> spans;
+	int nUnmatched;                     // Ends without a start, or the reverse
+};
+
+static bool ByTime(const FrameTraceRecord &a, const FrameTraceRecord &b)
+{
+	return a.nTicks < b.nTicks;
+}
+
+static bool Load(const char *pszPath, TraceFile *pTrace)
+{
+	FILE *pFile = fopen(pszPath, "rb");
+	if (pFile == NULL)
+	{
+		fprintf(stderr, "fptrace: cannot open %s\n", pszPath);
+		return false;
+	}
+	FrameTraceHeader &h = pTrace->header;
+	bool bOk = fread(&h, sizeof(h), 1, pFile) == 1 && memcmp(h.Magic, "FPTR", 4) == 0 &&
+		h.nVersion == g_FrameTraceVersion && h.nTickFrequency > 0 && h.nRecords <= (1u << 24);
+	if (bOk)
+	{
+		pTrace->records.resize(h.nRecords);
+		bOk = h.nRecords == 0 ||
+			fread(&pTrace->records[0], sizeof(FrameTraceRecord), h.nRecords, pFile) == h.nRecords;
+	}
+	fclose(pFile);
+	if (!bOk)
+	{
+		fprintf(stderr, "fptrace: %s is not a trace file of version %u\n", pszPath, g_FrameTraceVersion);
+		return false;
+	}
+	stable_sort(pTrace->records.begin(), pTrace->records.end(), ByTime);
+	return true;
+}
+
+//
+// Pair the events. Starts and ends nest per thread, except that the bands
+// are told apart by their number.
+//
+static void Pair(TraceFile *pTrace)
+{
+	map<unsigned long long, size_t> open;   // Thread, kind and band to the open span
+	pTrace->nUnmatched = 0;
+	for (size_t i = 0; i < pTrace->records.size(); i++)
+	{
+		const FrameTraceRecord &r = pTrace->records[i];
+		if (pTrace->lanes.find(r.nThread) == pTrace->lanes.end())
+		{
+			int nLane = (int)pTrace->lanes.size();
+			pTrace->lanes[r.nThread] = nLane;
+		}
+
+		char kind = 0;
+		bool bStart = false;
+		switch (r.nEvent)
+		{
+		case TRACE_FRAME_IN: kind = 'F'; bStart = true; break;
+		case TRACE_FRAME_OUT: kind = 'F'; break;
+		case TRACE_BAND_START: kind = 'B'; bStart = true; break;
+		case TRACE_BAND_END: kind = 'B'; break;
+		case TRACE_LUT_START: kind = 'L'; bStart = true; break;
+		case TRACE_LUT_END: kind = 'L'; break;
+		case TRACE_ALLOC_START: kind = 'A'; bStart = true; break;
+		case TRACE_ALLOC_END: kind = 'A'; break;
+		default: continue;
+		}
+		unsigned long long nKey = (unsigned long long)r.nThread << 40 | (unsigned long long)kind << 32 |
+			(kind == 'B' ? r.nArg : 0);
+		map<unsigned long long, size_t>::iterator it = open.find(nKey);
+		if (bStart)
+		{
+			if (it != open.end())
+				pTrace->nUnmatched++;
+			Span span = { kind, pTrace->lanes[r.nThread], r.nTicks, -1, r.nArg };
+			open[nKey] = pTrace->spans.size();
+			pTrace->spans.push_back(span);
+		}
+		else if (it == open.end())
+		{
+			pTrace->nUnmatched++;
+		}
+		else
+		{
+			pTrace->spans[it->second].nEnd = r.nTicks;
+			open.erase(it);
+		}
+	}
+	pTrace->nUnmatched += (int)open.size();
+}
+
+static double Ms(const TraceFile &trace, long long nTicks)
+{
+	return nTicks * 1000.0 / trace.header.nTickFrequency;
+}
+
+static void PrintDurations(const TraceFile &trace, char kind, const char *pszName)
+{
+	vector<double> ms;
+	for (size_t i = 0; i < trace.spans.size(); i++)
+	{
+		const Span &s = trace.spans[i];
+		if (s.kind == kind && s.nEnd >= 0)
+			ms.push_back(Ms(trace, s.nEnd - s.nStart));
+	}
+	if (ms.empty())
+	{
+		printf("%-14s %8d\n", pszName, 0);
+		return;
+	}
+	sort(ms.begin(), ms.end());
+	double dSum = 0;
+	for (size_t i = 0; i < ms.size(); i++)
+		dSum += ms[i];
+	printf("%-14s %8u %10.3f %10.3f %10.3f %10.3f %10.3f\n", pszName, (unsigned)ms.size(),
+		ms.front(), ms[ms.size() / 2], ms[(ms.size() * 99) / 100], ms.back(), dSum / ms.size());
+}
+
+static void PrintSummary(const TraceFile &trace)
+{
+	const vector<FrameTraceRecord> &records = trace.records;
+	double dSpan = records.empty() ? 0 : Ms(trace, records.back().nTicks - records.front().nTicks);
+	printf("%u events over %.3f ms on %u threads, %llu earlier ones overwritten",
+		(unsigned)records.size(), dSpan, (unsigned)trace.lanes.size(),
+		(unsigned long long)trace.header.nFirst);
+	if (trace.nUnmatched > 0)
+		printf(", %d starts or ends unmatched", trace.nUnmatched);
+	printf("\n\n");
+
+	printf("%-14s %8s %10s %10s %10s %10s %10s\n", "ms", "count", "min", "median", "p99", "max", "mean");
+	PrintDurations(trace, 'F', "frame");
+	PrintDurations(trace, 'B', "band");
+	PrintDurations(trace, 'L', "table rebuild");
+	PrintDurations(trace, 'A', "alloc wait");
+
+	unsigned int nQueue = 0, nMaxDepth = 0;
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		if (records[i].nEvent == TRACE_QUEUE_DEPTH)
+		{
+			nQueue++;
+			nMaxDepth = max(nMaxDepth, records[i].nArg);
+		}
+	}
+	if (nQueue > 0)
+		printf("\nqueue depth: %u samples at most over %u deliveries\n", nMaxDepth, nQueue);
+
+	bool bHeading = false;
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const FrameTraceRecord &r = records[i];
+		if (r.nEvent != TRACE_PARAMETER && r.nEvent != TRACE_ANOMALY)
+			continue;
+		if (!bHeading)
+			printf("\n");
+		bHeading = true;
+		double dAt = Ms(trace, r.nTicks - records.front().nTicks);
+		if (r.nEvent == TRACE_ANOMALY)
+			printf("%12.3f ms  anomaly: a frame took %.3f ms\n", dAt, r.nArg / 1000.0);
+		else
+			printf("%12.3f ms  %s set to %u\n", dAt, FrameTraceParameterName(r.nArg >> 16), r.nArg & 0xFFFF);
+	}
+}
+
+static void PrintEvents(const TraceFile &trace)
+{
+	const vector<FrameTraceRecord> &records = trace.records;
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const FrameTraceRecord &r = records[i];
+		printf("%12.3f ms  thread %5u  %-12s ", Ms(trace, r.nTicks - records.front().nTicks),
+			r.nThread, FrameTraceEventName(r.nEvent));
+		if (r.nEvent == TRACE_LUT_START || r.nEvent == TRACE_LUT_END)
+			printf("%s\n", FrameTraceTableName(r.nArg));
+		else if (r.nEvent == TRACE_PARAMETER)
+			printf("%s %u\n", FrameTraceParameterName(r.nArg >> 16), r.nArg & 0xFFFF);
+		else
+			printf("%u\n", r.nArg);
+	}
+}
+
+//
+// The last nFrames frames, nWidth columns wide. A later kind of span in
+// the legend order wins a column over an earlier one.
+//
+static void PrintTimeline(const TraceFile &trace, int nFrames, int nWidth)
+{
+	const vector<FrameTraceRecord> &records = trace.records;
+	if (records.empty())
+		return;
+	long long nStart = records.front().nTicks;
+	long long nEnd = records.back().nTicks;
+	int nSeen = 0;
+	for (size_t i = trace.spans.size(); i-- > 0;)
+	{
+		if (trace.spans[i].kind == 'F' && ++nSeen == nFrames)
+		{
+			nStart = trace.spans[i].nStart;
+			break;
+		}
+	}
+	if (nEnd <= nStart)
+		nEnd = nStart + 1;
+
+	vector<string> lanes(trace.lanes.size(), string(nWidth, '.'));
+	const char *pszOrder = "FLBA";
+	for (const char *pKind = pszOrder; *pKind; pKind++)
+	{
+		for (size_t i = 0; i < trace.spans.size(); i++)
+		{
+			const Span &s = trace.spans[i];
+			long long nSpanEnd = s.nEnd >= 0 ? s.nEnd : nEnd;
+			if (s.kind != *pKind || nSpanEnd < nStart)
+				continue;
+			int c0 = (int)((max(s.nStart, nStart) - nStart) * nWidth / (nEnd - nStart + 1));
+			int c1 = (int)((nSpanEnd - nStart) * nWidth / (nEnd - nStart + 1));
+			for (int c = c0; c <= c1 && c < nWidth; c++)
+				lanes[s.nLane][c] = s.kind;
+		}
+	}
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const FrameTraceRecord &r = records[i];
+		char mark = r.nEvent == TRACE_PARAMETER ? 'P' : r.nEvent == TRACE_ANOMALY ? '!' :
+			r.nEvent == TRACE_QUEUE_DEPTH ? 'Q' : 0;
+		if (mark == 0 || r.nTicks < nStart)
+			continue;
+		int c = (int)((r.nTicks - nStart) * nWidth / (nEnd - nStart + 1));
+		lanes[trace.lanes.find(r.nThread)->second][c] = mark;
+	}
+
+	printf("\n%.3f ms from %.3f ms, %.3f ms a column\n", Ms(trace, nEnd - nStart),
+		Ms(trace, nStart - records.front().nTicks), Ms(trace, nEnd - nStart) / nWidth);
+	for (map<unsigned short, int>::const_iterator it = trace.lanes.begin(); it != trace.lanes.end(); ++it)
+		printf("%5u |%s|\n", it->first, lanes[it->second].c_str());
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: fptrace [options] FILE\n"
+		"  -e, --events         list every event\n"
+		"  -t, --timeline N     draw the last N frames, one lane per thread (default: 0, none)\n"
+		"  -w, --width N        columns of the timeline (default: 100)\n");
+}
+
+int main(int argc, char **argv)
+{
+	bool bEvents = false;
+	int nTimelineFrames = 0;
+	int nWidth = 100;
+	const char *pszPath = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool bHasValue = i + 1 < argc;
+		if (arg == "-e" || arg == "--events")
+		{
+			bEvents = true;
+		}
+		else if ((arg == "-t" || arg == "--timeline") && bHasValue)
+		{
+			nTimelineFrames = atoi(argv[++i]);
+		}
+		else if ((arg == "-w" || arg == "--width") && bHasValue)
+		{
+			nWidth = atoi(argv[++i]);
+			if (nWidth < 10)
+				nWidth = 10;
+		}
+		else if (arg[0] != '-' && pszPath == NULL)
+		{
+			pszPath = argv[i];
+		}
+		else
+		{
+			Usage();
+			return arg == "-h" || arg == "--help" ? 0 : 2;
+		}
+	}
+	if (pszPath == NULL)
+	{
+		Usage();
+		return 2;
+	}
+
+	TraceFile trace;
+	if (!Load(pszPath, &trace))
+		return 1;
+	Pair(&trace);
+	if (bEvents)
+		PrintEvents(trace);
+	else
+		PrintSummary(trace);
+	if (nTimelineFrames > 0)
+		PrintTimeline(trace, nTimelineFrames, nWidth);
+	return 0;
+}
@@ -0,0 +1,4 @@
+#pragma once
+// FCC('abcd') is the four character code of the string, first character lowest
+#define FCC(ch4) ((((DWORD)(ch4) & 0xFF) << 24) | (((DWORD)(ch4) & 0xFF00) << 8) | \
+	(((DWORD)(ch4) & 0xFF0000) >> 8) | (((DWORD)(ch4) & 0xFF000000) >> 24))
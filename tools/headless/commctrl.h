@@ -0,0 +1,11 @@
+#pragma once
+// Trackbars of the property page; streams.h has no windows to put them in
+#define TRACKBAR_CLASS L"msctls_trackbar32"
+#define TBS_VERT 0x0002
+#define TBS_BOTH 0x0008
+#define TBS_DOWNISLEFT 0x0400
+#define TBM_GETPOS 0x0400
+#define TBM_SETTIC 0x0404
+#define TBM_SETPOS 0x0405
+#define TBM_SETRANGE 0x0406
+inline void InitCommonControls() {}
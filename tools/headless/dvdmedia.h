@@ -0,0 +1,6 @@
+#pragma once
+// dwControlFlags of VIDEOINFOHEADER2, which streams.h declares
+#define AMCONTROL_USED 0x00000001
+#define AMCONTROL_PAD_TO_4x3 0x00000002
+#define AMCONTROL_PAD_TO_16x9 0x00000004
+#define AMCONTROL_COLORINFO_PRESENT 0x00000080
@@ -0,0 +1,2 @@
+#pragma once
+// DEFINE_GUID in streams.h always defines the GUID
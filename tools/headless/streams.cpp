@@ -0,0 +1,1339 @@
+//
+// Headless DirectShow base classes; see streams.h
+//
+#include "streams.h"
+
+HeadlessCounters g_Headless;
+HINSTANCE g_hInst = NULL;
+
+void *CoTaskMemAlloc(size_t cb)
+{
+	__sync_fetch_and_add(&g_Headless.nTaskAllocs, 1);
+	return malloc(cb);
+}
+
+void CoTaskMemFree(void *pv)
+{
+	free(pv);
+}
+
+FILE *_wfopen(const wchar_t *pszPath, const wchar_t *pszMode)
+{
+	char szMode[16];
+	size_t cbPath = wcstombs(NULL, pszPath, 0);
+	if (cbPath == (size_t)-1 || wcstombs(szMode, pszMode, sizeof(szMode)) >= sizeof(szMode))
+		return NULL;
+	std::vector<char> path(cbPath + 1);
+	wcstombs(&path[0], pszPath, path.size());
+	return fopen(&path[0], szMode);
+}
+
+//
+// Media types
+//
+HRESULT CopyMediaType(AM_MEDIA_TYPE *pDest, const AM_MEDIA_TYPE *pSrc)
+{
+	*pDest = *pSrc;
+	if (pSrc->cbFormat != 0)
+	{
+		pDest->pbFormat = (BYTE *)CoTaskMemAlloc(pSrc->cbFormat);
+		if (pDest->pbFormat == NULL)
+		{
+			pDest->cbFormat = 0;
+			return E_OUTOFMEMORY;
+		}
+		memcpy(pDest->pbFormat, pSrc->pbFormat, pSrc->cbFormat);
+	}
+	if (pDest->pUnk != NULL)
+		pDest->pUnk->AddRef();
+	return S_OK;
+}
+
+void FreeMediaType(AM_MEDIA_TYPE &mt)
+{
+	if (mt.cbFormat != 0)
+		CoTaskMemFree(mt.pbFormat);
+	mt.cbFormat = 0;
+	mt.pbFormat = NULL;
+	if (mt.pUnk != NULL)
+	{
+		mt.pUnk->Release();
+		mt.pUnk = NULL;
+	}
+}
+
+AM_MEDIA_TYPE *CreateMediaType(const AM_MEDIA_TYPE *pSrc)
+{
+	AM_MEDIA_TYPE *pmt = (AM_MEDIA_TYPE *)CoTaskMemAlloc(sizeof(AM_MEDIA_TYPE));
+	if (pmt == NULL)
+		return NULL;
+	if (FAILED(CopyMediaType(pmt, pSrc)))
+	{
+		CoTaskMemFree(pmt);
+		return NULL;
+	}
+	return pmt;
+}
+
+void DeleteMediaType(AM_MEDIA_TYPE *pmt)
+{
+	if (pmt == NULL)
+		return;
+	FreeMediaType(*pmt);
+	CoTaskMemFree(pmt);
+}
+
+CMediaType::CMediaType()
+{
+	memset((AM_MEDIA_TYPE *)this, 0, sizeof(AM_MEDIA_TYPE));
+	InitMediaType();
+}
+
+CMediaType::CMediaType(const AM_MEDIA_TYPE &mt)
+{
+	CopyMediaType(this, &mt);
+}
+
+CMediaType::CMediaType(const CMediaType &mt)
+{
+	CopyMediaType(this, &mt);
+}
+
+CMediaType::~CMediaType()
+{
+	FreeMediaType(*this);
+}
+
+CMediaType &CMediaType::operator=(const AM_MEDIA_TYPE &mt)
+{
+	Set(mt);
+	return *this;
+}
+
+CMediaType &CMediaType::operator=(const CMediaType &mt)
+{
+	Set(mt);
+	return *this;
+}
+
+bool CMediaType::operator==(const CMediaType &mt) const
+{
+	return majortype == mt.majortype && subtype == mt.subtype && formattype == mt.formattype &&
+		cbFormat == mt.cbFormat && (cbFormat == 0 || memcmp(pbFormat, mt.pbFormat, cbFormat) == 0);
+}
+
+HRESULT CMediaType::Set(const AM_MEDIA_TYPE &mt)
+{
+	if (&mt == this)
+		return S_OK;
+	FreeMediaType(*this);
+	return CopyMediaType(this, &mt);
+}
+
+BOOL CMediaType::IsPartiallySpecified() const
+{
+	return majortype == GUID_NULL || formattype == GUID_NULL;
+}
+
+void CMediaType::InitMediaType()
+{
+	ZeroMemory((AM_MEDIA_TYPE *)this, sizeof(AM_MEDIA_TYPE));
+	lSampleSize = 1;
+	bFixedSizeSamples = TRUE;
+}
+
+void CMediaType::ResetFormatBuffer()
+{
+	if (cbFormat != 0)
+		CoTaskMemFree(pbFormat);
+	cbFormat = 0;
+	pbFormat = NULL;
+}
+
+void CMediaType::SetSampleSize(ULONG cb)
+{
+	if (cb == 0)
+	{
+		SetVariableSize();
+	}
+	else
+	{
+		bFixedSizeSamples = TRUE;
+		lSampleSize = cb;
+	}
+}
+
+BYTE *CMediaType::AllocFormatBuffer(ULONG cb)
+{
+	if (cbFormat == cb)
+		return pbFormat;
+	BYTE *pb = (BYTE *)CoTaskMemAlloc(cb);
+	if (pb == NULL)
+		return NULL;
+	ResetFormatBuffer();
+	cbFormat = cb;
+	pbFormat = pb;
+	return pb;
+}
+
+BYTE *CMediaType::ReallocFormatBuffer(ULONG cb)
+{
+	BYTE *pb = (BYTE *)CoTaskMemAlloc(cb);
+	if (pb == NULL)
+		return NULL;
+	if (cbFormat != 0)
+		memcpy(pb, pbFormat, (std::min)(cb, cbFormat));
+	ResetFormatBuffer();
+	cbFormat = cb;
+	pbFormat = pb;
+	return pb;
+}
+
+BOOL CMediaType::SetFormat(const BYTE *pFormat, ULONG cb)
+{
+	if (AllocFormatBuffer(cb) == NULL)
+		return FALSE;
+	memcpy(pbFormat, pFormat, cb);
+	return TRUE;
+}
+
+//
+// Locks and reference counting
+//
+CCritSec::CCritSec()
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&m_cs, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+CCritSec::~CCritSec()
+{
+	pthread_mutex_destroy(&m_cs);
+}
+
+CUnknown::CUnknown(LPCTSTR pName, LPUNKNOWN pUnk)
+	: m_cRef(0),
+	  m_pUnknown(pUnk != NULL ? pUnk : reinterpret_cast<LPUNKNOWN>(static_cast<PNDUNKNOWN>(this)))
+{
+}
+
+HRESULT CUnknown::NonDelegatingQueryInterface(REFIID riid, void **ppv)
+{
+	CheckPointer(ppv, E_POINTER);
+	if (riid == IID_IUnknown)
+		return GetInterface(reinterpret_cast<LPUNKNOWN>(static_cast<PNDUNKNOWN>(this)), ppv);
+	*ppv = NULL;
+	return E_NOINTERFACE;
+}
+
+ULONG CUnknown::NonDelegatingAddRef()
+{
+	return (ULONG)__sync_add_and_fetch(&m_cRef, 1);
+}
+
+ULONG CUnknown::NonDelegatingRelease()
+{
+	long cRef = __sync_sub_and_fetch(&m_cRef, 1);
+	if (cRef == 0)
+	{
+		// Guard against the destructor taking and dropping a reference
+		m_cRef++;
+		delete this;
+		return 0;
+	}
+	return (ULONG)(std::max)(cRef, 1L);
+}
+
+HRESULT GetInterface(LPUNKNOWN pUnk, void **ppv)
+{
+	CheckPointer(ppv, E_POINTER);
+	*ppv = pUnk;
+	pUnk->AddRef();
+	return S_OK;
+}
+
+//
+// CBasePin
+//
+CBasePin::CBasePin(LPCTSTR pObjectName, CBaseFilter *pFilter, CCritSec *pLock, HRESULT *phr,
+	LPCWSTR pName, PIN_DIRECTION dir)
+	: CUnknown(pObjectName, NULL),
+	  m_Name(pName != NULL ? pName : L""),
+	  m_Connected(NULL),
+	  m_dir(dir),
+	  m_pLock(pLock),
+	  m_bRunTimeError(false),
+	  m_pFilter(pFilter),
+	  m_pQSink(NULL),
+	  m_tStart(0),
+	  m_tStop(0x7fffffffffffffffLL),
+	  m_dRate(1.0)
+{
+}
+
+CBasePin::~CBasePin()
+{
+	ASSERT(m_Connected == NULL);
+}
+
+STDMETHODIMP CBasePin::NonDelegatingQueryInterface(REFIID riid, void **ppv)
+{
+	CheckPointer(ppv, E_POINTER);
+	if (riid == IID_IPin)
+		return GetInterface((IPin *)this, ppv);
+	if (riid == IID_IQualityControl)
+		return GetInterface((IQualityControl *)this, ppv);
+	return CUnknown::NonDelegatingQueryInterface(riid, ppv);
+}
+
+STDMETHODIMP_(ULONG) CBasePin::NonDelegatingAddRef()
+{
+	return m_pFilter->AddRef();
+}
+
+STDMETHODIMP_(ULONG) CBasePin::NonDelegatingRelease()
+{
+	return m_pFilter->Release();
+}
+
+BOOL CBasePin::IsStopped()
+{
+	return m_pFilter->IsStopped();
+}
+
+HRESULT CBasePin::CheckConnect(IPin *pPin)
+{
+	PIN_DIRECTION dir;
+	HRESULT hr = pPin->QueryDirection(&dir);
+	if (FAILED(hr))
+		return hr;
+	return dir == m_dir ? VFW_E_INVALID_DIRECTION : S_OK;
+}
+
+HRESULT CBasePin::SetMediaType(const CMediaType *pmt)
+{
+	return m_mt.Set(*pmt);
+}
+
+//
+// Connection with the given type, or else with each of the pin's own
+// types in turn
+//
+STDMETHODIMP CBasePin::Connect(IPin *pReceivePin, const AM_MEDIA_TYPE *pmt)
+{
+	CheckPointer(pReceivePin, E_POINTER);
+	CAutoLock lock(m_pLock);
+	if (m_Connected != NULL)
+		return VFW_E_ALREADY_CONNECTED;
+	if (!IsStopped())
+		return VFW_E_NOT_STOPPED;
+
+	if (pmt != NULL && !((const CMediaType *)pmt)->IsPartiallySpecified())
+	{
+		CMediaType mt(*pmt);
+		HRESULT hr = AttemptConnection(pReceivePin, &mt);
+		return FAILED(hr) ? hr : S_OK;
+	}
+	for (int i = 0; ; i++)
+	{
+		CMediaType mt;
+		HRESULT hr = GetMediaType(i, &mt);
+		if (hr != S_OK)
+			break;
+		if (SUCCEEDED(AttemptConnection(pReceivePin, &mt)))
+			return S_OK;
+	}
+	return VFW_E_NO_ACCEPTABLE_TYPES;
+}
+
+HRESULT CBasePin::AttemptConnection(IPin *pReceivePin, const CMediaType *pmt)
+{
+	HRESULT hr = CheckConnect(pReceivePin);
+	if (FAILED(hr))
+	{
+		BreakConnect();
+		return hr;
+	}
+	hr = CheckMediaType(pmt);
+	if (hr != S_OK)
+	{
+		BreakConnect();
+		return FAILED(hr) ? hr : VFW_E_TYPE_NOT_ACCEPTED;
+	}
+
+	m_Connected = pReceivePin;
+	m_Connected->AddRef();
+	hr = SetMediaType(pmt);
+	if (SUCCEEDED(hr))
+		hr = pReceivePin->ReceiveConnection((IPin *)this, pmt);
+	if (SUCCEEDED(hr))
+	{
+		hr = CompleteConnect(pReceivePin);
+		if (SUCCEEDED(hr))
+			return hr;
+		pReceivePin->Disconnect();
+	}
+	BreakConnect();
+	m_Connected->Release();
+	m_Connected = NULL;
+	return hr;
+}
+
+STDMETHODIMP CBasePin::ReceiveConnection(IPin *pConnector, const AM_MEDIA_TYPE *pmt)
+{
+	CheckPointer(pConnector, E_POINTER);
+	CheckPointer(pmt, E_POINTER);
+	CAutoLock lock(m_pLock);
+	if (m_Connected != NULL)
+		return VFW_E_ALREADY_CONNECTED;
+	if (!IsStopped())
+		return VFW_E_NOT_STOPPED;
+
+	HRESULT hr = CheckConnect(pConnector);
+	if (FAILED(hr))
+	{
+		BreakConnect();
+		return hr;
+	}
+	CMediaType mt(*pmt);
+	hr = CheckMediaType(&mt);
+	if (hr != S_OK)
+	{
+		BreakConnect();
+		return FAILED(hr) ? hr : VFW_E_TYPE_NOT_ACCEPTED;
+	}
+
+	m_Connected = pConnector;
+	m_Connected->AddRef();
+	hr = SetMediaType(&mt);
+	if (SUCCEEDED(hr))
+		hr = CompleteConnect(pConnector);
+	if (FAILED(hr))
+	{
+		BreakConnect();
+		m_Connected->Release();
+		m_Connected = NULL;
+	}
+	return hr;
+}
+
+void CBasePin::DisconnectInternal()
+{
+	BreakConnect();
+	m_Connected->Release();
+	m_Connected = NULL;
+	FreeMediaType(m_mt);
+	m_mt.InitMediaType();
+}
+
+STDMETHODIMP CBasePin::Disconnect()
+{
+	CAutoLock lock(m_pLock);
+	if (!IsStopped())
+		return VFW_E_NOT_STOPPED;
+	if (m_Connected == NULL)
+		return S_FALSE;
+	DisconnectInternal();
+	return S_OK;
+}
+
+STDMETHODIMP CBasePin::ConnectedTo(IPin **ppPin)
+{
+	CheckPointer(ppPin, E_POINTER);
+	*ppPin = m_Connected;
+	if (m_Connected == NULL)
+		return VFW_E_NOT_CONNECTED;
+	m_Connected->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP CBasePin::ConnectionMediaType(AM_MEDIA_TYPE *pmt)
+{
+	CheckPointer(pmt, E_POINTER);
+	CAutoLock lock(m_pLock);
+	if (m_Connected == NULL)
+	{
+		memset(pmt, 0, sizeof(AM_MEDIA_TYPE));
+		return VFW_E_NOT_CONNECTED;
+	}
+	return CopyMediaType(pmt, &m_mt);
+}
+
+STDMETHODIMP CBasePin::QueryPinInfo(PIN_INFO *pInfo)
+{
+	CheckPointer(pInfo, E_POINTER);
+	pInfo->pFilter = m_pFilter;
+	if (m_pFilter != NULL)
+		m_pFilter->AddRef();
+	wcsncpy(pInfo->achName, m_Name.c_str(), 127);
+	pInfo->achName[127] = 0;
+	pInfo->dir = m_dir;
+	return S_OK;
+}
+
+STDMETHODIMP CBasePin::QueryDirection(PIN_DIRECTION *pPinDir)
+{
+	CheckPointer(pPinDir, E_POINTER);
+	*pPinDir = m_dir;
+	return S_OK;
+}
+
+STDMETHODIMP CBasePin::QueryAccept(const AM_MEDIA_TYPE *pmt)
+{
+	CheckPointer(pmt, E_POINTER);
+	CMediaType mt(*pmt);
+	HRESULT hr = CheckMediaType(&mt);
+	return SUCCEEDED(hr) && hr != S_OK ? S_FALSE : hr;
+}
+
+STDMETHODIMP CBasePin::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+{
+	m_tStart = tStart;
+	m_tStop = tStop;
+	m_dRate = dRate;
+	return S_OK;
+}
+
+STDMETHODIMP CBasePin::SetSink(IQualityControl *piqc)
+{
+	CAutoLock lock(m_pLock);
+	m_pQSink = piqc;
+	return S_OK;
+}
+
+//
+// CBaseOutputPin
+//
+CBaseOutputPin::CBaseOutputPin(LPCTSTR pObjectName, CBaseFilter *pFilter, CCritSec *pLock,
+	HRESULT *phr, LPCWSTR pName)
+	: CBasePin(pObjectName, pFilter, pLock, phr, pName, PINDIR_OUTPUT),
+	  m_pAllocator(NULL),
+	  m_pInputPin(NULL)
+{
+}
+
+HRESULT CBaseOutputPin::CheckConnect(IPin *pPin)
+{
+	HRESULT hr = CBasePin::CheckConnect(pPin);
+	if (FAILED(hr))
+		return hr;
+	hr = pPin->QueryInterface(IID_IMemInputPin, (void **)&m_pInputPin);
+	if (FAILED(hr))
+	{
+		m_pInputPin = NULL;
+		return VFW_E_NO_TRANSPORT;
+	}
+	return S_OK;
+}
+
+HRESULT CBaseOutputPin::BreakConnect()
+{
+	if (m_pAllocator != NULL)
+	{
+		m_pAllocator->Decommit();
+		m_pAllocator->Release();
+		m_pAllocator = NULL;
+	}
+	if (m_pInputPin != NULL)
+	{
+		m_pInputPin->Release();
+		m_pInputPin = NULL;
+	}
+	return S_OK;
+}
+
+HRESULT CBaseOutputPin::CompleteConnect(IPin *pReceivePin)
+{
+	return DecideAllocator(m_pInputPin, &m_pAllocator);
+}
+
+//
+// The allocator of the input pin, sized by DecideBufferSize() from the
+// input pin's requirements. The base classes fall back to an allocator of
+// their own; here the input pin has to have one.
+//
+HRESULT CBaseOutputPin::DecideAllocator(IMemInputPin *pPin, IMemAllocator **ppAlloc)
+{
+	*ppAlloc = NULL;
+	ALLOCATOR_PROPERTIES prop;
+	ZeroMemory(&prop, sizeof(prop));
+	pPin->GetAllocatorRequirements(&prop);
+	if (prop.cbAlign == 0)
+		prop.cbAlign = 1;
+
+	HRESULT hr = pPin->GetAllocator(ppAlloc);
+	if (FAILED(hr))
+	{
+		*ppAlloc = NULL;
+		return VFW_E_NO_ALLOCATOR;
+	}
+	hr = DecideBufferSize(*ppAlloc, &prop);
+	if (SUCCEEDED(hr))
+		hr = pPin->NotifyAllocator(*ppAlloc, FALSE);
+	if (FAILED(hr))
+	{
+		(*ppAlloc)->Release();
+		*ppAlloc = NULL;
+	}
+	return hr;
+}
+
+HRESULT CBaseOutputPin::GetDeliveryBuffer(IMediaSample **ppSample, REFERENCE_TIME *pStartTime,
+	REFERENCE_TIME *pEndTime, DWORD dwFlags)
+{
+	if (m_pAllocator == NULL)
+		return E_NOINTERFACE;
+	return m_pAllocator->GetBuffer(ppSample, pStartTime, pEndTime, dwFlags);
+}
+
+HRESULT CBaseOutputPin::Deliver(IMediaSample *pSample)
+{
+	if (m_pInputPin == NULL)
+		return VFW_E_NOT_CONNECTED;
+	return m_pInputPin->Receive(pSample);
+}
+
+HRESULT CBaseOutputPin::DeliverEndOfStream()
+{
+	if (m_Connected == NULL)
+		return VFW_E_NOT_CONNECTED;
+	return m_Connected->EndOfStream();
+}
+
+HRESULT CBaseOutputPin::DeliverBeginFlush()
+{
+	if (m_Connected == NULL)
+		return VFW_E_NOT_CONNECTED;
+	return m_Connected->BeginFlush();
+}
+
+HRESULT CBaseOutputPin::DeliverEndFlush()
+{
+	if (m_Connected == NULL)
+		return VFW_E_NOT_CONNECTED;
+	return m_Connected->EndFlush();
+}
+
+HRESULT CBaseOutputPin::DeliverNewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+{
+	if (m_Connected == NULL)
+		return VFW_E_NOT_CONNECTED;
+	return m_Connected->NewSegment(tStart, tStop, dRate);
+}
+
+HRESULT CBaseOutputPin::Active()
+{
+	if (m_pAllocator == NULL)
+		return VFW_E_NO_ALLOCATOR;
+	return m_pAllocator->Commit();
+}
+
+HRESULT CBaseOutputPin::Inactive()
+{
+	m_bRunTimeError = false;
+	if (m_pAllocator == NULL)
+		return VFW_E_NO_ALLOCATOR;
+	return m_pAllocator->Decommit();
+}
+
+//
+// CBaseInputPin
+//
+CBaseInputPin::CBaseInputPin(LPCTSTR pObjectName, CBaseFilter *pFilter, CCritSec *pLock,
+	HRESULT *phr, LPCWSTR pName)
+	: CBasePin(pObjectName, pFilter, pLock, phr, pName, PINDIR_INPUT),
+	  m_pAllocator(NULL),
+	  m_bReadOnly(FALSE),
+	  m_bFlushing(FALSE)
+{
+}
+
+CBaseInputPin::~CBaseInputPin()
+{
+	if (m_pAllocator != NULL)
+		m_pAllocator->Release();
+}
+
+STDMETHODIMP CBaseInputPin::NonDelegatingQueryInterface(REFIID riid, void **ppv)
+{
+	CheckPointer(ppv, E_POINTER);
+	if (riid == IID_IMemInputPin)
+		return GetInterface((IMemInputPin *)this, ppv);
+	return CBasePin::NonDelegatingQueryInterface(riid, ppv);
+}
+
+STDMETHODIMP CBaseInputPin::GetAllocator(IMemAllocator **ppAllocator)
+{
+	CheckPointer(ppAllocator, E_POINTER);
+	CAutoLock lock(m_pLock);
+	*ppAllocator = m_pAllocator;
+	if (m_pAllocator == NULL)
+		return VFW_E_NO_ALLOCATOR;
+	m_pAllocator->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP CBaseInputPin::NotifyAllocator(IMemAllocator *pAllocator, BOOL bReadOnly)
+{
+	CheckPointer(pAllocator, E_POINTER);
+	CAutoLock lock(m_pLock);
+	pAllocator->AddRef();
+	if (m_pAllocator != NULL)
+		m_pAllocator->Release();
+	m_pAllocator = pAllocator;
+	m_bReadOnly = bReadOnly;
+	return S_OK;
+}
+
+HRESULT CBaseInputPin::CheckStreaming()
+{
+	if (!IsConnected())
+		return VFW_E_NOT_CONNECTED;
+	if (IsStopped())
+		return VFW_E_WRONG_STATE;
+	if (m_bFlushing)
+		return S_FALSE;
+	if (m_bRunTimeError)
+		return VFW_E_RUNTIME_ERROR;
+	return S_OK;
+}
+
+//
+// A sample that brings a new type is refused when the pin does not accept
+// the type; the filter takes it up itself, as with the base classes
+//
+STDMETHODIMP CBaseInputPin::Receive(IMediaSample *pSample)
+{
+	CheckPointer(pSample, E_POINTER);
+	HRESULT hr = CheckStreaming();
+	if (hr != S_OK)
+		return hr;
+
+	AM_MEDIA_TYPE *pmt = NULL;
+	if (pSample->GetMediaType(&pmt) == S_OK && pmt != NULL)
+	{
+		CMediaType mt(*pmt);
+		DeleteMediaType(pmt);
+		if (CheckMediaType(&mt) != S_OK)
+		{
+			m_bRunTimeError = true;
+			EndOfStream();
+			return VFW_E_INVALIDMEDIATYPE;
+		}
+	}
+	return S_OK;
+}
+
+STDMETHODIMP CBaseInputPin::BeginFlush()
+{
+	CAutoLock lock(m_pLock);
+	m_bFlushing = TRUE;
+	return S_OK;
+}
+
+STDMETHODIMP CBaseInputPin::EndFlush()
+{
+	CAutoLock lock(m_pLock);
+	m_bFlushing = FALSE;
+	m_bRunTimeError = false;
+	return S_OK;
+}
+
+HRESULT CBaseInputPin::BreakConnect()
+{
+	if (m_pAllocator != NULL)
+	{
+		m_pAllocator->Decommit();
+		m_pAllocator->Release();
+		m_pAllocator = NULL;
+	}
+	return S_OK;
+}
+
+HRESULT CBaseInputPin::Inactive()
+{
+	m_bRunTimeError = false;
+	m_bFlushing = FALSE;
+	if (m_pAllocator == NULL)
+		return VFW_E_NO_ALLOCATOR;
+	return m_pAllocator->Decommit();
+}
+
+HRESULT CBaseInputPin::PassNotify(Quality &q)
+{
+	if (m_pQSink != NULL)
+		return m_pQSink->Notify(m_pFilter, q);
+	if (m_Connected == NULL)
+		return VFW_E_NOT_FOUND;
+	IQualityControl *pIQC = NULL;
+	if (FAILED(m_Connected->QueryInterface(IID_IQualityControl, (void **)&pIQC)))
+		return VFW_E_NOT_FOUND;
+	HRESULT hr = pIQC->Notify(m_pFilter, q);
+	pIQC->Release();
+	return hr;
+}
+
+//
+// CBaseFilter
+//
+CBaseFilter::CBaseFilter(LPCTSTR pName, LPUNKNOWN pUnk, CCritSec *pLock, REFCLSID clsid)
+	: CUnknown(pName, pUnk),
+	  m_State(State_Stopped),
+	  m_pLock(pLock),
+	  m_clsid(clsid),
+	  m_tStart(0)
+{
+}
+
+STDMETHODIMP CBaseFilter::NonDelegatingQueryInterface(REFIID riid, void **ppv)
+{
+	CheckPointer(ppv, E_POINTER);
+	if (riid == IID_IBaseFilter)
+		return GetInterface((IBaseFilter *)this, ppv);
+	return CUnknown::NonDelegatingQueryInterface(riid, ppv);
+}
+
+STDMETHODIMP CBaseFilter::Stop()
+{
+	CAutoLock lock(m_pLock);
+	HRESULT hr = S_OK;
+	if (m_State != State_Stopped)
+	{
+		for (int i = 0; i < GetPinCount(); i++)
+		{
+			CBasePin *pPin = GetPin(i);
+			if (pPin != NULL && pPin->IsConnected())
+			{
+				HRESULT hrPin = pPin->Inactive();
+				if (FAILED(hrPin) && SUCCEEDED(hr))
+					hr = hrPin;
+			}
+		}
+	}
+	m_State = State_Stopped;
+	return hr;
+}
+
+STDMETHODIMP CBaseFilter::Pause()
+{
+	CAutoLock lock(m_pLock);
+	if (m_State == State_Stopped)
+	{
+		for (int i = 0; i < GetPinCount(); i++)
+		{
+			CBasePin *pPin = GetPin(i);
+			if (pPin != NULL && pPin->IsConnected())
+			{
+				HRESULT hr = pPin->Active();
+				if (FAILED(hr))
+					return hr;
+			}
+		}
+	}
+	m_State = State_Paused;
+	return S_OK;
+}
+
+STDMETHODIMP CBaseFilter::Run(REFERENCE_TIME tStart)
+{
+	CAutoLock lock(m_pLock);
+	m_tStart = tStart;
+	if (m_State == State_Stopped)
+	{
+		HRESULT hr = Pause();
+		if (FAILED(hr))
+			return hr;
+	}
+	if (m_State != State_Running)
+	{
+		for (int i = 0; i < GetPinCount(); i++)
+		{
+			CBasePin *pPin = GetPin(i);
+			if (pPin != NULL && pPin->IsConnected())
+			{
+				HRESULT hr = pPin->Run(tStart);
+				if (FAILED(hr))
+					return hr;
+			}
+		}
+	}
+	m_State = State_Running;
+	return S_OK;
+}
+
+STDMETHODIMP CBaseFilter::GetState(DWORD dwMilliSecsTimeout, FILTER_STATE *pState)
+{
+	CheckPointer(pState, E_POINTER);
+	*pState = m_State;
+	return S_OK;
+}
+
+STDMETHODIMP CBaseFilter::FindPin(LPCWSTR Id, IPin **ppPin)
+{
+	CheckPointer(Id, E_POINTER);
+	CheckPointer(ppPin, E_POINTER);
+	CAutoLock lock(m_pLock);
+	for (int i = 0; i < GetPinCount(); i++)
+	{
+		CBasePin *pPin = GetPin(i);
+		if (pPin != NULL && wcscmp(pPin->Name(), Id) == 0)
+		{
+			*ppPin = pPin;
+			pPin->AddRef();
+			return S_OK;
+		}
+	}
+	*ppPin = NULL;
+	return VFW_E_NOT_FOUND;
+}
+
+//
+// CTransformInputPin
+//
+CTransformInputPin::CTransformInputPin(LPCTSTR pObjectName, CTransformFilter *pTransformFilter,
+	HRESULT *phr, LPCWSTR pName)
+	: CBaseInputPin(pObjectName, pTransformFilter, &pTransformFilter->m_csFilter, phr, pName),
+	  m_pTransformFilter(pTransformFilter)
+{
+}
+
+HRESULT CTransformInputPin::CheckConnect(IPin *pPin)
+{
+	HRESULT hr = m_pTransformFilter->CheckConnect(PINDIR_INPUT, pPin);
+	if (FAILED(hr))
+		return hr;
+	return CBaseInputPin::CheckConnect(pPin);
+}
+
+HRESULT CTransformInputPin::BreakConnect()
+{
+	m_pTransformFilter->BreakConnect(PINDIR_INPUT);
+	return CBaseInputPin::BreakConnect();
+}
+
+HRESULT CTransformInputPin::CompleteConnect(IPin *pReceivePin)
+{
+	HRESULT hr = m_pTransformFilter->CompleteConnect(PINDIR_INPUT, pReceivePin);
+	if (FAILED(hr))
+		return hr;
+	return CBaseInputPin::CompleteConnect(pReceivePin);
+}
+
+HRESULT CTransformInputPin::CheckMediaType(const CMediaType *pmt)
+{
+	HRESULT hr = m_pTransformFilter->CheckInputType(pmt);
+	if (hr != S_OK)
+		return hr;
+	if (m_pTransformFilter->m_pOutput != NULL && m_pTransformFilter->m_pOutput->IsConnected())
+		return m_pTransformFilter->CheckTransform(pmt, &m_pTransformFilter->m_pOutput->CurrentMediaType());
+	return S_OK;
+}
+
+HRESULT CTransformInputPin::SetMediaType(const CMediaType *pmt)
+{
+	HRESULT hr = CBasePin::SetMediaType(pmt);
+	if (FAILED(hr))
+		return hr;
+	return m_pTransformFilter->SetMediaType(PINDIR_INPUT, pmt);
+}
+
+STDMETHODIMP CTransformInputPin::Receive(IMediaSample *pSample)
+{
+	CAutoLock lock(&m_pTransformFilter->m_csReceive);
+	HRESULT hr = CBaseInputPin::Receive(pSample);
+	if (hr == S_OK)
+		hr = m_pTransformFilter->Receive(pSample);
+	return hr;
+}
+
+STDMETHODIMP CTransformInputPin::EndOfStream()
+{
+	CAutoLock lock(&m_pTransformFilter->m_csReceive);
+	HRESULT hr = CheckStreaming();
+	if (hr == S_OK)
+		hr = m_pTransformFilter->EndOfStream();
+	return hr;
+}
+
+STDMETHODIMP CTransformInputPin::BeginFlush()
+{
+	CAutoLock lock(&m_pTransformFilter->m_csFilter);
+	if (!IsConnected() || !m_pTransformFilter->m_pOutput->IsConnected())
+		return VFW_E_NOT_CONNECTED;
+	HRESULT hr = CBaseInputPin::BeginFlush();
+	if (FAILED(hr))
+		return hr;
+	return m_pTransformFilter->BeginFlush();
+}
+
+STDMETHODIMP CTransformInputPin::EndFlush()
+{
+	CAutoLock lock(&m_pTransformFilter->m_csFilter);
+	if (!IsConnected() || !m_pTransformFilter->m_pOutput->IsConnected())
+		return VFW_E_NOT_CONNECTED;
+	HRESULT hr = m_pTransformFilter->EndFlush();
+	if (FAILED(hr))
+		return hr;
+	return CBaseInputPin::EndFlush();
+}
+
+STDMETHODIMP CTransformInputPin::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+{
+	CBasePin::NewSegment(tStart, tStop, dRate);
+	return m_pTransformFilter->NewSegment(tStart, tStop, dRate);
+}
+
+//
+// CTransformOutputPin
+//
+CTransformOutputPin::CTransformOutputPin(LPCTSTR pObjectName, CTransformFilter *pTransformFilter,
+	HRESULT *phr, LPCWSTR pName)
+	: CBaseOutputPin(pObjectName, pTransformFilter, &pTransformFilter->m_csFilter, phr, pName),
+	  m_pTransformFilter(pTransformFilter)
+{
+}
+
+HRESULT CTransformOutputPin::CheckConnect(IPin *pPin)
+{
+	if (m_pTransformFilter->m_pInput == NULL || !m_pTransformFilter->m_pInput->IsConnected())
+		return E_UNEXPECTED;
+	HRESULT hr = m_pTransformFilter->CheckConnect(PINDIR_OUTPUT, pPin);
+	if (FAILED(hr))
+		return hr;
+	return CBaseOutputPin::CheckConnect(pPin);
+}
+
+HRESULT CTransformOutputPin::BreakConnect()
+{
+	m_pTransformFilter->BreakConnect(PINDIR_OUTPUT);
+	return CBaseOutputPin::BreakConnect();
+}
+
+HRESULT CTransformOutputPin::CompleteConnect(IPin *pReceivePin)
+{
+	HRESULT hr = m_pTransformFilter->CompleteConnect(PINDIR_OUTPUT, pReceivePin);
+	if (FAILED(hr))
+		return hr;
+	return CBaseOutputPin::CompleteConnect(pReceivePin);
+}
+
+HRESULT CTransformOutputPin::DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp)
+{
+	return m_pTransformFilter->DecideBufferSize(pAlloc, pProp);
+}
+
+HRESULT CTransformOutputPin::CheckMediaType(const CMediaType *pmt)
+{
+	if (m_pTransformFilter->m_pInput == NULL || !m_pTransformFilter->m_pInput->IsConnected())
+		return E_INVALIDARG;
+	return m_pTransformFilter->CheckTransform(&m_pTransformFilter->m_pInput->CurrentMediaType(), pmt);
+}
+
+HRESULT CTransformOutputPin::SetMediaType(const CMediaType *pmt)
+{
+	HRESULT hr = CBasePin::SetMediaType(pmt);
+	if (FAILED(hr))
+		return hr;
+	return m_pTransformFilter->SetMediaType(PINDIR_OUTPUT, pmt);
+}
+
+HRESULT CTransformOutputPin::GetMediaType(int iPosition, CMediaType *pmt)
+{
+	if (m_pTransformFilter->m_pInput == NULL || !m_pTransformFilter->m_pInput->IsConnected())
+		return VFW_S_NO_MORE_ITEMS;
+	return m_pTransformFilter->GetMediaType(iPosition, pmt);
+}
+
+STDMETHODIMP CTransformOutputPin::Notify(IBaseFilter *pSender, Quality q)
+{
+	HRESULT hr = m_pTransformFilter->AlterQuality(q);
+	if (hr != S_FALSE)
+		return hr;
+	return m_pTransformFilter->m_pInput->PassNotify(q);
+}
+
+//
+// CTransformFilter
+//
+CTransformFilter::CTransformFilter(LPCTSTR pName, LPUNKNOWN pUnk, REFCLSID clsid)
+	: CBaseFilter(pName, pUnk, &m_csFilter, clsid),
+	  m_bEOSDelivered(FALSE),
+	  m_bSampleSkipped(FALSE),
+	  m_bQualityChanged(FALSE),
+	  m_pInput(NULL),
+	  m_pOutput(NULL)
+{
+}
+
+CTransformFilter::~CTransformFilter()
+{
+	delete m_pInput;
+	delete m_pOutput;
+}
+
+int CTransformFilter::GetPinCount()
+{
+	return 2;
+}
+
+CBasePin *CTransformFilter::GetPin(int n)
+{
+	if (m_pInput == NULL)
+	{
+		HRESULT hr = S_OK;
+		m_pInput = new CTransformInputPin(NAME("Transform input pin"), this, &hr, L"XForm In");
+		m_pOutput = new CTransformOutputPin(NAME("Transform output pin"), this, &hr, L"XForm Out");
+	}
+	if (n == 0)
+		return m_pInput;
+	if (n == 1)
+		return m_pOutput;
+	return NULL;
+}
+
+STDMETHODIMP CTransformFilter::FindPin(LPCWSTR Id, IPin **ppPin)
+{
+	CheckPointer(Id, E_POINTER);
+	CheckPointer(ppPin, E_POINTER);
+	if (wcscmp(Id, L"In") == 0)
+		*ppPin = GetPin(0);
+	else if (wcscmp(Id, L"Out") == 0)
+		*ppPin = GetPin(1);
+	else
+		*ppPin = NULL;
+	if (*ppPin == NULL)
+		return VFW_E_NOT_FOUND;
+	(*ppPin)->AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP CTransformFilter::Stop()
+{
+	CAutoLock lock(&m_csFilter);
+	if (m_State == State_Stopped)
+		return S_OK;
+	if (m_pInput == NULL || !m_pInput->IsConnected() || !m_pOutput->IsConnected())
+	{
+		m_State = State_Stopped;
+		m_bEOSDelivered = FALSE;
+		return S_OK;
+	}
+
+	// Stop the input first, so that no new samples come in, then the
+	// output once the streaming thread is out of Receive()
+	m_pInput->Inactive();
+	CAutoLock lockReceive(&m_csReceive);
+	m_pOutput->Inactive();
+	HRESULT hr = StopStreaming();
+	if (SUCCEEDED(hr))
+	{
+		m_State = State_Stopped;
+		m_bEOSDelivered = FALSE;
+	}
+	return hr;
+}
+
+STDMETHODIMP CTransformFilter::Pause()
+{
+	CAutoLock lock(&m_csFilter);
+	HRESULT hr = S_OK;
+	if (m_State == State_Paused)
+	{
+	}
+	else if (m_pInput == NULL || !m_pInput->IsConnected())
+	{
+		// Without an input the stream is over before it started
+		if (m_pOutput != NULL && !m_bEOSDelivered)
+		{
+			m_pOutput->DeliverEndOfStream();
+			m_bEOSDelivered = TRUE;
+		}
+		m_State = State_Paused;
+	}
+	else if (!m_pOutput->IsConnected())
+	{
+		m_State = State_Paused;
+	}
+	else
+	{
+		if (m_State == State_Stopped)
+		{
+			CAutoLock lockReceive(&m_csReceive);
+			hr = StartStreaming();
+		}
+		if (SUCCEEDED(hr))
+			hr = CBaseFilter::Pause();
+	}
+	m_bSampleSkipped = FALSE;
+	m_bQualityChanged = FALSE;
+	return hr;
+}
+
+//
+// An output buffer for pSample, with its times and flags
+//
+HRESULT CTransformFilter::InitializeOutputSample(IMediaSample *pSample, IMediaSample **ppOutSample)
+{
+	REFERENCE_TIME tStart = 0, tStop = 0;
+	HRESULT hrTime = pSample->GetTime(&tStart, &tStop);
+	DWORD dwFlags = m_bSampleSkipped ? AM_GBF_PREVFRAMESKIPPED : 0;
+	if (pSample->IsSyncPoint() != S_OK)
+		dwFlags |= AM_GBF_NOTASYNCPOINT;
+
+	IMediaSample *pOutSample = NULL;
+	HRESULT hr = m_pOutput->m_pAllocator->GetBuffer(&pOutSample,
+		SUCCEEDED(hrTime) ? &tStart : NULL, hrTime == S_OK ? &tStop : NULL, dwFlags);
+	*ppOutSample = pOutSample;
+	if (FAILED(hr))
+		return hr;
+
+	if (SUCCEEDED(hrTime))
+		pOutSample->SetTime(&tStart, hrTime == S_OK ? &tStop : NULL);
+	pOutSample->SetSyncPoint(pSample->IsSyncPoint() == S_OK);
+	pOutSample->SetDiscontinuity(pSample->IsDiscontinuity() == S_OK || m_bSampleSkipped);
+	pOutSample->SetPreroll(pSample->IsPreroll() == S_OK);
+	LONGLONG tMediaStart, tMediaEnd;
+	if (pSample->GetMediaTime(&tMediaStart, &tMediaEnd) == S_OK)
+		pOutSample->SetMediaTime(&tMediaStart, &tMediaEnd);
+	return S_OK;
+}
+
+//
+// Transform() into a new buffer, which goes downstream unless Transform()
+// returned S_FALSE to drop it
+//
+HRESULT CTransformFilter::Receive(IMediaSample *pSample)
+{
+	IMediaSample *pOutSample = NULL;
+	HRESULT hr = InitializeOutputSample(pSample, &pOutSample);
+	if (FAILED(hr))
+		return hr;
+
+	hr = Transform(pSample, pOutSample);
+	if (hr == S_OK)
+	{
+		hr = m_pOutput->m_pInputPin->Receive(pOutSample);
+		m_bSampleSkipped = FALSE;
+	}
+	else if (hr == S_FALSE)
+	{
+		m_bSampleSkipped = TRUE;
+		m_bQualityChanged = TRUE;
+		hr = S_OK;
+	}
+	pOutSample->Release();
+	return hr;
+}
+
+HRESULT CTransformFilter::EndOfStream()
+{
+	if (m_pOutput == NULL)
+		return S_OK;
+	return m_pOutput->DeliverEndOfStream();
+}
+
+HRESULT CTransformFilter::BeginFlush()
+{
+	if (m_pOutput == NULL)
+		return S_OK;
+	return m_pOutput->DeliverBeginFlush();
+}
+
+HRESULT CTransformFilter::EndFlush()
+{
+	return m_pOutput->DeliverEndFlush();
+}
+
+HRESULT CTransformFilter::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+{
+	if (m_pOutput == NULL)
+		return S_OK;
+	return m_pOutput->DeliverNewSegment(tStart, tStop, dRate);
+}
+
+//
+// COutputQueue
+//
+COutputQueue::COutputQueue(IPin *pInputPin, HRESULT *phr, BOOL bAuto, BOOL bQueue,
+	LONG lBatchSize, BOOL bBatchExact, LONG lListSize, DWORD dwPriority, bool bFlushingOpt)
+	: m_pPin(pInputPin),
+	  m_pInputPin(NULL),
+	  m_List(NULL),
+	  m_nBatched(0),
+	  m_bFlushing(FALSE),
+	  m_hr(S_OK)
+{
+	if (pInputPin == NULL || FAILED(pInputPin->QueryInterface(IID_IMemInputPin, (void **)&m_pInputPin)))
+	{
+		m_pInputPin = NULL;
+		*phr = VFW_E_NOT_CONNECTED;
+		return;
+	}
+	m_pPin->AddRef();
+}
+
+COutputQueue::~COutputQueue()
+{
+	if (m_pInputPin != NULL)
+	{
+		m_pInputPin->Release();
+		m_pPin->Release();
+	}
+}
+
+HRESULT COutputQueue::Receive(IMediaSample *pSample)
+{
+	CAutoLock lock(this);
+	HRESULT hr = m_bFlushing ? S_FALSE : m_hr;
+	if (hr == S_OK)
+	{
+		hr = m_pInputPin->Receive(pSample);
+		if (hr != S_OK)
+			m_hr = hr;
+	}
+	pSample->Release();
+	return hr;
+}
+
+void COutputQueue::EOS()
+{
+	CAutoLock lock(this);
+	if (m_hr == S_OK)
+		m_pPin->EndOfStream();
+}
+
+void COutputQueue::BeginFlush()
+{
+	CAutoLock lock(this);
+	m_bFlushing = TRUE;
+	m_pPin->BeginFlush();
+}
+
+void COutputQueue::EndFlush()
+{
+	CAutoLock lock(this);
+	m_pPin->EndFlush();
+	m_bFlushing = FALSE;
+	m_hr = S_OK;
+}
+
+void COutputQueue::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+{
+	CAutoLock lock(this);
+	m_pPin->NewSegment(tStart, tStop, dRate);
+}
+
+//
+// CBasePropertyPage
+//
+CBasePropertyPage::CBasePropertyPage(LPCTSTR pName, LPUNKNOWN pUnk, int DialogId, int TitleId)
+	: CUnknown(pName, pUnk),
+	  m_bDirty(FALSE),
+	  m_pPageSite(NULL),
+	  m_hwnd(NULL),
+	  m_Dlg(NULL)
+{
+}
@@ -0,0 +1,901 @@
+#pragma once
+//
+// Headless DirectShow base classes
+//
+// Just enough of the Windows SDK and of the DirectShow base class library
+// (streams.h) to build and run the filter - FrameProcessFilter.cpp,
+// FramePreviewPin.cpp and FrmProcessPropPage.cpp - on any platform, for
+// tools/fphost. The classes behave as their namesakes in the base classes
+// do on the paths the filter takes: pins connect, agree on a media type
+// and an allocator, and samples go through CTransformFilter::Receive(),
+// InitializeOutputSample() and Transform() to the downstream pin. There is
+// no filter graph, no clock and no allocator of their own; whoever drives
+// the filter supplies the pins on the other side and their allocators.
+//
+// Differences from the base classes that matter to a caller:
+//   - An output pin connects with the type it is given or one of its own
+//     types; it does not enumerate the types of the receiving pin.
+//   - CBaseInputPin::GetAllocator() fails until NotifyAllocator() is called.
+//   - COutputQueue never starts a thread: samples go straight to the pin.
+//   - The Win32 user interface functions do nothing.
+//
+// The runtime counts CoTaskMemAlloc() and CopyMemory() in g_Headless.
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+//
+// Windows types
+//
+typedef unsigned char BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int32_t HRESULT;
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef intptr_t LONG_PTR;
+typedef wchar_t WCHAR;
+typedef wchar_t TCHAR;
+typedef const wchar_t *LPCWSTR;
+typedef const wchar_t *LPCTSTR;
+typedef void *LPVOID;
+typedef void *HWND;
+typedef void *HINSTANCE;
+typedef intptr_t LPARAM;
+typedef uintptr_t WPARAM;
+typedef intptr_t INT_PTR;
+typedef intptr_t LRESULT;
+typedef LONGLONG REFERENCE_TIME;
+
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+#define STDMETHODCALLTYPE
+#define STDMETHODIMP HRESULT
+#define STDMETHODIMP_(type) type
+#define STDMETHOD(method) virtual HRESULT method
+#define STDMETHOD_(type, method) virtual type method
+#define PURE = 0
+#define THIS_
+#define THIS void
+#define DECLARE_INTERFACE_(iface, base) struct iface : public base
+#define STDAPI extern "C" HRESULT
+#define NAME(x) L##x
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define NOERROR 0
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define E_NOINTERFACE ((HRESULT)0x80004002)
+#define E_POINTER ((HRESULT)0x80004003)
+#define E_FAIL ((HRESULT)0x80004005)
+#define E_UNEXPECTED ((HRESULT)0x8000FFFF)
+#define E_INVALIDARG ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000E)
+#define VFW_E_INVALIDMEDIATYPE ((HRESULT)0x80040200)
+#define VFW_E_ALREADY_CONNECTED ((HRESULT)0x80040204)
+#define VFW_E_NO_ACCEPTABLE_TYPES ((HRESULT)0x80040207)
+#define VFW_E_INVALID_DIRECTION ((HRESULT)0x80040208)
+#define VFW_E_NOT_CONNECTED ((HRESULT)0x80040209)
+#define VFW_E_NO_ALLOCATOR ((HRESULT)0x8004020A)
+#define VFW_E_RUNTIME_ERROR ((HRESULT)0x8004020B)
+#define VFW_E_ALREADY_COMMITTED ((HRESULT)0x80040210)
+#define VFW_E_NOT_COMMITTED ((HRESULT)0x80040211)
+#define VFW_E_SIZENOTSET ((HRESULT)0x80040212)
+#define VFW_E_NOT_FOUND ((HRESULT)0x80040216)
+#define VFW_E_NOT_STOPPED ((HRESULT)0x80040224)
+#define VFW_E_TIMEOUT ((HRESULT)0x8004022E)
+#define VFW_E_WRONG_STATE ((HRESULT)0x80040227)
+#define VFW_E_TYPE_NOT_ACCEPTED ((HRESULT)0x8004022A)
+#define VFW_E_BUFFER_OVERFLOW ((HRESULT)0x8004020D)
+#define VFW_E_SAMPLE_TIME_NOT_SET ((HRESULT)0x80040249)
+#define VFW_E_MEDIA_TIME_NOT_SET ((HRESULT)0x80040251)
+#define VFW_E_NO_TRANSPORT ((HRESULT)0x80040266)
+#define VFW_S_NO_MORE_ITEMS ((HRESULT)0x00040103)
+#define VFW_S_NO_STOP_TIME ((HRESULT)0x00040270)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+
+#define ASSERT(x) assert(x)
+#define CheckPointer(p, ret) { if ((p) == NULL) return (ret); }
+#define ZeroMemory(dst, cb) memset((dst), 0, (cb))
+#define CopyMemory(dst, src, cb) HeadlessCopyMemory((dst), (src), (cb))
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#define LOWORD(l) ((WORD)(((uintptr_t)(l)) & 0xffff))
+#define MAKELONG(a, b) ((LONG)(((WORD)(a)) | ((DWORD)((WORD)(b))) << 16))
+
+//
+// Counters of the runtime, read by the harness around the calls it makes
+//
+struct HeadlessCounters
+{
+	volatile long long nTaskAllocs;   // CoTaskMemAlloc() calls
+	volatile long long nCopies;       // CopyMemory() calls
+	volatile long long nCopyBytes;    // And the bytes they copied
+};
+extern HeadlessCounters g_Headless;
+
+inline void HeadlessCopyMemory(void *pDst, const void *pSrc, size_t cb)
+{
+	__sync_fetch_and_add(&g_Headless.nCopies, 1);
+	__sync_fetch_and_add(&g_Headless.nCopyBytes, (long long)cb);
+	memcpy(pDst, pSrc, cb);
+}
+
+void *CoTaskMemAlloc(size_t cb);
+void CoTaskMemFree(void *pv);
+
+// Opens a file by a wide-character path, converted to the multibyte
+// encoding of the locale
+FILE *_wfopen(const wchar_t *pszPath, const wchar_t *pszMode);
+
+//
+// GUIDs and COM
+//
+struct GUID
+{
+	uint32_t Data1;
+	uint16_t Data2;
+	uint16_t Data3;
+	uint8_t Data4[8];
+};
+inline bool operator==(const GUID &a, const GUID &b) { return memcmp(&a, &b, sizeof(GUID)) == 0; }
+inline bool operator!=(const GUID &a, const GUID &b) { return !(a == b); }
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const GUID &REFGUID;
+typedef const GUID &REFIID;
+typedef const GUID &REFCLSID;
+
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+	static const GUID name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+DEFINE_GUID(GUID_NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+DEFINE_GUID(IID_IUnknown, 0x00000000, 0x0000, 0x0000, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46);
+DEFINE_GUID(IID_ISpecifyPropertyPages, 0xb196b28b, 0xbab4, 0x101a, 0xb6, 0x9c, 0x00, 0xaa, 0x00, 0x34, 0x1d, 0x07);
+DEFINE_GUID(IID_IPin, 0x56a86891, 0x0ad4, 0x11ce, 0xb0, 0x3a, 0x00, 0x20, 0xaf, 0x0b, 0xa7, 0x70);
+DEFINE_GUID(IID_IBaseFilter, 0x56a86895, 0x0ad4, 0x11ce, 0xb0, 0x3a, 0x00, 0x20, 0xaf, 0x0b, 0xa7, 0x70);
+DEFINE_GUID(IID_IMediaSample, 0x56a8689a, 0x0ad4, 0x11ce, 0xb0, 0x3a, 0x00, 0x20, 0xaf, 0x0b, 0xa7, 0x70);
+DEFINE_GUID(IID_IMemAllocator, 0x56a8689c, 0x0ad4, 0x11ce, 0xb0, 0x3a, 0x00, 0x20, 0xaf, 0x0b, 0xa7, 0x70);
+DEFINE_GUID(IID_IMemInputPin, 0x56a8689d, 0x0ad4, 0x11ce, 0xb0, 0x3a, 0x00, 0x20, 0xaf, 0x0b, 0xa7, 0x70);
+DEFINE_GUID(IID_IQualityControl, 0x56a868a5, 0x0ad4, 0x11ce, 0xb0, 0x3a, 0x00, 0x20, 0xaf, 0x0b, 0xa7, 0x70);
+DEFINE_GUID(MEDIATYPE_Video, 0x73646976, 0x0000, 0x0010, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71);
+DEFINE_GUID(MEDIASUBTYPE_YUY2, 0x32595559, 0x0000, 0x0010, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71);
+DEFINE_GUID(MEDIASUBTYPE_UYVY, 0x59565955, 0x0000, 0x0010, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71);
+DEFINE_GUID(FORMAT_VideoInfo, 0x05589f80, 0xc356, 0x11ce, 0xbf, 0x01, 0x00, 0xaa, 0x00, 0x55, 0x59, 0x5a);
+DEFINE_GUID(FORMAT_VideoInfo2, 0xf72a76a0, 0xeb0a, 0x11d0, 0xac, 0xe4, 0x00, 0x00, 0xc0, 0xcc, 0x16, 0xba);
+
+struct IUnknown
+{
+	virtual HRESULT QueryInterface(REFIID riid, void **ppv) = 0;
+	virtual ULONG AddRef() = 0;
+	virtual ULONG Release() = 0;
+};
+typedef IUnknown *LPUNKNOWN;
+
+// Same layout as IUnknown, as in the base classes
+struct INonDelegatingUnknown
+{
+	virtual HRESULT NonDelegatingQueryInterface(REFIID riid, void **ppv) = 0;
+	virtual ULONG NonDelegatingAddRef() = 0;
+	virtual ULONG NonDelegatingRelease() = 0;
+};
+typedef INonDelegatingUnknown *PNDUNKNOWN;
+
+struct CAUUID
+{
+	ULONG cElems;
+	GUID *pElems;
+};
+
+struct ISpecifyPropertyPages : public IUnknown
+{
+	virtual HRESULT GetPages(CAUUID *pPages) = 0;
+};
+
+//
+// Rectangles and bitmaps
+//
+struct RECT
+{
+	LONG left, top, right, bottom;
+};
+inline BOOL IsRectEmpty(const RECT *prc) { return prc->right <= prc->left || prc->bottom <= prc->top; }
+inline BOOL SetRect(RECT *prc, int left, int top, int right, int bottom)
+{
+	prc->left = left; prc->top = top; prc->right = right; prc->bottom = bottom;
+	return TRUE;
+}
+
+struct BITMAPINFOHEADER
+{
+	DWORD biSize;
+	LONG biWidth;
+	LONG biHeight;
+	WORD biPlanes;
+	WORD biBitCount;
+	DWORD biCompression;
+	DWORD biSizeImage;
+	LONG biXPelsPerMeter;
+	LONG biYPelsPerMeter;
+	DWORD biClrUsed;
+	DWORD biClrImportant;
+};
+
+#define WIDTHBYTES(bits) ((DWORD)(((bits) + 31) & (~31)) / 8)
+#define DIBWIDTHBYTES(bi) (DWORD)WIDTHBYTES((DWORD)(bi).biWidth * (DWORD)(bi).biBitCount)
+#define _DIBSIZE(bi) (DIBWIDTHBYTES(bi) * (DWORD)(bi).biHeight)
+#define DIBSIZE(bi) ((bi).biHeight < 0 ? (-1) * (_DIBSIZE(bi)) : _DIBSIZE(bi))
+
+struct VIDEOINFOHEADER
+{
+	RECT rcSource;
+	RECT rcTarget;
+	DWORD dwBitRate;
+	DWORD dwBitErrorRate;
+	REFERENCE_TIME AvgTimePerFrame;
+	BITMAPINFOHEADER bmiHeader;
+};
+
+struct VIDEOINFOHEADER2
+{
+	RECT rcSource;
+	RECT rcTarget;
+	DWORD dwBitRate;
+	DWORD dwBitErrorRate;
+	REFERENCE_TIME AvgTimePerFrame;
+	DWORD dwInterlaceFlags;
+	DWORD dwCopyProtectFlags;
+	DWORD dwPictAspectRatioX;
+	DWORD dwPictAspectRatioY;
+	DWORD dwControlFlags;
+	DWORD dwReserved2;
+	BITMAPINFOHEADER bmiHeader;
+};
+
+//
+// Media types
+//
+struct AM_MEDIA_TYPE
+{
+	GUID majortype;
+	GUID subtype;
+	BOOL bFixedSizeSamples;
+	BOOL bTemporalCompression;
+	ULONG lSampleSize;
+	GUID formattype;
+	IUnknown *pUnk;
+	ULONG cbFormat;
+	BYTE *pbFormat;
+};
+
+// Copies pSrc into the empty pDest; E_OUTOFMEMORY leaves pDest without a format
+HRESULT CopyMediaType(AM_MEDIA_TYPE *pDest, const AM_MEDIA_TYPE *pSrc);
+void FreeMediaType(AM_MEDIA_TYPE &mt);
+AM_MEDIA_TYPE *CreateMediaType(const AM_MEDIA_TYPE *pSrc);
+void DeleteMediaType(AM_MEDIA_TYPE *pmt);
+
+//
+// CMediaType
+//
+// An AM_MEDIA_TYPE that owns its format block. It adds no members, so an
+// AM_MEDIA_TYPE from CreateMediaType() may be used as one, as the filter
+// does with the type of a sample.
+//
+class CMediaType : public AM_MEDIA_TYPE
+{
+public:
+	CMediaType();
+	CMediaType(const AM_MEDIA_TYPE &mt);
+	CMediaType(const CMediaType &mt);
+	~CMediaType();
+
+	CMediaType &operator=(const AM_MEDIA_TYPE &mt);
+	CMediaType &operator=(const CMediaType &mt);
+	bool operator==(const CMediaType &mt) const;
+	bool operator!=(const CMediaType &mt) const { return !(*this == mt); }
+
+	HRESULT Set(const AM_MEDIA_TYPE &mt);
+	BOOL IsValid() const { return majortype != GUID_NULL; }
+	BOOL IsPartiallySpecified() const;
+	void InitMediaType();
+	void ResetFormatBuffer();
+
+	const GUID *Type() const { return &majortype; }
+	const GUID *Subtype() const { return &subtype; }
+	const GUID *FormatType() const { return &formattype; }
+	ULONG FormatLength() const { return cbFormat; }
+	BYTE *Format() const { return pbFormat; }
+	ULONG GetSampleSize() const { return bFixedSizeSamples ? lSampleSize : 0; }
+
+	void SetType(const GUID *pType) { majortype = *pType; }
+	void SetSubtype(const GUID *pType) { subtype = *pType; }
+	void SetFormatType(const GUID *pType) { formattype = *pType; }
+	void SetTemporalCompression(BOOL bCompressed) { bTemporalCompression = bCompressed; }
+	void SetSampleSize(ULONG cb);
+	void SetVariableSize() { bFixedSizeSamples = FALSE; }
+	BYTE *AllocFormatBuffer(ULONG cb);
+	BYTE *ReallocFormatBuffer(ULONG cb);
+	BOOL SetFormat(const BYTE *pFormat, ULONG cb);
+};
+
+#define HEADER(pVideoInfo) (&(((VIDEOINFOHEADER *)(pVideoInfo))->bmiHeader))
+
+//
+// Samples, allocators, pins and filters
+//
+enum PIN_DIRECTION { PINDIR_INPUT, PINDIR_OUTPUT };
+enum FILTER_STATE { State_Stopped, State_Paused, State_Running };
+
+struct ALLOCATOR_PROPERTIES
+{
+	LONG cBuffers;
+	LONG cbBuffer;
+	LONG cbAlign;
+	LONG cbPrefix;
+};
+
+// Flags of IMemAllocator::GetBuffer()
+#define AM_GBF_PREVFRAMESKIPPED 1
+#define AM_GBF_NOTASYNCPOINT 2
+#define AM_GBF_NOWAIT 4
+
+struct IMediaSample : public IUnknown
+{
+	virtual HRESULT GetPointer(BYTE **ppBuffer) = 0;
+	virtual long GetSize() = 0;
+	virtual HRESULT GetTime(REFERENCE_TIME *pTimeStart, REFERENCE_TIME *pTimeEnd) = 0;
+	virtual HRESULT SetTime(REFERENCE_TIME *pTimeStart, REFERENCE_TIME *pTimeEnd) = 0;
+	virtual HRESULT IsSyncPoint() = 0;
+	virtual HRESULT SetSyncPoint(BOOL bIsSyncPoint) = 0;
+	virtual HRESULT IsPreroll() = 0;
+	virtual HRESULT SetPreroll(BOOL bIsPreroll) = 0;
+	virtual long GetActualDataLength() = 0;
+	virtual HRESULT SetActualDataLength(long lLen) = 0;
+	virtual HRESULT GetMediaType(AM_MEDIA_TYPE **ppMediaType) = 0;
+	virtual HRESULT SetMediaType(AM_MEDIA_TYPE *pMediaType) = 0;
+	virtual HRESULT IsDiscontinuity() = 0;
+	virtual HRESULT SetDiscontinuity(BOOL bDiscontinuity) = 0;
+	virtual HRESULT GetMediaTime(LONGLONG *pTimeStart, LONGLONG *pTimeEnd) = 0;
+	virtual HRESULT SetMediaTime(LONGLONG *pTimeStart, LONGLONG *pTimeEnd) = 0;
+};
+
+struct IMemAllocator : public IUnknown
+{
+	virtual HRESULT SetProperties(ALLOCATOR_PROPERTIES *pRequest, ALLOCATOR_PROPERTIES *pActual) = 0;
+	virtual HRESULT GetProperties(ALLOCATOR_PROPERTIES *pProps) = 0;
+	virtual HRESULT Commit() = 0;
+	virtual HRESULT Decommit() = 0;
+	virtual HRESULT GetBuffer(IMediaSample **ppBuffer, REFERENCE_TIME *pStartTime,
+		REFERENCE_TIME *pEndTime, DWORD dwFlags) = 0;
+	virtual HRESULT ReleaseBuffer(IMediaSample *pBuffer) = 0;
+};
+
+struct IPin;
+struct IBaseFilter;
+
+struct PIN_INFO
+{
+	IBaseFilter *pFilter;
+	PIN_DIRECTION dir;
+	WCHAR achName[128];
+};
+
+struct IPin : public IUnknown
+{
+	virtual HRESULT Connect(IPin *pReceivePin, const AM_MEDIA_TYPE *pmt) = 0;
+	virtual HRESULT ReceiveConnection(IPin *pConnector, const AM_MEDIA_TYPE *pmt) = 0;
+	virtual HRESULT Disconnect() = 0;
+	virtual HRESULT ConnectedTo(IPin **ppPin) = 0;
+	virtual HRESULT ConnectionMediaType(AM_MEDIA_TYPE *pmt) = 0;
+	virtual HRESULT QueryPinInfo(PIN_INFO *pInfo) = 0;
+	virtual HRESULT QueryDirection(PIN_DIRECTION *pPinDir) = 0;
+	virtual HRESULT QueryAccept(const AM_MEDIA_TYPE *pmt) = 0;
+	virtual HRESULT EndOfStream() = 0;
+	virtual HRESULT BeginFlush() = 0;
+	virtual HRESULT EndFlush() = 0;
+	virtual HRESULT NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate) = 0;
+};
+
+struct IMemInputPin : public IUnknown
+{
+	virtual HRESULT GetAllocator(IMemAllocator **ppAllocator) = 0;
+	virtual HRESULT NotifyAllocator(IMemAllocator *pAllocator, BOOL bReadOnly) = 0;
+	virtual HRESULT GetAllocatorRequirements(ALLOCATOR_PROPERTIES *pProps) = 0;
+	virtual HRESULT Receive(IMediaSample *pSample) = 0;
+	virtual HRESULT ReceiveCanBlock() = 0;
+};
+
+struct IBaseFilter : public IUnknown
+{
+	virtual HRESULT Stop() = 0;
+	virtual HRESULT Pause() = 0;
+	virtual HRESULT Run(REFERENCE_TIME tStart) = 0;
+	virtual HRESULT GetState(DWORD dwMilliSecsTimeout, FILTER_STATE *pState) = 0;
+	virtual HRESULT FindPin(LPCWSTR Id, IPin **ppPin) = 0;
+};
+
+enum QualityMessageType { Famine, Flood };
+
+struct Quality
+{
+	QualityMessageType Type;
+	long Proportion;           // Of the frames that can be shown, in 1000ths
+	REFERENCE_TIME Late;
+	REFERENCE_TIME TimeStamp;
+};
+
+struct IQualityControl : public IUnknown
+{
+	virtual HRESULT Notify(IBaseFilter *pSelf, Quality q) = 0;
+	virtual HRESULT SetSink(IQualityControl *piqc) = 0;
+};
+
+//
+// Locks
+//
+class CCritSec
+{
+public:
+	CCritSec();
+	~CCritSec();
+	void Lock() { pthread_mutex_lock(&m_cs); }
+	void Unlock() { pthread_mutex_unlock(&m_cs); }
+private:
+	pthread_mutex_t m_cs;     // Recursive, as a critical section is
+	CCritSec(const CCritSec &);
+	CCritSec &operator=(const CCritSec &);
+};
+
+class CAutoLock
+{
+public:
+	CAutoLock(CCritSec *pLock) : m_pLock(pLock) { m_pLock->Lock(); }
+	~CAutoLock() { m_pLock->Unlock(); }
+private:
+	CCritSec *m_pLock;
+	CAutoLock(const CAutoLock &);
+	CAutoLock &operator=(const CAutoLock &);
+};
+
+//
+// CUnknown
+//
+// Reference counted object that may be aggregated; deleted when the last
+// reference is released
+//
+class CUnknown : public INonDelegatingUnknown
+{
+public:
+	CUnknown(LPCTSTR pName, LPUNKNOWN pUnk);
+	virtual ~CUnknown() {}
+
+	LPUNKNOWN GetOwner() const { return m_pUnknown; }
+
+	virtual HRESULT NonDelegatingQueryInterface(REFIID riid, void **ppv);
+	virtual ULONG NonDelegatingAddRef();
+	virtual ULONG NonDelegatingRelease();
+
+protected:
+	volatile long m_cRef;
+
+private:
+	const LPUNKNOWN m_pUnknown;
+};
+
+// Hands out pUnk with a reference
+HRESULT GetInterface(LPUNKNOWN pUnk, void **ppv);
+
+#define DECLARE_IUNKNOWN \
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv) { return GetOwner()->QueryInterface(riid, ppv); } \
+	STDMETHODIMP_(ULONG) AddRef() { return GetOwner()->AddRef(); } \
+	STDMETHODIMP_(ULONG) Release() { return GetOwner()->Release(); }
+
+class CBaseFilter;
+class CTransformFilter;
+
+//
+// CBasePin
+//
+// A pin of a CBaseFilter. Its references are the filter's.
+//
+class CBasePin : public CUnknown, public IPin, public IQualityControl
+{
+public:
+	CBasePin(LPCTSTR pObjectName, CBaseFilter *pFilter, CCritSec *pLock, HRESULT *phr,
+		LPCWSTR pName, PIN_DIRECTION dir);
+	virtual ~CBasePin();
+
+	DECLARE_IUNKNOWN
+	STDMETHODIMP NonDelegatingQueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) NonDelegatingAddRef();
+	STDMETHODIMP_(ULONG) NonDelegatingRelease();
+
+	// IPin
+	STDMETHODIMP Connect(IPin *pReceivePin, const AM_MEDIA_TYPE *pmt);
+	STDMETHODIMP ReceiveConnection(IPin *pConnector, const AM_MEDIA_TYPE *pmt);
+	STDMETHODIMP Disconnect();
+	STDMETHODIMP ConnectedTo(IPin **ppPin);
+	STDMETHODIMP ConnectionMediaType(AM_MEDIA_TYPE *pmt);
+	STDMETHODIMP QueryPinInfo(PIN_INFO *pInfo);
+	STDMETHODIMP QueryDirection(PIN_DIRECTION *pPinDir);
+	STDMETHODIMP QueryAccept(const AM_MEDIA_TYPE *pmt);
+	STDMETHODIMP NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+
+	// IQualityControl
+	STDMETHODIMP Notify(IBaseFilter *pSender, Quality q) { return E_NOTIMPL; }
+	STDMETHODIMP SetSink(IQualityControl *piqc);
+
+	BOOL IsConnected() { return m_Connected != NULL; }
+	IPin *GetConnected() { return m_Connected; }
+	BOOL IsStopped();
+	CMediaType &CurrentMediaType() { return m_mt; }
+	LPCWSTR Name() const { return m_Name.c_str(); }
+
+	virtual HRESULT CheckMediaType(const CMediaType *pmt) = 0;
+	virtual HRESULT SetMediaType(const CMediaType *pmt);
+	virtual HRESULT GetMediaType(int iPosition, CMediaType *pmt) { return E_UNEXPECTED; }
+	virtual HRESULT CheckConnect(IPin *pPin);
+	virtual HRESULT BreakConnect() { return S_OK; }
+	virtual HRESULT CompleteConnect(IPin *pReceivePin) { return S_OK; }
+	virtual HRESULT Active() { return S_OK; }
+	virtual HRESULT Inactive() { return S_OK; }
+	virtual HRESULT Run(REFERENCE_TIME tStart) { return S_OK; }
+
+protected:
+	HRESULT AttemptConnection(IPin *pReceivePin, const CMediaType *pmt);
+	void DisconnectInternal();
+
+	std::wstring m_Name;
+	IPin *m_Connected;
+	PIN_DIRECTION m_dir;
+	CCritSec *m_pLock;
+	bool m_bRunTimeError;
+	CMediaType m_mt;
+	CBaseFilter *m_pFilter;
+	IQualityControl *m_pQSink;
+	REFERENCE_TIME m_tStart;
+	REFERENCE_TIME m_tStop;
+	double m_dRate;
+};
+
+//
+// CBaseOutputPin
+//
+// Connects to a pin that implements IMemInputPin and takes its allocator,
+// which it sizes with DecideBufferSize()
+//
+class CBaseOutputPin : public CBasePin
+{
+public:
+	CBaseOutputPin(LPCTSTR pObjectName, CBaseFilter *pFilter, CCritSec *pLock, HRESULT *phr,
+		LPCWSTR pName);
+
+	HRESULT CheckConnect(IPin *pPin);
+	HRESULT BreakConnect();
+	HRESULT CompleteConnect(IPin *pReceivePin);
+	virtual HRESULT DecideAllocator(IMemInputPin *pPin, IMemAllocator **ppAlloc);
+	virtual HRESULT DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp) = 0;
+	virtual HRESULT GetDeliveryBuffer(IMediaSample **ppSample, REFERENCE_TIME *pStartTime,
+		REFERENCE_TIME *pEndTime, DWORD dwFlags);
+
+	virtual HRESULT Deliver(IMediaSample *pSample);
+	virtual HRESULT DeliverEndOfStream();
+	virtual HRESULT DeliverBeginFlush();
+	virtual HRESULT DeliverEndFlush();
+	virtual HRESULT DeliverNewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+
+	HRESULT Active();
+	HRESULT Inactive();
+
+	// Output pins take no stream events
+	STDMETHODIMP EndOfStream() { return E_UNEXPECTED; }
+	STDMETHODIMP BeginFlush() { return E_UNEXPECTED; }
+	STDMETHODIMP EndFlush() { return E_UNEXPECTED; }
+
+	IMemAllocator *m_pAllocator;
+	IMemInputPin *m_pInputPin;
+};
+
+//
+// CBaseInputPin
+//
+class CBaseInputPin : public CBasePin, public IMemInputPin
+{
+public:
+	CBaseInputPin(LPCTSTR pObjectName, CBaseFilter *pFilter, CCritSec *pLock, HRESULT *phr,
+		LPCWSTR pName);
+	~CBaseInputPin();
+
+	DECLARE_IUNKNOWN
+	STDMETHODIMP NonDelegatingQueryInterface(REFIID riid, void **ppv);
+
+	// IMemInputPin
+	STDMETHODIMP GetAllocator(IMemAllocator **ppAllocator);
+	STDMETHODIMP NotifyAllocator(IMemAllocator *pAllocator, BOOL bReadOnly);
+	STDMETHODIMP GetAllocatorRequirements(ALLOCATOR_PROPERTIES *pProps) { return E_NOTIMPL; }
+	STDMETHODIMP Receive(IMediaSample *pSample);
+	STDMETHODIMP ReceiveCanBlock() { return S_OK; }
+
+	STDMETHODIMP BeginFlush();
+	STDMETHODIMP EndFlush();
+	STDMETHODIMP EndOfStream() { return S_OK; }
+
+	HRESULT BreakConnect();
+	HRESULT Inactive();
+	virtual HRESULT CheckStreaming();
+
+	// Quality messages from downstream, passed to the pin upstream
+	HRESULT PassNotify(Quality &q);
+
+	BOOL IsFlushing() { return m_bFlushing; }
+
+protected:
+	IMemAllocator *m_pAllocator;
+	BOOL m_bReadOnly;
+	BOOL m_bFlushing;
+};
+
+//
+// CBaseFilter
+//
+class CBaseFilter : public CUnknown, public IBaseFilter
+{
+	friend class CBasePin;
+public:
+	CBaseFilter(LPCTSTR pName, LPUNKNOWN pUnk, CCritSec *pLock, REFCLSID clsid);
+	virtual ~CBaseFilter() {}
+
+	DECLARE_IUNKNOWN
+	STDMETHODIMP NonDelegatingQueryInterface(REFIID riid, void **ppv);
+
+	// IBaseFilter
+	STDMETHODIMP Stop();
+	STDMETHODIMP Pause();
+	STDMETHODIMP Run(REFERENCE_TIME tStart);
+	STDMETHODIMP GetState(DWORD dwMilliSecsTimeout, FILTER_STATE *pState);
+	STDMETHODIMP FindPin(LPCWSTR Id, IPin **ppPin);
+
+	virtual int GetPinCount() = 0;
+	virtual CBasePin *GetPin(int n) = 0;
+
+	BOOL IsStopped() { return m_State == State_Stopped; }
+	BOOL IsActive() { return m_State != State_Stopped; }
+
+protected:
+	FILTER_STATE m_State;
+	CCritSec *m_pLock;
+	CLSID m_clsid;
+	REFERENCE_TIME m_tStart;
+};
+
+//
+// CTransformFilter and its pins
+//
+class CTransformInputPin : public CBaseInputPin
+{
+	friend class CTransformFilter;
+public:
+	CTransformInputPin(LPCTSTR pObjectName, CTransformFilter *pTransformFilter, HRESULT *phr,
+		LPCWSTR pName);
+
+	HRESULT CheckConnect(IPin *pPin);
+	HRESULT BreakConnect();
+	HRESULT CompleteConnect(IPin *pReceivePin);
+	HRESULT CheckMediaType(const CMediaType *pmt);
+	HRESULT SetMediaType(const CMediaType *pmt);
+
+	STDMETHODIMP Receive(IMediaSample *pSample);
+	STDMETHODIMP EndOfStream();
+	STDMETHODIMP BeginFlush();
+	STDMETHODIMP EndFlush();
+	STDMETHODIMP NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+
+protected:
+	CTransformFilter *m_pTransformFilter;
+};
+
+class CTransformOutputPin : public CBaseOutputPin
+{
+	friend class CTransformFilter;
+public:
+	CTransformOutputPin(LPCTSTR pObjectName, CTransformFilter *pTransformFilter, HRESULT *phr,
+		LPCWSTR pName);
+
+	HRESULT CheckConnect(IPin *pPin);
+	HRESULT BreakConnect();
+	HRESULT CompleteConnect(IPin *pReceivePin);
+	HRESULT DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp);
+	HRESULT CheckMediaType(const CMediaType *pmt);
+	HRESULT SetMediaType(const CMediaType *pmt);
+	HRESULT GetMediaType(int iPosition, CMediaType *pmt);
+
+	STDMETHODIMP Notify(IBaseFilter *pSender, Quality q);
+
+protected:
+	CTransformFilter *m_pTransformFilter;
+};
+
+//
+// CTransformFilter
+//
+// One input, one output, a new output buffer for every input sample
+//
+class CTransformFilter : public CBaseFilter
+{
+	friend class CTransformInputPin;
+	friend class CTransformOutputPin;
+public:
+	CTransformFilter(LPCTSTR pName, LPUNKNOWN pUnk, REFCLSID clsid);
+	~CTransformFilter();
+
+	virtual int GetPinCount();
+	virtual CBasePin *GetPin(int n);
+	STDMETHODIMP FindPin(LPCWSTR Id, IPin **ppPin);
+	STDMETHODIMP Stop();
+	STDMETHODIMP Pause();
+
+	virtual HRESULT Transform(IMediaSample *pIn, IMediaSample *pOut) { return E_UNEXPECTED; }
+	virtual HRESULT CheckInputType(const CMediaType *mtIn) = 0;
+	virtual HRESULT CheckTransform(const CMediaType *mtIn, const CMediaType *mtOut) = 0;
+	virtual HRESULT DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProp) = 0;
+	virtual HRESULT GetMediaType(int iPosition, CMediaType *pMediaType) = 0;
+
+	virtual HRESULT StartStreaming() { return S_OK; }
+	virtual HRESULT StopStreaming() { return S_OK; }
+	virtual HRESULT AlterQuality(Quality q) { return S_FALSE; }
+	virtual HRESULT SetMediaType(PIN_DIRECTION direction, const CMediaType *pmt) { return S_OK; }
+	virtual HRESULT CheckConnect(PIN_DIRECTION dir, IPin *pPin) { return S_OK; }
+	virtual HRESULT BreakConnect(PIN_DIRECTION dir) { return S_OK; }
+	virtual HRESULT CompleteConnect(PIN_DIRECTION direction, IPin *pReceivePin) { return S_OK; }
+
+	virtual HRESULT Receive(IMediaSample *pSample);
+	virtual HRESULT InitializeOutputSample(IMediaSample *pSample, IMediaSample **ppOutSample);
+	virtual HRESULT EndOfStream();
+	virtual HRESULT BeginFlush();
+	virtual HRESULT EndFlush();
+	virtual HRESULT NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+
+protected:
+	BOOL m_bEOSDelivered;
+	BOOL m_bSampleSkipped;
+	BOOL m_bQualityChanged;
+	CCritSec m_csFilter;       // Filter state
+	CCritSec m_csReceive;      // Streaming
+	CTransformInputPin *m_pInput;
+	CTransformOutputPin *m_pOutput;
+};
+
+//
+// COutputQueue
+//
+// Passes the samples of an output pin on to the connected pin. The base
+// classes queue them for a thread of their own when the pin may block;
+// here every sample is received at once, on the caller's thread.
+//
+class CSampleList
+{
+public:
+	CSampleList() : m_nCount(0) {}
+	int GetCount() const { return m_nCount; }
+private:
+	int m_nCount;
+};
+
+class COutputQueue : public CCritSec
+{
+public:
+	COutputQueue(IPin *pInputPin, HRESULT *phr, BOOL bAuto = TRUE, BOOL bQueue = TRUE,
+		LONG lBatchSize = 1, BOOL bBatchExact = FALSE, LONG lListSize = 10,
+		DWORD dwPriority = 0, bool bFlushingOpt = false);
+	~COutputQueue();
+
+	// Takes over the reference of the caller
+	HRESULT Receive(IMediaSample *pSample);
+	void EOS();
+	void BeginFlush();
+	void EndFlush();
+	void NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+
+protected:
+	IPin *m_pPin;
+	IMemInputPin *m_pInputPin;
+	CSampleList *m_List;       // Always NULL: no thread
+	LONG m_nBatched;           // Always 0
+	BOOL m_bFlushing;
+	HRESULT m_hr;              // Of the last sample that failed, until a flush
+};
+
+//
+// Property pages and the class factory
+//
+struct IPropertyPageSite
+{
+	virtual HRESULT OnStatusChange(DWORD dwFlags) = 0;
+};
+#define PROPPAGESTATUS_DIRTY 1
+
+class CBasePropertyPage : public CUnknown
+{
+public:
+	CBasePropertyPage(LPCTSTR pName, LPUNKNOWN pUnk, int DialogId, int TitleId);
+
+	virtual HRESULT OnConnect(IUnknown *pUnknown) { return S_OK; }
+	virtual HRESULT OnDisconnect() { return S_OK; }
+	virtual HRESULT OnActivate() { return S_OK; }
+	virtual HRESULT OnDeactivate() { return S_OK; }
+	virtual HRESULT OnApplyChanges() { return S_OK; }
+	virtual INT_PTR OnReceiveMessage(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) { return 0; }
+
+protected:
+	BOOL m_bDirty;
+	IPropertyPageSite *m_pPageSite;
+	HWND m_hwnd;
+	HWND m_Dlg;
+};
+
+typedef CUnknown *(WINAPI *LPFNNewCOMObject)(LPUNKNOWN pUnkOuter, HRESULT *phr);
+typedef void (WINAPI *LPFNInitRoutine)(BOOL bLoading, const CLSID *rclsid);
+
+struct AMOVIESETUP_FILTER
+{
+	const CLSID *clsID;
+	const WCHAR *strName;
+	DWORD dwMerit;
+	UINT nPins;
+	const void *lpPin;
+};
+#define MERIT_DO_NOT_USE 0x200000
+
+struct CFactoryTemplate
+{
+	const WCHAR *m_Name;
+	const CLSID *m_ClsID;
+	LPFNNewCOMObject m_lpfnNew;
+	LPFNInitRoutine m_lpfnInit;
+	const AMOVIESETUP_FILTER *m_pAMovieSetup_Filter;
+};
+
+// There is no registry: registration succeeds and does nothing
+inline HRESULT AMovieDllRegisterServer2(BOOL bRegister) { return S_OK; }
+
+//
+// Win32 user interface, for the property page; there are no windows
+//
+extern HINSTANCE g_hInst;
+
+#define WM_DESTROY 0x0002
+#define WM_INITDIALOG 0x0110
+#define WM_COMMAND 0x0111
+#define WM_VSCROLL 0x0115
+#define WS_TABSTOP 0x00010000L
+#define WS_GROUP 0x00020000L
+#define WS_VISIBLE 0x10000000L
+#define WS_CHILD 0x40000000L
+
+inline HWND CreateWindow(LPCWSTR, LPCWSTR, DWORD, int, int, int, int, HWND, void *, HINSTANCE, void *) { return NULL; }
+inline LRESULT SendMessage(HWND, UINT, WPARAM, LPARAM) { return 0; }
+inline BOOL DestroyWindow(HWND) { return TRUE; }
+inline BOOL EnableWindow(HWND, BOOL) { return TRUE; }
+inline HWND GetDlgItem(HWND, int) { return NULL; }
+inline BOOL CheckDlgButton(HWND, int, UINT) { return TRUE; }
+inline UINT IsDlgButtonChecked(HWND, int) { return 0; }